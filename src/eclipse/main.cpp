@@ -2,14 +2,22 @@
 #include "eclipse/util/resource.h"
 #include "eclipse/util/file_util.h"
 #include "eclipse/util/input_parser.h"
+#include "eclipse/util/except.h"
 #include "eclipse/scene/scene.h"
 #include "eclipse/scene/scene_io.h"
+#include "eclipse/scene/compiler.h"
 #include "eclipse/render/options.h"
+#include "eclipse/render/batch_renderer.h"
+#ifdef ECLIPSE_WITH_GUI
 #include "eclipse/render/interactive_renderer.h"
+#endif
+#include "eclipse/tracer/cpu_tracer.h"
+#include "eclipse/tools/texture_bench.h"
 
 #include <iostream>
 #include <string>
 #include <memory>
+#include <sstream>
 
 using namespace eclipse;
 
@@ -25,18 +33,171 @@ void show_banner()
 void show_usage()
 {
     std::cout << "usage: eclipse --help\n"
-              << "usage: eclipse --info scene.(obj|bin)\n"
-              << "usage: eclipse --compile scene.obj\n"
+              << "usage: eclipse --info scene.(obj|bin) [-verify]\n"
+              << "usage: eclipse --compile scene.obj [-bvh (sah|binned|lbvh)] [-mesh-bvh mesh=builder,...]\n"
+              << "                                   [-wide-bvh (4|8)] [-wide-bvh-only] [-oct-normals] [-half-uvs]\n"
+              << "                                   [-mip-filter (box|kaiser)] [-no-mip-maps]\n"
+              << "                                   [-texture-layout (linear|tiled|morton)]\n"
+              << "                                   [-compress-textures role,...] [-paged-textures]\n"
+              << "                                   [-cache-dir dir] [-no-cache] [-compress]\n"
               << "usage: eclipse --list-devices\n"
               << "usage: eclipse --render scene.(obj|bin) [-w width] [-h height] [-spp spp]\n"
               << "                                        [-b num_bounces] [-rr bounces_before_RR]\n"
-              << "                                        [-exp exposure]\n\n"
+              << "                                        [-exp exposure] [-texture-cache MB] [-wavefront]\n"
+              << "usage: eclipse --batch scene.(obj|bin) -o image.(exr|png|...) [-spp spp] [-time seconds]\n"
+              << "                                       [-snapshot seconds] and the --render options\n"
+              << "usage: eclipse --bench-textures scene.(obj|bin) [-lookups count]\n\n"
               << "options in order of precedence:\n"
               << "       --help         Print this menu\n"
-              << "       --info         Print scene statistics\n"
+              << "       --info         Print scene statistics; -verify also checks a .bin against its checksums\n"
               << "       --list-devices List the available rendering devices\n"
-              << "       --compile      Compile scene to a compressed binary format\n"
-              << "       --render       Render a scene\n" << std::endl;
+              << "       --compile      Compile scene to a binary format that is memory mapped when\n"
+              << "                      rendered; -compress makes it smaller but loaded into memory\n"
+              << "       --render       Render a scene\n"
+              << "       --batch        Render a scene without a window until -spp samples or -time seconds\n"
+              << "                      are reached and write it to -o, with a snapshot every -snapshot\n"
+              << "                      seconds (default 30, 0 disables)\n"
+              << "       --bench-textures Measure bilinear lookups per second on the scene textures in each\n"
+              << "                      texture layout, at random uvs and along random walks; -lookups per\n"
+              << "                      texture (default 4194304)\n\n"
+              << "compile options (also used by --info and --render on obj scenes):\n"
+              << "       -bvh           BVH builder: sah (exhaustive, serial subtrees), binned (default) or lbvh (fastest build)\n"
+              << "       -mesh-bvh      Per mesh BVH builder overrides, e.g. -mesh-bvh cloth=lbvh,body=sah\n"
+              << "       -wide-bvh      Also collapse the BVH into 4 or 8 wide nodes for SIMD traversal\n"
+              << "       -wide-bvh-only Drop the binary BVH after collapsing it\n"
+              << "       -oct-normals   Store normals in 4 bytes instead of 12 (octahedral encoding)\n"
+              << "       -half-uvs      Store uvs as half floats, 4 bytes instead of 8\n"
+              << "       -mip-filter    Filter of the texture mip maps: box (default) or kaiser (sharper)\n"
+              << "       -no-mip-maps   Store textures without mip maps; they are always sampled at full\n"
+              << "                      resolution\n"
+              << "       -texture-layout Order of the texels: linear (default), tiled (8x8 tiles) or morton\n"
+              << "                      (Z order in 32x32 tiles), which keep bilinear lookups within fewer\n"
+              << "                      cache lines\n"
+              << "       -compress-textures Block compress the textures of the given roles: albedo (BC1),\n"
+              << "                      roughness (BC4), normal (BC5, normal maps), radiance (BC1 for\n"
+              << "                      8 bit emission and environment maps; HDR ones are kept\n"
+              << "                      uncompressed) or all\n"
+              << "       -paged-textures Store the textures as 64x64 texel tiles which are read from the\n"
+              << "                      mapped .bin on demand through a fixed size cache (see -texture-cache)\n"
+              << "                      instead of being loaded whole\n"
+              << "       -cache-dir     Reuse compiles of unchanged obj scenes from this directory\n"
+              << "                      (default $XDG_CACHE_HOME/eclipse or ~/.cache/eclipse)\n"
+              << "       -no-cache      Always compile obj scenes\n\n"
+              << "render options (--render and --batch):\n"
+              << "       -texture-cache Megabytes of texture tiles kept in memory for scenes compiled with\n"
+              << "                      -paged-textures (default 512)\n"
+              << "       -wavefront     Advance all paths of a tile one bounce at a time instead of tracing\n"
+              << "                      them path by path\n" << std::endl;
+}
+
+scene::CompileOptions get_compile_options(const InputParser& input)
+{
+    scene::CompileOptions options;
+    if (input.option_exists("-bvh"))
+        options.bvh_builder = scene::parse_bvh_builder_type(input.get_option("-bvh"));
+
+    if (input.option_exists("-mesh-bvh"))
+    {
+        std::istringstream overrides(input.get_option("-mesh-bvh"));
+        std::string entry;
+        while (std::getline(overrides, entry, ','))
+        {
+            size_t pos = entry.rfind('=');
+            if (pos == std::string::npos || pos == 0)
+                throw Error("invalid mesh BVH builder override `" + entry + "`; expected mesh=builder");
+            options.mesh_bvh_builders[entry.substr(0, pos)] = scene::parse_bvh_builder_type(entry.substr(pos + 1));
+        }
+    }
+
+    if (input.option_exists("-wide-bvh"))
+        options.wide_bvh_width = scene::parse_wide_bvh_width(input.get_option("-wide-bvh"));
+
+    if (input.option_exists("-wide-bvh-only"))
+    {
+        if (options.wide_bvh_width == 0)
+            throw Error("-wide-bvh-only requires -wide-bvh");
+        options.keep_binary_bvh = false;
+    }
+
+    options.oct_normals = input.option_exists("-oct-normals");
+    options.half_uvs = input.option_exists("-half-uvs");
+
+    options.mip_maps = !input.option_exists("-no-mip-maps");
+    if (input.option_exists("-mip-filter"))
+        options.mip_filter = scene::parse_mip_filter(input.get_option("-mip-filter"));
+    if (input.option_exists("-texture-layout"))
+        options.texture_layout = scene::parse_texture_layout(input.get_option("-texture-layout"));
+
+    if (input.option_exists("-compress-textures"))
+    {
+        std::istringstream roles(input.get_option("-compress-textures"));
+        std::string role;
+        while (std::getline(roles, role, ','))
+        {
+            if (role == "all")
+            {
+                options.compressed_textures = { scene::AlbedoTexture, scene::RoughnessTexture,
+                                                scene::NormalMapTexture, scene::RadianceTexture };
+            }
+            else
+            {
+                options.compressed_textures.insert(scene::parse_texture_role(role));
+            }
+        }
+    }
+
+    options.paged_textures = input.option_exists("-paged-textures");
+
+    return options;
+}
+
+render::Options get_render_options(const InputParser& input)
+{
+    render::Options options;
+    options.frame_width = 512;
+    options.frame_height = 512;
+    options.samples_per_pixel = 0;
+    options.num_bounces = 5;
+    options.min_bounces_for_rr = 3;
+    options.exposure = 1.2f;
+    options.time_budget_s = 0.0f;
+    options.snapshot_interval_s = 30.0f;
+
+    if (input.option_exists("-w"))
+        options.frame_width = std::stol(input.get_option("-w"));
+    if (input.option_exists("-h"))
+        options.frame_height = std::stol(input.get_option("-h"));
+    if (input.option_exists("-spp"))
+        options.samples_per_pixel = std::stof(input.get_option("-spp"));
+    if (input.option_exists("-b"))
+        options.num_bounces = std::stol(input.get_option("-b"));
+    if (input.option_exists("-rr"))
+        options.min_bounces_for_rr = std::stol(input.get_option("-rr"));
+    if (input.option_exists("-exp"))
+        options.exposure = std::stof(input.get_option("-exp"));
+    if (input.option_exists("-o"))
+        options.output_file = input.get_option("-o");
+    if (input.option_exists("-time"))
+        options.time_budget_s = std::stof(input.get_option("-time"));
+    if (input.option_exists("-snapshot"))
+        options.snapshot_interval_s = std::stof(input.get_option("-snapshot"));
+
+    if (options.num_bounces == 0 || options.min_bounces_for_rr >= options.num_bounces)
+    {
+        logger.log<INFO>("disabling russian roulette for path elimination");
+        options.min_bounces_for_rr = options.num_bounces + 1;
+    }
+
+    return options;
+}
+
+std::shared_ptr<CPUTracer> create_cpu_tracer(const InputParser& input)
+{
+    auto tracer = std::make_shared<CPUTracer>();
+    if (input.option_exists("-texture-cache"))
+        tracer->set_tile_cache_size(uint64_t(std::stoull(input.get_option("-texture-cache"))) << 20);
+    tracer->set_wavefront(input.option_exists("-wavefront"));
+    return tracer;
 }
 
 int main(int argc, char** argv)
@@ -46,6 +207,11 @@ int main(int argc, char** argv)
         show_banner();
         InputParser input(argc, argv);
 
+        if (input.option_exists("-no-cache"))
+            scene::set_compile_cache_dir("");
+        else if (input.option_exists("-cache-dir"))
+            scene::set_compile_cache_dir(input.get_option("-cache-dir"));
+
         if (input.option_exists("--help") || argc == 1)
         {
             show_usage();
@@ -56,7 +222,10 @@ int main(int argc, char** argv)
             if (!scene_file.empty())
             {
                 std::shared_ptr<Resource> scene_res = std::make_shared<Resource>(scene_file);
-                std::shared_ptr<scene::Scene> scene = scene::read(scene_res);
+                if (input.option_exists("-verify"))
+                    scene::verify(scene_res);
+
+                std::shared_ptr<scene::Scene> scene = scene::read(scene_res, get_compile_options(input));
 
                 std::string stats = scene->get_stats();
                 logger.log<INFO>(stats);
@@ -82,8 +251,8 @@ int main(int argc, char** argv)
                 }
                 else
                 {
-                    std::shared_ptr<scene::Scene> scene = scene::read(scene_res);
-                    scene::write(scene, scene_res);
+                    std::shared_ptr<scene::Scene> scene = scene::read(scene_res, get_compile_options(input));
+                    scene::write(scene, scene_res, input.option_exists("-compress"));
                 }
             }
             else
@@ -93,41 +262,53 @@ int main(int argc, char** argv)
         }
         else if (input.option_exists("--render"))
         {
-            render::Options options;
-            options.frame_width = 512;
-            options.frame_height = 512;
-            options.samples_per_pixel = 0;
-            options.num_bounces = 5;
-            options.min_bounces_for_rr = 3;
-            options.exposure = 1.2f;
-
-            if (input.option_exists("-w"))
-                options.frame_width = std::stol(input.get_option("-w"));
-            if (input.option_exists("-h"))
-                options.frame_height = std::stol(input.get_option("-h"));
-            if (input.option_exists("-spp"))
-                options.samples_per_pixel = std::stof(input.get_option("-spp"));
-            if (input.option_exists("-b"))
-                options.num_bounces = std::stol(input.get_option("-b"));
-            if (input.option_exists("-rr"))
-                options.min_bounces_for_rr = std::stol(input.get_option("-rr"));
-            if (input.option_exists("-exp"))
-                options.exposure = std::stof(input.get_option("-exp"));
-
-            if (options.num_bounces == 0 || options.min_bounces_for_rr >= options.num_bounces)
-            {
-                logger.log<INFO>("disabling russian roulette for path elimination");
-                options.min_bounces_for_rr = options.num_bounces + 1;
-            }
+            render::Options options = get_render_options(input);
 
             std::string scene_file = input.get_option("--render");
             if (scene_file[0] == '-' || scene_file.empty())
                 throw Error("missing scene file argument");
 
             std::shared_ptr<Resource> scene_res = std::make_shared<Resource>(scene_file);
-            std::shared_ptr<scene::Scene> scene = scene::read(scene_res);
+            std::shared_ptr<scene::Scene> scene = scene::read(scene_res, get_compile_options(input));
+
+#ifdef ECLIPSE_WITH_GUI
+            auto renderer = std::make_unique<render::InteractiveRenderer>(scene, options);
+            renderer->add_tracer(create_cpu_tracer(input));
+            return renderer->render();
+#else
+            throw Error("built without the interactive renderer; use --batch");
+#endif
+        }
+        else if (input.option_exists("--batch"))
+        {
+            render::Options options = get_render_options(input);
+
+            std::string scene_file = input.get_option("--batch");
+            if (scene_file[0] == '-' || scene_file.empty())
+                throw Error("missing scene file argument");
+            if (options.output_file.empty())
+                throw Error("missing output image; use -o image.(exr|png|...)");
+
+            std::shared_ptr<Resource> scene_res = std::make_shared<Resource>(scene_file);
+            std::shared_ptr<scene::Scene> scene = scene::read(scene_res, get_compile_options(input));
 
-            return std::make_unique<render::InteractiveRenderer>(scene, options)->render();
+            auto renderer = std::make_unique<render::BatchRenderer>(scene, options);
+            renderer->add_tracer(create_cpu_tracer(input));
+            return renderer->render();
+        }
+        else if (input.option_exists("--bench-textures"))
+        {
+            std::string scene_file = input.get_option("--bench-textures");
+            if (scene_file[0] == '-' || scene_file.empty())
+                throw Error("missing scene file argument");
+
+            uint32_t num_lookups = 1 << 22;
+            if (input.option_exists("-lookups"))
+                num_lookups = std::stoul(input.get_option("-lookups"));
+
+            std::shared_ptr<Resource> scene_res = std::make_shared<Resource>(scene_file);
+            std::shared_ptr<scene::Scene> scene = scene::read(scene_res, get_compile_options(input));
+            tools::bench_textures(*scene, num_lookups);
         }
         else
         {
@@ -151,10 +151,10 @@ inline Mat4 operator*(float v, const Mat4& m)
 inline Vec4 operator*(const Mat4& m, const Vec4& v)
 {
     Vec4 res;
-    for (int i = 0; i < 3; ++i)
+    for (int i = 0; i < 4; ++i)
     {
         res[i] = 0.0f;
-        for (int j = 0; j < 3; ++j)
+        for (int j = 0; j < 4; ++j)
             res[i] += m.m[i][j] * v[j];
     }
     return res;
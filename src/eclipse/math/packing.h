@@ -0,0 +1,168 @@
+#pragma once
+
+#include "eclipse/prerequisites.h"
+#include "eclipse/math/math.h"
+#include "eclipse/math/vec2.h"
+#include "eclipse/math/vec3.h"
+
+#include <cstdint>
+#include <cstring>
+
+namespace eclipse {
+
+// Compact encodings of vertex attributes.
+//
+// Normals are mapped onto the octahedron |x| + |y| + |z| = 1, whose lower
+// half is folded over the upper one, and stored as the x and y coordinates
+// of the result in two snorm16 values (x in the low half). The code for the
+// zero vector, which marks missing normals, is not used by any unit vector.
+//
+// Half floats are IEEE binary16, rounded to nearest even; the software
+// conversions give the same results as the F16C instructions.
+
+constexpr uint32_t oct_zero = 0x80008000u;
+
+inline Vec3 decode_oct(uint32_t code)
+{
+    if (code == oct_zero)
+        return Vec3(0.0f, 0.0f, 0.0f);
+
+    Vec3 n(float(int16_t(code & 0xffff)) * (1.0f / 32767.0f), float(int16_t(code >> 16)) * (1.0f / 32767.0f), 0.0f);
+    n.z = 1.0f - abs(n.x) - abs(n.y);
+
+    // Unfold the lower half
+    const float t = max(-n.z, 0.0f);
+    n.x += n.x >= 0.0f ? -t : t;
+    n.y += n.y >= 0.0f ? -t : t;
+    return normalize(n);
+}
+
+// Of the four codes around the projection of `n`, the one decoding closest
+// to it is picked, which halves the worst case error of plain rounding
+inline uint32_t encode_oct(const Vec3& n)
+{
+    const float l1 = abs(n.x) + abs(n.y) + abs(n.z);
+    if (!(l1 > 0.0f))
+        return oct_zero;
+
+    float x = n.x / l1;
+    float y = n.y / l1;
+    if (n.z < 0.0f)
+    {
+        const float folded_x = (1.0f - abs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        const float folded_y = (1.0f - abs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = folded_x;
+        y = folded_y;
+    }
+
+    const float qx = floor(clamp(x, -1.0f, 1.0f) * 32767.0f);
+    const float qy = floor(clamp(y, -1.0f, 1.0f) * 32767.0f);
+    const Vec3 unit = n * (1.0f / length(n));
+
+    uint32_t best_code = 0;
+    float best_cos = neg_inf;
+    for (uint32_t i = 0; i < 4; ++i)
+    {
+        const int32_t cx = int32_t(min(qx + float(i & 1), 32767.0f));
+        const int32_t cy = int32_t(min(qy + float(i >> 1), 32767.0f));
+        const uint32_t code = uint32_t(uint16_t(int16_t(cx))) | uint32_t(uint16_t(int16_t(cy))) << 16;
+
+        const float cos = dot(decode_oct(code), unit);
+        if (cos > best_cos)
+        {
+            best_cos = cos;
+            best_code = code;
+        }
+    }
+    return best_code;
+}
+
+inline uint16_t float_to_half(float f)
+{
+#if defined(__F16C__)
+    return uint16_t(_cvtss_sh(f, _MM_FROUND_TO_NEAREST_INT));
+#else
+    uint32_t bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+    const uint32_t sign = (bits >> 16) & 0x8000;
+    bits &= 0x7fffffff;
+
+    // Too large values become infinity; NaNs are quieted and keep the top
+    // bits of their payload
+    if (bits >= (127 + 16) << 23)
+        return uint16_t(sign | (bits > 0x7f800000 ? 0x7e00 | ((bits >> 13) & 0x3ff) : 0x7c00));
+
+    // Subnormal results are rounded by a float addition that aligns their
+    // 10 mantissa bits at the bottom of the float
+    if (bits < (127 - 14) << 23)
+    {
+        const uint32_t magic_bits = 126 << 23;
+        float magic;
+        std::memcpy(&magic, &magic_bits, sizeof(magic));
+
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        value += magic;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return uint16_t(sign | (bits - magic_bits));
+    }
+
+    // Rebias the exponent and round the dropped 13 bits to nearest even;
+    // a carry out of the mantissa correctly bumps the exponent
+    const uint32_t mantissa_odd = (bits >> 13) & 1;
+    bits += (uint32_t(15 - 127) << 23) + 0xfff + mantissa_odd;
+    return uint16_t(sign | (bits >> 13));
+#endif
+}
+
+inline float half_to_float(uint16_t h)
+{
+#if defined(__F16C__)
+    return _cvtsh_ss(h);
+#else
+    const uint32_t shifted_exponent = 0x7c00 << 13;
+    uint32_t bits = uint32_t(h & 0x7fff) << 13;
+    const uint32_t exponent = bits & shifted_exponent;
+    bits += uint32_t(127 - 15) << 23;
+
+    float f;
+    if (exponent == shifted_exponent)
+    {
+        // Infinity or NaN, which is quieted
+        bits += uint32_t(128 - 16) << 23;
+        if (bits & 0x7fffff)
+            bits |= 0x400000;
+        std::memcpy(&f, &bits, sizeof(f));
+    }
+    else if (exponent == 0)
+    {
+        // Zero or subnormal; renormalize
+        const uint32_t magic_bits = 113 << 23;
+        float magic;
+        std::memcpy(&magic, &magic_bits, sizeof(magic));
+
+        bits += 1 << 23;
+        std::memcpy(&f, &bits, sizeof(f));
+        f -= magic;
+    }
+    else
+    {
+        std::memcpy(&f, &bits, sizeof(f));
+    }
+
+    return (h & 0x8000) ? -f : f;
+#endif
+}
+
+// Two half floats, u in the low half
+inline uint32_t encode_half2(const Vec2& v)
+{
+    return uint32_t(float_to_half(v.x)) | uint32_t(float_to_half(v.y)) << 16;
+}
+
+inline Vec2 decode_half2(uint32_t code)
+{
+    return Vec2(half_to_float(uint16_t(code & 0xffff)), half_to_float(uint16_t(code >> 16)));
+}
+
+} // namespace eclipse
@@ -0,0 +1,157 @@
+#include "eclipse/render/batch_renderer.h"
+#include "eclipse/render/options.h"
+#include "eclipse/scene/scene.h"
+#include "eclipse/tracer/cpu_tracer.h"
+#include "eclipse/util/file_util.h"
+#include "eclipse/util/stop_watch.h"
+#include "eclipse/util/logger.h"
+#include "eclipse/math/vec4.h"
+#include "eclipse/math/math.h"
+
+#include <cstdio>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <OpenImageIO/imageio.h>
+OIIO_NAMESPACE_USING
+
+namespace eclipse { namespace render {
+
+namespace {
+    auto logger = Logger::create("batch_renderer");
+}
+
+BatchRenderer::BatchRenderer(std::shared_ptr<scene::Scene> scene, const Options& options)
+    : Renderer(scene, options)
+{
+    if (m_options.output_file.empty())
+        throw Error("batch renderer: no output file");
+    if (m_options.samples_per_pixel == 0 && m_options.time_budget_s <= 0.0f)
+        throw Error("batch renderer: needs a sample count or a time budget to stop at");
+
+    scene->camera.make_projection((float)m_options.frame_width / (float)m_options.frame_height);
+    scene->camera.invert_y_axis(false);
+}
+
+BatchRenderer::~BatchRenderer()
+{
+}
+
+int BatchRenderer::render()
+{
+    if (m_tracers.empty())
+        throw Error("batch renderer: no tracers to render with");
+
+    init_tracers();
+
+    StopWatch render_watch;
+    StopWatch snapshot_watch;
+    render_watch.start();
+    snapshot_watch.start();
+
+    while (render_frame())
+    {
+        if (m_options.time_budget_s > 0.0f && render_watch.get_elapsed_time_s() >= m_options.time_budget_s)
+            break;
+
+        if (m_options.snapshot_interval_s > 0.0f && snapshot_watch.get_elapsed_time_s() >= m_options.snapshot_interval_s)
+        {
+            publish_image();
+            logger.log<INFO>("snapshot at ", m_accumulated_samples, " spp after ",
+                             render_watch.get_elapsed_time_s(), " s");
+            snapshot_watch.start();
+        }
+    }
+
+    render_watch.stop();
+    publish_image();
+
+    logger.log<INFO>("rendered ", m_accumulated_samples, " spp in ", render_watch.get_elapsed_time_s(),
+                     " s to ", m_options.output_file);
+
+    const CPUTracer* tracer = dynamic_cast<const CPUTracer*>(m_tracers[0].get());
+    if (tracer != nullptr && !m_scene->texture_tiles.empty())
+    {
+        const TileCache::Stats stats = tracer->get_tile_cache_stats();
+        const uint64_t lookups = stats.hits + stats.misses;
+        logger.log<INFO>("texture tiles: ", lookups > 0 ? 100.0 * double(stats.hits) / double(lookups) : 0.0,
+                         "% of ", lookups, " lookups hit, ", stats.resident_tiles, " tiles (",
+                         double(stats.resident_bytes) / (1024.0 * 1024.0), " of ",
+                         double(stats.capacity_bytes) / (1024.0 * 1024.0), " MB) resident");
+    }
+    return 0;
+}
+
+void BatchRenderer::publish_image() const
+{
+    // Write next to the output and rename, so readers never see a half
+    // written image; the extension is kept since it picks the format
+    const std::string base = remove_extension(m_options.output_file);
+    const std::string partial_file = base + ".partial" + m_options.output_file.substr(base.size());
+
+    write_image(partial_file);
+    if (std::rename(partial_file.c_str(), m_options.output_file.c_str()) != 0)
+    {
+        std::remove(partial_file.c_str());
+        throw ImageOutputError("batch renderer: could not move " + partial_file + " to " + m_options.output_file);
+    }
+}
+
+void BatchRenderer::write_image(const std::string& file) const
+{
+    // Only the CPU tracer exposes its output to the host
+    const CPUTracer* tracer = dynamic_cast<const CPUTracer*>(m_tracers[0].get());
+    if (tracer == nullptr)
+        throw ImageOutputError("batch renderer: the primary tracer cannot read back its output");
+
+    const uint32_t width = m_options.frame_width;
+    const uint32_t height = m_options.frame_height;
+    const bool hdr = has_extension(file, ".exr") || has_extension(file, ".hdr");
+
+    std::vector<float> pixels(size_t(width) * height * 4);
+    const std::vector<Vec4>& source = hdr ? tracer->get_accumulator() : tracer->get_framebuffer();
+    for (size_t i = 0; i < source.size(); ++i)
+    {
+        const Vec4& pixel = source[i];
+        if (hdr)
+        {
+            const float scale = m_options.exposure / max(pixel.w, 1.0f);
+            pixels[i * 4 + 0] = pixel.x * scale;
+            pixels[i * 4 + 1] = pixel.y * scale;
+            pixels[i * 4 + 2] = pixel.z * scale;
+            pixels[i * 4 + 3] = 1.0f;
+        }
+        else
+        {
+            for (uint8_t c = 0; c < 4; ++c)
+                pixels[i * 4 + c] = pixel[c];
+        }
+    }
+
+    ImageOutput* output = ImageOutput::create(file);
+    if (!output)
+        throw ImageOutputError("batch renderer: no image writer for " + file + ": " + OpenImageIO::geterror());
+
+    // OpenImageIO converts the float pixels to the file's format
+    ImageSpec spec(width, height, 4, hdr ? TypeDesc::HALF : TypeDesc::UINT8);
+    if (!output->open(file, spec))
+    {
+        std::string error = output->geterror();
+        ImageOutput::destroy(output);
+        throw ImageOutputError("batch renderer: could not open " + file + ": " + error);
+    }
+
+    if (!output->write_image(TypeDesc::FLOAT, pixels.data()))
+    {
+        std::string error = output->geterror();
+        output->close();
+        ImageOutput::destroy(output);
+        throw ImageOutputError("batch renderer: could not write " + file + ": " + error);
+    }
+
+    output->close();
+    ImageOutput::destroy(output);
+}
+
+} } // namespace eclipse::render
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "eclipse/render/renderer.h"
+#include "eclipse/scene/scene.h"
+#include "eclipse/util/except.h"
+
+#include <cstdint>
+#include <string>
+#include <memory>
+
+namespace eclipse { namespace render {
+
+class ImageOutputError : public Error
+{
+public:
+    ImageOutputError(const std::string& msg) : Error(msg) { }
+};
+
+// Renders without a window until Options::samples_per_pixel samples were
+// accumulated or Options::time_budget_s ran out, whichever comes first, and
+// writes the image to Options::output_file. The format follows the file
+// extension: HDR formats (.exr, .hdr) get the linear radiance scaled by the
+// exposure, all others the tone mapped framebuffer. A snapshot of the image
+// so far is written every Options::snapshot_interval_s seconds.
+class BatchRenderer : public Renderer
+{
+public:
+    BatchRenderer(std::shared_ptr<scene::Scene> scene, const Options& options);
+    ~BatchRenderer();
+
+    int render();
+
+private:
+    // Writes the image to Options::output_file, replacing it at once
+    void publish_image() const;
+    void write_image(const std::string& file) const;
+};
+
+} } // namespace eclipse::render
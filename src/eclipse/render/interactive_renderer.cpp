@@ -3,6 +3,7 @@
 #include "eclipse/scene/camera.h"
 #include "eclipse/render/options.h"
 #include "eclipse/render/window.h"
+#include "eclipse/tracer/cpu_tracer.h"
 #include "eclipse/math/vec3.h"
 #include "eclipse/math/math.h"
 
@@ -61,10 +62,19 @@ InteractiveRenderer::~InteractiveRenderer()
 
 int InteractiveRenderer::render()
 {
+    init_tracers();
+    m_series.init(m_tracers.size(), m_options.frame_width);
+
     while (!m_window->should_close())
     {
         m_window->poll_events();
 
+        if (!m_tracers.empty())
+        {
+            render_frame();
+            upload_framebuffer();
+        }
+
         glBindFramebuffer(GL_FRAMEBUFFER, m_fbo_id);
         glBlitFramebuffer(0, 0, m_options.frame_width, m_options.frame_height,
                           0, 0, m_options.frame_width, m_options.frame_height,
@@ -102,6 +112,19 @@ void InteractiveRenderer::init_gl()
     check_gl_error();
 }
 
+void InteractiveRenderer::upload_framebuffer()
+{
+    // Only the CPU tracer exposes its framebuffer to the host
+    const CPUTracer* tracer = dynamic_cast<const CPUTracer*>(m_tracers[0].get());
+    if (tracer == nullptr)
+        return;
+
+    glBindTexture(GL_TEXTURE_2D, m_tex_id);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_options.frame_width, m_options.frame_height,
+                    GL_RGBA, GL_FLOAT, tracer->get_framebuffer().data());
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
 void InteractiveRenderer::init_ui()
 {
     glDisable(GL_DEPTH_TEST);
@@ -34,6 +34,7 @@ public:
 
 private:
     void init_gl();
+    void upload_framebuffer();
     void init_ui();
     void render_ui();
     void on_before_show_ui();
@@ -14,6 +14,13 @@ struct Options
     uint32_t min_bounces_for_rr;
     uint32_t samples_per_pixel;
     float exposure;
+
+    // Batch rendering: image to write, render time limit (0 for none) and
+    // seconds between progressive snapshots (0 for none)
+    std::string output_file;
+    float time_budget_s;
+    float snapshot_interval_s;
+
     std::vector<std::string> device_blacklist;
     std::string force_primary_device;
 };
@@ -1,20 +1,88 @@
 #include "eclipse/render/renderer.h"
 #include "eclipse/render/options.h"
 #include "eclipse/scene/scene.h"
+#include "eclipse/tracer/tracer.h"
+#include "eclipse/tracer/cpu_tracer.h"
+#include "eclipse/math/math.h"
 
 #include <memory>
+#include <omp.h>
 
 namespace eclipse { namespace render {
 
 Renderer::Renderer(std::shared_ptr<scene::Scene> scene, const Options& options)
-    : m_scene(scene), m_options(options)
+    : m_scene(scene), m_options(options), m_accumulated_samples(0)
 {
 
 }
 
 Renderer::~Renderer()
 {
+    for (auto& tracer : m_tracers)
+        tracer->terminate();
+}
+
+void Renderer::add_tracer(std::shared_ptr<Tracer> tracer)
+{
+    m_tracers.push_back(tracer);
+}
+
+void Renderer::init_tracers()
+{
+    uint32_t dimensions[2] = { m_options.frame_width, m_options.frame_height };
+
+    // The tile scheduler runs the tracers side by side, so CPU tracers share
+    // the cores instead of each starting a team as large as the machine
+    std::vector<CPUTracer*> cpu_tracers;
+    for (auto& tracer : m_tracers)
+    {
+        if (CPUTracer* cpu_tracer = dynamic_cast<CPUTracer*>(tracer.get()))
+            cpu_tracers.push_back(cpu_tracer);
+    }
+    if (cpu_tracers.size() > 1)
+    {
+        const uint32_t share = max(uint32_t(omp_get_max_threads()) / uint32_t(cpu_tracers.size()), 1u);
+        for (CPUTracer* cpu_tracer : cpu_tracers)
+            cpu_tracer->set_num_threads(min(cpu_tracer->get_num_threads(), share));
+    }
+
+    for (auto& tracer : m_tracers)
+    {
+        tracer->init();
+        tracer->update(FrameDimensions, dimensions);
+        tracer->update(SceneData, m_scene.get());
+        tracer->update(CameraData, &m_scene->camera);
+    }
+
+    m_scheduler.set_tracers(m_tracers);
+    m_blocks.assign(m_tracers.size(), 0);
+    m_accumulated_samples = 0;
+}
+
+bool Renderer::render_frame()
+{
+    if (m_tracers.empty())
+        return false;
+    if (m_options.samples_per_pixel > 0 && m_accumulated_samples >= m_options.samples_per_pixel)
+        return false;
+
+    TraceTile frame;
+    frame.frame_width = m_options.frame_width;
+    frame.frame_height = m_options.frame_height;
+    frame.tile_x = 0;
+    frame.tile_y = 0;
+    frame.tile_w = m_options.frame_width;
+    frame.tile_h = m_options.frame_height;
+    frame.samples_per_pixel = 1;
+    frame.num_bounces = m_options.num_bounces;
+    frame.bounces_before_russian_roulette = m_options.min_bounces_for_rr;
+    frame.accumulated_samples = m_accumulated_samples;
+    frame.exposure = m_options.exposure;
 
+    m_scheduler.render_frame(frame);
+    m_accumulated_samples += frame.samples_per_pixel;
+    m_blocks = m_scheduler.get_tiles_per_tracer();
+    return true;
 }
 
 } } // namespace eclipse::render
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "eclipse/render/options.h"
+#include "eclipse/render/tile_scheduler.h"
 #include "eclipse/tracer/tracer.h"
 #include "eclipse/scene/scene.h"
 
@@ -16,11 +17,26 @@ public:
     Renderer(std::shared_ptr<scene::Scene> scene, const Options& options);
     virtual ~Renderer();
 
+    // Registers a tracer; the first one registered holds the final image
+    void add_tracer(std::shared_ptr<Tracer> tracer);
+
+protected:
+    // Initializes the registered tracers and uploads the frame dimensions,
+    // scene and camera to them
+    void init_tracers();
+
+    // Adds one sample per pixel to the image, split over all tracers; does
+    // nothing and returns false once Options::samples_per_pixel samples were
+    // accumulated
+    bool render_frame();
+
 protected:
     std::shared_ptr<scene::Scene> m_scene;
     Options m_options;
-    std::vector<Tracer> m_tracers;
+    std::vector<std::shared_ptr<Tracer>> m_tracers;
     std::vector<uint32_t> m_blocks;
+    TileScheduler m_scheduler;
+    uint32_t m_accumulated_samples;
 };
 
 } } // namespace eclipse::render
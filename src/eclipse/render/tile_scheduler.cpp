@@ -0,0 +1,251 @@
+#include "eclipse/render/tile_scheduler.h"
+#include "eclipse/tracer/tracer.h"
+#include "eclipse/util/except.h"
+#include "eclipse/math/math.h"
+
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace eclipse { namespace render {
+
+namespace {
+
+// Each new tile takes this fraction of the rows left in a tracer's share,
+// so tiles get smaller towards the end of the frame
+constexpr uint32_t tile_split = 4;
+
+// Tiles are not made smaller than this much work for their tracer
+constexpr float min_tile_time_ms = 2.0f;
+
+// Weight of the latest measurement in the tracer speed estimates
+constexpr float speed_smoothing = 0.5f;
+
+} // namespace
+
+TileScheduler::TileScheduler()
+{
+}
+
+TileScheduler::~TileScheduler()
+{
+}
+
+void TileScheduler::set_tracers(const std::vector<std::shared_ptr<Tracer>>& tracers)
+{
+    m_tracers = tracers;
+    m_queues.clear();
+    for (size_t i = 0; i < tracers.size(); ++i)
+    {
+        m_queues.push_back(std::make_unique<TracerQueue>());
+        m_queues.back()->speed = 0.0f;
+    }
+    m_tiles_per_tracer.assign(tracers.size(), 0);
+}
+
+void TileScheduler::render_frame(const TraceTile& frame)
+{
+    if (m_tracers.empty())
+        throw Error("tile scheduler: no tracers to render with");
+
+    split_frame(frame);
+
+    // The first tracer runs on the calling thread
+    const size_t num_tracers = m_tracers.size();
+    std::vector<std::exception_ptr> errors(num_tracers);
+    std::vector<std::thread> threads;
+
+    for (size_t i = 1; i < num_tracers; ++i)
+    {
+        threads.emplace_back([this, i, &errors]() {
+            try
+            {
+                run_tracer(i);
+            }
+            catch (...)
+            {
+                errors[i] = std::current_exception();
+            }
+        });
+    }
+
+    try
+    {
+        run_tracer(0);
+    }
+    catch (...)
+    {
+        errors[0] = std::current_exception();
+    }
+
+    for (auto& thread : threads)
+        thread.join();
+
+    for (const auto& error : errors)
+    {
+        if (error)
+            std::rethrow_exception(error);
+    }
+}
+
+void TileScheduler::split_frame(const TraceTile& frame)
+{
+    const size_t num_tracers = m_tracers.size();
+
+    // Weight the tracers by their measured speed; tracers without a
+    // measurement get the average of the measured ones, or their GFLOPS
+    // estimate when nothing was measured yet
+    float measured_sum = 0.0f;
+    uint32_t num_measured = 0;
+    for (const auto& queue : m_queues)
+    {
+        if (queue->speed > 0.0f)
+        {
+            measured_sum += queue->speed;
+            ++num_measured;
+        }
+    }
+
+    std::vector<float> weights(num_tracers);
+    float total_weight = 0.0f;
+    for (size_t i = 0; i < num_tracers; ++i)
+    {
+        if (num_measured == 0)
+            weights[i] = max(m_tracers[i]->get_gflops_estimate(), 1.0f);
+        else if (m_queues[i]->speed > 0.0f)
+            weights[i] = m_queues[i]->speed;
+        else
+            weights[i] = measured_sum / float(num_measured);
+        total_weight += weights[i];
+    }
+
+    // Hand out consecutive bands of rows; rounding leftovers go to the last
+    // tracer
+    uint32_t row = 0;
+    for (size_t i = 0; i < num_tracers; ++i)
+    {
+        uint32_t num_rows = uint32_t(float(frame.frame_height) * weights[i] / total_weight);
+        if (i == num_tracers - 1)
+            num_rows = frame.frame_height - row;
+        num_rows = min(num_rows, frame.frame_height - row);
+
+        const float samples_per_row = float(frame.frame_width) * float(max(frame.samples_per_pixel, 1u));
+        const uint32_t min_rows = max(uint32_t(m_queues[i]->speed * min_tile_time_ms / samples_per_row), 1u);
+
+        std::lock_guard<std::mutex> lock(m_queues[i]->mutex);
+        m_queues[i]->tiles.clear();
+
+        while (num_rows > 0)
+        {
+            const uint32_t tile_rows = min(max(num_rows / tile_split, min_rows), num_rows);
+
+            TraceTile tile = frame;
+            tile.tile_x = 0;
+            tile.tile_y = row;
+            tile.tile_w = frame.frame_width;
+            tile.tile_h = tile_rows;
+            m_queues[i]->tiles.push_back(tile);
+
+            row += tile_rows;
+            num_rows -= tile_rows;
+        }
+    }
+}
+
+bool TileScheduler::pop_tile(size_t tracer_index, TraceTile* tile)
+{
+    {
+        TracerQueue& own = *m_queues[tracer_index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tiles.empty())
+        {
+            *tile = own.tiles.front();
+            own.tiles.pop_front();
+            return true;
+        }
+    }
+
+    // Steal the last, smallest tile of the fullest queue
+    for (;;)
+    {
+        size_t victim = tracer_index;
+        size_t victim_size = 0;
+        for (size_t i = 0; i < m_queues.size(); ++i)
+        {
+            if (i == tracer_index)
+                continue;
+
+            std::lock_guard<std::mutex> lock(m_queues[i]->mutex);
+            if (m_queues[i]->tiles.size() > victim_size)
+            {
+                victim = i;
+                victim_size = m_queues[i]->tiles.size();
+            }
+        }
+
+        if (victim_size == 0)
+            return false;
+
+        TracerQueue& queue = *m_queues[victim];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tiles.empty())
+        {
+            *tile = queue.tiles.back();
+            queue.tiles.pop_back();
+            return true;
+        }
+    }
+}
+
+void TileScheduler::run_tracer(size_t tracer_index)
+{
+    Tracer* tracer = m_tracers[tracer_index].get();
+    Tracer* primary = m_tracers[0].get();
+
+    uint32_t num_tiles = 0;
+    TraceTile tile;
+
+    while (pop_tile(tracer_index, &tile))
+    {
+        // Continue from the samples accumulated so far, wherever they were
+        // rendered
+        if (tracer != primary && tile.accumulated_samples > 0)
+            tracer->merge_output(primary, &tile);
+
+        tracer->trace(&tile);
+        update_speed(tracer_index, tile);
+
+        {
+            std::lock_guard<std::mutex> lock(m_merge_mutex);
+            if (tracer != primary)
+                primary->merge_output(tracer, &tile);
+            primary->sync_framebuffer(&tile);
+        }
+
+        ++num_tiles;
+    }
+
+    m_tiles_per_tracer[tracer_index] = num_tiles;
+}
+
+void TileScheduler::update_speed(size_t tracer_index, const TraceTile& tile)
+{
+    const TracerStats* stats = m_tracers[tracer_index]->get_stats();
+    if (stats == nullptr || stats->render_time_ms <= 0.0f)
+        return;
+
+    const float samples = float(tile.tile_w) * float(tile.tile_h) * float(tile.samples_per_pixel);
+    const float speed = samples / stats->render_time_ms;
+
+    TracerQueue& queue = *m_queues[tracer_index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.speed > 0.0f)
+        queue.speed += speed_smoothing * (speed - queue.speed);
+    else
+        queue.speed = speed;
+}
+
+} } // namespace eclipse::render
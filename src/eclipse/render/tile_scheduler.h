@@ -0,0 +1,67 @@
+#pragma once
+
+#include "eclipse/tracer/tracer.h"
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace eclipse { namespace render {
+
+// Splits frames into tiles and renders them on a set of tracers at once.
+//
+// Each tracer gets a share of the frame rows proportional to its measured
+// speed, cut into tiles that shrink towards the end of the share, and
+// renders them from its own queue. A tracer that runs out of tiles steals
+// the last tile of the fullest queue, so a misjudged tracer delays the
+// frame by at most one small tile. Speeds are estimated from the render
+// time reported in TracerStats after every tile and used to size the next
+// frame.
+//
+// The first tracer holds the final image: the tiles rendered by the others
+// are merged into it and it keeps the tone mapped framebuffer up to date.
+// Tracers rendering a tile that already has samples first pull the tile's
+// accumulated output from the first tracer, so tiles may move between
+// tracers from frame to frame.
+class TileScheduler
+{
+public:
+    TileScheduler();
+    ~TileScheduler();
+
+    void set_tracers(const std::vector<std::shared_ptr<Tracer>>& tracers);
+
+    // Renders a frame; the tile position and size of `frame` are ignored,
+    // everything else is passed to the tracers as is
+    void render_frame(const TraceTile& frame);
+
+    // Number of tiles each tracer rendered in the last frame
+    const std::vector<uint32_t>& get_tiles_per_tracer() const { return m_tiles_per_tracer; }
+
+private:
+    struct TracerQueue
+    {
+        std::mutex mutex;
+        std::deque<TraceTile> tiles;
+
+        // Samples per millisecond, 0 until the first tile was rendered
+        float speed;
+    };
+
+    void split_frame(const TraceTile& frame);
+    bool pop_tile(size_t tracer_index, TraceTile* tile);
+    void run_tracer(size_t tracer_index);
+    void update_speed(size_t tracer_index, const TraceTile& tile);
+
+private:
+    std::vector<std::shared_ptr<Tracer>> m_tracers;
+    std::vector<std::unique_ptr<TracerQueue>> m_queues;
+    std::vector<uint32_t> m_tiles_per_tracer;
+
+    // Serializes the merges into the first tracer
+    std::mutex m_merge_mutex;
+};
+
+} } // namespace eclipse::render
@@ -0,0 +1,478 @@
+#pragma once
+
+#include "eclipse/scene/bvh_node.h"
+#include "eclipse/math/math.h"
+#include "eclipse/math/vec3.h"
+#include "eclipse/math/bbox.h"
+
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <functional>
+#include <omp.h>
+
+namespace eclipse { namespace bvh {
+
+// Binned SAH builder. Rather than copying the item lists at each level and
+// rescanning them once per candidate split, the builder keeps a single array
+// of item indices that gets partitioned in place. Item centroids are binned
+// along each axis in a single pass and every bin boundary is then scored with
+// a prefix and a suffix sweep over the bins, so splitting a node is O(N).
+//
+// Subtrees are built concurrently using OpenMP tasks. Each task appends its
+// nodes to a private list; once all tasks are done the lists are flattened
+// into the final node array in depth-first order and the leaf callback is
+// invoked serially, so the output does not depend on the number of threads.
+// When called from inside a parallel region the tasks are spawned on the
+// enclosing team, which allows several BVHs to be built at once.
+//
+// Object and ObjectAccesor have the same requirements as for Builder; the
+// leaf callback receives the same arguments so both builders are
+// interchangeable.
+template <typename Object, typename ObjectAccesor>
+class BinnedBuilder
+{
+public:
+    typedef std::function<void(Node*, const std::vector<Object>&)> LeafCreationCallback;
+
+    // Nodes with more than max_leaf_size items are always split, at the
+    // object median if no split improves their score.
+    static const std::vector<Node> build(const std::vector<Object>& items, uint32_t min_leaf_size, LeafCreationCallback callback,
+                                         uint32_t max_leaf_size = UINT32_MAX);
+
+private:
+    static constexpr uint32_t num_bins = 32;
+
+    // Nodes with at least this many items are built by a separate task
+    static constexpr uint32_t parallel_threshold = 4096;
+
+    // Nodes with at least this many items are binned by several tasks
+    static constexpr uint32_t parallel_binning_threshold = 128 * 1024;
+
+    struct Bin
+    {
+        BBox bbox;
+        BBox centroid_bbox;
+        uint32_t count;
+
+        Bin() : count(0) { }
+
+        void merge(const Bin& o)
+        {
+            bbox.merge(o.bbox);
+            centroid_bbox.merge(o.centroid_bbox);
+            count += o.count;
+        }
+    };
+
+    struct BinSet
+    {
+        Bin bins[3][num_bins];
+
+        void merge(const BinSet& o)
+        {
+            for (uint8_t axis = 0; axis < 3; ++axis)
+                for (uint32_t i = 0; i < num_bins; ++i)
+                    bins[axis][i].merge(o.bins[axis][i]);
+        }
+    };
+
+    struct Subtree;
+
+    struct ChildRef
+    {
+        Subtree* tree;
+        uint32_t index;
+    };
+
+    struct BuildNode
+    {
+        BBox bbox;
+        uint32_t begin, end;
+        ChildRef children[2];
+        bool is_leaf;
+    };
+
+    // Nodes created by a single task. Children large enough to be built by
+    // another task get their own subtree which is owned by this one.
+    struct Subtree
+    {
+        std::vector<BuildNode> nodes;
+        std::vector<std::unique_ptr<Subtree>> subtrees;
+    };
+
+    BinnedBuilder(const std::vector<Object>& items)
+        : m_items(items), m_callback(nullptr), m_min_leaf_size(0), m_max_leaf_size(UINT32_MAX), m_num_partitioned_items(0)
+        , m_num_nodes(0), m_num_leaves(0), m_max_depth(0), m_accessor(items)
+    {
+    }
+
+    uint32_t partition(Subtree* tree, uint32_t begin, uint32_t end, const Bin& bounds);
+    uint32_t split_median(uint32_t begin, uint32_t end, const Bin& bounds, Bin* left, Bin* right);
+    void link_child(Subtree* tree, uint32_t node_index, int side, uint32_t begin, uint32_t end, const Bin& bounds);
+    void bin_items(uint32_t begin, uint32_t end, const BBox& centroid_bbox, BinSet* bin_set) const;
+    uint32_t flatten(const Subtree* tree, uint32_t index, int depth);
+    uint32_t create_leaf(Node* node, uint32_t begin, uint32_t end);
+
+    static uint32_t get_bin(float centroid, float origin, float scale)
+    {
+        int32_t bin = int32_t((centroid - origin) * scale);
+        return uint32_t(clamp(bin, 0, int32_t(num_bins) - 1));
+    }
+
+    static float get_bin_scale(const BBox& centroid_bbox, uint8_t axis)
+    {
+        const float extent = centroid_bbox.pmax[axis] - centroid_bbox.pmin[axis];
+        return extent > 0.0f ? (float)num_bins / extent : 0.0f;
+    }
+
+    static float half_area(const BBox& bbox)
+    {
+        const Vec3 side = bbox.pmax - bbox.pmin;
+        return side.x * side.y + side.x * side.z + side.y * side.z;
+    }
+
+private:
+    const std::vector<Object>& m_items;
+
+    // Indices into m_items; every node owns a contiguous range
+    std::vector<uint32_t> m_indices;
+
+    // Item bounds are fetched once through the accessor
+    std::vector<BBox> m_bboxes;
+    std::vector<Vec3> m_centroids;
+
+    std::vector<Node> m_nodes;
+    std::vector<Object> m_leaf_items;
+
+    LeafCreationCallback m_callback;
+
+    uint32_t m_min_leaf_size;
+    uint32_t m_max_leaf_size;
+    uint32_t m_num_partitioned_items;
+    uint32_t m_num_nodes;
+    uint32_t m_num_leaves;
+    uint32_t m_max_depth;
+
+    ObjectAccesor m_accessor;
+};
+
+template <typename Object, typename ObjectAccesor>
+const std::vector<Node> BinnedBuilder<Object, ObjectAccesor>::build(
+        const std::vector<Object>& items, uint32_t min_leaf_size, LeafCreationCallback callback, uint32_t max_leaf_size)
+{
+    BinnedBuilder builder(items);
+    builder.m_callback = callback;
+    builder.m_min_leaf_size = min_leaf_size;
+    builder.m_max_leaf_size = std::max(max_leaf_size, min_leaf_size);
+
+    if (items.empty())
+        return builder.m_nodes;
+
+    const size_t num_items = items.size();
+    builder.m_indices.resize(num_items);
+    builder.m_bboxes.resize(num_items);
+    builder.m_centroids.resize(num_items);
+
+    // Fetch item bounds and compute the root bounds
+    Bin root_bounds;
+    root_bounds.count = uint32_t(num_items);
+
+#pragma omp parallel
+    {
+        BBox bbox, centroid_bbox;
+
+#pragma omp for nowait
+        for (size_t i = 0; i < num_items; ++i)
+        {
+            builder.m_indices[i] = uint32_t(i);
+            builder.m_bboxes[i] = builder.m_accessor.get_bbox(items[i]);
+            builder.m_centroids[i] = builder.m_accessor.get_centroid(items[i]);
+
+            bbox.merge(builder.m_bboxes[i]);
+            centroid_bbox.merge(builder.m_centroids[i]);
+        }
+
+#pragma omp critical
+        {
+            root_bounds.bbox.merge(bbox);
+            root_bounds.centroid_bbox.merge(centroid_bbox);
+        }
+    }
+
+    Subtree root;
+    if (omp_in_parallel())
+    {
+#pragma omp taskgroup
+        builder.partition(&root, 0, uint32_t(num_items), root_bounds);
+    }
+    else
+    {
+#pragma omp parallel
+#pragma omp single
+        builder.partition(&root, 0, uint32_t(num_items), root_bounds);
+    }
+
+    // A binary tree with N leaves has at most 2N - 1 nodes
+    builder.m_nodes.reserve(2 * num_items / std::max(min_leaf_size, 1u) + 1);
+
+    builder.flatten(&root, 0, 0);
+
+    return builder.m_nodes;
+}
+
+template <typename Object, typename ObjectAccesor>
+uint32_t BinnedBuilder<Object, ObjectAccesor>::partition(Subtree* tree, uint32_t begin, uint32_t end, const Bin& bounds)
+{
+    const uint32_t count = end - begin;
+
+    BuildNode build_node;
+    build_node.bbox = bounds.bbox;
+    build_node.begin = begin;
+    build_node.end = end;
+    build_node.children[0] = build_node.children[1] = ChildRef{ nullptr, 0 };
+    build_node.is_leaf = true;
+
+    uint32_t node_index = tree->nodes.size();
+    tree->nodes.push_back(build_node);
+
+    if (count <= m_min_leaf_size)
+        return node_index;
+
+    // Bin the item centroids along all axes. Large nodes are split into
+    // chunks that are binned concurrently and merged afterwards.
+    BinSet bin_set;
+    if (count >= parallel_binning_threshold)
+    {
+        const uint32_t chunk_size = parallel_binning_threshold / 4;
+        const uint32_t num_chunks = (count + chunk_size - 1) / chunk_size;
+        std::vector<BinSet> chunk_bins(num_chunks);
+
+        for (uint32_t chunk = 0; chunk < num_chunks; ++chunk)
+        {
+            const uint32_t chunk_begin = begin + chunk * chunk_size;
+            const uint32_t chunk_end = std::min(end, chunk_begin + chunk_size);
+            const BBox* centroid_bbox = &bounds.centroid_bbox;
+            BinSet* chunk_bin_set = &chunk_bins[chunk];
+
+#pragma omp task firstprivate(chunk_begin, chunk_end, centroid_bbox, chunk_bin_set)
+            bin_items(chunk_begin, chunk_end, *centroid_bbox, chunk_bin_set);
+        }
+
+#pragma omp taskwait
+
+        for (auto& chunk_bin_set : chunk_bins)
+            bin_set.merge(chunk_bin_set);
+    }
+    else
+    {
+        bin_items(begin, end, bounds.centroid_bbox, &bin_set);
+    }
+
+    // Get current node score; a split must improve on it
+    float best_score = (float)count * half_area(bounds.bbox);
+    int best_axis = -1;
+    uint32_t best_split = 0;
+
+    for (uint8_t axis = 0; axis < 3; ++axis)
+    {
+        // Skip axis if all centroids project to the same point
+        if (get_bin_scale(bounds.centroid_bbox, axis) == 0.0f)
+            continue;
+
+        const Bin* bins = bin_set.bins[axis];
+
+        // Sweep from the left to accumulate the cost of bins [0, split)
+        float left_cost[num_bins];
+        Bin left;
+        for (uint32_t split = 1; split < num_bins; ++split)
+        {
+            left.merge(bins[split - 1]);
+            left_cost[split] = left.count > 0 ? (float)left.count * half_area(left.bbox) : (float)pos_inf;
+        }
+
+        // Sweep from the right and score each split. Splits which leave
+        // one of the partitions empty are ignored.
+        Bin right;
+        for (uint32_t split = num_bins - 1; split > 0; --split)
+        {
+            right.merge(bins[split]);
+            if (right.count == 0 || right.count == count)
+                continue;
+
+            const float score = left_cost[split] + (float)right.count * half_area(right.bbox);
+            if (score < best_score)
+            {
+                best_score = score;
+                best_axis = axis;
+                best_split = split;
+            }
+        }
+    }
+
+    // If we can't find a split that improves the current node score create a
+    // leaf, unless the node holds too many items
+    if (best_axis == -1 && count <= m_max_leaf_size)
+        return node_index;
+
+    Bin left, right;
+    uint32_t mid;
+    if (best_axis == -1)
+    {
+        mid = split_median(begin, end, bounds, &left, &right);
+    }
+    else
+    {
+        // Partition the index range in place around the split
+        const uint8_t axis = uint8_t(best_axis);
+        const float origin = bounds.centroid_bbox.pmin[axis];
+        const float scale = get_bin_scale(bounds.centroid_bbox, axis);
+
+        auto mid_iter = std::partition(m_indices.begin() + begin, m_indices.begin() + end, [&](uint32_t item) {
+            return get_bin(m_centroids[item][axis], origin, scale) < best_split;
+        });
+        mid = uint32_t(mid_iter - m_indices.begin());
+
+        // The child bounds are the union of the bins on each side of the split
+        for (uint32_t i = 0; i < best_split; ++i)
+            left.merge(bin_set.bins[axis][i]);
+        for (uint32_t i = best_split; i < num_bins; ++i)
+            right.merge(bin_set.bins[axis][i]);
+    }
+
+    tree->nodes[node_index].is_leaf = false;
+
+    // Partition children and update node indices
+    link_child(tree, node_index, 0, begin, mid, left);
+    link_child(tree, node_index, 1, mid, end, right);
+
+    return node_index;
+}
+
+template <typename Object, typename ObjectAccesor>
+uint32_t BinnedBuilder<Object, ObjectAccesor>::split_median(
+        uint32_t begin, uint32_t end, const Bin& bounds, Bin* left, Bin* right)
+{
+    // Split the index range in two halves along the longest centroid axis
+    const Vec3 side = bounds.centroid_bbox.pmax - bounds.centroid_bbox.pmin;
+    uint8_t axis = 0;
+    if (side[1] > side[axis])
+        axis = 1;
+    if (side[2] > side[axis])
+        axis = 2;
+
+    const uint32_t mid = begin + (end - begin) / 2;
+    std::nth_element(m_indices.begin() + begin, m_indices.begin() + mid, m_indices.begin() + end,
+                     [&](uint32_t a, uint32_t b) {
+        return m_centroids[a][axis] < m_centroids[b][axis] || (m_centroids[a][axis] == m_centroids[b][axis] && a < b);
+    });
+
+    for (uint32_t i = begin; i < end; ++i)
+    {
+        const uint32_t item = m_indices[i];
+        Bin* bin = i < mid ? left : right;
+        bin->bbox.merge(m_bboxes[item]);
+        bin->centroid_bbox.merge(m_centroids[item]);
+        ++bin->count;
+    }
+
+    return mid;
+}
+
+template <typename Object, typename ObjectAccesor>
+void BinnedBuilder<Object, ObjectAccesor>::link_child(
+        Subtree* tree, uint32_t node_index, int side, uint32_t begin, uint32_t end, const Bin& bounds)
+{
+    if (end - begin >= parallel_threshold)
+    {
+        tree->subtrees.emplace_back(new Subtree());
+        Subtree* subtree = tree->subtrees.back().get();
+        tree->nodes[node_index].children[side] = ChildRef{ subtree, 0 };
+
+        Bin child_bounds = bounds;
+#pragma omp task firstprivate(subtree, begin, end, child_bounds)
+        partition(subtree, begin, end, child_bounds);
+    }
+    else
+    {
+        uint32_t child_index = partition(tree, begin, end, bounds);
+        tree->nodes[node_index].children[side] = ChildRef{ tree, child_index };
+    }
+}
+
+template <typename Object, typename ObjectAccesor>
+void BinnedBuilder<Object, ObjectAccesor>::bin_items(
+        uint32_t begin, uint32_t end, const BBox& centroid_bbox, BinSet* bin_set) const
+{
+    const float scale[3] = {
+        get_bin_scale(centroid_bbox, 0),
+        get_bin_scale(centroid_bbox, 1),
+        get_bin_scale(centroid_bbox, 2)
+    };
+
+    for (uint32_t i = begin; i < end; ++i)
+    {
+        const uint32_t item = m_indices[i];
+        const Vec3& centroid = m_centroids[item];
+
+        for (uint8_t axis = 0; axis < 3; ++axis)
+        {
+            Bin& bin = bin_set->bins[axis][get_bin(centroid[axis], centroid_bbox.pmin[axis], scale[axis])];
+            bin.bbox.merge(m_bboxes[item]);
+            bin.centroid_bbox.merge(centroid);
+            ++bin.count;
+        }
+    }
+}
+
+template <typename Object, typename ObjectAccesor>
+uint32_t BinnedBuilder<Object, ObjectAccesor>::flatten(const Subtree* tree, uint32_t index, int depth)
+{
+    if (depth > (int)m_max_depth)
+        m_max_depth = depth;
+
+    const BuildNode& build_node = tree->nodes[index];
+
+    Node node;
+    node.bbox = build_node.bbox;
+
+    if (build_node.is_leaf)
+        return create_leaf(&node, build_node.begin, build_node.end);
+
+    // Add node to list
+    uint32_t node_index = m_nodes.size();
+    m_nodes.push_back(node);
+    ++m_num_nodes;
+
+    // Flatten children and update node indices
+    const ChildRef& left = build_node.children[0];
+    const ChildRef& right = build_node.children[1];
+    uint32_t left_node_index = flatten(left.tree, left.index, depth + 1);
+    uint32_t right_node_index = flatten(right.tree, right.index, depth + 1);
+    m_nodes[node_index].set_child_nodes(left_node_index, right_node_index);
+
+    return node_index;
+}
+
+template <typename Object, typename ObjectAccesor>
+uint32_t BinnedBuilder<Object, ObjectAccesor>::create_leaf(Node* node, uint32_t begin, uint32_t end)
+{
+    m_leaf_items.clear();
+    for (uint32_t i = begin; i < end; ++i)
+        m_leaf_items.push_back(m_items[m_indices[i]]);
+
+    m_callback(node, m_leaf_items);
+
+    // Append node to list
+    uint32_t node_index = m_nodes.size();
+    m_nodes.push_back(*node);
+
+    // Update stats
+    ++m_num_leaves;
+    m_num_partitioned_items += end - begin;
+
+    return node_index;
+}
+
+} } // namespace eclipse::bvh
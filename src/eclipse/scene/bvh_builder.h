@@ -7,10 +7,17 @@
 
 #include <cstdint>
 #include <vector>
+#include <algorithm>
 #include <functional>
 
 namespace eclipse { namespace bvh {
 
+// Exhaustive SAH builder: every node scores 100 candidate planes per axis,
+// each against all of its items. Only the candidates of one node are scored
+// in parallel; subtrees are built one after another, so the levels near the
+// leaves run on a single thread and large meshes build much slower than
+// with BinnedBuilder, which is why that one is the default.
+//
 // Object must be a pointer to a type with the following methods:
 //     BBox get_bbox();
 //     Vec3 get_centroid();
@@ -25,16 +32,20 @@ class Builder
 public:
     typedef std::function<void(Node*, const std::vector<Object>&)> LeafCreationCallback;
 
-    static const std::vector<Node> build(const std::vector<Object>& items, uint32_t min_leaf_size, LeafCreationCallback callback);
+    // Nodes with more than max_leaf_size items are always split, at the
+    // object median if no split improves their score.
+    static const std::vector<Node> build(const std::vector<Object>& items, uint32_t min_leaf_size, LeafCreationCallback callback,
+                                         uint32_t max_leaf_size = UINT32_MAX);
 
 private:
     Builder(const std::vector<Object>& items)
-        : m_callback(nullptr), m_min_leaf_size(0), m_num_partitioned_items(0), m_num_total_items(0)
+        : m_callback(nullptr), m_min_leaf_size(0), m_max_leaf_size(UINT32_MAX), m_num_partitioned_items(0), m_num_total_items(0)
         , m_num_nodes(0), m_num_leaves(0), m_max_depth(0), m_accessor(items)
     {
     }
 
     uint32_t partition(const std::vector<Object>& items, int depth);
+    void split_median(const std::vector<Object>& items, const BBox& bbox, std::vector<Object>* left_items, std::vector<Object>* right_items);
     uint32_t create_leaf(Node* node, const std::vector<Object>& items);
 
 private:
@@ -55,6 +66,7 @@ private:
     LeafCreationCallback m_callback;
 
     uint32_t m_min_leaf_size;
+    uint32_t m_max_leaf_size;
     uint32_t m_num_partitioned_items;
     uint32_t m_num_total_items;
     uint32_t m_num_nodes;
@@ -66,11 +78,12 @@ private:
 
 template <typename Object, typename ObjectAccesor, typename ScoringStrategy>
 const std::vector<Node> Builder<Object, ObjectAccesor, ScoringStrategy>::build(
-        const std::vector<Object>& items, uint32_t min_leaf_size, LeafCreationCallback callback)
+        const std::vector<Object>& items, uint32_t min_leaf_size, LeafCreationCallback callback, uint32_t max_leaf_size)
 {
     Builder builder(items);
     builder.m_callback = callback;
     builder.m_min_leaf_size = min_leaf_size;
+    builder.m_max_leaf_size = std::max(max_leaf_size, min_leaf_size);
     builder.m_num_total_items = items.size();
 
     builder.partition(items, 0);
@@ -96,9 +109,12 @@ uint32_t Builder<Object, ObjectAccesor, ScoringStrategy>::partition(const std::v
     // Get current node score
     float best_score = ScoringStrategy::score_partition(items, &m_accessor);
 
+    // Each candidate split writes to its own slot so the scores
+    // can be computed in parallel
     constexpr size_t num_buckets = 100;
-    static SplitScore score_list[3 * num_buckets];
-    size_t num_scores = 0;
+    SplitScore score_list[3 * num_buckets];
+    for (auto& score : score_list)
+        score.score = pos_inf;
 
     const Vec3 side = node.bbox.pmax - node.bbox.pmin;
 
@@ -121,13 +137,13 @@ uint32_t Builder<Object, ObjectAccesor, ScoringStrategy>::partition(const std::v
             score.axis = axis;
             score.split_point = split_point;
             score.score = ScoringStrategy::score_split(items, &m_accessor, axis, split_point, &score.left_count, &score.right_count);
-            score_list[num_scores++] = score;
+            score_list[axis * num_buckets + i] = score;
         }
     }
 
     // Process all scores and pick the best split
     SplitScore* best_split = nullptr;
-    for (size_t i = 0; i < num_scores; ++i)
+    for (size_t i = 0; i < 3 * num_buckets; ++i)
     {
         SplitScore* score = &score_list[i];
         if (score->score < best_score)
@@ -137,22 +153,30 @@ uint32_t Builder<Object, ObjectAccesor, ScoringStrategy>::partition(const std::v
         }
     }
 
-    // If we can't find a split that improves the current node score create a leaf
-    if (best_split == nullptr)
+    // If we can't find a split that improves the current node score create a
+    // leaf, unless the node holds too many items
+    if (best_split == nullptr && items.size() <= m_max_leaf_size)
         return create_leaf(&node, items);
 
     // Split items list into two sets
     std::vector<Object> left_items, right_items;
-    left_items.reserve(best_split->left_count);
-    right_items.reserve(best_split->right_count);
-
-    for (auto& item : items)
+    if (best_split == nullptr)
     {
-        Vec3 center = m_accessor.get_centroid(item);
-        if (center[best_split->axis] < best_split->split_point)
-            left_items.push_back(item);
-        else
-            right_items.push_back(item);
+        split_median(items, node.bbox, &left_items, &right_items);
+    }
+    else
+    {
+        left_items.reserve(best_split->left_count);
+        right_items.reserve(best_split->right_count);
+
+        for (auto& item : items)
+        {
+            Vec3 center = m_accessor.get_centroid(item);
+            if (center[best_split->axis] < best_split->split_point)
+                left_items.push_back(item);
+            else
+                right_items.push_back(item);
+        }
     }
 
     // Add node to list
@@ -168,6 +192,28 @@ uint32_t Builder<Object, ObjectAccesor, ScoringStrategy>::partition(const std::v
     return node_index;
 }
 
+template <typename Object, typename ObjectAccesor, typename ScoringStrategy>
+void Builder<Object, ObjectAccesor, ScoringStrategy>::split_median(const std::vector<Object>& items, const BBox& bbox,
+        std::vector<Object>* left_items, std::vector<Object>* right_items)
+{
+    // Sort items along the longest axis and split them in two halves
+    const Vec3 side = bbox.pmax - bbox.pmin;
+    uint8_t axis = 0;
+    if (side[1] > side[axis])
+        axis = 1;
+    if (side[2] > side[axis])
+        axis = 2;
+
+    std::vector<Object> sorted_items(items);
+    std::stable_sort(sorted_items.begin(), sorted_items.end(), [&](const Object& a, const Object& b) {
+        return m_accessor.get_centroid(a)[axis] < m_accessor.get_centroid(b)[axis];
+    });
+
+    const size_t mid = sorted_items.size() / 2;
+    left_items->assign(sorted_items.begin(), sorted_items.begin() + mid);
+    right_items->assign(sorted_items.begin() + mid, sorted_items.end());
+}
+
 template <typename Object, typename ObjectAccesor, typename ScoringStrategy>
 uint32_t Builder<Object, ObjectAccesor, ScoringStrategy>::create_leaf(Node* node, const std::vector<Object>& items)
 {
@@ -0,0 +1,333 @@
+#pragma once
+
+#include "eclipse/scene/bvh_node.h"
+#include "eclipse/math/math.h"
+#include "eclipse/math/vec3.h"
+#include "eclipse/math/bbox.h"
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+namespace eclipse { namespace bvh {
+
+// Linear BVH builder. Items are sorted along a Morton curve through their
+// centroids and the hierarchy is derived from the sorted codes alone: every
+// internal node splits its range where the highest differing bit of the
+// codes changes (Karras, "Maximizing Parallelism in the Construction of BVHs,
+// Octrees, and k-d Trees"). Each internal node is found independently, so the
+// hierarchy is built in parallel and the whole build is linear in the number
+// of items.
+//
+// The tree does not take the surface area heuristic into account; it builds
+// much faster than Builder or BinnedBuilder but traces slower, which makes it
+// suitable for meshes that get rebuilt often.
+//
+// Object and ObjectAccesor have the same requirements as for Builder; the
+// leaf callback receives the same arguments so the builders are
+// interchangeable. Subtrees with at most min_leaf_size items are collapsed
+// into a single leaf.
+template <typename Object, typename ObjectAccesor>
+class LinearBuilder
+{
+public:
+    typedef std::function<void(Node*, const std::vector<Object>&)> LeafCreationCallback;
+
+    // Leaves never hold more than min_leaf_size items; max_leaf_size is only
+    // accepted for compatibility with the other builders.
+    static const std::vector<Node> build(const std::vector<Object>& items, uint32_t min_leaf_size, LeafCreationCallback callback,
+                                         uint32_t max_leaf_size = UINT32_MAX);
+
+private:
+    // Number of bits per axis in a Morton code
+    static constexpr uint32_t morton_bits = 10;
+
+    // Number of bits sorted per radix sort pass
+    static constexpr uint32_t radix_bits = 10;
+    static constexpr uint32_t radix_size = 1 << radix_bits;
+
+    // Loops over fewer items than this are not worth running in parallel
+    static constexpr uint32_t parallel_threshold = 4096;
+
+    LinearBuilder(const std::vector<Object>& items)
+        : m_items(items), m_callback(nullptr), m_min_leaf_size(0), m_num_partitioned_items(0)
+        , m_num_nodes(0), m_num_leaves(0), m_max_depth(0), m_accessor(items)
+    {
+    }
+
+    void sort_items();
+    void find_splits();
+    uint32_t emit(uint32_t first, uint32_t last, uint32_t internal_index, int depth, BBox* bbox);
+    uint32_t create_leaf(Node* node, uint32_t first, uint32_t last);
+
+    // Length of the common prefix of the codes at i and j. Identical codes
+    // are made unique by appending the item position to them.
+    int32_t common_prefix(int32_t i, int32_t j) const
+    {
+        if (j < 0 || j >= int32_t(m_codes.size()))
+            return -1;
+
+        const uint32_t a = m_codes[i];
+        const uint32_t b = m_codes[j];
+        if (a == b)
+            return 32 + __builtin_clz(uint32_t(i ^ j));
+        return __builtin_clz(a ^ b);
+    }
+
+    // Insert two zero bits after each of the lower 10 bits of v
+    static uint32_t expand_bits(uint32_t v)
+    {
+        v = (v * 0x00010001u) & 0xFF0000FFu;
+        v = (v * 0x00000101u) & 0x0F00F00Fu;
+        v = (v * 0x00000011u) & 0xC30C30C3u;
+        v = (v * 0x00000005u) & 0x49249249u;
+        return v;
+    }
+
+    static uint32_t quantize(float value, float origin, float scale)
+    {
+        const int32_t max_value = (1 << morton_bits) - 1;
+        return uint32_t(clamp(int32_t((value - origin) * scale), 0, max_value));
+    }
+
+private:
+    const std::vector<Object>& m_items;
+
+    // Morton codes and the item indices they belong to, in sorted order
+    std::vector<uint32_t> m_codes;
+    std::vector<uint32_t> m_indices;
+
+    // Item bounds are fetched once through the accessor
+    std::vector<BBox> m_bboxes;
+    std::vector<Vec3> m_centroids;
+
+    // Split position of each internal node of the Karras hierarchy
+    std::vector<uint32_t> m_splits;
+
+    std::vector<Node> m_nodes;
+    std::vector<Object> m_leaf_items;
+
+    LeafCreationCallback m_callback;
+
+    uint32_t m_min_leaf_size;
+    uint32_t m_num_partitioned_items;
+    uint32_t m_num_nodes;
+    uint32_t m_num_leaves;
+    uint32_t m_max_depth;
+
+    ObjectAccesor m_accessor;
+};
+
+template <typename Object, typename ObjectAccesor>
+const std::vector<Node> LinearBuilder<Object, ObjectAccesor>::build(
+        const std::vector<Object>& items, uint32_t min_leaf_size, LeafCreationCallback callback, uint32_t max_leaf_size)
+{
+    (void)max_leaf_size;
+
+    LinearBuilder builder(items);
+    builder.m_callback = callback;
+    builder.m_min_leaf_size = std::max(min_leaf_size, 1u);
+
+    if (items.empty())
+        return builder.m_nodes;
+
+    builder.sort_items();
+    builder.find_splits();
+
+    // A binary tree with N leaves has at most 2N - 1 nodes
+    builder.m_nodes.reserve(2 * items.size() / builder.m_min_leaf_size + 1);
+
+    BBox bbox;
+    builder.emit(0, uint32_t(items.size() - 1), 0, 0, &bbox);
+
+    return builder.m_nodes;
+}
+
+template <typename Object, typename ObjectAccesor>
+void LinearBuilder<Object, ObjectAccesor>::sort_items()
+{
+    const int64_t num_items = int64_t(m_items.size());
+    m_bboxes.resize(num_items);
+    m_centroids.resize(num_items);
+
+    // Fetch item bounds and compute the centroid bounds
+    BBox centroid_bbox;
+
+#pragma omp parallel if(num_items >= parallel_threshold)
+    {
+        BBox local_bbox;
+
+#pragma omp for nowait
+        for (int64_t i = 0; i < num_items; ++i)
+        {
+            m_bboxes[i] = m_accessor.get_bbox(m_items[i]);
+            m_centroids[i] = m_accessor.get_centroid(m_items[i]);
+            local_bbox.merge(m_centroids[i]);
+        }
+
+#pragma omp critical
+        centroid_bbox.merge(local_bbox);
+    }
+
+    // Compute Morton codes over the centroid bounds
+    float scale[3];
+    for (uint8_t axis = 0; axis < 3; ++axis)
+    {
+        const float extent = centroid_bbox.pmax[axis] - centroid_bbox.pmin[axis];
+        scale[axis] = extent > 0.0f ? (float)(1 << morton_bits) / extent : 0.0f;
+    }
+
+    std::vector<uint32_t> codes(num_items);
+    std::vector<uint32_t> indices(num_items);
+
+#pragma omp parallel for if(num_items >= parallel_threshold)
+    for (int64_t i = 0; i < num_items; ++i)
+    {
+        const Vec3& centroid = m_centroids[i];
+        const uint32_t x = quantize(centroid.x, centroid_bbox.pmin.x, scale[0]);
+        const uint32_t y = quantize(centroid.y, centroid_bbox.pmin.y, scale[1]);
+        const uint32_t z = quantize(centroid.z, centroid_bbox.pmin.z, scale[2]);
+
+        codes[i] = (expand_bits(x) << 2) | (expand_bits(y) << 1) | expand_bits(z);
+        indices[i] = uint32_t(i);
+    }
+
+    // Sort codes with a stable LSD radix sort, so items with equal codes
+    // keep their original order and the result is deterministic
+    m_codes.resize(num_items);
+    m_indices.resize(num_items);
+
+    for (uint32_t shift = 0; shift < 3 * morton_bits; shift += radix_bits)
+    {
+        uint32_t offsets[radix_size] = { };
+        for (int64_t i = 0; i < num_items; ++i)
+            ++offsets[(codes[i] >> shift) & (radix_size - 1)];
+
+        uint32_t sum = 0;
+        for (uint32_t digit = 0; digit < radix_size; ++digit)
+        {
+            const uint32_t count = offsets[digit];
+            offsets[digit] = sum;
+            sum += count;
+        }
+
+        for (int64_t i = 0; i < num_items; ++i)
+        {
+            const uint32_t dst = offsets[(codes[i] >> shift) & (radix_size - 1)]++;
+            m_codes[dst] = codes[i];
+            m_indices[dst] = indices[i];
+        }
+
+        codes.swap(m_codes);
+        indices.swap(m_indices);
+    }
+
+    // The last pass swapped the sorted lists back into the temporaries
+    m_codes.swap(codes);
+    m_indices.swap(indices);
+}
+
+template <typename Object, typename ObjectAccesor>
+void LinearBuilder<Object, ObjectAccesor>::find_splits()
+{
+    // N items have N - 1 internal nodes; internal node i covers a range of
+    // items that starts or ends at i
+    const int32_t num_internal = int32_t(m_codes.size()) - 1;
+    m_splits.resize(std::max(num_internal, 0));
+
+#pragma omp parallel for if(num_internal >= int32_t(parallel_threshold))
+    for (int32_t i = 0; i < num_internal; ++i)
+    {
+        // The range extends in the direction of the longer common prefix
+        const int32_t dir = common_prefix(i, i + 1) - common_prefix(i, i - 1) >= 0 ? 1 : -1;
+        const int32_t min_prefix = common_prefix(i, i - dir);
+
+        // Find an upper bound for the range length, then binary search the other end
+        int32_t max_length = 2;
+        while (common_prefix(i, i + max_length * dir) > min_prefix)
+            max_length *= 2;
+
+        int32_t length = 0;
+        for (int32_t step = max_length / 2; step >= 1; step /= 2)
+        {
+            if (common_prefix(i, i + (length + step) * dir) > min_prefix)
+                length += step;
+        }
+
+        // Binary search the position where the common prefix of the range changes
+        const int32_t node_prefix = common_prefix(i, i + length * dir);
+        int32_t split = 0;
+        for (int32_t div = 2; ; div *= 2)
+        {
+            const int32_t step = (length + div - 1) / div;
+            if (common_prefix(i, i + (split + step) * dir) > node_prefix)
+                split += step;
+            if (step == 1)
+                break;
+        }
+
+        m_splits[i] = uint32_t(i + split * dir + std::min(dir, 0));
+    }
+}
+
+template <typename Object, typename ObjectAccesor>
+uint32_t LinearBuilder<Object, ObjectAccesor>::emit(
+        uint32_t first, uint32_t last, uint32_t internal_index, int depth, BBox* bbox)
+{
+    if (depth > (int)m_max_depth)
+        m_max_depth = depth;
+
+    Node node;
+
+    // Collapse small ranges into a leaf
+    if (last - first + 1 <= m_min_leaf_size)
+    {
+        for (uint32_t i = first; i <= last; ++i)
+            node.bbox.merge(m_bboxes[m_indices[i]]);
+
+        *bbox = node.bbox;
+        return create_leaf(&node, first, last);
+    }
+
+    // Add node to list
+    uint32_t node_index = m_nodes.size();
+    m_nodes.push_back(node);
+    ++m_num_nodes;
+
+    // The left child is the internal node at the split, the right one
+    // follows it; children covering a single item are leaves
+    const uint32_t split = m_splits[internal_index];
+
+    BBox left_bbox, right_bbox;
+    uint32_t left_node_index = emit(first, split, split, depth + 1, &left_bbox);
+    uint32_t right_node_index = emit(split + 1, last, split + 1, depth + 1, &right_bbox);
+
+    m_nodes[node_index].bbox = merge(left_bbox, right_bbox);
+    m_nodes[node_index].set_child_nodes(left_node_index, right_node_index);
+
+    *bbox = m_nodes[node_index].bbox;
+    return node_index;
+}
+
+template <typename Object, typename ObjectAccesor>
+uint32_t LinearBuilder<Object, ObjectAccesor>::create_leaf(Node* node, uint32_t first, uint32_t last)
+{
+    m_leaf_items.clear();
+    for (uint32_t i = first; i <= last; ++i)
+        m_leaf_items.push_back(m_items[m_indices[i]]);
+
+    m_callback(node, m_leaf_items);
+
+    // Append node to list
+    uint32_t node_index = m_nodes.size();
+    m_nodes.push_back(*node);
+
+    // Update stats
+    ++m_num_leaves;
+    m_num_partitioned_items += last - first + 1;
+
+    return node_index;
+}
+
+} } // namespace eclipse::bvh
@@ -17,6 +17,7 @@ struct Node
     void set_mesh_index(uint32_t index)
     {
         left_data = -int32_t(index);
+        right_data = 0;
     }
 
     uint32_t get_mesh_index() const
@@ -50,6 +51,15 @@ struct Node
         right_data += offset;
     }
 
+    void offset_primitives(int32_t offset)
+    {
+        // Ignore inner nodes
+        if (left_data > 0)
+            return;
+
+        left_data -= offset;
+    }
+
     void set_child_nodes(uint32_t left, uint32_t right)
     {
         left_data = int32_t(left);
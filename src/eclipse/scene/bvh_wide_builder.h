@@ -0,0 +1,168 @@
+#pragma once
+
+#include "eclipse/scene/bvh_node.h"
+#include "eclipse/scene/bvh_wide_node.h"
+#include "eclipse/math/vec3.h"
+#include "eclipse/math/bbox.h"
+#include "eclipse/util/array.h"
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+namespace eclipse { namespace bvh {
+
+// Collapses binary BVHs into BVHs with up to Width children per node.
+// Starting from the children of a binary node, the child with the largest
+// surface area is repeatedly replaced by its own two children until the
+// node is full or only leaves are left; the leaves of the binary tree are
+// kept as they are, so primitive ranges do not change.
+//
+// Several trees stored in the same node list, such as the scene BVH and the
+// mesh BVHs of a compiled scene, can be collapsed at once. Child indices of
+// the binary nodes must be indices into that list. The collapsed trees are
+// stored one after the other in the order of their roots, each one in
+// depth-first order.
+template <uint32_t Width>
+class WideBuilder
+{
+public:
+    static const std::vector<WideNode<Width>> build(const Array<Node>& nodes, const std::vector<uint32_t>& roots,
+                                                    std::vector<uint32_t>* wide_roots);
+
+private:
+    WideBuilder(const Array<Node>& nodes) : m_binary_nodes(nodes) { }
+
+    uint32_t collapse(uint32_t binary_index);
+
+    static float half_area(const BBox& bbox)
+    {
+        const Vec3 side = bbox.pmax - bbox.pmin;
+        return side.x * side.y + side.x * side.z + side.y * side.z;
+    }
+
+    bool is_leaf(uint32_t binary_index) const
+    {
+        return m_binary_nodes[binary_index].left_data <= 0;
+    }
+
+private:
+    const Array<Node>& m_binary_nodes;
+    std::vector<WideNode<Width>> m_nodes;
+};
+
+template <uint32_t Width>
+const std::vector<WideNode<Width>> WideBuilder<Width>::build(
+        const Array<Node>& nodes, const std::vector<uint32_t>& roots, std::vector<uint32_t>* wide_roots)
+{
+    const int64_t num_roots = int64_t(roots.size());
+    std::vector<std::vector<WideNode<Width>>> trees(num_roots);
+
+    // Collapse each tree separately; child indices start at 0
+#pragma omp parallel for schedule(dynamic)
+    for (int64_t i = 0; i < num_roots; ++i)
+    {
+        if (roots[i] >= nodes.size())
+            continue;
+
+        WideBuilder builder(nodes);
+        builder.collapse(roots[i]);
+        trees[i].swap(builder.m_nodes);
+    }
+
+    // Assign each tree its node range and relocate the child indices
+    wide_roots->resize(num_roots);
+    size_t total_nodes = 0;
+    for (int64_t i = 0; i < num_roots; ++i)
+    {
+        (*wide_roots)[i] = uint32_t(total_nodes);
+        total_nodes += trees[i].size();
+    }
+
+    std::vector<WideNode<Width>> wide_nodes(total_nodes);
+
+#pragma omp parallel for schedule(dynamic)
+    for (int64_t i = 0; i < num_roots; ++i)
+    {
+        const int32_t offset = int32_t((*wide_roots)[i]);
+        for (size_t j = 0; j < trees[i].size(); ++j)
+        {
+            wide_nodes[offset + j] = trees[i][j];
+            wide_nodes[offset + j].offset_child_nodes(offset);
+        }
+    }
+
+    return wide_nodes;
+}
+
+template <uint32_t Width>
+uint32_t WideBuilder<Width>::collapse(uint32_t binary_index)
+{
+    // Gather children by repeatedly opening the largest inner child
+    uint32_t children[Width];
+    uint32_t num_children = 0;
+
+    if (is_leaf(binary_index))
+    {
+        // A tree made of a single leaf still needs a root
+        children[num_children++] = binary_index;
+    }
+    else
+    {
+        children[num_children++] = m_binary_nodes[binary_index].left_data;
+        children[num_children++] = m_binary_nodes[binary_index].right_data;
+    }
+
+    while (num_children < Width)
+    {
+        int32_t best_child = -1;
+        float best_area = -1.0f;
+        for (uint32_t i = 0; i < num_children; ++i)
+        {
+            if (is_leaf(children[i]))
+                continue;
+
+            const float area = half_area(m_binary_nodes[children[i]].bbox);
+            if (area > best_area)
+            {
+                best_area = area;
+                best_child = int32_t(i);
+            }
+        }
+
+        if (best_child == -1)
+            break;
+
+        const Node& node = m_binary_nodes[children[best_child]];
+        children[best_child] = node.left_data;
+        children[num_children++] = node.right_data;
+    }
+
+    // Add node to list
+    uint32_t node_index = m_nodes.size();
+    m_nodes.emplace_back();
+    m_nodes[node_index].clear();
+
+    // Collapse inner children and update node indices
+    for (uint32_t i = 0; i < num_children; ++i)
+    {
+        const Node& child = m_binary_nodes[children[i]];
+        m_nodes[node_index].set_bbox(i, child.bbox);
+
+        if (is_leaf(children[i]))
+        {
+            // Scene BVH leaves written by older versions left right_data
+            // uninitialized; it must not be mistaken for an empty slot
+            m_nodes[node_index].set_leaf(i, child.left_data, std::max(child.right_data, 0));
+        }
+        else
+        {
+            uint32_t child_index = collapse(children[i]);
+            m_nodes[node_index].set_child_node(i, child_index);
+        }
+    }
+
+    return node_index;
+}
+
+} } // namespace eclipse::bvh
@@ -0,0 +1,124 @@
+#pragma once
+
+#include "eclipse/math/math.h"
+#include "eclipse/math/bbox.h"
+
+#include <cstdint>
+
+namespace eclipse { namespace bvh {
+
+// A BVH node with up to Width children. The child bounds are stored as a
+// structure of arrays so that all children can be tested against a ray with
+// a few SIMD instructions. Node4 and Node8 are 128 and 256 bytes long; with
+// 8 children each bounds array fills one AVX register.
+//
+// The child data follows the bvh::Node conventions: a positive value is the
+// index of an inner node, otherwise the child is a leaf whose data is the
+// negated first primitive (or mesh instance) index and whose count holds the
+// number of primitives. Unused slots have empty bounds which never intersect
+// a ray, and a count of -1.
+template <uint32_t Width>
+struct WideNode
+{
+    static constexpr uint32_t width = Width;
+
+    float min_x[Width];
+    float min_y[Width];
+    float min_z[Width];
+    float max_x[Width];
+    float max_y[Width];
+    float max_z[Width];
+    int32_t child_data[Width];
+    int32_t child_count[Width];
+
+    void clear()
+    {
+        for (uint32_t i = 0; i < Width; ++i)
+        {
+            min_x[i] = min_y[i] = min_z[i] = pos_inf;
+            max_x[i] = max_y[i] = max_z[i] = neg_inf;
+            child_data[i] = 0;
+            child_count[i] = -1;
+        }
+    }
+
+    void set_bbox(uint32_t i, const BBox& bbox)
+    {
+        min_x[i] = bbox.pmin.x;
+        min_y[i] = bbox.pmin.y;
+        min_z[i] = bbox.pmin.z;
+        max_x[i] = bbox.pmax.x;
+        max_y[i] = bbox.pmax.y;
+        max_z[i] = bbox.pmax.z;
+    }
+
+    BBox get_bbox(uint32_t i) const
+    {
+        return BBox(Vec3(min_x[i], min_y[i], min_z[i]), Vec3(max_x[i], max_y[i], max_z[i]));
+    }
+
+    bool is_empty(uint32_t i) const
+    {
+        return child_count[i] < 0;
+    }
+
+    bool is_leaf(uint32_t i) const
+    {
+        return child_data[i] <= 0;
+    }
+
+    void set_child_node(uint32_t i, uint32_t index)
+    {
+        child_data[i] = int32_t(index);
+        child_count[i] = 0;
+    }
+
+    uint32_t get_child_node(uint32_t i) const
+    {
+        return uint32_t(child_data[i]);
+    }
+
+    void set_leaf(uint32_t i, int32_t left_data, int32_t right_data)
+    {
+        child_data[i] = left_data;
+        child_count[i] = right_data;
+    }
+
+    uint32_t get_mesh_index(uint32_t i) const
+    {
+        return uint32_t(-child_data[i]);
+    }
+
+    uint32_t get_primitives_offset(uint32_t i) const
+    {
+        return uint32_t(-child_data[i]);
+    }
+
+    uint32_t get_num_primitives(uint32_t i) const
+    {
+        return uint32_t(child_count[i]);
+    }
+
+    uint32_t get_num_children() const
+    {
+        uint32_t num_children = 0;
+        for (uint32_t i = 0; i < Width; ++i)
+            num_children += is_empty(i) ? 0 : 1;
+        return num_children;
+    }
+
+    void offset_child_nodes(int32_t offset)
+    {
+        // Ignore leaves and empty slots
+        for (uint32_t i = 0; i < Width; ++i)
+        {
+            if (!is_empty(i) && !is_leaf(i))
+                child_data[i] += offset;
+        }
+    }
+};
+
+typedef WideNode<4> Node4;
+typedef WideNode<8> Node8;
+
+} } // namespace eclipse::bvh
@@ -0,0 +1,282 @@
+#include "eclipse/scene/compile_cache.h"
+#include "eclipse/scene/compile_record.h"
+#include "eclipse/scene/compiler.h"
+#include "eclipse/scene/scene.h"
+#include "eclipse/scene/scene_file.h"
+#include "eclipse/util/file_util.h"
+#include "eclipse/util/mapped_file.h"
+#include "eclipse/util/hash.h"
+#include "eclipse/util/logger.h"
+#include "eclipse/util/stop_watch.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace eclipse { namespace scene {
+
+namespace {
+
+auto logger = Logger::create("compile_cache");
+
+const char manifest_header[] = "eclipse compile cache";
+
+using raw::SourceFile;
+
+bool same_source(const SourceFile& a, const SourceFile& b)
+{
+    return a.path == b.path && a.exists == b.exists && (!a.exists || a.hash == b.hash);
+}
+
+// Canonical description of what a compile depends on besides its sources
+std::string describe_compile(const std::string& obj_path, const CompileOptions& options)
+{
+    std::ostringstream ss;
+    ss << "version " << compile_cache_version << " " << scene_file_version << "\n"
+       << "scene " << obj_path << "\n"
+       << "bvh " << int(options.bvh_builder) << "\n";
+    for (const auto& entry : options.mesh_bvh_builders)
+        ss << "mesh-bvh " << int(entry.second) << " " << entry.first << "\n";
+    ss << "wide-bvh " << options.wide_bvh_width << " " << options.keep_binary_bvh << "\n"
+       << "oct-normals " << options.oct_normals << "\n"
+       << "half-uvs " << options.half_uvs << "\n"
+       << "mip-maps " << options.mip_maps << " " << int(options.mip_filter) << "\n"
+       << "texture-layout " << int(options.texture_layout) << "\n";
+    for (TextureRole role : options.compressed_textures)
+        ss << "compress-textures " << int(role) << "\n";
+    ss << "paged-textures " << options.paged_textures << "\n";
+    return ss.str();
+}
+
+// Missing files are sources too; a texture that appears must be picked up
+void hash_sources(std::vector<SourceFile>& sources)
+{
+    const int64_t num_sources = int64_t(sources.size());
+
+#pragma omp parallel for schedule(dynamic)
+    for (int64_t i = 0; i < num_sources; ++i)
+    {
+        SourceFile& source = sources[i];
+        source.exists = false;
+        source.hash = 0;
+
+        if (!file_exists(source.path))
+            continue;
+
+        try
+        {
+            MappedFile file(source.path);
+            source.hash = hash64(file.get_data(), file.get_size());
+            source.exists = true;
+        }
+        catch (const IOError& e)
+        {
+            logger.log<WARNING>("could not hash ", source.path, ": ", e.what());
+        }
+    }
+}
+
+std::string format_sources(const std::vector<SourceFile>& sources)
+{
+    std::string str;
+    for (const SourceFile& source : sources)
+        str += (source.exists ? "file " + hash_to_string(source.hash) + " " : std::string("missing ")) + source.path + "\n";
+    return str;
+}
+
+struct Manifest
+{
+    std::string scene_file;
+    std::vector<SourceFile> sources;
+};
+
+bool read_manifest(const std::string& path, Manifest* manifest)
+{
+    std::ifstream file(path);
+    if (!file)
+        return false;
+
+    std::string line;
+    if (!std::getline(file, line) || line != manifest_header + std::string(" ") + std::to_string(compile_cache_version))
+        return false;
+
+    while (std::getline(file, line))
+    {
+        if (line.compare(0, 6, "scene ") == 0)
+        {
+            manifest->scene_file = line.substr(6);
+        }
+        else if (line.compare(0, 5, "file ") == 0 && line.size() > 22 && line[21] == ' ')
+        {
+            SourceFile source;
+            source.path = line.substr(22);
+            source.exists = true;
+            source.hash = std::strtoull(line.substr(5, 16).c_str(), nullptr, 16);
+            manifest->sources.push_back(source);
+        }
+        else if (line.compare(0, 8, "missing ") == 0)
+        {
+            manifest->sources.push_back(SourceFile{ line.substr(8), false, 0 });
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    // The scene file lies in the cache directory
+    return !manifest->scene_file.empty() && manifest->scene_file.find('/') == std::string::npos;
+}
+
+} // namespace
+
+std::string get_default_compile_cache_dir()
+{
+    const char* xdg_cache_home = std::getenv("XDG_CACHE_HOME");
+    if (xdg_cache_home != nullptr && xdg_cache_home[0] == '/')
+        return std::string(xdg_cache_home) + "/eclipse";
+
+    const char* home = std::getenv("HOME");
+    if (home != nullptr && home[0] != '\0')
+        return std::string(home) + "/.cache/eclipse";
+    return "";
+}
+
+std::unique_ptr<Scene> find_cached_scene(const std::string& cache_dir, const std::string& obj_path,
+                                         const CompileOptions& options)
+{
+    const std::string abs_obj_path = get_absolute_path(obj_path);
+    const std::string key = hash_to_string(hash64(describe_compile(abs_obj_path, options)));
+
+    Manifest manifest;
+    if (!read_manifest(cache_dir + "/" + key + ".deps", &manifest))
+        return nullptr;
+
+    StopWatch stop_watch;
+    stop_watch.start();
+
+    std::vector<SourceFile> sources = manifest.sources;
+    hash_sources(sources);
+    for (size_t i = 0; i < sources.size(); ++i)
+    {
+        if (!same_source(sources[i], manifest.sources[i]))
+        {
+            logger.log<INFO>(sources[i].path, " changed since ", abs_obj_path, " was cached; recompiling");
+            return nullptr;
+        }
+    }
+
+    stop_watch.stop();
+    logger.log<INFO>("hashed the ", sources.size(), " sources of ", abs_obj_path, " in ",
+                     stop_watch.get_elapsed_time_ms(), " ms; using the cached compile");
+
+    try
+    {
+        return read_scene_file(cache_dir + "/" + manifest.scene_file);
+    }
+    catch (const IOError& e)
+    {
+        logger.log<WARNING>("could not read the cached compile of ", abs_obj_path, ": ", e.what());
+        return nullptr;
+    }
+}
+
+std::unique_ptr<Scene> find_previous_compile(const std::string& cache_dir, const std::string& obj_path,
+                                             const CompileOptions& options, CompileRecord* record)
+{
+    const std::string abs_obj_path = get_absolute_path(obj_path);
+    const std::string key = hash_to_string(hash64(describe_compile(abs_obj_path, options)));
+
+    Manifest manifest;
+    if (!read_manifest(cache_dir + "/" + key + ".deps", &manifest))
+        return nullptr;
+
+    try
+    {
+        return read_scene_file(cache_dir + "/" + manifest.scene_file, false, record);
+    }
+    catch (const IOError& e)
+    {
+        logger.log<WARNING>("could not read the previous compile of ", abs_obj_path, ": ", e.what());
+        return nullptr;
+    }
+}
+
+void add_cached_scene(const std::string& cache_dir, const std::string& obj_path, const CompileOptions& options,
+                      const Scene& scene, const CompileRecord& record,
+                      const std::vector<SourceFile>& source_files)
+{
+    const std::string abs_obj_path = get_absolute_path(obj_path);
+    const std::string key = hash_to_string(hash64(describe_compile(abs_obj_path, options)));
+    const std::string manifest_path = cache_dir + "/" + key + ".deps";
+
+    // A file read more than once must have been read the same each time
+    std::vector<SourceFile> sources;
+    for (const SourceFile& source : source_files)
+        sources.push_back(SourceFile{ get_absolute_path(source.path), source.exists, source.hash });
+    std::sort(sources.begin(), sources.end(), [](const SourceFile& a, const SourceFile& b) {
+        return a.path < b.path;
+    });
+    for (size_t i = 1; i < sources.size(); ++i)
+    {
+        if (sources[i].path == sources[i - 1].path && !same_source(sources[i], sources[i - 1]))
+        {
+            logger.log<INFO>(sources[i].path, " changed while ", abs_obj_path, " was compiled; not caching it");
+            return;
+        }
+    }
+    sources.erase(std::unique(sources.begin(), sources.end(), [](const SourceFile& a, const SourceFile& b) {
+        return a.path == b.path;
+    }), sources.end());
+
+    std::vector<SourceFile> current = sources;
+    hash_sources(current);
+    for (size_t i = 0; i < sources.size(); ++i)
+    {
+        if (!same_source(current[i], sources[i]))
+        {
+            logger.log<INFO>(sources[i].path, " changed while ", abs_obj_path, " was compiled; not caching it");
+            return;
+        }
+    }
+
+    // The scene file is named after its sources, so a manifest never
+    // points to the compile of other sources
+    const std::string formatted_sources = format_sources(sources);
+    const std::string scene_file = key + "-" + hash_to_string(hash64(formatted_sources)) + ".bin";
+
+    try
+    {
+        Manifest previous;
+        const bool has_previous = read_manifest(manifest_path, &previous);
+
+        create_dirs(cache_dir);
+        write_scene_file(scene, cache_dir + "/" + scene_file, false, &record);
+        write_atomically(manifest_path, [&](const std::string& path) {
+            std::ofstream file(path);
+            file << manifest_header << " " << compile_cache_version << "\n"
+                 << "scene " << scene_file << "\n"
+                 << formatted_sources;
+            file.close();
+            if (!file)
+                throw IOError("could not write " + path);
+        });
+
+        if (has_previous && previous.scene_file != scene_file)
+            std::remove((cache_dir + "/" + previous.scene_file).c_str());
+
+        logger.log<INFO>("cached the compile of ", abs_obj_path, " and its ", sources.size(), " sources in ", cache_dir);
+    }
+    catch (const IOError& e)
+    {
+        logger.log<WARNING>("could not cache the compile of ", abs_obj_path, ": ", e.what());
+    }
+}
+
+} } // namespace eclipse::scene
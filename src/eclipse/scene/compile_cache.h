@@ -0,0 +1,54 @@
+#pragma once
+
+#include "eclipse/scene/raw_scene.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace eclipse { namespace scene {
+
+struct Scene;
+struct CompileOptions;
+struct CompileRecord;
+
+// Compiled OBJ scenes are kept in a cache directory so that reading an
+// unchanged scene skips loading and compiling it. An entry is keyed by the
+// absolute path of the OBJ and the compile options, and records the content
+// hash of every file the compile read: the OBJ, the OBJ and MTL files pulled
+// in through `call` and `mtllib`, and the textures, including missing ones.
+// It is reused only while all of them still hash the same.
+//
+// Each entry is a manifest, <key>.deps, naming an uncompressed .bin that is
+// memory mapped when read. Both are replaced atomically, so concurrent
+// readers and writers at worst recompile. The .bin also holds the
+// CompileRecord of the compile, from which a recompile after an edit reuses
+// what the edit did not touch.
+
+// Increase whenever the compiler output changes for the same input, to
+// invalidate existing entries
+constexpr uint32_t compile_cache_version = 5;
+
+// Per user cache directory: $XDG_CACHE_HOME/eclipse, or ~/.cache/eclipse
+// when that is not set; empty if neither variable is
+std::string get_default_compile_cache_dir();
+
+// Returns the cached compile of `obj_path` with `options`, or nullptr if
+// there is none or its sources changed
+std::unique_ptr<Scene> find_cached_scene(const std::string& cache_dir, const std::string& obj_path,
+                                         const CompileOptions& options);
+
+// Returns the cached compile of `obj_path` with `options` and its record
+// whether or not its sources changed, or nullptr if there is none
+std::unique_ptr<Scene> find_previous_compile(const std::string& cache_dir, const std::string& obj_path,
+                                             const CompileOptions& options, CompileRecord* record);
+
+// Stores a compiled scene and its record along with the files it was compiled
+// from, hashed as they were read. Nothing is stored if a file changed since,
+// as the scene may be compiled from its old content. Errors are logged rather
+// than thrown as the scene itself is fine.
+void add_cached_scene(const std::string& cache_dir, const std::string& obj_path, const CompileOptions& options,
+                      const Scene& scene, const CompileRecord& record,
+                      const std::vector<raw::SourceFile>& source_files);
+
+} } // namespace eclipse::scene
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "eclipse/scene/bvh_node.h"
+#include "eclipse/scene/raw_scene.h"
+#include "eclipse/util/array.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace eclipse { namespace scene {
+
+struct MeshRecord
+{
+    // Hash of the mesh geometry and of how its BVH was built
+    uint64_t fingerprint;
+
+    // Range in CompileRecord::bvh_nodes
+    uint32_t first_node;
+    uint32_t num_nodes;
+
+    // Range in CompileRecord::primitive_triangles
+    uint32_t first_primitive;
+    uint32_t num_primitives;
+};
+
+struct TextureRecord
+{
+    // Hash of the texture file content
+    uint64_t fingerprint;
+
+    // Index in the scene's texture_metadata and the number of bytes of
+    // texture_data it spans, padding included, or of texture_tile_data for
+    // paged textures
+    uint32_t metadata_index;
+    uint32_t size;
+};
+
+// What the expensive parts of a compiled scene were built from, so that a
+// compile of an edited scene can reuse the mesh BVHs and textures whose
+// sources did not change. Primitives are always regenerated from the raw
+// scene through the stored BVH leaf order, which also patches their material
+// indices. Written along with the scene in the compile cache; see
+// compile_cache.h.
+struct CompileRecord
+{
+    Array<MeshRecord> meshes;
+
+    // The mesh BVHs; child indices are relative to the first node of their
+    // mesh and leaves to its first primitive
+    Array<bvh::Node> bvh_nodes;
+
+    // Triangle of the raw mesh at each primitive of the compiled mesh
+    Array<uint32_t> primitive_triangles;
+
+    Array<TextureRecord> textures;
+
+    // The textures the scene references, including missing ones, hashed as
+    // they were decoded; not written with the record
+    std::vector<raw::SourceFile> texture_files;
+};
+
+} } // namespace eclipse::scene
@@ -2,6 +2,9 @@
 #include "eclipse/scene/scene.h"
 #include "eclipse/scene/raw_scene.h"
 #include "eclipse/scene/bvh_builder.h"
+#include "eclipse/scene/bvh_binned_builder.h"
+#include "eclipse/scene/bvh_linear_builder.h"
+#include "eclipse/scene/bvh_wide_builder.h"
 #include "eclipse/scene/mat_expr.h"
 #include "eclipse/scene/known_ior.h"
 #include "eclipse/util/except.h"
@@ -9,6 +12,11 @@
 #include "eclipse/util/logger.h"
 #include "eclipse/util/stop_watch.h"
 #include "eclipse/util/texture.h"
+#include "eclipse/util/file_util.h"
+#include "eclipse/util/mapped_file.h"
+#include "eclipse/util/hash.h"
+#include "eclipse/util/block_compression.h"
+#include "eclipse/util/texture_tiles.h"
 #include "eclipse/math/vec3.h"
 #include "eclipse/math/vec4.h"
 #include "eclipse/math/bbox.h"
@@ -18,7 +26,10 @@
 #include <vector>
 #include <algorithm>
 #include <iterator>
+#include <functional>
 #include <cstring>
+#include <exception>
+#include <set>
 
 namespace eclipse { namespace scene {
 
@@ -29,20 +40,68 @@ auto logger = Logger::create("compiler");
 void create_layered_material_tree();
 int32_t generate_material(raw::MaterialPtr material);
 int32_t generate_material_tree(raw::MaterialPtr material, material::ExprNodePtr expr_node);
-int32_t bake_texture(raw::MaterialPtr material, const std::string& texture);
+int32_t bake_texture(raw::MaterialPtr material, const std::string& texture, TextureRole role);
+void decode_textures();
 void partition_geometry();
 void setup_camera();
+void index_previous_compile();
+bool has_texture_levels();
+TextureRole get_texture_role(material::ParamType param);
+std::string get_texture_key(const std::string& path, TextureRole role);
+uint64_t fingerprint_mesh(const raw::Mesh& mesh, BvhBuilderType builder);
 
 std::shared_ptr<raw::Scene> g_raw_scene;
 std::unique_ptr<Scene> g_scene;
+CompileOptions g_options;
+
+// Where the compile is recorded, and the previous compile whose mesh BVHs
+// and textures can be reused
+CompileRecord* g_record;
+const Scene* g_previous;
+const CompileRecord* g_previous_record;
+
+// Fingerprints of the previous compile's meshes and textures mapped to the
+// index of their record
+std::map<uint64_t, uint32_t> g_previous_meshes;
+std::map<uint64_t, uint32_t> g_previous_textures;
 
 // A map of material indices to their layered material tree roots
 std::map<int32_t, int32_t> g_mat_index_to_mat_root;
 
-// A map of texture paths to their indices. This cache allows
+// A map of texture keys to their indices. This cache allows
 // us to reuse already loaded textures when referenced by multiple materials
 std::map<std::string, int32_t> g_texture_index_cache;
 
+const char* texture_role_names[] = { "albedo", "roughness", "normal", "radiance", "other" };
+
+// A texture file read ahead of baking: the hash of its content, its
+// fingerprint, its pixels and the levels of its mip chain below them, unless
+// it can be copied from the previous compile, or what went wrong. Textures
+// stored in another format or layout than they were decoded in keep their
+// pixels as stored in base and their levels are stored that way too.
+struct DecodedTexture
+{
+    uint64_t file_hash = 0;
+    uint64_t fingerprint = 0;
+    std::shared_ptr<Texture> texture;
+    std::vector<uint8_t> base;
+    std::vector<std::vector<uint8_t>> levels;
+    Texture::Format format = Texture::RGBA8;
+    TextureLayout layout = LinearTextureLayout;
+    std::exception_ptr error;
+};
+
+// A texture and what it is used for
+struct TextureUse
+{
+    std::shared_ptr<Resource> resource;
+    TextureRole role;
+};
+
+// Textures referenced by the materials, decoded in parallel before the
+// materials are processed and keyed by get_texture_key
+std::map<std::string, DecodedTexture> g_decoded_textures;
+
 // A map of material indices to an emissive layered material tree node.
 std::map<int32_t, int32_t> g_emissive_index_cache;
 
@@ -51,13 +110,76 @@ std::vector<std::string> g_mat_ref_list;
 
 } // anonymous namespace
 
-std::unique_ptr<Scene> compile(std::shared_ptr<raw::Scene> raw_scene)
+BvhBuilderType parse_bvh_builder_type(const std::string& name)
+{
+    if (name == "sah")
+        return SAHBuilder;
+    if (name == "binned")
+        return BinnedSAHBuilder;
+    if (name == "lbvh")
+        return LinearBVHBuilder;
+
+    throw Error("unknown BVH builder `" + name + "`; expected one of sah, binned, lbvh");
+}
+
+uint32_t parse_wide_bvh_width(const std::string& width)
+{
+    if (width == "4")
+        return 4;
+    if (width == "8")
+        return 8;
+
+    throw Error("unsupported wide BVH width `" + width + "`; expected 4 or 8");
+}
+
+MipFilter parse_mip_filter(const std::string& name)
+{
+    if (name == "box")
+        return BoxMipFilter;
+    if (name == "kaiser")
+        return KaiserMipFilter;
+
+    throw Error("unknown mip map filter `" + name + "`; expected box or kaiser");
+}
+
+TextureLayout parse_texture_layout(const std::string& name)
+{
+    if (name == "linear")
+        return LinearTextureLayout;
+    if (name == "tiled")
+        return TiledTextureLayout;
+    if (name == "morton")
+        return MortonTextureLayout;
+
+    throw Error("unknown texture layout `" + name + "`; expected linear, tiled or morton");
+}
+
+TextureRole parse_texture_role(const std::string& name)
+{
+    for (uint32_t role = AlbedoTexture; role < OtherTexture; ++role)
+    {
+        if (name == texture_role_names[role])
+            return TextureRole(role);
+    }
+
+    throw Error("unknown texture role `" + name + "`; expected albedo, roughness, normal, radiance or all");
+}
+
+std::unique_ptr<Scene> compile(std::shared_ptr<raw::Scene> raw_scene, const CompileOptions& options,
+                               CompileRecord* record, const Scene* previous, const CompileRecord* previous_record)
 {
     StopWatch stop_watch;
     stop_watch.start();
     logger.log<INFO>("compiling scene");
 
     g_raw_scene = raw_scene;
+    g_options = options;
+    g_record = record;
+    g_previous = previous_record ? previous : nullptr;
+    g_previous_record = previous ? previous_record : nullptr;
+    if (g_record)
+        *g_record = CompileRecord();
+    index_previous_compile();
     g_scene = std::make_unique<Scene>();
     g_scene->scene_diffuse_mat_index = -1;
     g_scene->scene_emissive_mat_index = -1;
@@ -66,8 +188,19 @@ std::unique_ptr<Scene> compile(std::shared_ptr<raw::Scene> raw_scene)
 
     partition_geometry();
 
+    if (g_options.oct_normals || g_options.half_uvs)
+    {
+        logger.log<INFO>("encoding vertex attributes");
+        g_scene->encode_vertex_attributes(g_options.oct_normals, g_options.half_uvs);
+    }
+
     setup_camera();
 
+    g_previous = nullptr;
+    g_previous_record = nullptr;
+    g_previous_meshes.clear();
+    g_previous_textures.clear();
+
     stop_watch.stop();
     logger.log<INFO>("compiled scene in ", stop_watch.get_elapsed_time_ms(), " ms");
 
@@ -84,14 +217,53 @@ public:
     Vec3 get_centroid(const raw::MeshInstancePtr ptr) const { return ptr->get_centroid(); }
 };
 
-class TriangleAccessor
+// Triangle of a raw mesh as partitioned by the BVH builders
+struct MeshTriangle
+{
+    const raw::Mesh* mesh;
+    uint32_t index;
+};
+
+class MeshTriangleAccessor
 {
 public:
-    TriangleAccessor(const std::vector<raw::Triangle>& items) { (void)items; }
-    BBox get_bbox(const raw::Triangle tri) const { return tri.get_bbox(); }
-    Vec3 get_centroid(const raw::Triangle tri) const { return tri.get_centroid(); }
+    MeshTriangleAccessor(const std::vector<MeshTriangle>& items) { (void)items; }
+    BBox get_bbox(const MeshTriangle tri) const { return tri.mesh->get_triangle_bbox(tri.index); }
+    Vec3 get_centroid(const MeshTriangle tri) const { return tri.mesh->get_triangle_centroid(tri.index); }
 };
 
+// Build a BVH over the given items using the given builder.
+template <typename Object, typename ObjectAccesor>
+std::vector<bvh::Node> build_bvh(BvhBuilderType builder, const std::vector<Object>& items, uint32_t min_leaf_size,
+        std::function<void(bvh::Node*, const std::vector<Object>&)> callback, uint32_t max_leaf_size = UINT32_MAX)
+{
+    if (builder == SAHBuilder)
+        return bvh::Builder<Object, ObjectAccesor, bvh::SAHStrategy<Object, ObjectAccesor>>::build(
+                items, min_leaf_size, callback, max_leaf_size);
+
+    if (builder == LinearBVHBuilder)
+        return bvh::LinearBuilder<Object, ObjectAccesor>::build(items, min_leaf_size, callback, max_leaf_size);
+
+    return bvh::BinnedBuilder<Object, ObjectAccesor>::build(items, min_leaf_size, callback, max_leaf_size);
+}
+
+// Collapse the scene BVH and the mesh BVHs into a single list of wide nodes.
+// The wide root of each mesh is returned in mesh_wide_roots.
+template <uint32_t Width>
+void build_wide_bvh(const std::vector<uint32_t>& mesh_bvh_roots,
+        Array<bvh::WideNode<Width>>* wide_nodes, std::vector<uint32_t>* mesh_wide_roots)
+{
+    // The scene BVH starts at index 0, followed by the mesh BVHs
+    std::vector<uint32_t> roots(1, 0);
+    roots.insert(roots.end(), mesh_bvh_roots.begin(), mesh_bvh_roots.end());
+
+    std::vector<uint32_t> wide_roots;
+    *wide_nodes = bvh::WideBuilder<Width>::build(g_scene->bvh_nodes, roots, &wide_roots);
+    mesh_wide_roots->assign(wide_roots.begin() + 1, wide_roots.end());
+
+    logger.log<INFO>("collapsed BVH into ", wide_nodes->size(), " ", Width, "-wide nodes");
+}
+
 // Generate a two-level BVH tree for the scene. The top level tree partitions
 // the mesh instances. The bottom level trees are for the different meshes.
 void partition_geometry()
@@ -119,91 +291,241 @@ void partition_geometry()
         }
     };
 
-    g_scene->bvh_nodes = bvh::Builder<raw::MeshInstancePtr, MeshInstancePtrAccessor,
-         bvh::SAHStrategy<raw::MeshInstancePtr, MeshInstancePtrAccessor>>::build(
-                 g_raw_scene->mesh_instances, 1, inst_leaf_cb);
+    g_scene->bvh_nodes = build_bvh<raw::MeshInstancePtr, MeshInstancePtrAccessor>(
+            g_options.bvh_builder, g_raw_scene->mesh_instances, 1, inst_leaf_cb, 1);
 
-    // Scan all meshes and calculate the size of material, vertex, normal
-    // and uv lists; the pre-allocate them.
+    // Scan all meshes and calculate the size of material, index, vertex,
+    // normal and uv lists; the pre-allocate them. Each mesh gets contiguous
+    // ranges of primitives and vertices so meshes can be processed concurrently.
+    const size_t num_meshes = g_raw_scene->meshes.size();
+    std::vector<uint32_t> mesh_tri_offsets(num_meshes);
+    std::vector<uint32_t> mesh_vertex_offsets(num_meshes);
+    size_t total_triangles = 0;
     size_t total_vertices = 0;
-    for (auto& mesh : g_raw_scene->meshes)
-        total_vertices += 3 * mesh->triangles.size();
+    for (size_t mesh_index = 0; mesh_index < num_meshes; ++mesh_index)
+    {
+        mesh_tri_offsets[mesh_index] = uint32_t(total_triangles);
+        mesh_vertex_offsets[mesh_index] = uint32_t(total_vertices);
+        total_triangles += g_raw_scene->meshes[mesh_index]->triangles.size();
+        total_vertices += g_raw_scene->meshes[mesh_index]->vertices.size();
+    }
 
     g_scene->vertices.resize(total_vertices);
     g_scene->normals.resize(total_vertices);
     g_scene->uvs.resize(total_vertices);
-    g_scene->material_indices.resize(total_vertices / 3);
-
-    // Partition each mesh into ist own BVH. Update all instances to point
-    // to this mesh BVH.
-    uint32_t vertex_offset = 0;
-    uint32_t tri_offset = 0;
-    std::vector<uint32_t> mesh_bvh_roots(g_raw_scene->meshes.size());
-    std::vector<EmissivePrimitive> mesh_emissive_primitives;
-    std::map<int32_t, uint32_t> emissive_index_to_mesh_index_map;
+    g_scene->indices.resize(3 * total_triangles);
+    g_scene->material_indices.resize(total_triangles);
+
+    // Flatten material lookups; std::map::operator[] is not safe to call
+    // from multiple threads.
+    std::vector<int32_t> mat_roots(g_raw_scene->materials.size(), 0);
+    std::vector<int32_t> emissive_nodes(g_raw_scene->materials.size(), -1);
+    for (auto& it : g_mat_index_to_mat_root)
+        mat_roots[it.first] = it.second;
+    for (auto& it : g_emissive_index_cache)
+        emissive_nodes[it.first] = it.second;
+
+    // Partition each mesh into its own BVH. Meshes are built concurrently,
+    // largest first; each one only writes to its own primitive range. BVHs
+    // of meshes whose geometry did not change since the previous compile
+    // are reused along with their leaf order.
+    std::vector<std::vector<bvh::Node>> mesh_bvh_nodes(num_meshes);
+    std::vector<std::vector<uint32_t>> mesh_primitive_triangles(num_meshes);
+    std::vector<uint64_t> mesh_fingerprints(num_meshes);
+    std::vector<std::vector<EmissivePrimitive>> mesh_emissives(num_meshes);
+    size_t num_reused_meshes = 0;
+
+    std::vector<size_t> build_order(num_meshes);
+    for (size_t mesh_index = 0; mesh_index < num_meshes; ++mesh_index)
+        build_order[mesh_index] = mesh_index;
+    std::stable_sort(build_order.begin(), build_order.end(), [&](size_t a, size_t b) {
+        return g_raw_scene->meshes[a]->triangles.size() > g_raw_scene->meshes[b]->triangles.size();
+    });
+
+#pragma omp parallel for schedule(dynamic)
+    for (int64_t mesh_index = 0; mesh_index < int64_t(num_meshes); ++mesh_index)
+    {
+        const raw::Mesh& mesh = *g_raw_scene->meshes[mesh_index];
+        mesh_fingerprints[mesh_index] = fingerprint_mesh(mesh, g_options.get_mesh_bvh_builder(mesh.name));
+    }
 
-    for (size_t mesh_index = 0; mesh_index < g_raw_scene->meshes.size(); ++mesh_index)
+#pragma omp parallel
+#pragma omp single
+    for (size_t mesh_index : build_order)
     {
         auto& mesh = g_raw_scene->meshes[mesh_index];
+        auto previous_iter = g_previous_meshes.find(mesh_fingerprints[mesh_index]);
+        const MeshRecord* previous = nullptr;
+        if (previous_iter != g_previous_meshes.end() &&
+            g_previous_record->meshes[previous_iter->second].num_primitives == mesh->triangles.size())
+        {
+            previous = &g_previous_record->meshes[previous_iter->second];
+            ++num_reused_meshes;
+        }
+        else
+        {
+            logger.log<INFO>("building BVH tree for ", mesh->name, " (", mesh->triangles.size(), " triangles)");
+        }
 
-        logger.log<INFO>("building BVH tree for ", mesh->name, " (", mesh->triangles.size(), " triangles)");
-
-        auto tri_leaf_cb = [&](bvh::Node* leaf, const std::vector<raw::Triangle>& triangles)
+#pragma omp task firstprivate(mesh_index, previous)
         {
-            leaf->set_primitives(tri_offset, uint32_t(triangles.size()));
+            auto& mesh = g_raw_scene->meshes[mesh_index];
+            auto& bvh_nodes = mesh_bvh_nodes[mesh_index];
+            auto& primitive_triangles = mesh_primitive_triangles[mesh_index];
+            auto& emissives = mesh_emissives[mesh_index];
+            const BvhBuilderType builder = g_options.get_mesh_bvh_builder(mesh->name);
+            const uint32_t first_primitive = mesh_tri_offsets[mesh_index];
+            const uint32_t vertex_offset = mesh_vertex_offsets[mesh_index];
+
+            if (previous)
+            {
+                const bvh::Node* nodes = g_previous_record->bvh_nodes.data() + previous->first_node;
+                bvh_nodes.assign(nodes, nodes + previous->num_nodes);
+                for (auto& node : bvh_nodes)
+                    node.offset_primitives(int32_t(first_primitive));
 
-            // Copy triangles to flat arrays
-            for (auto& tri : triangles)
+                const uint32_t* triangles = g_previous_record->primitive_triangles.data() + previous->first_primitive;
+                primitive_triangles.assign(triangles, triangles + previous->num_primitives);
+            }
+            else
             {
-                g_scene->vertices[vertex_offset + 0] = Vec4(tri.vertices[0], 0.0f);
-                g_scene->vertices[vertex_offset + 1] = Vec4(tri.vertices[1], 0.0f);
-                g_scene->vertices[vertex_offset + 2] = Vec4(tri.vertices[2], 0.0f);
+                // Leaves only record which triangles they hold; the primitives
+                // are filled in below
+                primitive_triangles.reserve(mesh->triangles.size());
+                auto tri_leaf_cb = [&](bvh::Node* leaf, const std::vector<MeshTriangle>& triangles)
+                {
+                    leaf->set_primitives(first_primitive + uint32_t(primitive_triangles.size()), uint32_t(triangles.size()));
+                    for (auto& mesh_tri : triangles)
+                        primitive_triangles.push_back(mesh_tri.index);
+                };
+
+                std::vector<MeshTriangle> mesh_triangles(mesh->triangles.size());
+                for (size_t i = 0; i < mesh_triangles.size(); ++i)
+                    mesh_triangles[i] = MeshTriangle{ mesh.get(), uint32_t(i) };
+
+                bvh_nodes = build_bvh<MeshTriangle, MeshTriangleAccessor>(
+                        builder, mesh_triangles, min_primitives_per_leaf, tri_leaf_cb);
+            }
 
-                g_scene->normals[vertex_offset + 0] = Vec4(tri.normals[0], 0.0f);
-                g_scene->normals[vertex_offset + 1] = Vec4(tri.normals[1], 0.0f);
-                g_scene->normals[vertex_offset + 2] = Vec4(tri.normals[2], 0.0f);
+            // Copy the vertices; the triangles index them in BVH leaf order
+            std::copy(mesh->vertices.begin(), mesh->vertices.end(), g_scene->vertices.data() + vertex_offset);
+            std::copy(mesh->normals.begin(), mesh->normals.end(), g_scene->normals.data() + vertex_offset);
+            std::copy(mesh->uvs.begin(), mesh->uvs.end(), g_scene->uvs.data() + vertex_offset);
 
-                g_scene->uvs[vertex_offset + 0] = tri.uvs[0];
-                g_scene->uvs[vertex_offset + 1] = tri.uvs[1];
-                g_scene->uvs[vertex_offset + 2] = tri.uvs[2];
+            // Copy triangles to flat arrays
+            for (size_t i = 0; i < primitive_triangles.size(); ++i)
+            {
+                const uint32_t primitive = first_primitive + uint32_t(i);
+                const raw::Triangle& tri = mesh->triangles[primitive_triangles[i]];
+                for (uint32_t j = 0; j < 3; ++j)
+                    g_scene->indices[3 * primitive + j] = vertex_offset + tri.indices[j];
 
                 // Lookup root material node for primitive material index
-                int32_t mat_node_index = g_mat_index_to_mat_root[tri.material_index];
-                g_scene->material_indices[tri_offset] = uint32_t(mat_node_index);
+                g_scene->material_indices[primitive] = uint32_t(mat_roots[tri.material_index]);
 
                 // Check if this is an emissive primitive and keep track of it
                 // Since we may use multiple instances of this mesh, we need a
                 // separate pass to generate a primitive for each mesh instance
-                int32_t emissive_node_index = g_emissive_index_cache[tri.material_index];
+                int32_t emissive_node_index = emissive_nodes[tri.material_index];
                 if (emissive_node_index != -1)
                 {
                     EmissivePrimitive eprim;
                     eprim.type = AreaLight;
-                    eprim.primitive_index = tri_offset;
+                    eprim.primitive_index = primitive;
                     eprim.material_index = uint32_t(emissive_node_index);
-                    eprim.area = 0.5f * length(cross(tri.vertices[2] - tri.vertices[0],
-                                                     tri.vertices[2] - tri.vertices[1]));
-
-                    mesh_emissive_primitives.push_back(eprim);
+                    const Vec3& v0 = mesh->vertices[tri.indices[0]];
+                    const Vec3& v1 = mesh->vertices[tri.indices[1]];
+                    const Vec3& v2 = mesh->vertices[tri.indices[2]];
+                    eprim.area = 0.5f * length(cross(v2 - v0, v2 - v1));
 
-                    emissive_index_to_mesh_index_map[mesh_emissive_primitives.size() - 1] = uint32_t(mesh_index);
+                    emissives.push_back(eprim);
                 }
+            }
+        }
+    }
 
-                vertex_offset += 3;
-                ++tri_offset;
+    if (g_previous_record)
+        logger.log<INFO>("reused the BVH trees of ", num_reused_meshes, " of ", num_meshes, " meshes");
+
+    // Record the mesh BVHs relative to their own nodes and primitives
+    if (g_record)
+    {
+        size_t num_record_nodes = 0;
+        for (size_t mesh_index = 0; mesh_index < num_meshes; ++mesh_index)
+            num_record_nodes += mesh_bvh_nodes[mesh_index].size();
+
+        g_record->meshes.resize(num_meshes);
+        g_record->bvh_nodes.resize_uninitialized(num_record_nodes);
+        g_record->primitive_triangles.resize_uninitialized(total_triangles);
+
+        uint32_t first_node = 0;
+        for (size_t mesh_index = 0; mesh_index < num_meshes; ++mesh_index)
+        {
+            const auto& bvh_nodes = mesh_bvh_nodes[mesh_index];
+            const auto& primitive_triangles = mesh_primitive_triangles[mesh_index];
+            const uint32_t first_primitive = mesh_tri_offsets[mesh_index];
+
+            MeshRecord& mesh_record = g_record->meshes[mesh_index];
+            mesh_record.fingerprint = mesh_fingerprints[mesh_index];
+            mesh_record.first_node = first_node;
+            mesh_record.num_nodes = uint32_t(bvh_nodes.size());
+            mesh_record.first_primitive = first_primitive;
+            mesh_record.num_primitives = uint32_t(primitive_triangles.size());
+
+            for (size_t i = 0; i < bvh_nodes.size(); ++i)
+            {
+                bvh::Node node = bvh_nodes[i];
+                node.offset_primitives(-int32_t(first_primitive));
+                g_record->bvh_nodes[first_node + i] = node;
             }
-        };
+            std::copy(primitive_triangles.begin(), primitive_triangles.end(),
+                      g_record->primitive_triangles.data() + first_primitive);
+            first_node += mesh_record.num_nodes;
+        }
+    }
 
-        auto bvh_nodes = bvh::Builder<raw::Triangle, TriangleAccessor,
-             bvh::SAHStrategy<raw::Triangle, TriangleAccessor>>::build(
-                mesh->triangles, min_primitives_per_leaf, tri_leaf_cb);
+    // Assign each mesh BVH its node range and relocate the child indices.
+    // Update all instances to point to their mesh BVH.
+    std::vector<uint32_t> mesh_bvh_roots(num_meshes);
+    size_t total_nodes = g_scene->bvh_nodes.size();
+    for (size_t mesh_index = 0; mesh_index < num_meshes; ++mesh_index)
+    {
+        mesh_bvh_roots[mesh_index] = uint32_t(total_nodes);
+        total_nodes += mesh_bvh_nodes[mesh_index].size();
+    }
 
-        int32_t offset = (int32_t)g_scene->bvh_nodes.size();
-        mesh_bvh_roots[mesh_index] = uint32_t(offset);
+    g_scene->bvh_nodes.resize(total_nodes);
+
+#pragma omp parallel for schedule(dynamic)
+    for (size_t mesh_index = 0; mesh_index < num_meshes; ++mesh_index)
+    {
+        const int32_t offset = int32_t(mesh_bvh_roots[mesh_index]);
+        auto& bvh_nodes = mesh_bvh_nodes[mesh_index];
         for (size_t i = 0; i < bvh_nodes.size(); ++i)
+        {
             bvh_nodes[i].offset_child_nodes(offset);
+            g_scene->bvh_nodes[offset + i] = bvh_nodes[i];
+        }
+        std::vector<bvh::Node>().swap(bvh_nodes);
+    }
+
+    // Collapse the binary trees into a wide BVH
+    std::vector<uint32_t> mesh_wide_bvh_roots(num_meshes, 0);
+    if (g_options.wide_bvh_width == 4)
+        build_wide_bvh<4>(mesh_bvh_roots, &g_scene->bvh4_nodes, &mesh_wide_bvh_roots);
+    else if (g_options.wide_bvh_width == 8)
+        build_wide_bvh<8>(mesh_bvh_roots, &g_scene->bvh8_nodes, &mesh_wide_bvh_roots);
 
-        g_scene->bvh_nodes.insert(g_scene->bvh_nodes.end(), bvh_nodes.begin(), bvh_nodes.end());
+    // Gather the emissive primitives in mesh order
+    std::vector<EmissivePrimitive> mesh_emissive_primitives;
+    std::map<int32_t, uint32_t> emissive_index_to_mesh_index_map;
+    for (size_t mesh_index = 0; mesh_index < num_meshes; ++mesh_index)
+    {
+        for (auto& eprim : mesh_emissives[mesh_index])
+        {
+            mesh_emissive_primitives.push_back(eprim);
+            emissive_index_to_mesh_index_map[mesh_emissive_primitives.size() - 1] = uint32_t(mesh_index);
+        }
     }
 
     // Process each mesh instance
@@ -215,10 +537,20 @@ void partition_geometry()
         MeshInstance* mesh_inst = &g_scene->mesh_instances[i];
         mesh_inst->mesh_index = raw_mesh_inst->mesh_index;
         mesh_inst->bvh_root = mesh_bvh_roots[raw_mesh_inst->mesh_index];
+        mesh_inst->wide_bvh_root = mesh_wide_bvh_roots[raw_mesh_inst->mesh_index];
+        mesh_inst->padding = 0;
         // We need to invert the transformation matrix when performing ray traversal
         mesh_inst->transform = raw_mesh_inst->transform.inv;
     }
 
+    // Only keep the wide BVH if requested
+    if (g_options.wide_bvh_width != 0 && !g_options.keep_binary_bvh)
+    {
+        g_scene->bvh_nodes.clear();
+        for (auto& mesh_inst : g_scene->mesh_instances)
+            mesh_inst.bvh_root = 0;
+    }
+
     logger.log<INFO>("creating emissive primitive copies for mesh instances");
 
     // For each unique emissive primitive for the scene's meshes we need to
@@ -259,6 +591,90 @@ void partition_geometry()
     logger.log<INFO>("partioned geometry in ", stop_watch.get_elapsed_time_ms(), " ms");
 }
 
+// Hash of what the BVH of a mesh is built from: its triangles and the builder
+uint64_t fingerprint_mesh(const raw::Mesh& mesh, BvhBuilderType builder)
+{
+    const uint32_t settings[] = { uint32_t(builder), min_primitives_per_leaf };
+    uint64_t hash = hash64(settings, sizeof(settings));
+    hash = hash64(mesh.vertices.data(), mesh.vertices.size() * sizeof(Vec3), hash);
+
+    // Materials do not affect the BVH
+    std::vector<uint32_t> corners(3 * mesh.triangles.size());
+    for (size_t i = 0; i < mesh.triangles.size(); ++i)
+        std::copy(mesh.triangles[i].indices, mesh.triangles[i].indices + 3, corners.data() + 3 * i);
+    return hash64(corners.data(), corners.size() * sizeof(uint32_t), hash);
+}
+
+// Textures get TextureLevels when there is a mip chain or a layout to
+// record, and always when paged
+bool has_texture_levels()
+{
+    return g_options.mip_maps || g_options.texture_layout != LinearTextureLayout || g_options.paged_textures;
+}
+
+TextureRole get_texture_role(material::ParamType param)
+{
+    switch (param)
+    {
+        case material::REFLECTANCE:
+        case material::SPECULARITY:
+        case material::TRANSMITTANCE:
+            return AlbedoTexture;
+        case material::ROUGHNESS:
+            return RoughnessTexture;
+        case material::RADIANCE:
+            return RadianceTexture;
+        default:
+            return OtherTexture;
+    }
+}
+
+// Textures are baked once per file, and once per role for the roles they
+// are compressed in
+std::string get_texture_key(const std::string& path, TextureRole role)
+{
+    if (g_options.compressed_textures.count(role) == 0)
+        return path;
+    return path + "#" + texture_role_names[role];
+}
+
+// Map the fingerprints of the previous compile to their records, skipping
+// records that do not fit the data they point to
+void index_previous_compile()
+{
+    g_previous_meshes.clear();
+    g_previous_textures.clear();
+    if (!g_previous_record)
+        return;
+
+    const CompileRecord& record = *g_previous_record;
+    for (uint32_t i = 0; i < record.meshes.size(); ++i)
+    {
+        const MeshRecord& mesh = record.meshes[i];
+        if (uint64_t(mesh.first_node) + mesh.num_nodes <= record.bvh_nodes.size() &&
+            uint64_t(mesh.first_primitive) + mesh.num_primitives <= record.primitive_triangles.size())
+            g_previous_meshes.emplace(mesh.fingerprint, i);
+    }
+
+    for (uint32_t i = 0; i < record.textures.size(); ++i)
+    {
+        const TextureRecord& texture = record.textures[i];
+        if (g_options.paged_textures)
+        {
+            if (texture.metadata_index < g_previous->texture_tiles.size() &&
+                texture.metadata_index < g_previous->texture_levels.size() &&
+                g_previous->texture_tiles[texture.metadata_index].offsets[0] + texture.size <=
+                    g_previous->texture_tile_data.size())
+                g_previous_textures.emplace(texture.fingerprint, i);
+        }
+        else if (texture.metadata_index < g_previous->texture_metadata.size() &&
+            uint64_t(g_previous->texture_metadata[texture.metadata_index].offset) + texture.size <=
+                g_previous->texture_data.size() &&
+            (!has_texture_levels() || texture.metadata_index < g_previous->texture_levels.size()))
+            g_previous_textures.emplace(texture.fingerprint, i);
+    }
+}
+
 void setup_camera()
 {
     g_scene->camera.fov = g_raw_scene->camera.fov;
@@ -305,6 +721,8 @@ void create_layered_material_tree()
     g_texture_index_cache.clear();
     g_emissive_index_cache.clear();
 
+    decode_textures();
+
     for (size_t mat_index = 0; mat_index < g_raw_scene->materials.size(); ++mat_index)
     {
         raw::MaterialPtr mat = g_raw_scene->materials[mat_index];
@@ -349,10 +767,286 @@ void create_layered_material_tree()
             g_scene->scene_emissive_mat_index = g_mat_index_to_mat_root[mat_index];
     }
 
+    g_decoded_textures.clear();
+
     stop_watch.stop();
     logger.log<INFO>("processsed ", g_raw_scene->materials.size(), " materials in ", stop_watch.get_elapsed_time_ms(), " ms");
 }
 
+// Collect the textures referenced from a material expression, following
+// material references; materials that do not parse are left to report their
+// errors when they are processed
+void collect_textures(raw::MaterialPtr material, material::ExprNodePtr expr_node, std::set<std::string>& visited,
+                      std::vector<TextureUse>& textures)
+{
+    auto add_texture = [&](const std::string& tex_name, TextureRole role)
+    {
+        try
+        {
+            auto res = std::make_shared<Resource>(tex_name, material->resource);
+            if (g_decoded_textures.emplace(get_texture_key(res->get_path(), role), DecodedTexture()).second)
+                textures.push_back(TextureUse{ res, role });
+        }
+        catch (ResourceError&)
+        {
+        }
+    };
+
+    if (auto mat_ref_node = std::dynamic_pointer_cast<material::NMatRef>(expr_node))
+    {
+        if (!visited.insert(mat_ref_node->name).second)
+            return;
+
+        for (auto& mat : g_raw_scene->materials)
+        {
+            if (mat->name == mat_ref_node->name)
+            {
+                material::ExprNodePtr mat_expr_node;
+                try
+                {
+                    mat_expr_node = material::parse_expr(mat->expression);
+                }
+                catch (Error&)
+                {
+                }
+                if (mat_expr_node)
+                    collect_textures(mat, mat_expr_node, visited, textures);
+                return;
+            }
+        }
+    }
+    else if (auto bxdf_node = std::dynamic_pointer_cast<material::NBxdf>(expr_node))
+    {
+        for (auto& param : bxdf_node->parameters)
+        {
+            if (param.value.type == material::TEXTURE)
+                add_texture(param.value.name, get_texture_role(param.type));
+        }
+    }
+    else if (auto mix_node = std::dynamic_pointer_cast<material::NMix>(expr_node))
+    {
+        collect_textures(material, mix_node->expressions[0], visited, textures);
+        collect_textures(material, mix_node->expressions[1], visited, textures);
+    }
+    else if (auto mix_map_node = std::dynamic_pointer_cast<material::NMixMap>(expr_node))
+    {
+        collect_textures(material, mix_map_node->expressions[0], visited, textures);
+        collect_textures(material, mix_map_node->expressions[1], visited, textures);
+        add_texture(mix_map_node->texture, OtherTexture);
+    }
+    else if (auto bump_map_node = std::dynamic_pointer_cast<material::NBumpMap>(expr_node))
+    {
+        collect_textures(material, bump_map_node->expression, visited, textures);
+        add_texture(bump_map_node->texture, OtherTexture);
+    }
+    else if (auto normal_map_node = std::dynamic_pointer_cast<material::NNormalMap>(expr_node))
+    {
+        collect_textures(material, normal_map_node->expression, visited, textures);
+        add_texture(normal_map_node->texture, NormalMapTexture);
+    }
+    else if (auto disperse_node = std::dynamic_pointer_cast<material::NDisperse>(expr_node))
+    {
+        collect_textures(material, disperse_node->expression, visited, textures);
+    }
+}
+
+// Levels 1 and below of the mip chain of a texture, each filtered from the
+// one above it
+std::vector<std::vector<uint8_t>> generate_mip_chain(const Texture& texture)
+{
+    std::vector<std::vector<uint8_t>> levels;
+
+    const Texture::Format format = texture.get_format();
+    const uint32_t width = texture.get_width();
+    const uint32_t height = texture.get_height();
+    const uint32_t texel_size = get_texel_size(format);
+
+    const uint32_t num_levels = min(get_num_mip_levels(width, height), max_texture_levels);
+    for (uint32_t level = 1; level < num_levels; ++level)
+    {
+        const uint8_t* src = level == 1 ? texture.get_data() : levels.back().data();
+        std::vector<uint8_t> dst(size_t(get_mip_size(width, level)) * get_mip_size(height, level) * texel_size);
+        downsample(g_options.mip_filter, format, src, get_mip_size(width, level - 1), get_mip_size(height, level - 1),
+                   dst.data());
+        levels.push_back(std::move(dst));
+    }
+    return levels;
+}
+
+// Reorders the pixels and mip chain of a decoded texture into the layout of
+// the compile options
+void swizzle_texture(DecodedTexture& decoded)
+{
+    const Texture& texture = *decoded.texture;
+    const uint32_t width = texture.get_width();
+    const uint32_t height = texture.get_height();
+    const uint32_t texel_size = get_texel_size(texture.get_format());
+
+    decoded.layout = g_options.texture_layout;
+
+    auto swizzle = [&](const uint8_t* src, uint32_t level)
+    {
+        const uint32_t level_width = get_mip_size(width, level);
+        const uint32_t level_height = get_mip_size(height, level);
+        const TextureLayout layout = get_level_layout(decoded.layout, level_width, level_height);
+        std::vector<uint8_t> dst(get_layout_texels(layout, level_width, level_height) * texel_size);
+        swizzle_texels(layout, texel_size, src, level_width, level_height, dst.data());
+        return dst;
+    };
+
+    decoded.base = swizzle(texture.get_data(), 0);
+    for (size_t level = 0; level < decoded.levels.size(); ++level)
+        decoded.levels[level] = swizzle(decoded.levels[level].data(), uint32_t(level + 1));
+}
+
+// Block compresses the pixels and mip chain of a decoded texture in the
+// format of its role, if its texels can be
+void compress_texture(DecodedTexture& decoded, TextureRole role)
+{
+    const Texture& texture = *decoded.texture;
+    const Texture::Format src_format = texture.get_format();
+    const bool is_float = src_format == Texture::LUMINANCE32F || src_format == Texture::RGBA32F;
+
+    Texture::Format format;
+    switch (role)
+    {
+        case AlbedoTexture:
+            format = Texture::BC1;
+            break;
+        case RoughnessTexture:
+            format = Texture::BC4;
+            break;
+        case NormalMapTexture:
+            format = Texture::BC5;
+            break;
+        case RadianceTexture:
+            // BC6H is only encoded in its single region mode, which is off
+            // by a quarter on blocks of two colors; too much for emission
+            if (is_float)
+                return;
+            format = Texture::BC1;
+            break;
+        default:
+            return;
+    }
+
+    const uint32_t width = texture.get_width();
+    const uint32_t height = texture.get_height();
+    if (!can_compress(format, src_format))
+        return;
+
+    auto compress = [&](const uint8_t* src, uint32_t level)
+    {
+        const uint32_t level_width = get_mip_size(width, level);
+        const uint32_t level_height = get_mip_size(height, level);
+        std::vector<uint8_t> dst(get_compressed_size(format, level_width, level_height));
+        compress_texels(format, src_format, src, level_width, level_height, dst.data());
+        return dst;
+    };
+
+    decoded.format = format;
+    decoded.base = compress(texture.get_data(), 0);
+    for (size_t level = 0; level < decoded.levels.size(); ++level)
+        decoded.levels[level] = compress(decoded.levels[level].data(), uint32_t(level + 1));
+}
+
+// Textures are identified by their file content, so one that did not change
+// since the previous compile is copied instead of decoded. The extension
+// picks the decoder and goes in too, as does the role of compressed ones.
+// Errors are kept to be thrown when the texture is baked.
+DecodedTexture decode_texture(std::shared_ptr<Resource> res, TextureRole role)
+{
+    DecodedTexture decoded;
+    try
+    {
+        const bool compressed = g_options.compressed_textures.count(role) != 0;
+        if (g_record || g_previous_record)
+        {
+            const std::string& path = res->get_path();
+            MappedFile file(path);
+            uint64_t seed = hash64(path.substr(remove_extension(path).size()));
+            if (compressed)
+                seed = hash64(std::string(texture_role_names[role]), seed);
+            decoded.file_hash = hash64(file.get_data(), file.get_size());
+            decoded.fingerprint = hash64(&decoded.file_hash, sizeof(decoded.file_hash), seed);
+        }
+
+        if (g_previous_record && g_previous_textures.find(decoded.fingerprint) != g_previous_textures.end())
+            return decoded;
+
+        decoded.texture = std::make_shared<Texture>(res);
+        decoded.format = decoded.texture->get_format();
+
+        // Mip maps, layouts and compression address the pixels by the
+        // dimensions of the texture
+        const Texture& texture = *decoded.texture;
+        if (uint64_t(texture.get_width()) * texture.get_height() * get_texel_size(decoded.format) != texture.get_size())
+        {
+            throw TextureError("texture: " + res->get_path() + " holds " + std::to_string(texture.get_size()) +
+                               " bytes of pixels, which does not match its dimensions");
+        }
+        if (g_options.mip_maps)
+            decoded.levels = generate_mip_chain(*decoded.texture);
+        if (compressed)
+            compress_texture(decoded, role);
+        if (g_options.texture_layout != LinearTextureLayout && !is_block_compressed(decoded.format) &&
+            !g_options.paged_textures)
+            swizzle_texture(decoded);
+    }
+    catch (...)
+    {
+        decoded.error = std::current_exception();
+    }
+    return decoded;
+}
+
+// Decode the textures of all used materials ahead of processing them, so that
+// decoding runs in parallel; baking them in material order keeps their
+// indices and offsets the same as when decoding them one by one
+void decode_textures()
+{
+    StopWatch stop_watch;
+    stop_watch.start();
+
+    g_decoded_textures.clear();
+
+    std::set<std::string> visited;
+    std::vector<TextureUse> textures;
+    for (auto& mat : g_raw_scene->materials)
+    {
+        if (!mat->used)
+            continue;
+
+        visited.insert(mat->name);
+        material::ExprNodePtr expr_node;
+        try
+        {
+            expr_node = material::parse_expr(mat->expression);
+        }
+        catch (Error&)
+        {
+        }
+        if (expr_node)
+            collect_textures(mat, expr_node, visited, textures);
+    }
+
+    if (textures.empty())
+        return;
+
+    const int64_t num_textures = int64_t(textures.size());
+    std::vector<DecodedTexture> decoded(num_textures);
+
+#pragma omp parallel for schedule(dynamic)
+    for (int64_t i = 0; i < num_textures; ++i)
+        decoded[i] = decode_texture(textures[i].resource, textures[i].role);
+
+    for (int64_t i = 0; i < num_textures; ++i)
+        g_decoded_textures[get_texture_key(textures[i].resource->get_path(), textures[i].role)] = std::move(decoded[i]);
+
+    stop_watch.stop();
+    logger.log<INFO>("decoded ", num_textures, " textures in ", stop_watch.get_elapsed_time_ms(), " ms");
+}
+
 // Compile material expression and generate a layered material tree from it.
 // This method returns back the root material tree node index.
 int32_t generate_material(raw::MaterialPtr material)
@@ -449,13 +1143,13 @@ int32_t generate_material_tree(raw::MaterialPtr material, material::ExprNodePtr
                     if (param.value.type == material::VECTOR)
                         node.set_vec3(param.type, param.value.vec);
                     else
-                        node.set_texture(param.type, bake_texture(material, param.value.name));
+                        node.set_texture(param.type, bake_texture(material, param.value.name, get_texture_role(param.type)));
                     break;
                 case material::TRANSMITTANCE:
                     if (param.value.type == material::VECTOR)
                         node.set_vec3(param.type, param.value.vec);
                     else
-                        node.set_texture(param.type, bake_texture(material, param.value.name));
+                        node.set_texture(param.type, bake_texture(material, param.value.name, get_texture_role(param.type)));
                     break;
                 case material::INT_IOR:
                 case material::EXT_IOR: {
@@ -479,7 +1173,7 @@ int32_t generate_material_tree(raw::MaterialPtr material, material::ExprNodePtr
                     if (param.value.type == material::NUM)
                         node.set_float(param.type, param.value.vec[0]);
                     else if (param.value.type == material::TEXTURE)
-                        node.set_texture(param.type, bake_texture(material, param.value.name));
+                        node.set_texture(param.type, bake_texture(material, param.value.name, get_texture_role(param.type)));
                     break;
 
                 default:
@@ -499,19 +1193,19 @@ int32_t generate_material_tree(raw::MaterialPtr material, material::ExprNodePtr
         node.set_type(material::OP_MIXMAP);
         node.set_left_child(generate_material_tree(material, mix_map_node->expressions[0]));
         node.set_right_child(generate_material_tree(material, mix_map_node->expressions[1]));
-        node.set_texture(material::PARAM_NONE, bake_texture(material, mix_map_node->texture));
+        node.set_texture(material::PARAM_NONE, bake_texture(material, mix_map_node->texture, OtherTexture));
     }
     else if (auto bump_map_node = std::dynamic_pointer_cast<material::NBumpMap>(expr_node))
     {
         node.set_type(material::OP_BUMPMAP);
         node.set_left_child(generate_material_tree(material, bump_map_node->expression));
-        node.set_texture(material::PARAM_NONE, bake_texture(material, bump_map_node->texture));
+        node.set_texture(material::PARAM_NONE, bake_texture(material, bump_map_node->texture, OtherTexture));
     }
     else if (auto normal_map_node = std::dynamic_pointer_cast<material::NNormalMap>(expr_node))
     {
         node.set_type(material::OP_NORMALMAP);
         node.set_left_child(generate_material_tree(material, normal_map_node->expression));
-        node.set_texture(material::PARAM_NONE, bake_texture(material, normal_map_node->texture));
+        node.set_texture(material::PARAM_NONE, bake_texture(material, normal_map_node->texture, NormalMapTexture));
     }
     else if (auto disperse_node = std::dynamic_pointer_cast<material::NDisperse>(expr_node))
     {
@@ -532,7 +1226,7 @@ int32_t generate_material_tree(raw::MaterialPtr material, material::ExprNodePtr
 
 // Load a texture resource and store its data into the scene.
 // Texture data is always aligned on a dword boundary.
-int32_t bake_texture(raw::MaterialPtr material, const std::string& tex_name)
+int32_t bake_texture(raw::MaterialPtr material, const std::string& tex_name, TextureRole role)
 {
     std::shared_ptr<Resource> res;
     try
@@ -542,53 +1236,182 @@ int32_t bake_texture(raw::MaterialPtr material, const std::string& tex_name)
     catch (ResourceError& e)
     {
         logger.log<WARNING>(material->name, ": skipping missing texture ", tex_name);
+        if (g_record)
+        {
+            const std::string path = material->resource ? concat_paths(material->resource->get_path(), tex_name) : tex_name;
+            g_record->texture_files.push_back(raw::SourceFile{ path, false, 0 });
+        }
         return -1;
     }
 
     // Check if the texture is already loaded
-    auto cache_iter = g_texture_index_cache.find(res->get_path());
+    const std::string key = get_texture_key(res->get_path(), role);
+    auto cache_iter = g_texture_index_cache.find(key);
     if (cache_iter != g_texture_index_cache.end())
     {
         logger.log<INFO>(material->name, ": reusing already loaded texture ", res->get_path());
         return cache_iter->second;
     }
 
-    logger.log<INFO>(material->name, ": processing texture ", res->get_path());
-
-    std::shared_ptr<Texture> texture;
-    try
+    // Textures missed by decode_textures are decoded here
+    DecodedTexture decoded;
+    auto decoded_iter = g_decoded_textures.find(key);
+    if (decoded_iter != g_decoded_textures.end())
+    {
+        decoded = std::move(decoded_iter->second);
+        g_decoded_textures.erase(decoded_iter);
+    }
+    else
     {
-        texture = std::make_shared<Texture>(res);
+        decoded = decode_texture(res, role);
     }
-    catch (TextureError& e)
+
+    if (decoded.error)
     {
-        throw TextureError(material->name + e.what());
+        try
+        {
+            std::rethrow_exception(decoded.error);
+        }
+        catch (TextureError& e)
+        {
+            throw TextureError(material->name + e.what());
+        }
     }
 
+    if (g_record)
+        g_record->texture_files.push_back(raw::SourceFile{ res->get_path(), true, decoded.file_hash });
+
+    if (decoded.texture && role == RadianceTexture && g_options.compressed_textures.count(role) &&
+        (decoded.format == Texture::LUMINANCE32F || decoded.format == Texture::RGBA32F))
+        logger.log<WARNING>(material->name, ": keeping HDR radiance texture ", res->get_path(), " uncompressed");
+
+    const uint64_t fingerprint = decoded.fingerprint;
+    TextureMetadata metadata;
+    TextureLevels levels = {};
+    TextureTiles tiles = {};
     uint32_t offset = g_scene->texture_data.size();
-    uint32_t real_size = texture->get_size();
-    uint32_t aligned_size = (real_size % 4 == 0) ? real_size : real_size + 1;
+    uint64_t aligned_size;
 
-    // Copy data and add alignement padding
-    uint8_t* data = texture->get_data();
-    g_scene->texture_data.reserve(g_scene->texture_data.size() + aligned_size);
-    std::copy(&data[0], &data[real_size], std::back_inserter(g_scene->texture_data));
-    while (aligned_size > real_size)
+    if (!decoded.texture)
     {
-        g_scene->texture_data.push_back(0);
-        ++real_size;
+        logger.log<INFO>(material->name, ": reusing texture ", res->get_path(), " from the previous compile");
+
+        const TextureRecord& previous = g_previous_record->textures[g_previous_textures.at(fingerprint)];
+        metadata = g_previous->texture_metadata[previous.metadata_index];
+        aligned_size = previous.size;
+
+        if (g_options.paged_textures)
+        {
+            // The tiles of all levels follow each other from the first one
+            tiles = g_previous->texture_tiles[previous.metadata_index];
+            const uint64_t tile_offset = g_scene->texture_tile_data.size();
+            const uint8_t* data = g_previous->texture_tile_data.data() + tiles.offsets[0];
+            g_scene->texture_tile_data.resize(tile_offset + aligned_size);
+            std::copy(data, data + aligned_size, g_scene->texture_tile_data.data() + tile_offset);
+
+            levels = g_previous->texture_levels[previous.metadata_index];
+            const uint64_t previous_offset = tiles.offsets[0];
+            for (uint32_t level = 0; level < levels.num_levels; ++level)
+                tiles.offsets[level] = tiles.offsets[level] - previous_offset + tile_offset;
+        }
+        else
+        {
+            const uint8_t* data = g_previous->texture_data.data() + metadata.offset;
+            g_scene->texture_data.resize(offset + aligned_size);
+            std::copy(data, data + aligned_size, g_scene->texture_data.data() + offset);
+
+            // The mip chain moves along with the texture
+            if (has_texture_levels())
+            {
+                levels = g_previous->texture_levels[previous.metadata_index];
+                for (uint32_t level = 0; level < levels.num_levels; ++level)
+                    levels.offsets[level] = levels.offsets[level] - metadata.offset + offset;
+            }
+        }
     }
+    else
+    {
+        logger.log<INFO>(material->name, ": processing texture ", res->get_path());
 
-    TextureMetadata metadata;
-    metadata.format = texture->get_format();
-    metadata.width = texture->get_width();
-    metadata.height = texture->get_height();
-    metadata.offset = offset;
+        const std::shared_ptr<Texture>& texture = decoded.texture;
+        metadata.format = decoded.format;
+        metadata.width = texture->get_width();
+        metadata.height = texture->get_height();
+
+        // Copy each level and pad it to a dword boundary
+        auto append_level = [&](const uint8_t* data, uint32_t size)
+        {
+            const uint32_t level_offset = g_scene->texture_data.size();
+            g_scene->texture_data.resize(level_offset + ((size + 3) & ~3u));
+            std::copy(data, data + size, g_scene->texture_data.data() + level_offset);
+            return level_offset;
+        };
+
+        // Or cut it into tiles
+        auto append_tiles = [&](const uint8_t* data, uint32_t level)
+        {
+            const uint32_t level_width = get_mip_size(metadata.width, level);
+            const uint32_t level_height = get_mip_size(metadata.height, level);
+            const uint32_t tiles_x = get_num_texture_tiles(level_width);
+            const uint32_t tiles_y = get_num_texture_tiles(level_height);
+
+            const uint64_t level_offset = g_scene->texture_tile_data.size();
+            g_scene->texture_tile_data.resize(level_offset + uint64_t(tiles_x) * tiles_y * tiles.tile_size);
+            uint8_t* dst = g_scene->texture_tile_data.data() + level_offset;
+            for (uint32_t y = 0; y < tiles_y; ++y)
+            {
+                for (uint32_t x = 0; x < tiles_x; ++x)
+                    copy_texture_tile(decoded.format, data, level_width, level_height, x, y,
+                                      dst + (uint64_t(y) * tiles_x + x) * tiles.tile_size);
+            }
+            return level_offset;
+        };
 
+        const uint8_t* base = decoded.base.empty() ? texture->get_data() : decoded.base.data();
+        levels.num_levels = 1 + uint32_t(decoded.levels.size());
+        levels.layout = decoded.layout;
+
+        if (g_options.paged_textures)
+        {
+            const size_t base_size = decoded.base.empty() ? texture->get_size() : decoded.base.size();
+            const uint32_t texel_size = get_texel_size(decoded.format);
+            const size_t expected_size = texel_size == 0 ?
+                get_compressed_size(decoded.format, metadata.width, metadata.height) :
+                size_t(metadata.width) * metadata.height * texel_size;
+            if (base_size != expected_size)
+                throw TextureError(material->name + ": texture " + res->get_path() + " cannot be cut into tiles");
+
+            tiles.tile_size = get_texture_tile_size(decoded.format);
+            const uint64_t tile_offset = g_scene->texture_tile_data.size();
+            tiles.offsets[0] = append_tiles(base, 0);
+            for (size_t level = 0; level < decoded.levels.size(); ++level)
+                tiles.offsets[level + 1] = append_tiles(decoded.levels[level].data(), uint32_t(level + 1));
+            aligned_size = g_scene->texture_tile_data.size() - tile_offset;
+        }
+        else
+        {
+            levels.offsets[0] = append_level(base, decoded.base.empty() ? texture->get_size() : uint32_t(decoded.base.size()));
+            for (size_t level = 0; level < decoded.levels.size(); ++level)
+                levels.offsets[level + 1] = append_level(decoded.levels[level].data(), uint32_t(decoded.levels[level].size()));
+            aligned_size = g_scene->texture_data.size() - offset;
+        }
+    }
+
+    // Paged textures have no texture data; their tiles tell where they are
+    metadata.offset = g_options.paged_textures ? 0 : offset;
     g_scene->texture_metadata.push_back(metadata);
+    if (has_texture_levels())
+        g_scene->texture_levels.push_back(levels);
+    if (g_options.paged_textures)
+        g_scene->texture_tiles.push_back(tiles);
 
     int32_t tex_index = int32_t(g_scene->texture_metadata.size() - 1);
-    g_texture_index_cache[res->get_path()] = tex_index;
+    g_texture_index_cache[key] = tex_index;
+
+    // Records hold 32 bit sizes; paged textures beyond that are decoded
+    // again on every compile
+    if (g_record && aligned_size <= UINT32_MAX)
+        g_record->textures.push_back(TextureRecord{ fingerprint, uint32_t(tex_index), uint32_t(aligned_size) });
 
     return tex_index;
 }
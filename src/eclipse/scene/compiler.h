@@ -2,9 +2,15 @@
 
 #include "eclipse/scene/scene.h"
 #include "eclipse/scene/raw_scene.h"
+#include "eclipse/scene/compile_record.h"
+#include "eclipse/util/mip_map.h"
+#include "eclipse/util/texture_layout.h"
 
 #include <memory>
 #include <cstdint>
+#include <string>
+#include <map>
+#include <set>
 
 namespace eclipse {
 
@@ -15,6 +21,94 @@ constexpr char SceneEmissiveMaterialName[] = "scene_emissive_material";
 
 constexpr uint32_t min_primitives_per_leaf = 10;
 
-std::unique_ptr<Scene> compile(std::shared_ptr<raw::Scene> raw_scene);
+enum BvhBuilderType
+{
+    SAHBuilder,
+    BinnedSAHBuilder,
+    LinearBVHBuilder
+};
+
+// What a texture is used for, which decides the block compressed format it
+// is stored in when compression is enabled for it; see
+// util/block_compression.h
+enum TextureRole
+{
+    AlbedoTexture,      // reflectance, specularity, transmittance: BC1
+    RoughnessTexture,   // BC4
+    NormalMapTexture,   // BC5
+    RadianceTexture,    // emission of surfaces and the environment map: BC1 if 8 bit, float ones are
+                        // kept uncompressed
+    OtherTexture        // mix and bump maps, never compressed
+};
+
+struct CompileOptions
+{
+    // Builder used for the scene BVH and for meshes without an override;
+    // BinnedSAHBuilder by default. SAHBuilder builds subtrees serially and is
+    // much slower on large meshes.
+    BvhBuilderType bvh_builder;
+
+    // Per mesh builder overrides, keyed by mesh name
+    std::map<std::string, BvhBuilderType> mesh_bvh_builders;
+
+    // Width of the wide BVH generated from the binary one (4 or 8), or 0
+    // for none. The binary BVH can be dropped once it has been collapsed.
+    uint32_t wide_bvh_width;
+    bool keep_binary_bvh;
+
+    // Store normals octahedral encoded in 32 bits and uvs as half floats
+    // instead of 12 and 8 bytes per vertex; see math/packing.h
+    bool oct_normals;
+    bool half_uvs;
+
+    // Generate a mip chain for each texture with the given filter
+    bool mip_maps;
+    MipFilter mip_filter;
+
+    // Order of the texels of the textures; see util/texture_layout.h
+    TextureLayout texture_layout;
+
+    // Roles of the textures that are block compressed. Compressed textures
+    // are stored as rows of blocks whatever the texture layout.
+    std::set<TextureRole> compressed_textures;
+
+    // Store the textures as tiles to be paged in on demand instead of in
+    // texture_data; see util/texture_tiles.h. Tiles are always linear, so
+    // the texture layout is ignored.
+    bool paged_textures;
+
+    CompileOptions()
+        : bvh_builder(BinnedSAHBuilder), wide_bvh_width(0), keep_binary_bvh(true), oct_normals(false), half_uvs(false)
+        , mip_maps(true), mip_filter(BoxMipFilter), texture_layout(LinearTextureLayout), paged_textures(false) { }
+
+    BvhBuilderType get_mesh_bvh_builder(const std::string& mesh_name) const
+    {
+        auto it = mesh_bvh_builders.find(mesh_name);
+        return it != mesh_bvh_builders.end() ? it->second : bvh_builder;
+    }
+};
+
+// Parse a BVH builder name (sah, binned, lbvh) as given on the command line.
+BvhBuilderType parse_bvh_builder_type(const std::string& name);
+
+// Parse a wide BVH width (4, 8) as given on the command line.
+uint32_t parse_wide_bvh_width(const std::string& width);
+
+// Parse a mip map filter name (box, kaiser) as given on the command line.
+MipFilter parse_mip_filter(const std::string& name);
+
+// Parse a texture layout name (linear, tiled, morton) as given on the command line.
+TextureLayout parse_texture_layout(const std::string& name);
+
+// Parse a texture role name (albedo, roughness, normal, radiance) as given on the command line.
+TextureRole parse_texture_role(const std::string& name);
+
+// Compiles a raw scene. If `record` is given it receives what the scene was
+// built from. Given an earlier compile of the scene and its record, mesh BVHs
+// and textures whose fingerprints match are taken from it instead of being
+// rebuilt; see compile_record.h.
+std::unique_ptr<Scene> compile(std::shared_ptr<raw::Scene> raw_scene, const CompileOptions& options = CompileOptions(),
+                               CompileRecord* record = nullptr, const Scene* previous = nullptr,
+                               const CompileRecord* previous_record = nullptr);
 
 } } // namespace eclipse::scene
@@ -27,6 +27,16 @@ T alias_cast(F raw_data)
     return ac.data;
 }
 
+// Reads the value starting at word `index` of a node. Nodes are packed, so
+// their words are copied out rather than read through typed pointers.
+template <typename T>
+T read_word(const Node& node, uint32_t index)
+{
+    T value;
+    memcpy(&value, reinterpret_cast<const uint8_t*>(&node) + index * sizeof(uint32_t), sizeof(T));
+    return value;
+}
+
 Node::Node()
 {
     memset(this, 0, sizeof(*this));
@@ -110,6 +120,48 @@ void Node::set_texture(ParamType param_type, int32_t texture)
     }
 }
 
+Vec3 Node::get_vec3(ParamType param_type) const
+{
+    uint32_t index = 4;
+    if (param_type == TRANSMITTANCE ||
+        param_type == EXT_IOR)
+    {
+        index = 8;
+    }
+    return Vec3(read_word<float>(*this, index), read_word<float>(*this, index + 1), read_word<float>(*this, index + 2));
+}
+
+float Node::get_float(ParamType param_type) const
+{
+    if (param_type == WEIGHT)
+        return read_word<float>(*this, 4);
+    else if (param_type == INT_IOR)
+        return read_word<float>(*this, 12);
+    else if (param_type == EXT_IOR)
+        return read_word<float>(*this, 13);
+    else if (param_type == ROUGHNESS || param_type == SCALER)
+        return read_word<float>(*this, 14);
+    return 0.0f;
+}
+
+int32_t Node::get_texture(ParamType param_type) const
+{
+    int32_t type = read_word<int32_t>(*this, 0);
+
+    if (param_type == TRANSMITTANCE)
+        return read_word<int32_t>(*this, 2);
+    else if (param_type == REFLECTANCE ||
+             param_type == SPECULARITY ||
+             param_type == RADIANCE    ||
+             type == OP_MIXMAP         ||
+             type == OP_BUMPMAP        ||
+             type == OP_NORMALMAP)
+        return read_word<int32_t>(*this, 3);
+    else if (param_type == ROUGHNESS)
+        return read_word<int32_t>(*this, 15);
+    return -1;
+}
+
 void Node::set_left_child(int32_t left)
 {
     *alias_cast<int32_t*>(data + 1) = left;
@@ -35,6 +35,10 @@ struct Node
     void set_float(ParamType param_type, float v);
     void set_texture(ParamType param_type, int32_t texture);
 
+    Vec3 get_vec3(ParamType param_type) const;
+    float get_float(ParamType param_type) const;
+    int32_t get_texture(ParamType param_type) const;
+
     void set_left_child(int32_t left);
     void set_right_child(int32_t right);
 
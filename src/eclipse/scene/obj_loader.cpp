@@ -1,4 +1,5 @@
 #include "eclipse/scene/obj_loader.h"
+#include "eclipse/scene/obj_tokenizer.h"
 #include "eclipse/scene/raw_scene.h"
 #include "eclipse/scene/compiler.h"
 #include "eclipse/scene/mat_expr.h"
@@ -8,7 +9,10 @@
 #include "eclipse/util/logger.h"
 #include "eclipse/util/stop_watch.h"
 #include "eclipse/util/resource.h"
+#include "eclipse/util/mapped_file.h"
+#include "eclipse/util/hash.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <cstddef>
 #include <string>
@@ -17,6 +21,7 @@
 #include <vector>
 #include <sstream>
 #include <memory>
+#include <omp.h>
 
 namespace eclipse { namespace scene {
 
@@ -46,31 +51,286 @@ struct Material
     std::string get_expression();
 };
 
+// Error in a line whose position is added where it is caught; lines parsed
+// in parallel only learn their line number once all chunks are parsed
+class LineError : public Error
+{
+public:
+    LineError(const std::string& msg) : Error(msg) { }
+};
+
 template <typename... Args>
-std::string fmt_error(const std::string& file, int line, Args const&... args)
+std::string fmt_message(Args const&... args)
 {
-    std::string s = "[" + file + ": " + std::to_string(line) + "] error: ";
-    std::ostringstream oss(s);
+    std::ostringstream oss;
     using List = int[];
     (void)List{ 0, ((void)(oss << args), 0) ... };
     return oss.str();
 }
 
-void parse(std::shared_ptr<Resource> res);
+template <typename... Args>
+std::string fmt_error(const std::string& file, size_t line, Args const&... args)
+{
+    return "[" + file + ": " + std::to_string(line) + "] error: " + fmt_message(args...);
+}
+
+constexpr int32_t no_index = INT32_MIN;
+constexpr size_t invalid_coord_index = SIZE_MAX;
+
+// Files are split into chunks of at least this size, parsed in parallel
+constexpr size_t min_chunk_size = 1 << 20;
+
+// Face as read from a chunk. Its indices may refer to coords of other
+// chunks, so they are kept as written until all chunks are read.
+struct ObjFace
+{
+    int32_t indices[4][3];      // vertex, uv and normal index of each argument
+    uint32_t num_args;
+
+    // Coords read in the segment before the face, which bound its indices
+    uint32_t num_vertices;
+    uint32_t num_uvs;
+    uint32_t num_normals;
+
+    uint32_t line;              // within the chunk
+};
+
+// Line changing the parser state, applied in file order once all chunks are
+// read. A line that fails to parse ends its chunk with its error.
+struct ObjDirective
+{
+    size_t num_faces;           // faces of the segment before it
+    size_t line;                // within the chunk
+    std::vector<ObjToken> tokens;
+    std::string error;
+};
+
+// Lines of a chunk up to and including a call. The coords of a segment are
+// contiguous in the scene wide coord lists; called files add theirs after.
+struct ObjSegment
+{
+    std::vector<Vec3> vertices;
+    std::vector<Vec3> normals;
+    std::vector<Vec2> uvs;
+    std::vector<ObjFace> faces;
+    std::vector<ObjDirective> directives;
+};
+
+struct ObjChunk
+{
+    const char* begin;
+    const char* end;
+    size_t first_line;
+    size_t num_lines;
+    std::vector<ObjSegment> segments;
+};
+
+struct ObjFile
+{
+    std::shared_ptr<Resource> res;
+    std::unique_ptr<MappedFile> mapping;
+    std::vector<ObjChunk> chunks;
+
+    // Files of the call lines by argument, or why they could not be opened
+    std::map<std::string, const ObjFile*> calls;
+    std::map<std::string, std::string> call_errors;
+};
+
+// A segment at its place in the scene wide coord lists. Files called more
+// than once are placed once per call.
+struct Placement
+{
+    const ObjFile* file;
+    const ObjChunk* chunk;
+    const ObjSegment* segment;
+
+    // Index of the first coords of the segment and of its file
+    size_t vertex_base;
+    size_t normal_base;
+    size_t uv_base;
+    size_t rel_vertex_offset;
+    size_t rel_normal_offset;
+    size_t rel_uv_offset;
+
+    std::string call_stack;
+};
+
+// Faces of a placed segment added to one mesh with one material
+struct FaceRun
+{
+    size_t placement;
+    size_t begin;
+    size_t end;
+    size_t mesh_index;
+    uint32_t material_index;
+};
+
+// Face argument with its indices into the scene wide coord lists and the
+// coords they refer to. A missing uv or normal has invalid_coord_index.
+struct Corner
+{
+    size_t vertex_index;
+    size_t uv_index;
+    size_t normal_index;
+    Vec3 vertex;
+    Vec2 uv;
+    Vec3 normal;
+};
+
+// Instance whose bbox covers the triangles its mesh had when it was defined
+struct PendingInstance
+{
+    std::shared_ptr<raw::MeshInstance> instance;
+    size_t num_triangles;
+};
+
+// Scene wide coord list referencing the coords of the placed segments
+template <typename T>
+class CoordList
+{
+public:
+    CoordList() : m_size(0) { }
+
+    void clear()
+    {
+        m_ranges.clear();
+        m_size = 0;
+    }
+
+    size_t size() const { return m_size; }
+
+    // Appends the coords and returns the index of the first one
+    size_t append(const std::vector<T>& coords)
+    {
+        const size_t base = m_size;
+        if (!coords.empty())
+        {
+            m_ranges.push_back(Range{ base, coords.data() });
+            m_size += coords.size();
+        }
+        return base;
+    }
+
+    const T& operator[](size_t index) const
+    {
+        auto it = std::upper_bound(m_ranges.begin(), m_ranges.end(), index,
+                                   [](size_t i, const Range& range) { return i < range.begin; });
+        --it;
+        return it->coords[index - it->begin];
+    }
+
+private:
+    struct Range
+    {
+        size_t begin;
+        const T* coords;
+    };
+
+    std::vector<Range> m_ranges;
+    size_t m_size;
+};
+
+// Maps the coord indices of corners to the vertices of a mesh. Open
+// addressing with linear probing; kept at most half full.
+class VertexMap
+{
+public:
+    VertexMap() : m_size(0) { }
+
+    // Returns the vertex of the corner, or adds `vertex` for it
+    uint32_t insert(const Corner& corner, uint32_t vertex)
+    {
+        if (2 * (m_size + 1) > m_slots.size())
+            grow();
+
+        const size_t mask = m_slots.size() - 1;
+        for (size_t i = hash(corner.vertex_index, corner.uv_index, corner.normal_index) & mask; ; i = (i + 1) & mask)
+        {
+            Slot& slot = m_slots[i];
+            if (slot.vertex == empty)
+            {
+                slot.vertex_index = corner.vertex_index;
+                slot.uv_index = corner.uv_index;
+                slot.normal_index = corner.normal_index;
+                slot.vertex = vertex;
+                ++m_size;
+                return vertex;
+            }
+
+            if (slot.vertex_index == corner.vertex_index && slot.uv_index == corner.uv_index &&
+                slot.normal_index == corner.normal_index)
+                return slot.vertex;
+        }
+    }
+
+private:
+    struct Slot
+    {
+        size_t vertex_index;
+        size_t uv_index;
+        size_t normal_index;
+        uint32_t vertex;
+    };
+
+    static constexpr uint32_t empty = UINT32_MAX;
 
-std::vector<raw::Triangle> parse_face(const std::vector<std::string>& tokens, size_t vert_off, size_t norm_off, size_t uv_off);
-std::shared_ptr<raw::MeshInstance> parse_mesh_instance(const std::vector<std::string>& tokens);
+    static size_t hash(size_t vertex_index, size_t uv_index, size_t normal_index)
+    {
+        uint64_t hash = vertex_index * 0x9e3779b97f4a7c15ull;
+        hash = (hash ^ uv_index) * 0x9e3779b97f4a7c15ull;
+        hash = (hash ^ normal_index) * 0x9e3779b97f4a7c15ull;
+        return size_t(hash ^ (hash >> 32));
+    }
+
+    void grow()
+    {
+        std::vector<Slot> slots(std::max(size_t(1024), 2 * m_slots.size()), Slot{ 0, 0, 0, empty });
+        slots.swap(m_slots);
+
+        const size_t mask = m_slots.size() - 1;
+        for (const Slot& slot : slots)
+        {
+            if (slot.vertex == empty)
+                continue;
+
+            size_t i = hash(slot.vertex_index, slot.uv_index, slot.normal_index) & mask;
+            while (m_slots[i].vertex != empty)
+                i = (i + 1) & mask;
+            m_slots[i] = slot;
+        }
+    }
+
+private:
+    std::vector<Slot> m_slots;
+    size_t m_size;
+};
+
+const ObjFile* load_files(std::shared_ptr<Resource> res);
+ObjFile* add_file(std::shared_ptr<Resource> res);
+void split_chunks(ObjFile& file);
+void parse_chunk(ObjChunk& chunk);
+void assemble(const ObjFile& file);
+void apply_directive(const ObjFile& file, const std::vector<ObjToken>& tokens, size_t line_num);
+void add_faces(size_t placement, size_t begin, size_t end);
+void build_triangles();
+void build_mesh(size_t mesh_index, const std::vector<size_t>& runs, std::vector<std::string>* errors);
+
+void parse_face(const std::vector<ObjToken>& tokens, ObjFace* face);
+bool resolve_face(const Placement& placement, const ObjFace& face, Corner* corners);
+std::shared_ptr<raw::MeshInstance> parse_mesh_instance(const std::vector<ObjToken>& tokens);
 void create_default_mesh_instances();
-uint32_t select_coord_index(const std::string& index_token, size_t coord_list_size, size_t rel_offset);
+size_t select_coord_index(int32_t index, size_t coord_list_size, size_t rel_offset);
 void verify_last_parsed_mesh();
 
 void parse_materials(std::shared_ptr<Resource> res);
 void process_materials();
 Material* default_material();
 
-float parse_float(const std::vector<std::string>& tokens);
-Vec2 parse_vec2(const std::vector<std::string>& tokens);
-Vec3 parse_vec3(const std::vector<std::string>& tokens);
+int32_t parse_index(const ObjToken& token);
+float parse_number(const ObjToken& token);
+float parse_float(const std::vector<ObjToken>& tokens);
+Vec2 parse_vec2(const std::vector<ObjToken>& tokens);
+Vec3 parse_vec3(const std::vector<ObjToken>& tokens);
 
 void push_call(const std::string& msg);
 void pop_call();
@@ -82,9 +342,16 @@ std::map<std::string, size_t> g_mat_name_to_index_map;
 std::vector<Material*> g_materials;
 Material* g_current_mat;
 
-std::vector<Vec3> g_vertices;
-std::vector<Vec3> g_normals;
-std::vector<Vec2> g_uvs;
+std::map<std::string, std::unique_ptr<ObjFile>> g_files;
+std::vector<const ObjFile*> g_assembling;
+std::vector<Placement> g_placements;
+std::vector<FaceRun> g_face_runs;
+std::vector<PendingInstance> g_pending_instances;
+std::vector<size_t> g_mesh_sizes;
+
+CoordList<Vec3> g_vertices;
+CoordList<Vec3> g_normals;
+CoordList<Vec2> g_uvs;
 
 std::vector<std::string> g_call_stack;
 const char* g_file;
@@ -103,6 +370,12 @@ std::unique_ptr<raw::Scene> load_obj(std::shared_ptr<Resource> scene)
 
     g_mat_name_to_index_map.clear();
     g_materials.clear();
+    g_files.clear();
+    g_assembling.clear();
+    g_placements.clear();
+    g_face_runs.clear();
+    g_pending_instances.clear();
+    g_mesh_sizes.clear();
     g_vertices.clear();
     g_normals.clear();
     g_uvs.clear();
@@ -114,7 +387,35 @@ std::unique_ptr<raw::Scene> load_obj(std::shared_ptr<Resource> scene)
     g_num_vertices = 0;
     g_raw_scene = std::make_unique<raw::Scene>();
 
-    parse(scene);
+    const ObjFile* file = load_files(scene);
+    assemble(*file);
+    build_triangles();
+
+    // Hash the mappings that were parsed rather than the files on disk,
+    // which may have been saved again since
+    std::vector<const ObjFile*> files;
+    for (const auto& entry : g_files)
+        files.push_back(entry.second.get());
+
+    const size_t first_source = g_raw_scene->source_files.size();
+    g_raw_scene->source_files.resize(first_source + files.size());
+    const int64_t num_files = int64_t(files.size());
+
+#pragma omp parallel for schedule(dynamic)
+    for (int64_t i = 0; i < num_files; ++i)
+    {
+        const MappedFile& mapping = *files[i]->mapping;
+        g_raw_scene->source_files[first_source + i] =
+            raw::SourceFile{ files[i]->res->get_path(), true, hash64(mapping.get_data(), mapping.get_size()) };
+    }
+
+    // The coords are referenced from the mapped files until here
+    g_vertices.clear();
+    g_normals.clear();
+    g_uvs.clear();
+    g_placements.clear();
+    g_face_runs.clear();
+    g_files.clear();
 
     if (g_raw_scene->mesh_instances.empty())
         create_default_mesh_instances();
@@ -241,7 +542,7 @@ void create_default_mesh_instances()
 // the material indices for all parsed primitives
 void process_materials()
 {
-    std::map<int, int> obj_mat_to_scene_mat;
+    std::vector<uint32_t> obj_mat_to_scene_mat(g_materials.size(), 0);
     std::vector<std::shared_ptr<raw::Material>> pruned_materials;
     size_t pruned = 0;
 
@@ -276,12 +577,15 @@ void process_materials()
         mat->used = true;
         g_raw_scene->materials.push_back(mat);
 
-        obj_mat_to_scene_mat[obj_mat_idx] = g_raw_scene->materials.size() - 1;
+        obj_mat_to_scene_mat[obj_mat_idx] = uint32_t(g_raw_scene->materials.size() - 1);
     }
 
     // For each primitive, map obj material indices to the generated materials
-    for (auto& mesh : g_raw_scene->meshes)
-        for (auto& tri : mesh->triangles)
+    const int64_t num_meshes = int64_t(g_raw_scene->meshes.size());
+
+#pragma omp parallel for schedule(dynamic)
+    for (int64_t i = 0; i < num_meshes; ++i)
+        for (auto& tri : g_raw_scene->meshes[i]->triangles)
             tri.material_index = obj_mat_to_scene_mat[tri.material_index];
 
     // Append pruned materials at the end of the list as they may be
@@ -321,137 +625,520 @@ Material* default_material()
     return g_current_mat;
 }
 
-// Parse wavefront object scene format
-void parse(std::shared_ptr<Resource> res)
+// Load a wavefront object scene and the files it calls, a level of calls at
+// a time. The chunks of all files of a level are parsed in parallel.
+const ObjFile* load_files(std::shared_ptr<Resource> res)
 {
-    size_t rel_vertex_offset = g_vertices.size();
-    size_t rel_normal_offset = g_normals.size();
-    size_t rel_uv_offset = g_uvs.size();
+    const ObjFile* root = add_file(res);
+    std::vector<ObjFile*> level = { g_files[res->get_path()].get() };
 
-    std::istream& input_stream = res->get_stream();
-    std::vector<std::string> tokens(20);
-
-    size_t line_num = 0;
-    for (std::string line; std::getline(input_stream, line);)
+    while (!level.empty())
     {
-        ++line_num;
-        g_line_num = line_num;
-        g_file = res->get_path().c_str();
+        std::vector<ObjChunk*> chunks;
+        for (ObjFile* file : level)
+        {
+            split_chunks(*file);
+            for (auto& chunk : file->chunks)
+                chunks.push_back(&chunk);
+        }
 
-        // Tokenize line
-        std::stringstream line_stream(line);
-        tokens.clear();
-        std::string token;
-        while (line_stream >> token)
-            tokens.push_back(token);
+        const int64_t num_chunks = int64_t(chunks.size());
 
-        if (tokens.empty() || tokens[0][0] == '#')
-            continue;
+#pragma omp parallel for schedule(dynamic)
+        for (int64_t i = 0; i < num_chunks; ++i)
+            parse_chunk(*chunks[i]);
 
-        if (tokens[0] == "call" || tokens[0] == "mtllib")
+        std::vector<ObjFile*> next_level;
+        for (ObjFile* file : level)
         {
-            if (tokens.size() != 2)
-                throw ObjError(fmt_error(res->get_path(), line_num,
-                    "unsupported syntax for '", tokens[0],
-                    "'; expected 1 argument; got ", tokens.size() - 1, get_call_stack()));
+            size_t line_num = 1;
+            for (auto& chunk : file->chunks)
+            {
+                chunk.first_line = line_num;
+                line_num += chunk.num_lines;
+
+                for (const auto& segment : chunk.segments)
+                {
+                    for (const auto& directive : segment.directives)
+                    {
+                        if (!directive.error.empty() || directive.tokens[0] != "call" || directive.tokens.size() != 2)
+                            continue;
+
+                        const std::string arg = directive.tokens[1].str();
+                        if (file->calls.count(arg) || file->call_errors.count(arg))
+                            continue;
+
+                        // Files that cannot be opened fail once their call is reached
+                        std::shared_ptr<Resource> inner_res;
+                        try
+                        {
+                            inner_res = std::make_shared<Resource>(arg, file->res);
+                        }
+                        catch (const ResourceError& error)
+                        {
+                            file->call_errors[arg] = error.what();
+                            continue;
+                        }
+
+                        auto it = g_files.find(inner_res->get_path());
+                        if (it != g_files.end())
+                        {
+                            file->calls[arg] = it->second.get();
+                            continue;
+                        }
+
+                        ObjFile* inner = add_file(inner_res);
+                        file->calls[arg] = inner;
+                        next_level.push_back(inner);
+                    }
+                }
+            }
+        }
 
-            push_call("referenced from '" + tokens[1] + "': " + std::to_string(line_num) + " [" + tokens[0] + "]");
+        level = next_level;
+    }
 
-            auto inner_res = std::make_shared<Resource>(tokens[1], res);
-            if (tokens[0] == "call")
-                parse(inner_res);
-            else
-                parse_materials(inner_res);
+    return root;
+}
 
-            pop_call();
-        }
-        else if (tokens[0] == "usemtl")
-        {
-            if (tokens.size() != 2)
-                throw ObjError(fmt_error(res->get_path(), line_num,
-                    "unsupported syntax for 'usemtl';",
-                    "expected 1 argument; got ", tokens.size() - 1, get_call_stack()));
+ObjFile* add_file(std::shared_ptr<Resource> res)
+{
+    auto file = std::make_unique<ObjFile>();
+    file->res = res;
+    file->mapping = std::make_unique<MappedFile>(res->get_path());
+    file->mapping->prefetch(0, file->mapping->get_size());
+
+    ObjFile* ptr = file.get();
+    g_files[res->get_path()] = std::move(file);
+    return ptr;
+}
 
-            if (g_mat_name_to_index_map.find(tokens[1]) == g_mat_name_to_index_map.end())
-                throw ObjError(fmt_error(res->get_path(), line_num,
-                    "undefined material with name '", tokens[1], "'", get_call_stack()));
+// Split a file at line ends into chunks of about equal size, a few per thread
+void split_chunks(ObjFile& file)
+{
+    const char* begin = reinterpret_cast<const char*>(file.mapping->get_data());
+    const size_t size = file.mapping->get_size();
+    const char* end = begin + size;
 
-            size_t mat_index = g_mat_name_to_index_map[tokens[1]];
-            g_current_mat = g_materials[mat_index];
-        }
-        else if (tokens[0] == "v")
+    const size_t max_chunks = 4 * size_t(omp_get_max_threads());
+    const size_t num_chunks = std::max(size_t(1), std::min(size / min_chunk_size, max_chunks));
+
+    const char* chunk_begin = begin;
+    for (size_t i = 1; chunk_begin < end; ++i)
+    {
+        const char* chunk_end = end;
+        if (i < num_chunks)
         {
-            g_vertices.push_back(parse_vec3(tokens));
-            ++g_num_vertices;
+            const char* target = begin + size * i / num_chunks;
+            if (target <= chunk_begin)
+                continue;
+
+            const void* newline = std::memchr(target - 1, '\n', size_t(end - target + 1));
+            chunk_end = newline != nullptr ? static_cast<const char*>(newline) + 1 : end;
         }
-        else if (tokens[0] == "vn")
+
+        ObjChunk chunk;
+        chunk.begin = chunk_begin;
+        chunk.end = chunk_end;
+        chunk.first_line = 1;
+        chunk.num_lines = 0;
+        file.chunks.push_back(std::move(chunk));
+
+        chunk_begin = chunk_end;
+    }
+}
+
+bool is_directive(const ObjToken& token)
+{
+    return token == "call" || token == "mtllib" || token == "usemtl" || token == "g" || token == "o" ||
+           token == "instance" || token == "camera_fov" || token == "camera_eye" || token == "camera_look" ||
+           token == "camera_up";
+}
+
+// Parse the coords and faces of a chunk; the lines changing the parser state
+// are kept to be applied in order by assemble
+void parse_chunk(ObjChunk& chunk)
+{
+    ObjTokenizer tokenizer(chunk.begin, chunk.end);
+    std::vector<ObjToken> tokens;
+    tokens.reserve(20);
+
+    chunk.segments.emplace_back();
+
+    while (tokenizer.next_line(tokens))
+    {
+        if (tokens.empty() || tokens[0].front() == '#')
+            continue;
+
+        ObjSegment& segment = chunk.segments.back();
+        try
         {
-            g_normals.push_back(parse_vec3(tokens));
+            if (tokens[0] == "v")
+            {
+                segment.vertices.push_back(parse_vec3(tokens));
+            }
+            else if (tokens[0] == "vn")
+            {
+                segment.normals.push_back(parse_vec3(tokens));
+            }
+            else if (tokens[0] == "vt")
+            {
+                segment.uvs.push_back(parse_vec2(tokens));
+            }
+            else if (tokens[0] == "f")
+            {
+                ObjFace face;
+                parse_face(tokens, &face);
+                face.num_vertices = uint32_t(segment.vertices.size());
+                face.num_uvs = uint32_t(segment.uvs.size());
+                face.num_normals = uint32_t(segment.normals.size());
+                face.line = uint32_t(tokenizer.get_line_num());
+                segment.faces.push_back(face);
+            }
+            else if (is_directive(tokens[0]))
+            {
+                ObjDirective directive;
+                directive.num_faces = segment.faces.size();
+                directive.line = tokenizer.get_line_num();
+                directive.tokens = tokens;
+                segment.directives.push_back(std::move(directive));
+
+                // Coords after a call come after those of the called file
+                if (tokens[0] == "call")
+                    chunk.segments.emplace_back();
+            }
         }
-        else if (tokens[0] == "vt")
+        catch (const LineError& error)
         {
-            g_uvs.push_back(parse_vec2(tokens));
+            ObjDirective directive;
+            directive.num_faces = segment.faces.size();
+            directive.line = tokenizer.get_line_num();
+            directive.error = error.what();
+            segment.directives.push_back(std::move(directive));
+            break;
         }
-        else if (tokens[0] == "g" || tokens[0] == "o")
-        {
-            if (tokens.size() < 2)
-                throw ObjError(fmt_error(res->get_path(), line_num,
-                        "unsupported syntax for '", tokens[0],
-                        "'; expected 1 argument; got ", tokens.size() - 1, get_call_stack()));
+    }
 
-            verify_last_parsed_mesh();
-            g_raw_scene->meshes.push_back(std::make_shared<raw::Mesh>(tokens[1]));
-        }
-        else if (tokens[0] == "f")
+    chunk.num_lines = tokenizer.get_line_num();
+}
+
+// Apply the state changing lines of a file in order, placing its segments
+// and those of the files it calls in the scene wide coord lists
+void assemble(const ObjFile& file)
+{
+    const std::string& path = file.res->get_path();
+    const size_t rel_vertex_offset = g_vertices.size();
+    const size_t rel_normal_offset = g_normals.size();
+    const size_t rel_uv_offset = g_uvs.size();
+
+    g_assembling.push_back(&file);
+
+    for (const auto& chunk : file.chunks)
+    {
+        for (const auto& segment : chunk.segments)
         {
-            std::vector<raw::Triangle> triangles = parse_face(tokens, rel_vertex_offset, rel_normal_offset, rel_uv_offset);
-            g_num_triangles += triangles.size();
-
-            // If no object has been defined, create a default one
-            if (g_raw_scene->meshes.size() == 0)
-                g_raw_scene->meshes.push_back(std::make_shared<raw::Mesh>("default"));
-
-            // Append primitive
-            size_t mesh_index = g_raw_scene->meshes.size() - 1;
-            auto mesh = g_raw_scene->meshes[mesh_index];
-            mesh->mark_bbox_dirty();
-            mesh->triangles.insert(mesh->triangles.end(), triangles.begin(), triangles.end());
+            Placement placement;
+            placement.file = &file;
+            placement.chunk = &chunk;
+            placement.segment = &segment;
+            placement.vertex_base = g_vertices.append(segment.vertices);
+            placement.normal_base = g_normals.append(segment.normals);
+            placement.uv_base = g_uvs.append(segment.uvs);
+            placement.rel_vertex_offset = rel_vertex_offset;
+            placement.rel_normal_offset = rel_normal_offset;
+            placement.rel_uv_offset = rel_uv_offset;
+            placement.call_stack = get_call_stack();
+            g_placements.push_back(std::move(placement));
+            g_num_vertices += segment.vertices.size();
+
+            const size_t placement_index = g_placements.size() - 1;
+            size_t num_faces = 0;
+
+            for (const auto& directive : segment.directives)
+            {
+                add_faces(placement_index, num_faces, directive.num_faces);
+                num_faces = directive.num_faces;
+
+                const size_t line_num = chunk.first_line + directive.line - 1;
+                g_line_num = line_num;
+                g_file = path.c_str();
+
+                if (!directive.error.empty())
+                    throw ObjError(fmt_error(path, line_num, directive.error, get_call_stack()));
+
+                try
+                {
+                    apply_directive(file, directive.tokens, line_num);
+                }
+                catch (const LineError& error)
+                {
+                    // Material libraries update the position as they go
+                    throw ObjError(fmt_error(g_file, g_line_num, error.what(), get_call_stack()));
+                }
+            }
+
+            add_faces(placement_index, num_faces, segment.faces.size());
         }
-        else if (tokens[0] == "camera_fov")
+    }
+
+    verify_last_parsed_mesh();
+    g_assembling.pop_back();
+}
+
+void apply_directive(const ObjFile& file, const std::vector<ObjToken>& tokens, size_t line_num)
+{
+    const std::string& path = file.res->get_path();
+
+    if (tokens[0] == "call" || tokens[0] == "mtllib")
+    {
+        if (tokens.size() != 2)
+            throw ObjError(fmt_error(path, line_num,
+                "unsupported syntax for '", tokens[0],
+                "'; expected 1 argument; got ", tokens.size() - 1, get_call_stack()));
+
+        push_call("referenced from '" + tokens[1].str() + "': " + std::to_string(line_num) + " [" + tokens[0].str() + "]");
+
+        if (tokens[0] == "call")
         {
-            g_raw_scene->camera.fov = parse_float(tokens);
+            const std::string arg = tokens[1].str();
+            auto error = file.call_errors.find(arg);
+            if (error != file.call_errors.end())
+                throw ResourceError(error->second);
+
+            const ObjFile* inner = file.calls.at(arg);
+            if (std::find(g_assembling.begin(), g_assembling.end(), inner) != g_assembling.end())
+                throw ObjError(fmt_error(path, line_num, "recursive call of '", tokens[1], "'", get_call_stack()));
+
+            assemble(*inner);
         }
-        else if (tokens[0] == "camera_eye")
+        else
         {
-            g_raw_scene->camera.eye = parse_vec3(tokens);
+            parse_materials(std::make_shared<Resource>(tokens[1].str(), file.res));
         }
-        else if (tokens[0] == "camera_look")
+
+        pop_call();
+    }
+    else if (tokens[0] == "usemtl")
+    {
+        if (tokens.size() != 2)
+            throw ObjError(fmt_error(path, line_num,
+                "unsupported syntax for 'usemtl';",
+                "expected 1 argument; got ", tokens.size() - 1, get_call_stack()));
+
+        auto it = g_mat_name_to_index_map.find(tokens[1].str());
+        if (it == g_mat_name_to_index_map.end())
+            throw ObjError(fmt_error(path, line_num,
+                "undefined material with name '", tokens[1], "'", get_call_stack()));
+
+        g_current_mat = g_materials[it->second];
+    }
+    else if (tokens[0] == "g" || tokens[0] == "o")
+    {
+        if (tokens.size() < 2)
+            throw ObjError(fmt_error(path, line_num,
+                    "unsupported syntax for '", tokens[0],
+                    "'; expected 1 argument; got ", tokens.size() - 1, get_call_stack()));
+
+        verify_last_parsed_mesh();
+        g_raw_scene->meshes.push_back(std::make_shared<raw::Mesh>(tokens[1].str()));
+        g_mesh_sizes.push_back(0);
+    }
+    else if (tokens[0] == "camera_fov")
+    {
+        g_raw_scene->camera.fov = parse_float(tokens);
+    }
+    else if (tokens[0] == "camera_eye")
+    {
+        g_raw_scene->camera.eye = parse_vec3(tokens);
+    }
+    else if (tokens[0] == "camera_look")
+    {
+        g_raw_scene->camera.look_at = parse_vec3(tokens);
+    }
+    else if (tokens[0] == "camera_up")
+    {
+        g_raw_scene->camera.up = parse_vec3(tokens);
+    }
+    else if (tokens[0] == "instance")
+    {
+        auto instance = parse_mesh_instance(tokens);
+        g_pending_instances.push_back(PendingInstance{ instance, g_mesh_sizes[instance->mesh_index] });
+        g_raw_scene->mesh_instances.push_back(instance);
+    }
+}
+
+// Add faces [begin, end) of a placed segment to the current mesh with the
+// current material. Their triangles are built by build_triangles.
+void add_faces(size_t placement, size_t begin, size_t end)
+{
+    if (begin == end)
+        return;
+
+    // If no object has been defined, create a default one
+    if (g_raw_scene->meshes.size() == 0)
+    {
+        g_raw_scene->meshes.push_back(std::make_shared<raw::Mesh>("default"));
+        g_mesh_sizes.push_back(0);
+    }
+
+    // If no material defined select the default. Also flag the current material
+    // as being in use so we don't prune it later
+    if (g_current_mat == nullptr)
+        g_current_mat = default_material();
+    g_current_mat->used = true;
+
+    const uint32_t material_index = uint32_t(g_mat_name_to_index_map[g_current_mat->name]);
+    const size_t mesh_index = g_raw_scene->meshes.size() - 1;
+    const std::vector<ObjFace>& faces = g_placements[placement].segment->faces;
+
+    FaceRun run;
+    run.placement = placement;
+    run.begin = begin;
+    run.end = end;
+    run.mesh_index = mesh_index;
+    run.material_index = material_index;
+
+    // Quads are split in two triangles
+    size_t num_triangles = 0;
+    for (size_t i = begin; i < end; ++i)
+        num_triangles += faces[i].num_args - 2;
+
+    g_mesh_sizes[mesh_index] += num_triangles;
+    g_num_triangles += num_triangles;
+    g_face_runs.push_back(run);
+}
+
+// Build the meshes from their face runs in parallel, then the bboxes that
+// depend on them
+void build_triangles()
+{
+    const int64_t num_meshes = int64_t(g_raw_scene->meshes.size());
+
+    std::vector<std::vector<size_t>> mesh_runs(g_raw_scene->meshes.size());
+    for (size_t i = 0; i < g_face_runs.size(); ++i)
+        mesh_runs[g_face_runs[i].mesh_index].push_back(i);
+
+    std::vector<std::string> errors(g_face_runs.size());
+
+#pragma omp parallel for schedule(dynamic)
+    for (int64_t i = 0; i < num_meshes; ++i)
+        build_mesh(size_t(i), mesh_runs[i], &errors);
+
+    // Report the first error in file order
+    for (const auto& error : errors)
+        if (!error.empty())
+            throw ObjError(error);
+
+#pragma omp parallel for schedule(dynamic)
+    for (int64_t i = 0; i < num_meshes; ++i)
+    {
+        g_raw_scene->meshes[i]->mark_bbox_dirty();
+        g_raw_scene->meshes[i]->get_bbox();
+    }
+
+    // Get mesh bbox and recalculate a new BBox for the mesh instance
+    for (const auto& pending : g_pending_instances)
+    {
+        BBox mesh_bbox;
+        auto instance = pending.instance;
+        if (instance->mesh_index < g_raw_scene->meshes.size())
         {
-            g_raw_scene->camera.look_at = parse_vec3(tokens);
+            auto mesh = g_raw_scene->meshes[instance->mesh_index];
+            if (pending.num_triangles == mesh->triangles.size())
+                mesh_bbox = mesh->get_bbox();
+            else
+                for (size_t i = 0; i < pending.num_triangles; ++i)
+                    mesh_bbox.merge(mesh->get_triangle_bbox(i));
         }
-        else if (tokens[0] == "camera_up")
+
+        BBox inst_bbox = transform_bbox(instance->transform, mesh_bbox);
+        instance->bbox = inst_bbox;
+        instance->centroid = inst_bbox.get_centroid();
+    }
+}
+
+// Build the vertices and triangles of a mesh from its face runs in order.
+// Face arguments with the same coords share a vertex, except for faces
+// without normals, which get a generated normal for their own vertices.
+// Errors are stored by run; building stops at the first one.
+void build_mesh(size_t mesh_index, const std::vector<size_t>& runs, std::vector<std::string>* errors)
+{
+    raw::Mesh& mesh = *g_raw_scene->meshes[mesh_index];
+    mesh.triangles.reserve(g_mesh_sizes[mesh_index]);
+
+    VertexMap vertex_map;
+
+    auto add_vertex = [&mesh](const Corner& corner)
+    {
+        mesh.vertices.push_back(corner.vertex);
+        mesh.normals.push_back(corner.normal);
+        mesh.uvs.push_back(corner.uv);
+        return uint32_t(mesh.vertices.size() - 1);
+    };
+
+    for (size_t run_index : runs)
+    {
+        const FaceRun& run = g_face_runs[run_index];
+        const Placement& placement = g_placements[run.placement];
+
+        try
         {
-            g_raw_scene->camera.up = parse_vec3(tokens);
+            for (size_t face_index = run.begin; face_index < run.end; ++face_index)
+            {
+                const ObjFace& face = placement.segment->faces[face_index];
+                Corner corners[4];
+                const bool has_normals = resolve_face(placement, face, corners);
+
+                uint32_t indices[4];
+                for (size_t arg = 0; arg < face.num_args; ++arg)
+                {
+                    const Corner& corner = corners[arg];
+                    if (!has_normals)
+                    {
+                        indices[arg] = add_vertex(corner);
+                        continue;
+                    }
+
+                    const uint32_t vertex = uint32_t(mesh.vertices.size());
+                    indices[arg] = vertex_map.insert(corner, vertex);
+                    if (indices[arg] == vertex)
+                        add_vertex(corner);
+                }
+
+                // Quads are split along their 0-2 diagonal
+                raw::Triangle tri;
+                tri.material_index = run.material_index;
+                tri.indices[0] = indices[0];
+                tri.indices[1] = indices[1];
+                tri.indices[2] = indices[2];
+                mesh.triangles.push_back(tri);
+
+                if (face.num_args == 4)
+                {
+                    tri.indices[1] = indices[2];
+                    tri.indices[2] = indices[3];
+                    mesh.triangles.push_back(tri);
+                }
+            }
         }
-        else if (tokens[0] == "instance")
+        catch (const ObjError& error)
         {
-            auto instance = parse_mesh_instance(tokens);
-            g_raw_scene->mesh_instances.push_back(instance);
+            (*errors)[run_index] = error.what();
+            return;
         }
     }
-
-    verify_last_parsed_mesh();
 }
 
 void verify_last_parsed_mesh()
 {
     int last_mesh_index = g_raw_scene->meshes.size() - 1;
-    if (last_mesh_index >= 0 && g_raw_scene->meshes[last_mesh_index]->triangles.size() == 0)
+    if (last_mesh_index >= 0 && g_mesh_sizes[last_mesh_index] == 0)
     {
         logger.log<WARNING>("dropping mesh '", g_raw_scene->meshes[last_mesh_index]->name,
                 "' as it contains no polygons");
 
         g_raw_scene->meshes.pop_back();
+        g_mesh_sizes.pop_back();
     }
 }
 
@@ -459,28 +1146,23 @@ void verify_last_parsed_mesh()
 void parse_materials(std::shared_ptr<Resource> res)
 {
     logger.log<INFO>("parsing material library '", res->get_path(), "'");
-
-    std::istream& input_stream = res->get_stream();
-    std::vector<std::string> tokens(50);
+    MappedFile file(res->get_path());
+    g_raw_scene->source_files.push_back(raw::SourceFile{ res->get_path(), true, hash64(file.get_data(), file.get_size()) });
+    const char* data = reinterpret_cast<const char*>(file.get_data());
+    ObjTokenizer tokenizer(data, data + file.get_size());
+    std::vector<ObjToken> tokens;
+    tokens.reserve(50);
 
     Material* current_mat = nullptr;
     std::string mat_name;
 
-    size_t line_num = 0;
-    for (std::string line; std::getline(input_stream, line);)
+    while (tokenizer.next_line(tokens))
     {
-        ++line_num;
+        const size_t line_num = tokenizer.get_line_num();
         g_line_num = line_num;
         g_file = res->get_path().c_str();
 
-        // Tokenize line
-        std::stringstream line_stream(line);
-        tokens.clear();
-        std::string token;
-        while (line_stream >> token)
-            tokens.push_back(token);
-
-        if (tokens.empty() || tokens[0][0] == '#')
+        if (tokens.empty() || tokens[0].front() == '#')
             continue;
 
         if (tokens[0] == "newmtl")
@@ -490,7 +1172,7 @@ void parse_materials(std::shared_ptr<Resource> res)
                         "unsupported syntax for 'newmtl'; ",
                         "expected 1 argument; got ", tokens.size() - 1, get_call_stack()));
 
-            mat_name = tokens[1];
+            mat_name = tokens[1].str();
             if (g_mat_name_to_index_map.find(mat_name) != g_mat_name_to_index_map.end())
                 throw ObjError(fmt_error(res->get_path(), line_num,
                         "material '", mat_name, "' already defined", get_call_stack()));
@@ -516,7 +1198,7 @@ void parse_materials(std::shared_ptr<Resource> res)
                             "unsupported syntax for 'include'; expected 1 argument; ",
                             "got ", tokens.size() - 1, get_call_stack()));
 
-                auto it = g_mat_name_to_index_map.find(tokens[1]);
+                auto it = g_mat_name_to_index_map.find(tokens[1].str());
                 if (it == g_mat_name_to_index_map.end())
                     throw ObjError(fmt_error(res->get_path(), line_num, "could not ",
                             "include unknown material '", tokens[1], get_call_stack()));
@@ -546,27 +1228,27 @@ void parse_materials(std::shared_ptr<Resource> res)
             }
             else if (tokens[0] == "map_Kd")
             {
-                current_mat->Kd_tex = tokens[1];
+                current_mat->Kd_tex = tokens[1].str();
             }
             else if (tokens[0] == "map_Ks")
             {
-                current_mat->Ks_tex = tokens[1];
+                current_mat->Ks_tex = tokens[1].str();
             }
             else if (tokens[0] == "map_Ke")
             {
-                current_mat->Ke_tex = tokens[1];
+                current_mat->Ke_tex = tokens[1].str();
             }
             else if (tokens[0] == "map_Tf")
             {
-                current_mat->Tf_tex = tokens[1];
+                current_mat->Tf_tex = tokens[1].str();
             }
             else if (tokens[0] == "map_bump")
             {
-                current_mat->bump_tex = tokens[1];
+                current_mat->bump_tex = tokens[1].str();
             }
             else if (tokens[0] == "map_normal")
             {
-                current_mat->normal_tex = tokens[1];
+                current_mat->normal_tex = tokens[1].str();
             }
             else if (tokens[0] == "mat_expr")
             {
@@ -575,8 +1257,8 @@ void parse_materials(std::shared_ptr<Resource> res)
                             "'mat_expr'; expected 1 argument; got ", tokens.size() - 1, get_call_stack()));
 
                 for (size_t i = 1; i < tokens.size() - 1; ++i)
-                    current_mat->expression += tokens[i] + " ";
-                current_mat->expression += tokens[tokens.size() - 1];
+                    current_mat->expression += tokens[i].str() + " ";
+                current_mat->expression += tokens[tokens.size() - 1].str();
             }
             else if (tokens[0] == "KeScaler")
             {
@@ -603,159 +1285,155 @@ void parse_materials(std::shared_ptr<Resource> res)
 // an offset off the end of the vertex/uv list
 //
 // This method only works with triangular/quad faces and will return an error if a
-// face with more than 4 vertices is encountered.
-std::vector<raw::Triangle> parse_face(const std::vector<std::string>& tokens,
-                                      size_t rel_vertex_offset,
-                                      size_t rel_normal_offset,
-                                      size_t rel_uv_offset)
+// face with more than 4 vertices is encountered. The indices are resolved by
+// resolve_face once all chunks are parsed.
+void parse_face(const std::vector<ObjToken>& tokens, ObjFace* face)
 {
-    std::vector<raw::Triangle> triangles;
     if (tokens.size() < 4 || tokens.size() > 5)
-        throw ObjError(fmt_error(g_file, g_line_num, "unsupported syntax for ",
+        throw LineError(fmt_message("unsupported syntax for ",
                 "'f'; expected 3 arguments for triangular faces or 4 arguments for a ",
                 "quad face; got ", tokens.size() - 1,
-                ". Select the triangulation option in your exporter", get_call_stack()));
+                ". Select the triangulation option in your exporter"));
 
-    Vec3 vertices[4];
-    Vec3 normals[4];
-    Vec2 uvs[4];
-    bool has_normals = false;
+    face->num_args = uint32_t(tokens.size() - 1);
     size_t exp_indices = 0;
 
     for (size_t arg = 0; arg < tokens.size() - 1; ++arg)
     {
-        std::vector<std::string> face_tokens;
-        const char* c = tokens[arg + 1].c_str();
-        std::string token;
-        while (1)
+        // Split the argument at slashes; only the first three indices are used
+        ObjToken face_tokens[3];
+        size_t num_face_tokens = 0;
+        const ObjToken& token = tokens[arg + 1];
+        const char* begin = token.begin;
+        for (const char* c = token.begin; ; ++c)
         {
-            if (*c == '/' || *c == '\0')
+            if (c == token.end || *c == '/')
             {
-                face_tokens.push_back(token);
-                token.clear();
-                if (*c == '\0')
+                if (num_face_tokens < 3)
+                    face_tokens[num_face_tokens] = ObjToken{ begin, c };
+                ++num_face_tokens;
+                begin = c + 1;
+                if (c == token.end)
                     break;
             }
-            else
-            {
-                token += *c;
-            }
-            ++c;
         }
 
         // The first triangle defines the format for the following args
         if (arg == 0)
         {
-            exp_indices = face_tokens.size();
+            exp_indices = num_face_tokens;
         }
-        else if (face_tokens.size() != exp_indices)
+        else if (num_face_tokens != exp_indices)
         {
-            throw ObjError(fmt_error(g_file, g_line_num, "expected each face argument ",
+            throw LineError(fmt_message("expected each face argument ",
                     "to contain ", exp_indices, " indices; arg ", arg, " contains ",
-                    face_tokens.size(), " indices", get_call_stack()));
+                    num_face_tokens, " indices"));
         }
 
         // Faces must at least define a vertex coord
         if (face_tokens[0].empty())
-            throw ObjError(fmt_error(g_file, g_line_num, "face argument ", arg,
-                    " does not include a vertex index", get_call_stack()));
+            throw LineError(fmt_message("face argument ", arg,
+                    " does not include a vertex index"));
+
+        // Uv and normal coords are optional
+        for (size_t i = 0; i < 3; ++i)
+        {
+            const bool specified = i < num_face_tokens && !face_tokens[i].empty();
+            face->indices[arg][i] = specified ? parse_index(face_tokens[i]) : no_index;
+        }
+    }
+}
 
-        uint32_t offset = select_coord_index(face_tokens[0], g_vertices.size(), rel_vertex_offset);
-        if (offset == (uint32_t)pos_inf)
-            throw ObjError(fmt_error(g_file, g_line_num, "could not parse vertex coord ",
-                    "for face argument ", arg, ": index out of bounds", get_call_stack()));
-        vertices[arg] = g_vertices[offset];
+// Resolve the indices of a parsed face into corners. Faces without normals
+// get one generated from their vertices; returns whether the face has normals.
+bool resolve_face(const Placement& placement, const ObjFace& face, Corner* corners)
+{
+    const ObjSegment& segment = *placement.segment;
+    const size_t line_num = placement.chunk->first_line + face.line - 1;
+    const std::string& path = placement.file->res->get_path();
+
+    // Coords of the segment are read locally, earlier ones from the scene
+    // wide lists
+    const size_t num_vertices = placement.vertex_base + face.num_vertices;
+    const size_t num_uvs = placement.uv_base + face.num_uvs;
+    const size_t num_normals = placement.normal_base + face.num_normals;
+
+    bool has_normals = false;
+
+    for (size_t arg = 0; arg < face.num_args; ++arg)
+    {
+        const int32_t* indices = face.indices[arg];
+        Corner& corner = corners[arg];
+        corner.uv_index = invalid_coord_index;
+        corner.normal_index = invalid_coord_index;
+        corner.uv = Vec2();
+        corner.normal = Vec3();
+
+        size_t offset = select_coord_index(indices[0], num_vertices, placement.rel_vertex_offset);
+        if (offset == invalid_coord_index)
+            throw ObjError(fmt_error(path, line_num, "could not parse vertex coord ",
+                    "for face argument ", arg, ": index out of bounds", placement.call_stack));
+        corner.vertex_index = offset;
+        corner.vertex = offset >= placement.vertex_base ? segment.vertices[offset - placement.vertex_base]
+                                                        : g_vertices[offset];
 
         // Parse uv coords if specified
-        if (exp_indices > 1 && !face_tokens[1].empty())
+        if (indices[1] != no_index)
         {
-            offset = select_coord_index(face_tokens[1], g_uvs.size(), rel_uv_offset);
-            if (offset == (uint32_t)pos_inf)
-                throw ObjError(fmt_error(g_file, g_line_num, "could not parse tex coord ",
-                    "for face argument ", arg, ": index out of bounds", get_call_stack()));
-            uvs[arg] = g_uvs[offset];
+            offset = select_coord_index(indices[1], num_uvs, placement.rel_uv_offset);
+            if (offset == invalid_coord_index)
+                throw ObjError(fmt_error(path, line_num, "could not parse tex coord ",
+                    "for face argument ", arg, ": index out of bounds", placement.call_stack));
+            corner.uv_index = offset;
+            corner.uv = offset >= placement.uv_base ? segment.uvs[offset - placement.uv_base] : g_uvs[offset];
         }
 
         // Parse normal coords if specified
-        if (exp_indices > 2 && !face_tokens[2].empty())
+        if (indices[2] != no_index)
         {
-            offset = select_coord_index(face_tokens[2], g_normals.size(), rel_normal_offset);
-            if (offset == (uint32_t)pos_inf)
-                throw ObjError(fmt_error(g_file, g_line_num, "could not parse normal coord ",
-                    "for face argument ", arg, ": index out of bounds", get_call_stack()));
-            normals[arg] = g_normals[offset];
+            offset = select_coord_index(indices[2], num_normals, placement.rel_normal_offset);
+            if (offset == invalid_coord_index)
+                throw ObjError(fmt_error(path, line_num, "could not parse normal coord ",
+                    "for face argument ", arg, ": index out of bounds", placement.call_stack));
+            corner.normal_index = offset;
+            corner.normal = offset >= placement.normal_base ? segment.normals[offset - placement.normal_base]
+                                                            : g_normals[offset];
             has_normals = true;
         }
     }
 
-    // If no material defined select the default. Also flag the current material
-    // as being in use so we don't prune it later
-    if (g_current_mat == nullptr)
-        g_current_mat = default_material();
-    g_current_mat->used = true;
-
     // If no normals are available generate them from the vertices
     if (!has_normals)
     {
-        const Vec3 e01 = vertices[1] - vertices[0];
-        const Vec3 e02 = vertices[2] - vertices[0];
+        const Vec3 e01 = corners[1].vertex - corners[0].vertex;
+        const Vec3 e02 = corners[2].vertex - corners[0].vertex;
         const Vec3 normal = normalize(cross(e01, e02));
-        normals[0] = normal;
-        normals[1] = normal;
-        normals[2] = normal;
-        normals[3] = normal;
+        for (size_t arg = 0; arg < face.num_args; ++arg)
+            corners[arg].normal = normal;
     }
 
-    // Assemble vertices into one or two primitives depending on whether we are parsing
-    // a triangular or a quad face
-    size_t indices_list[2][3] = { { 0, 1, 2 }, { 0, 2, 3 } };
-    size_t num_tris = (tokens.size() == 4) ? 1 : 2;
-
-    for (size_t i = 0; i < num_tris; ++i)
-    {
-        size_t* indices = &indices_list[i][0];
-
-        raw::Triangle tri;
-        tri.material_index = g_mat_name_to_index_map[g_current_mat->name];
-
-        for (size_t j = 0; j < 3; ++j)
-        {
-            size_t index = indices[j];
-            tri.vertices[j] = vertices[index];
-            tri.normals[j] = normals[index];
-            tri.uvs[j] = uvs[index];
-        }
-
-        tri.bbox = BBox(tri.vertices[0], tri.vertices[1], tri.vertices[2]);
-        tri.centroid = (tri.vertices[0] + tri.vertices[1] + tri.vertices[2]) * (1.0f / 3.0f);
-
-        triangles.push_back(std::move(tri));
-    }
-
-    return triangles;
+    return has_normals;
 }
 
 // Given an index for a face coord type (vertex, normal, tex) calculate the
 // proper offset into the coord list. wavefront format can also use negative
 // indices to reference elements from the end of the coord list.
-// An error is signaled by returing positive infinite as the return value.
-uint32_t select_coord_index(const std::string& index_token, size_t coord_list_size, size_t rel_offset)
+// An error is signaled by returning invalid_coord_index.
+size_t select_coord_index(int32_t index, size_t coord_list_size, size_t rel_offset)
 {
-    int index = std::stoi(index_token);
-
-    int offset = 0;
+    int64_t offset = 0;
     if (index < 0)
-        offset = int(coord_list_size) + index;
+        offset = int64_t(coord_list_size) + index;
     else
-        offset = int(rel_offset) + index - 1;
+        offset = int64_t(rel_offset) + index - 1;
 
-    if (offset < 0 || size_t(offset) >= coord_list_size)
+    if (offset < 0 || uint64_t(offset) >= coord_list_size)
     {
         // signal error
-        return pos_inf;
+        return invalid_coord_index;
     }
 
-    return offset;
+    return size_t(offset);
 }
 
 // Parse mesh instance definition. Definitions use the following format:
@@ -764,7 +1442,7 @@ uint32_t select_coord_index(const std::string& index_token, size_t coord_list_si
 // tX, tY, tZ       : translation vector
 // yaw, pitch, roll : rotation angles in degrees
 // sX, sY, sZ       : scale
-std::shared_ptr<raw::MeshInstance> parse_mesh_instance(const std::vector<std::string>& tokens)
+std::shared_ptr<raw::MeshInstance> parse_mesh_instance(const std::vector<ObjToken>& tokens)
 {
     if (tokens.size() != 11)
         throw ObjError(fmt_error(g_file, g_line_num, "unsupported syntax for ",
@@ -772,7 +1450,7 @@ std::shared_ptr<raw::MeshInstance> parse_mesh_instance(const std::vector<std::st
                 "scaleX scaleY scaleZ; got ", tokens.size() - 1, get_call_stack()));
 
     // Find object by name
-    std::string mesh_name = tokens[1];
+    std::string mesh_name = tokens[1].str();
     int mesh_index = -1;
     for (size_t i = 0; i < g_raw_scene->meshes.size(); ++i)
     {
@@ -793,15 +1471,15 @@ std::shared_ptr<raw::MeshInstance> parse_mesh_instance(const std::vector<std::st
 
     // Parse translation
     for (size_t i = 2; i < 5; ++i)
-        translation[i - 2] = std::stof(tokens[i]);
+        translation[i - 2] = parse_number(tokens[i]);
 
     // Parse rotation angles and convert to radians
     for (size_t i = 5; i < 8; ++i)
-        rotation[i - 5] = std::stof(tokens[i]) * (float)pi / 180.0f;
+        rotation[i - 5] = parse_number(tokens[i]) * (float)pi / 180.0f;
 
     // Parse scale
     for (size_t i = 8; i < 11; ++i)
-        scaling[i - 8] = std::stof(tokens[i]);
+        scaling[i - 8] = parse_number(tokens[i]);
 
     // Generate final matrix: M = T * R * S
     Transform scale_xfm = scale(scaling);
@@ -809,47 +1487,57 @@ std::shared_ptr<raw::MeshInstance> parse_mesh_instance(const std::vector<std::st
     Transform rot_xfm = rotate_z(rotation[2]) * rotate_y(rotation[1]) * rotate_x(rotation[0]);
     Transform total_xfm = trans_xfm * rot_xfm * scale_xfm;
 
-    // Get mesh bbox and recalculate a new BBox for the mesh instance
-    BBox mesh_bbox = g_raw_scene->meshes[mesh_index]->get_bbox();
-    BBox inst_bbox = transform_bbox(total_xfm, mesh_bbox);
-
+    // The bbox is computed once the mesh triangles are built
     auto instance = std::make_shared<raw::MeshInstance>();
     instance->mesh_index = uint32_t(mesh_index);
-    instance->bbox = inst_bbox;
-    instance->centroid = inst_bbox.get_centroid();
     instance->transform = total_xfm;
 
     return instance;
 }
 
-float parse_float(const std::vector<std::string>& tokens)
+int32_t parse_index(const ObjToken& token)
+{
+    int index;
+    if (!to_int(token, &index))
+        throw LineError(fmt_message("could not parse index '", token, "'"));
+
+    return int32_t(index);
+}
+
+float parse_number(const ObjToken& token)
+{
+    float value;
+    if (!to_float(token, &value))
+        throw LineError(fmt_message("could not parse number '", token, "'"));
+
+    return value;
+}
+
+float parse_float(const std::vector<ObjToken>& tokens)
 {
     if (tokens.size() < 2)
-        throw ObjError(fmt_error(g_file, g_line_num,
-                  "unsupported syntax for '", tokens[0],
-                  "'; expected 1 arguments; got ", tokens.size() - 1, get_call_stack()));
+        throw LineError(fmt_message("unsupported syntax for '", tokens[0],
+                  "'; expected 1 arguments; got ", tokens.size() - 1));
 
-    return std::stof(tokens[1]);
+    return parse_number(tokens[1]);
 }
 
-Vec2 parse_vec2(const std::vector<std::string>& tokens)
+Vec2 parse_vec2(const std::vector<ObjToken>& tokens)
 {
     if (tokens.size() < 3)
-        throw ObjError(fmt_error(g_file, g_line_num,
-                  "unsupported syntax for '", tokens[0],
-                  "'; expected 2 arguments; got ", tokens.size() - 1, get_call_stack()));
+        throw LineError(fmt_message("unsupported syntax for '", tokens[0],
+                  "'; expected 2 arguments; got ", tokens.size() - 1));
 
-    return Vec2(std::stof(tokens[1]), std::stof(tokens[2]));
+    return Vec2(parse_number(tokens[1]), parse_number(tokens[2]));
 }
 
-Vec3 parse_vec3(const std::vector<std::string>& tokens)
+Vec3 parse_vec3(const std::vector<ObjToken>& tokens)
 {
     if (tokens.size() < 4)
-        throw ObjError(fmt_error(g_file, g_line_num,
-                  "unsupported syntax for '", tokens[0],
-                  "'; expected 3 arguments; got ", tokens.size() - 1, get_call_stack()));
+        throw LineError(fmt_message("unsupported syntax for '", tokens[0],
+                  "'; expected 3 arguments; got ", tokens.size() - 1));
 
-    return Vec3(std::stof(tokens[1]), std::stof(tokens[2]), std::stof(tokens[3]));
+    return Vec3(parse_number(tokens[1]), parse_number(tokens[2]), parse_number(tokens[3]));
 }
 
 } // anonymous namespace
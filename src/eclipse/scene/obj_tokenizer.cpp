@@ -0,0 +1,237 @@
+#include "eclipse/scene/obj_tokenizer.h"
+
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace eclipse { namespace scene {
+
+namespace {
+
+// Powers of ten that are exact in a double
+const double exact_powers_of_ten[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+constexpr int max_exact_power_of_ten = 22;
+constexpr uint64_t max_exact_mantissa = uint64_t(1) << 53;
+constexpr int max_mantissa_digits = 19;
+
+inline bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+inline bool is_digit(char c)
+{
+    return unsigned(c - '0') < 10;
+}
+
+// Numbers the fast path does not handle exactly go through strtof. The token
+// may end the mapped file, so it is copied and terminated first.
+bool strtof_token(const ObjToken& token, float* value)
+{
+    char buffer[64];
+    std::string long_token;
+    const char* str = buffer;
+
+    if (token.size() < sizeof(buffer))
+    {
+        std::memcpy(buffer, token.begin, token.size());
+        buffer[token.size()] = '\0';
+    }
+    else
+    {
+        long_token = token.str();
+        str = long_token.c_str();
+    }
+
+    char* end = nullptr;
+    const float result = std::strtof(str, &end);
+    if (end == str)
+        return false;
+
+    *value = result;
+    return true;
+}
+
+} // namespace
+
+std::ostream& operator<<(std::ostream& os, const ObjToken& token)
+{
+    return os.write(token.begin, std::streamsize(token.size()));
+}
+
+ObjTokenizer::ObjTokenizer(const char* begin, const char* end, size_t first_line_num)
+    : m_pos(begin), m_end(end), m_line_num(first_line_num - 1)
+{
+}
+
+bool ObjTokenizer::next_line(std::vector<ObjToken>& tokens)
+{
+    tokens.clear();
+    if (m_pos == m_end)
+        return false;
+
+    const char* p = m_pos;
+    const char* line_end = static_cast<const char*>(std::memchr(p, '\n', size_t(m_end - p)));
+    if (line_end == nullptr)
+        line_end = m_end;
+
+    while (true)
+    {
+        while (p < line_end && is_space(*p))
+            ++p;
+        if (p == line_end)
+            break;
+
+        const char* begin = p;
+        while (p < line_end && !is_space(*p))
+            ++p;
+        tokens.push_back(ObjToken{ begin, p });
+    }
+
+    m_pos = line_end == m_end ? m_end : line_end + 1;
+    ++m_line_num;
+    return true;
+}
+
+// Decimal numbers with at most 19 significant digits whose mantissa and power
+// of ten are exact in a double are converted with a single, correctly rounded
+// multiplication or division. Rounding that to a float gives the same result
+// as strtof unless the double lies exactly halfway between two floats; those,
+// and everything else (long mantissas, large exponents, hex, inf, nan,
+// trailing characters), go through strtof.
+bool to_float(const ObjToken& token, float* value)
+{
+    const char* p = token.begin;
+    const char* end = token.end;
+
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        negative = *p == '-';
+        ++p;
+    }
+
+    uint64_t mantissa = 0;
+    int num_digits = 0;
+    int exponent = 0;
+    bool has_digits = false;
+    bool truncated = false;
+
+    for (; p < end && is_digit(*p); ++p)
+    {
+        has_digits = true;
+        if (num_digits < max_mantissa_digits)
+        {
+            mantissa = mantissa * 10 + uint64_t(*p - '0');
+            num_digits += mantissa != 0;
+        }
+        else
+        {
+            truncated = true;
+        }
+    }
+
+    if (p < end && *p == '.')
+    {
+        for (++p; p < end && is_digit(*p); ++p)
+        {
+            has_digits = true;
+            if (num_digits < max_mantissa_digits)
+            {
+                mantissa = mantissa * 10 + uint64_t(*p - '0');
+                num_digits += mantissa != 0;
+                --exponent;
+            }
+            else
+            {
+                truncated = true;
+            }
+        }
+    }
+
+    if (!has_digits)
+        return strtof_token(token, value);
+
+    // An 'e' without digits is not part of the number
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        const char* q = p + 1;
+        bool negative_exponent = false;
+        if (q < end && (*q == '-' || *q == '+'))
+        {
+            negative_exponent = *q == '-';
+            ++q;
+        }
+
+        if (q < end && is_digit(*q))
+        {
+            int e = 0;
+            for (; q < end && is_digit(*q); ++q)
+                if (e < 10000)
+                    e = e * 10 + (*q - '0');
+            exponent += negative_exponent ? -e : e;
+            p = q;
+        }
+    }
+
+    if (p != end || truncated || mantissa > max_exact_mantissa ||
+        exponent < -max_exact_power_of_ten || exponent > max_exact_power_of_ten)
+        return strtof_token(token, value);
+
+    double result = double(mantissa);
+    if (exponent < 0)
+        result /= exact_powers_of_ten[-exponent];
+    else
+        result *= exact_powers_of_ten[exponent];
+
+    // The 29 bits a float drops are exactly one half
+    uint64_t bits;
+    std::memcpy(&bits, &result, sizeof(bits));
+    if ((bits & 0x1fffffff) == 0x10000000)
+        return strtof_token(token, value);
+
+    const float f = float(result);
+    *value = negative ? -f : f;
+    return true;
+}
+
+bool to_int(const ObjToken& token, int* value)
+{
+    const char* p = token.begin;
+    const char* end = token.end;
+
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        negative = *p == '-';
+        ++p;
+    }
+
+    if (p == end || !is_digit(*p))
+        return false;
+
+    int64_t result = 0;
+    for (; p < end && is_digit(*p); ++p)
+    {
+        result = result * 10 + (*p - '0');
+        if (result > int64_t(INT_MAX) + 1)
+            return false;
+    }
+
+    result = negative ? -result : result;
+    if (result > INT_MAX)
+        return false;
+
+    *value = int(result);
+    return true;
+}
+
+} } // namespace eclipse::scene
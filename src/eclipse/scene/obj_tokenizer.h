@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace eclipse { namespace scene {
+
+// A run of characters in the buffer being tokenized
+struct ObjToken
+{
+    const char* begin;
+    const char* end;
+
+    size_t size() const { return size_t(end - begin); }
+    bool empty() const { return begin == end; }
+    char front() const { return *begin; }
+    std::string str() const { return std::string(begin, end); }
+
+    template <size_t N>
+    bool operator==(const char (&str)[N]) const
+    {
+        return size() == N - 1 && std::memcmp(begin, str, N - 1) == 0;
+    }
+
+    template <size_t N>
+    bool operator!=(const char (&str)[N]) const { return !(*this == str); }
+};
+
+std::ostream& operator<<(std::ostream& os, const ObjToken& token);
+
+// Splits OBJ and MTL text into lines of whitespace separated tokens. The
+// tokens point into the buffer, so no memory is allocated once the token
+// vector has grown to the longest line.
+class ObjTokenizer
+{
+public:
+    ObjTokenizer(const char* begin, const char* end, size_t first_line_num = 1);
+
+    // Tokenizes the next line, which may be empty; returns false once all
+    // lines have been read
+    bool next_line(std::vector<ObjToken>& tokens);
+
+    // Number of the line last read
+    size_t get_line_num() const { return m_line_num; }
+
+private:
+    const char* m_pos;
+    const char* m_end;
+    size_t m_line_num;
+};
+
+// Parse the number at the start of the token the way std::stof and std::stoi
+// do, without needing a terminated string; return false if there is none
+bool to_float(const ObjToken& token, float* value);
+bool to_int(const ObjToken& token, int* value);
+
+} } // namespace eclipse::scene
@@ -14,25 +14,25 @@
 
 namespace eclipse { namespace raw {
 
+// Triangle indexing the vertex attributes of its mesh
 struct Triangle
 {
-    Vec3 vertices[3];
-    Vec3 normals[3];
-    Vec2 uvs[3];
+    uint32_t indices[3];
     uint32_t material_index;
 
-    BBox bbox;
-    Vec3 centroid;
-
-    Triangle() : material_index(0) { }
-
-    BBox get_bbox() const { return bbox; }
-    Vec3 get_centroid() const { return centroid; }
+    Triangle() : indices{ 0, 0, 0 }, material_index(0) { }
 };
 
+// Indexed triangle mesh. The vertex, normal and uv lists have one entry per
+// vertex; vertices are shared by the triangles using the same position,
+// normal and uv, and every vertex is used by a triangle. Triangle bounds are
+// computed when needed.
 struct Mesh
 {
     std::string name;
+    std::vector<Vec3> vertices;
+    std::vector<Vec3> normals;
+    std::vector<Vec2> uvs;
     std::vector<Triangle> triangles;
 
     BBox bbox;
@@ -47,13 +47,25 @@ struct Mesh
         if (bbox_needs_update)
         {
             bbox = BBox();
-            for (auto tri : triangles)
-                bbox.merge(tri.get_bbox());
+            for (auto& vertex : vertices)
+                bbox.merge(vertex);
             bbox_needs_update = false;
         }
         return bbox;
     }
 
+    BBox get_triangle_bbox(size_t index) const
+    {
+        const uint32_t* indices = triangles[index].indices;
+        return BBox(vertices[indices[0]], vertices[indices[1]], vertices[indices[2]]);
+    }
+
+    Vec3 get_triangle_centroid(size_t index) const
+    {
+        const uint32_t* indices = triangles[index].indices;
+        return (vertices[indices[0]] + vertices[indices[1]] + vertices[indices[2]]) * (1.0f / 3.0f);
+    }
+
     ~Mesh()
     {
         //LOG_DEBUG("Mesh ", name, " deleted");
@@ -98,6 +110,16 @@ struct Material
 
 typedef std::shared_ptr<Material> MaterialPtr;
 
+// A file a scene was read from and the hash of the bytes read from it, taken
+// when they were read so that later edits are told apart; missing files are
+// recorded too
+struct SourceFile
+{
+    std::string path;
+    bool exists;
+    uint64_t hash;
+};
+
 struct Camera
 {
     float fov;
@@ -114,6 +136,9 @@ struct Scene
     std::vector<std::shared_ptr<MeshInstance>> mesh_instances;
     std::vector<std::shared_ptr<Material>> materials;
     Camera camera;
+
+    // The OBJ and MTL files the scene was loaded from
+    std::vector<SourceFile> source_files;
 };
 
 } } // namespace eclipse::raw
@@ -1,82 +1,132 @@
 #include "eclipse/scene/scene.h"
+#include "eclipse/util/serializer.h"
 #include "eclipse/util/except.h"
 
 #include <string>
 #include <sstream>
-#include <istream>
-#include <ostream>
 #include <iomanip>
+#include <cstdint>
 #include <cstdio>
 
 namespace eclipse { namespace scene {
 
-template <typename T>
-void read_many(std::istream& is, T* value, size_t num)
-{
-    if (is.good())
-        is.read((char*)value, sizeof(T) * num);
-    if (is.fail())
-        throw Error("read_many: failed to read scene from stream");
-}
+namespace {
+
+// Sequential reads and writes in the stream layout: each array is its
+// element count as a size_t followed by the elements
 
 template <typename T>
-void write_many(std::ostream& os, const T* value, size_t num)
+void read_many(const Reader& reader, uint64_t& offset, T* value, size_t num)
 {
-    if (os.good())
-        os.write((char*)value, sizeof(T) * num);
-    if (os.fail())
-        throw Error("write_many: failed to write scene to stream");
+    reader.read(offset, value, sizeof(T) * num);
+    offset += sizeof(T) * num;
 }
 
 template <typename T>
-void read_vec(std::istream& is, std::vector<T>& vec)
+void read_vec(const Reader& reader, uint64_t& offset, Array<T>& vec)
 {
     size_t size;
-    read_many(is, &size, 1);
-    vec.resize(size);
-    read_many(is, &vec[0], size);
+    read_many(reader, offset, &size, 1);
+
+    // Check the count before allocating for it
+    if (size > (reader.get_size() - offset) / sizeof(T))
+        throw Error("read_vec: array of " + std::to_string(size) + " elements is larger than the scene data");
+
+    vec.resize_uninitialized(size);
+    read_many(reader, offset, vec.data(), size);
 }
 
-template <typename T>
-void write_vec(std::ostream& os, const std::vector<T>& vec)
+} // namespace
+
+void Scene::set_unindexed_geometry(const Array<Vec4>& corner_vertices, const Array<Vec4>& corner_normals,
+                                   const Array<Vec2>& corner_uvs)
 {
-    size_t size = vec.size();
-    write_many(os, &size, 1);
-    write_many(os, &vec[0], vec.size());
+    const int64_t num_corners = int64_t(corner_vertices.size());
+    vertices.resize_uninitialized(size_t(num_corners));
+    normals.resize_uninitialized(size_t(num_corners));
+    uvs.resize_uninitialized(size_t(num_corners));
+    indices.resize_uninitialized(size_t(num_corners));
+
+    Vec3* vertex_data = vertices.data();
+    Vec3* normal_data = normals.data();
+    Vec2* uv_data = uvs.data();
+    uint32_t* index_data = indices.data();
+
+#pragma omp parallel for
+    for (int64_t i = 0; i < num_corners; ++i)
+    {
+        vertex_data[i] = Vec3(&corner_vertices[i].x);
+        normal_data[i] = Vec3(&corner_normals[i].x);
+        uv_data[i] = corner_uvs[i];
+        index_data[i] = uint32_t(i);
+    }
 }
 
-void Scene::deserialize(std::istream& is)
+void Scene::encode_vertex_attributes(bool encode_normals, bool encode_uvs)
 {
-    read_vec(is, bvh_nodes);
-    read_vec(is, mesh_instances);
-    read_vec(is, material_nodes);
-    read_vec(is, emissive_primitives);
-    read_vec(is, texture_data);
-    read_vec(is, texture_metadata);
-    read_vec(is, vertices);
-    read_vec(is, normals);
-    read_vec(is, uvs);
-    read_vec(is, material_indices);
-    read_many(is, &scene_diffuse_mat_index, 1);
-    read_many(is, &scene_emissive_mat_index, 1);
-    read_many(is, &camera, 1);
+    if (encode_normals && oct_normals.empty())
+    {
+        const int64_t num_normals = int64_t(normals.size());
+        oct_normals.resize_uninitialized(size_t(num_normals));
+
+        const Vec3* normal_data = static_cast<const Array<Vec3>&>(normals).data();
+        uint32_t* oct_data = oct_normals.data();
+
+#pragma omp parallel for
+        for (int64_t i = 0; i < num_normals; ++i)
+            oct_data[i] = encode_oct(normal_data[i]);
+
+        normals.clear();
+    }
+
+    if (encode_uvs && half_uvs.empty())
+    {
+        const int64_t num_uvs = int64_t(uvs.size());
+        half_uvs.resize_uninitialized(size_t(num_uvs));
+
+        const Vec2* uv_data = static_cast<const Array<Vec2>&>(uvs).data();
+        uint32_t* half_data = half_uvs.data();
+
+#pragma omp parallel for
+        for (int64_t i = 0; i < num_uvs; ++i)
+            half_data[i] = encode_half2(uv_data[i]);
+
+        uvs.clear();
+    }
 }
 
-void Scene::serialize(std::ostream& os) const
+void Scene::deserialize(const Reader& reader)
 {
-    write_vec(os, bvh_nodes);
-    write_vec(os, mesh_instances);
-    write_vec(os, material_nodes);
-    write_vec(os, emissive_primitives);
-    write_vec(os, texture_data);
-    write_vec(os, texture_metadata);
-    write_vec(os, vertices);
-    write_vec(os, normals);
-    write_vec(os, uvs);
-    write_vec(os, material_indices);
-    write_many(os, &scene_diffuse_mat_index, 1);
-    write_many(os, &scene_emissive_mat_index, 1);
-    write_many(os, &camera, 1);
+    uint64_t offset = 0;
+    read_vec(reader, offset, bvh_nodes);
+    read_vec(reader, offset, mesh_instances);
+    read_vec(reader, offset, material_nodes);
+    read_vec(reader, offset, emissive_primitives);
+    read_vec(reader, offset, texture_data);
+    read_vec(reader, offset, texture_metadata);
+
+    // The stream layout stores three vertices per primitive
+    Array<Vec4> corner_vertices;
+    Array<Vec4> corner_normals;
+    Array<Vec2> corner_uvs;
+    read_vec(reader, offset, corner_vertices);
+    read_vec(reader, offset, corner_normals);
+    read_vec(reader, offset, corner_uvs);
+    read_vec(reader, offset, material_indices);
+
+    const size_t num_primitives = material_indices.size();
+    if (corner_vertices.size() != 3 * num_primitives || corner_normals.size() != 3 * num_primitives ||
+        corner_uvs.size() != 3 * num_primitives)
+        throw Error("deserialize: vertex arrays do not match the " + std::to_string(num_primitives) + " primitives");
+
+    set_unindexed_geometry(corner_vertices, corner_normals, corner_uvs);
+
+    read_many(reader, offset, &scene_diffuse_mat_index, 1);
+    read_many(reader, offset, &scene_emissive_mat_index, 1);
+    read_many(reader, offset, &camera, 1);
+
+    if (offset != reader.get_size())
+        throw Error("deserialize: " + std::to_string(reader.get_size() - offset) + " trailing bytes after the scene");
 }
 
 std::string size_str(float size)
@@ -92,13 +142,13 @@ std::string size_str(float size)
 }
 
 template <typename T>
-size_t vec_size(const std::vector<T>& v)
+size_t vec_size(const Array<T>& v)
 {
     return sizeof(T) * v.size();
 }
 
 template <typename T>
-std::string vec_size_str(const std::vector<T>& v)
+std::string vec_size_str(const Array<T>& v)
 {
     return size_str(vec_size(v));
 }
@@ -109,10 +159,13 @@ std::string Scene::get_stats() const
 
     ss << "scene statistics:\n\n";
 
-    size_t total_size = vec_size(vertices) + vec_size(normals) + vec_size(uvs) + vec_size(bvh_nodes) +
+    size_t total_size = vec_size(vertices) + vec_size(normals) + vec_size(uvs) + vec_size(indices) +
+                        vec_size(oct_normals) + vec_size(half_uvs) + vec_size(bvh_nodes) +
+                        vec_size(bvh4_nodes) + vec_size(bvh8_nodes) +
                         vec_size(mesh_instances) + vec_size(emissive_primitives) +
                         vec_size(material_indices) + vec_size(material_nodes) +
-                        vec_size(texture_metadata) + vec_size(texture_data);
+                        vec_size(texture_metadata) + vec_size(texture_levels) + vec_size(texture_data) +
+                        vec_size(texture_tiles) + vec_size(texture_tile_data);
     size_t col1w = 18;
     size_t col2w = 18;
     size_t col3w = 18;
@@ -122,10 +175,25 @@ std::string Scene::get_stats() const
     ss << std::setw(titleoff - 4) << ' ' << "Geometry" << "\n"
        << " " << std::setfill('-') << std::setw(totalw) << '-' << "\n" << std::setfill(' ');
 
-    ss << std::setw(col1w) << "Vertices: "  << std::setw(col2w) << vertices.size()  << std::setw(col3w) << vec_size_str(vertices)  << "\n"
-       << std::setw(col1w) << "Normals: "   << std::setw(col2w) << normals.size()   << std::setw(col3w) << vec_size_str(normals)   << "\n"
-       << std::setw(col1w) << "UVs: "       << std::setw(col2w) << uvs.size()       << std::setw(col3w) << vec_size_str(uvs)       << "\n"
-       << std::setw(col1w) << "BVH nodes: " << std::setw(col2w) << bvh_nodes.size() << std::setw(col3w) << vec_size_str(bvh_nodes) << "\n\n";
+    ss << std::setw(col1w) << "Vertices: "  << std::setw(col2w) << vertices.size()  << std::setw(col3w) << vec_size_str(vertices)  << "\n";
+
+    if (oct_normals.empty())
+        ss << std::setw(col1w) << "Normals: "     << std::setw(col2w) << normals.size()     << std::setw(col3w) << vec_size_str(normals)     << "\n";
+    else
+        ss << std::setw(col1w) << "Oct normals: " << std::setw(col2w) << oct_normals.size() << std::setw(col3w) << vec_size_str(oct_normals) << "\n";
+    if (half_uvs.empty())
+        ss << std::setw(col1w) << "UVs: "         << std::setw(col2w) << uvs.size()         << std::setw(col3w) << vec_size_str(uvs)         << "\n";
+    else
+        ss << std::setw(col1w) << "Half UVs: "    << std::setw(col2w) << half_uvs.size()    << std::setw(col3w) << vec_size_str(half_uvs)    << "\n";
+
+    ss << std::setw(col1w) << "Indices: "   << std::setw(col2w) << indices.size()   << std::setw(col3w) << vec_size_str(indices)   << "\n"
+       << std::setw(col1w) << "BVH nodes: " << std::setw(col2w) << bvh_nodes.size() << std::setw(col3w) << vec_size_str(bvh_nodes) << "\n";
+
+    if (!bvh4_nodes.empty())
+        ss << std::setw(col1w) << "BVH4 nodes: " << std::setw(col2w) << bvh4_nodes.size() << std::setw(col3w) << vec_size_str(bvh4_nodes) << "\n";
+    if (!bvh8_nodes.empty())
+        ss << std::setw(col1w) << "BVH8 nodes: " << std::setw(col2w) << bvh8_nodes.size() << std::setw(col3w) << vec_size_str(bvh8_nodes) << "\n";
+    ss << "\n";
 
     ss << std::setw(titleoff - 7) << ' ' << "Mesh/emissives" << "\n"
        << " " << std::setfill('-') << std::setw(totalw) << '-' << "\n" << std::setfill(' ');
@@ -142,13 +210,18 @@ std::string Scene::get_stats() const
     ss << std::setw(titleoff - 4) << ' ' << "Textures" << "\n"
        << " " << std::setfill('-') << std::setw(totalw) << '-' << "\n" << std::setfill(' ');
 
-    ss << std::setw(col1w) << "Metadata: " << std::setw(col2w) << texture_metadata.size() << std::setw(col3w) << vec_size_str(texture_metadata) << "\n"
-       << std::setw(col1w) << "Data: "     << std::setw(col2w) << texture_data.size()     << std::setw(col3w) << vec_size_str(texture_data)     << "\n\n";
+    ss << std::setw(col1w) << "Metadata: " << std::setw(col2w) << texture_metadata.size() << std::setw(col3w) << vec_size_str(texture_metadata) << "\n";
+    if (!texture_levels.empty())
+        ss << std::setw(col1w) << "Mip chains: " << std::setw(col2w) << texture_levels.size() << std::setw(col3w) << vec_size_str(texture_levels) << "\n";
+    if (texture_tiles.empty())
+        ss << std::setw(col1w) << "Data: "     << std::setw(col2w) << texture_data.size()     << std::setw(col3w) << vec_size_str(texture_data)     << "\n\n";
+    else
+        ss << std::setw(col1w) << "Tile data: " << std::setw(col2w) << texture_tile_data.size() << std::setw(col3w) << vec_size_str(texture_tile_data) << "\n\n";
 
     ss << " " << std::setfill('-') << std::setw(totalw) << '-' << "\n" << std::setfill(' ')
        << std::setw(col1w) << "Total: "     << std::setw(col2w) << ' ' << std::setw(col3w) << size_str(total_size) << "\n\n";
 
-    return std::move(ss.str());
+    return ss.str();
 }
 
 } } // namespace eclipse::scene
@@ -1,26 +1,33 @@
 #pragma once
 
 #include "eclipse/scene/bvh_node.h"
+#include "eclipse/scene/bvh_wide_node.h"
 #include "eclipse/scene/material_node.h"
 #include "eclipse/scene/camera.h"
 #include "eclipse/math/vec2.h"
+#include "eclipse/math/vec3.h"
 #include "eclipse/math/vec4.h"
 #include "eclipse/math/mat4.h"
+#include "eclipse/math/packing.h"
 #include "eclipse/util/texture.h"
+#include "eclipse/util/array.h"
 
 #include <string>
 #include <cstdint>
 #include <vector>
-#include <istream>
-#include <ostream>
 
-namespace eclipse { namespace scene {
+namespace eclipse {
+
+class Reader;
+
+namespace scene {
 
 struct MeshInstance
 {
     uint32_t mesh_index;
     uint32_t bvh_root;
-    uint32_t padding[2];
+    uint32_t wide_bvh_root;
+    uint32_t padding;
     Mat4 transform;
 };
 
@@ -32,6 +39,31 @@ struct TextureMetadata
     uint32_t offset;
 };
 
+constexpr uint32_t max_texture_levels = 16;
+
+// Mip chain of a texture. Level 0 is the texture its TextureMetadata
+// describes; each further level halves the size of the previous one, see
+// util/mip_map.h, and is stored in the same format at its offset into the
+// texture data. All levels are stored in the TextureLayout given by layout,
+// see util/texture_layout.h.
+struct TextureLevels
+{
+    uint32_t num_levels;
+    uint32_t layout;
+    uint32_t offsets[max_texture_levels];
+};
+
+// Tiles of a texture compiled for paging. The tiles of each level of its mip
+// chain, see util/texture_tiles.h, are stored from its offset into the tile
+// data. All tiles of a texture take tile_size bytes, so a level smaller than
+// a tile still takes a whole one.
+struct TextureTiles
+{
+    uint32_t tile_size;
+    uint32_t padding;
+    uint64_t offsets[max_texture_levels];
+};
+
 struct EmissivePrimitive
 {
     Mat4 transform;
@@ -47,22 +79,49 @@ enum EmissivePrimitiveType
     EnvironmentLight
 };
 
+// Arrays either own their elements or view the memory mapping of the file
+// the scene was read from; see scene_file.h.
 struct Scene
 {
-    std::vector<bvh::Node> bvh_nodes;
-    std::vector<MeshInstance> mesh_instances;
-    std::vector<material::Node> material_nodes;
-    std::vector<EmissivePrimitive> emissive_primitives;
+    Array<bvh::Node> bvh_nodes;
+
+    // Optional wide versions of bvh_nodes; at most one of them is used
+    Array<bvh::Node4> bvh4_nodes;
+    Array<bvh::Node8> bvh8_nodes;
+
+    Array<MeshInstance> mesh_instances;
+    Array<material::Node> material_nodes;
+    Array<EmissivePrimitive> emissive_primitives;
 
     // Texture definitions and the associated data
-    std::vector<uint8_t> texture_data;
-    std::vector<TextureMetadata> texture_metadata;
+    Array<uint8_t> texture_data;
+    Array<TextureMetadata> texture_metadata;
+
+    // Mip chains and layouts of the textures, one per texture metadata, or
+    // none if the scene was compiled with neither; textures are then linear
+    // single levels
+    Array<TextureLevels> texture_levels;
+
+    // Tiles of the textures, one per texture metadata, or none unless the
+    // scene was compiled for paging textures in on demand; texture_data is
+    // then empty. Levels and formats still come from texture_levels and
+    // texture_metadata.
+    Array<TextureTiles> texture_tiles;
+    Array<uint8_t> texture_tile_data;
 
-    // Primitives are stored as an array of structs
-    std::vector<Vec4> vertices;
-    std::vector<Vec4> normals;
-    std::vector<Vec2> uvs;
-    std::vector<uint32_t> material_indices;
+    // Vertex attributes, shared by the primitives of a mesh. Each primitive
+    // is a triangle given by three consecutive indices into them.
+    Array<Vec3> vertices;
+    Array<Vec3> normals;
+    Array<Vec2> uvs;
+    Array<uint32_t> indices;
+    Array<uint32_t> material_indices;
+
+    // Compact alternatives to normals and uvs, chosen at compile time:
+    // octahedral normals and half float uvs; see math/packing.h. A scene
+    // stores each attribute in one of the two encodings.
+    Array<uint32_t> oct_normals;
+    Array<uint32_t> half_uvs;
 
     // Indices to material nodes for storing the scene global
     // properties such as diffuse and emissive colors
@@ -71,8 +130,29 @@ struct Scene
 
     Camera camera;
 
-    void serialize(std::ostream& os) const;
-    void deserialize(std::istream& is);
+    size_t get_num_primitives() const { return material_indices.size(); }
+
+    // Attributes of a vertex in whichever encoding the scene stores
+    Vec3 get_normal(uint32_t vertex) const
+    {
+        return oct_normals.empty() ? normals[vertex] : decode_oct(oct_normals[vertex]);
+    }
+
+    Vec2 get_uv(uint32_t vertex) const
+    {
+        return half_uvs.empty() ? uvs[vertex] : decode_half2(half_uvs[vertex]);
+    }
+
+    // Replaces normals and uvs by their compact encodings
+    void encode_vertex_attributes(bool encode_normals, bool encode_uvs);
+
+    // Sets the geometry from three vertices per primitive, the layout of
+    // scenes compiled before primitives were indexed
+    void set_unindexed_geometry(const Array<Vec4>& corner_vertices, const Array<Vec4>& corner_normals,
+                                const Array<Vec2>& corner_uvs);
+
+    // Reads the stream layout of scenes compiled before the .bin container
+    void deserialize(const Reader& reader);
 
     std::string get_stats() const;
 };
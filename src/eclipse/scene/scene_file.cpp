@@ -0,0 +1,693 @@
+#include "eclipse/scene/scene_file.h"
+#include "eclipse/scene/scene.h"
+#include "eclipse/scene/compile_record.h"
+#include "eclipse/scene/camera.h"
+#include "eclipse/math/vec2.h"
+#include "eclipse/math/vec3.h"
+#include "eclipse/util/serializer.h"
+#include "eclipse/util/file_util.h"
+#include "eclipse/util/array.h"
+#include "eclipse/util/logger.h"
+#include "eclipse/util/stop_watch.h"
+#include "eclipse/util/texture_layout.h"
+#include "eclipse/util/texture_tiles.h"
+#include "eclipse/util/mip_map.h"
+#include "eclipse/util/block_compression.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include <zlib.h>
+#include <omp.h>
+
+namespace eclipse { namespace scene {
+
+namespace {
+
+auto logger = Logger::create("scene_file");
+
+constexpr uint32_t num_section_types = SECTION_TEXTURE_TILE_DATA + 1;
+
+// Contents of the globals section
+struct SceneGlobals
+{
+    int32_t scene_diffuse_mat_index;
+    int32_t scene_emissive_mat_index;
+    Camera camera;
+};
+
+uint64_t align_offset(uint64_t offset)
+{
+    return (offset + scene_file_alignment - 1) / scene_file_alignment * scene_file_alignment;
+}
+
+// CRC-32 of `size` bytes at `data`, one chunk per thread
+uint32_t compute_checksum(const uint8_t* data, uint64_t size)
+{
+    const int64_t num_chunks = int64_t((size + scene_file_chunk_size - 1) / scene_file_chunk_size);
+    std::vector<uLong> checksums(static_cast<size_t>(num_chunks));
+
+#pragma omp parallel for schedule(dynamic)
+    for (int64_t i = 0; i < num_chunks; ++i)
+    {
+        const uint64_t begin = uint64_t(i) * scene_file_chunk_size;
+        const uInt length = uInt(std::min(scene_file_chunk_size, size - begin));
+        checksums[i] = crc32(crc32(0, Z_NULL, 0), data + begin, length);
+    }
+
+    uLong checksum = crc32(0, Z_NULL, 0);
+    for (int64_t i = 0; i < num_chunks; ++i)
+    {
+        const uint64_t begin = uint64_t(i) * scene_file_chunk_size;
+        const z_off_t length = z_off_t(std::min(scene_file_chunk_size, size - begin));
+        checksum = crc32_combine(checksum, checksums[i], length);
+    }
+    return uint32_t(checksum);
+}
+
+class SectionWriter
+{
+public:
+    SectionWriter(Writer& writer, uint32_t num_sections, bool compress)
+        : m_writer(writer), m_compress(compress), m_written_end(0)
+    {
+        m_offset = align_offset(sizeof(FileHeader) + num_sections * sizeof(SectionEntry));
+    }
+
+    // Sections that are not compressible are stored as is even when
+    // compressing
+    template <typename T>
+    void write(SectionType type, const Array<T>& array, bool compressible = true)
+    {
+        write(type, array.data(), sizeof(T), array.size() * sizeof(T), compressible);
+    }
+
+    void write(SectionType type, const void* data, uint64_t element_size, uint64_t size, bool compressible = true)
+    {
+        SectionEntry entry;
+        entry.type = type;
+        entry.compression = COMPRESSION_NONE;
+        entry.checksum = 0;
+        entry.reserved = 0;
+        entry.element_size = element_size;
+        entry.offset = m_offset;
+        entry.stored_size = size;
+        entry.size = size;
+
+        // Sections smaller than a page take a page either way
+        if (m_compress && compressible && size >= scene_file_alignment)
+        {
+            entry.compression = COMPRESSION_ZLIB;
+            entry.stored_size = write_chunks(entry.offset, static_cast<const uint8_t*>(data), size, &entry.checksum);
+        }
+        else
+        {
+            m_writer.write(entry.offset, data, size);
+            entry.checksum = compute_checksum(static_cast<const uint8_t*>(data), size);
+        }
+
+        if (entry.stored_size > 0)
+            m_written_end = entry.offset + entry.stored_size;
+        m_offset = align_offset(entry.offset + entry.stored_size);
+        m_sections.push_back(entry);
+    }
+
+    const std::vector<SectionEntry>& get_sections() const { return m_sections; }
+
+    // Pads the file to the end of the last section
+    uint64_t finish()
+    {
+        if (m_written_end < m_offset)
+        {
+            const uint8_t zero = 0;
+            m_writer.write(m_offset - 1, &zero, 1);
+        }
+        return m_offset;
+    }
+
+private:
+    // Writes `data` as compressed chunks at `offset` and returns the number
+    // of bytes written. Chunks are compressed in parallel a batch at a time,
+    // so memory use does not grow with the section size.
+    uint64_t write_chunks(uint64_t offset, const uint8_t* data, uint64_t size, uint32_t* checksum)
+    {
+        ChunkIndex index;
+        index.chunk_size = scene_file_chunk_size;
+        index.num_chunks = (size + scene_file_chunk_size - 1) / scene_file_chunk_size;
+
+        // The index is written once the chunk ends are known
+        std::vector<uint64_t> chunk_ends(index.num_chunks, 0);
+        const uint64_t index_size = sizeof(index) + chunk_ends.size() * sizeof(uint64_t);
+        uint64_t stored_size = index_size;
+        uLong chunks_checksum = crc32(0, Z_NULL, 0);
+
+        const uint64_t batch_size = 4 * uint64_t(omp_get_max_threads());
+        std::vector<std::vector<Bytef>> buffers(batch_size);
+
+        for (uint64_t first = 0; first < index.num_chunks; first += batch_size)
+        {
+            const int64_t count = int64_t(std::min(batch_size, index.num_chunks - first));
+            bool failed = false;
+
+#pragma omp parallel for schedule(dynamic) reduction(||:failed)
+            for (int64_t i = 0; i < count; ++i)
+            {
+                const uint64_t begin = (first + uint64_t(i)) * scene_file_chunk_size;
+                const uLong raw_size = uLong(std::min(scene_file_chunk_size, size - begin));
+
+                uLongf compressed_size = compressBound(raw_size);
+                buffers[i].resize(compressed_size);
+                if (compress(buffers[i].data(), &compressed_size, data + begin, raw_size) != Z_OK)
+                    failed = true;
+
+                // Keep chunks that do not compress as they are
+                if (compressed_size >= raw_size)
+                    buffers[i].assign(data + begin, data + begin + raw_size);
+                else
+                    buffers[i].resize(compressed_size);
+            }
+
+            if (failed)
+                throw IOError("scene file: could not compress section data");
+
+            for (int64_t i = 0; i < count; ++i)
+            {
+                m_writer.write(offset + stored_size, buffers[i].data(), buffers[i].size());
+                chunks_checksum = crc32(chunks_checksum, buffers[i].data(), uInt(buffers[i].size()));
+                stored_size += buffers[i].size();
+                chunk_ends[first + uint64_t(i)] = stored_size;
+            }
+        }
+
+        m_writer.write(offset, &index, sizeof(index));
+        m_writer.write(offset + sizeof(index), chunk_ends.data(), chunk_ends.size() * sizeof(uint64_t));
+
+        // The checksum covers the stored bytes, index included
+        uLong index_checksum = crc32(crc32(0, Z_NULL, 0), reinterpret_cast<const Bytef*>(&index), sizeof(index));
+        index_checksum = crc32(index_checksum, reinterpret_cast<const Bytef*>(chunk_ends.data()),
+                               uInt(chunk_ends.size() * sizeof(uint64_t)));
+        *checksum = uint32_t(crc32_combine(index_checksum, chunks_checksum, z_off_t(stored_size - index_size)));
+
+        return stored_size;
+    }
+
+private:
+    Writer& m_writer;
+    bool m_compress;
+    uint64_t m_offset;
+    uint64_t m_written_end;
+    std::vector<SectionEntry> m_sections;
+};
+
+// Inflates the chunks of a compressed section in parallel; returns false if
+// the section is corrupt
+bool inflate_chunks(const uint8_t* stored, uint64_t stored_size, uint8_t* data, uint64_t size)
+{
+    ChunkIndex index;
+    if (stored_size < sizeof(index))
+        return false;
+    std::memcpy(&index, stored, sizeof(index));
+
+    if (index.chunk_size == 0 || index.num_chunks != (size + index.chunk_size - 1) / index.chunk_size ||
+        index.num_chunks > (stored_size - sizeof(index)) / sizeof(uint64_t))
+        return false;
+
+    std::vector<uint64_t> chunk_ends(index.num_chunks);
+    std::memcpy(chunk_ends.data(), stored + sizeof(index), chunk_ends.size() * sizeof(uint64_t));
+
+    uint64_t chunk_begin = sizeof(index) + chunk_ends.size() * sizeof(uint64_t);
+    for (uint64_t end : chunk_ends)
+    {
+        if (end < chunk_begin || end > stored_size)
+            return false;
+        chunk_begin = end;
+    }
+
+    const int64_t num_chunks = int64_t(index.num_chunks);
+    bool failed = false;
+
+#pragma omp parallel for schedule(dynamic) reduction(||:failed)
+    for (int64_t i = 0; i < num_chunks; ++i)
+    {
+        const uint64_t begin = i == 0 ? sizeof(index) + chunk_ends.size() * sizeof(uint64_t) : chunk_ends[i - 1];
+        const uint64_t chunk_stored_size = chunk_ends[i] - begin;
+        const uint64_t offset = uint64_t(i) * index.chunk_size;
+        const uint64_t raw_size = std::min(index.chunk_size, size - offset);
+
+        if (chunk_stored_size == raw_size)
+        {
+            std::memcpy(data + offset, stored + begin, raw_size);
+            continue;
+        }
+
+        uLongf inflated_size = uLongf(raw_size);
+        if (uncompress(data + offset, &inflated_size, stored + begin, uLong(chunk_stored_size)) != Z_OK ||
+            inflated_size != raw_size)
+            failed = true;
+    }
+
+    return !failed;
+}
+
+void verify_section(const SectionEntry& entry, const uint8_t* stored)
+{
+    if (compute_checksum(stored, entry.stored_size) != entry.checksum)
+        throw IOError("scene file: checksum mismatch in section " + std::to_string(entry.type));
+}
+
+// Reads a section straight into its array. Uncompressed sections of readers
+// holding the data in memory become views of it, and are only checksummed
+// when asked to, as that would touch every page. Sections that are copied
+// anyway are always checked.
+template <typename T>
+void read_section(const Reader& reader, const SectionEntry* entry, bool verify, Array<T>* array)
+{
+    // Sections missing from the file are empty arrays
+    if (entry == nullptr)
+    {
+        array->clear();
+        return;
+    }
+
+    if (entry->element_size != sizeof(T) || entry->size % sizeof(T) != 0)
+        throw IOError("scene file: section " + std::to_string(entry->type) + " has elements of " +
+                      std::to_string(entry->element_size) + " bytes; expected " + std::to_string(sizeof(T)));
+
+    const size_t count = size_t(entry->size / sizeof(T));
+    const uint8_t* data = reader.get_data();
+
+    if (entry->compression == COMPRESSION_NONE)
+    {
+        if (data != nullptr)
+        {
+            if (verify)
+                verify_section(*entry, data + entry->offset);
+            *array = Array<T>::view(reinterpret_cast<const T*>(data + entry->offset), count, reader.get_owner());
+            return;
+        }
+
+        array->resize_uninitialized(count);
+        reader.read(entry->offset, array->data(), entry->size);
+        verify_section(*entry, reinterpret_cast<const uint8_t*>(array->data()));
+        return;
+    }
+
+    Array<uint8_t> buffer;
+    const uint8_t* stored = nullptr;
+    if (data != nullptr)
+    {
+        reader.prefetch(entry->offset, entry->stored_size);
+        stored = data + entry->offset;
+    }
+    else
+    {
+        buffer.resize_uninitialized(size_t(entry->stored_size));
+        reader.read(entry->offset, buffer.data(), entry->stored_size);
+        stored = buffer.data();
+    }
+    verify_section(*entry, stored);
+
+    array->resize_uninitialized(count);
+    if (!inflate_chunks(stored, entry->stored_size, reinterpret_cast<uint8_t*>(array->data()), entry->size))
+        throw IOError("scene file: corrupt section " + std::to_string(entry->type));
+}
+
+// Bytes of a texture level as the tracer reads it
+uint64_t get_level_size(uint32_t format, TextureLayout layout, uint32_t width, uint32_t height)
+{
+    if (is_block_compressed(format))
+        return get_compressed_size(Texture::Format(format), width, height);
+    return uint64_t(get_layout_texels(get_level_layout(layout, width, height), width, height)) *
+           get_texel_size(Texture::Format(format));
+}
+
+// Every level of every texture has to lie within the texture data, and
+// every tile of every level of paged textures within the tile data
+void validate_textures(const Scene& scene)
+{
+    const Array<TextureMetadata>& metadata = scene.texture_metadata;
+    const Array<TextureLevels>& levels = scene.texture_levels;
+    const Array<TextureTiles>& tiles = scene.texture_tiles;
+
+    if (!levels.empty() && levels.size() != metadata.size())
+        throw IOError("scene file: mip chains do not match the " + std::to_string(metadata.size()) + " textures");
+    if (!tiles.empty() && (tiles.size() != metadata.size() || levels.size() != metadata.size()))
+        throw IOError("scene file: texture tiles do not match the " + std::to_string(metadata.size()) + " textures");
+
+    for (size_t texture = 0; texture < metadata.size(); ++texture)
+    {
+        const TextureMetadata& meta = metadata[texture];
+        if (meta.format > Texture::BC6H || meta.width == 0 || meta.height == 0)
+            throw IOError("scene file: texture " + std::to_string(texture) + " has an unknown format or no texels");
+
+        uint32_t num_levels = 1;
+        TextureLayout layout = LinearTextureLayout;
+        if (!levels.empty())
+        {
+            num_levels = levels[texture].num_levels;
+            if (num_levels == 0 || num_levels > max_texture_levels)
+                throw IOError("scene file: mip chain of " + std::to_string(num_levels) + " levels");
+            if (levels[texture].layout > MortonTextureLayout)
+                throw IOError("scene file: unknown texture layout " + std::to_string(levels[texture].layout));
+            layout = TextureLayout(levels[texture].layout);
+        }
+
+        if (!tiles.empty())
+        {
+            if (tiles[texture].tile_size != get_texture_tile_size(Texture::Format(meta.format)) ||
+                tiles[texture].tile_size == 0)
+                throw IOError("scene file: tiles of texture " + std::to_string(texture) + " do not match its format");
+        }
+
+        for (uint32_t level = 0; level < num_levels; ++level)
+        {
+            const uint32_t width = get_mip_size(meta.width, level);
+            const uint32_t height = get_mip_size(meta.height, level);
+            if (!tiles.empty())
+            {
+                const uint64_t num_tiles = uint64_t(get_num_texture_tiles(width)) * get_num_texture_tiles(height);
+                const uint64_t offset = tiles[texture].offsets[level];
+                if (offset > scene.texture_tile_data.size() ||
+                    num_tiles * tiles[texture].tile_size > scene.texture_tile_data.size() - offset)
+                    throw IOError("scene file: tiles of texture " + std::to_string(texture) + " lie outside of the tile data");
+            }
+            else
+            {
+                const uint64_t offset = levels.empty() ? meta.offset : levels[texture].offsets[level];
+                if (offset > scene.texture_data.size() ||
+                    get_level_size(meta.format, layout, width, height) > scene.texture_data.size() - offset)
+                    throw IOError("scene file: level " + std::to_string(level) + " of texture " +
+                                  std::to_string(texture) + " lies outside of the texture data");
+            }
+        }
+    }
+}
+
+// Calls visit(leaf, data, count) for the children of a node: the index of
+// inner children, or the first item and the item count of leaves
+template <typename Visit>
+void for_each_child(const bvh::Node& node, Visit visit)
+{
+    if (node.left_data > 0)
+    {
+        visit(false, uint32_t(node.left_data), 0u);
+        visit(false, uint32_t(node.right_data), 0u);
+    }
+    else
+    {
+        visit(true, node.get_primitives_offset(), node.get_num_primitives());
+    }
+}
+
+template <uint32_t Width, typename Visit>
+void for_each_child(const bvh::WideNode<Width>& node, Visit visit)
+{
+    for (uint32_t i = 0; i < Width; ++i)
+    {
+        if (node.is_empty(i))
+            continue;
+        if (node.is_leaf(i))
+            visit(true, node.get_primitives_offset(i), node.get_num_primitives(i));
+        else
+            visit(false, node.get_child_node(i), 0u);
+    }
+}
+
+// The scene tree at node 0 has to end in mesh instances and the mesh trees
+// at `mesh_roots` in primitive ranges. No node may be reached twice, which
+// also rules out cycles.
+template <typename Node>
+void validate_bvh(const Array<Node>& nodes, std::vector<uint32_t> mesh_roots, size_t num_instances,
+                  size_t num_primitives, const std::string& name)
+{
+    if (nodes.empty())
+        return;
+
+    std::sort(mesh_roots.begin(), mesh_roots.end());
+    mesh_roots.erase(std::unique(mesh_roots.begin(), mesh_roots.end()), mesh_roots.end());
+
+    std::vector<bool> visited(nodes.size(), false);
+    auto walk = [&](uint32_t root, bool instance_leaves)
+    {
+        std::vector<uint32_t> pending(1, root);
+        while (!pending.empty())
+        {
+            const uint32_t index = pending.back();
+            pending.pop_back();
+            if (index >= nodes.size() || visited[index])
+                throw IOError("scene file: " + name + " nodes do not form trees");
+            visited[index] = true;
+
+            for_each_child(nodes[index], [&](bool leaf, uint32_t data, uint32_t count)
+            {
+                if (!leaf)
+                    pending.push_back(data);
+                else if (instance_leaves ? data >= num_instances : uint64_t(data) + count > num_primitives)
+                    throw IOError("scene file: " + name + " leaf lies outside of the " +
+                                  (instance_leaves ? "mesh instances" : "primitives"));
+            });
+        }
+    };
+
+    walk(0, true);
+    for (uint32_t root : mesh_roots)
+        walk(root, false);
+}
+
+// Every index the tracer follows has to lie within the array it indexes
+void validate_geometry(const Scene& scene)
+{
+    const Array<uint32_t>& indices = scene.indices;
+    const Array<uint32_t>& material_indices = scene.material_indices;
+    const size_t num_vertices = scene.vertices.size();
+    const size_t num_materials = scene.material_nodes.size();
+    const size_t num_primitives = material_indices.size();
+
+    const int64_t num_indices = int64_t(indices.size());
+    bool failed = false;
+#pragma omp parallel for reduction(||:failed)
+    for (int64_t i = 0; i < num_indices; ++i)
+        failed = failed || indices[size_t(i)] >= num_vertices;
+    if (failed)
+        throw IOError("scene file: indices lie outside of the " + std::to_string(num_vertices) + " vertices");
+
+#pragma omp parallel for reduction(||:failed)
+    for (int64_t i = 0; i < int64_t(num_primitives); ++i)
+        failed = failed || material_indices[size_t(i)] >= num_materials;
+    if (failed)
+        throw IOError("scene file: material indices lie outside of the " + std::to_string(num_materials) + " material nodes");
+
+    for (const EmissivePrimitive& eprim : static_cast<const Array<EmissivePrimitive>&>(scene.emissive_primitives))
+    {
+        if (eprim.material_index >= num_materials || (eprim.type == AreaLight && eprim.primitive_index >= num_primitives))
+            throw IOError("scene file: emissive primitive lies outside of the scene");
+    }
+
+    const Array<MeshInstance>& instances = scene.mesh_instances;
+    std::vector<uint32_t> roots(instances.size());
+    std::vector<uint32_t> wide_roots(instances.size());
+    for (size_t i = 0; i < instances.size(); ++i)
+    {
+        roots[i] = instances[i].bvh_root;
+        wide_roots[i] = instances[i].wide_bvh_root;
+    }
+
+    validate_bvh(scene.bvh_nodes, roots, instances.size(), num_primitives, "BVH");
+    validate_bvh(scene.bvh4_nodes, wide_roots, instances.size(), num_primitives, "4 wide BVH");
+    validate_bvh(scene.bvh8_nodes, wide_roots, instances.size(), num_primitives, "8 wide BVH");
+}
+
+} // namespace
+
+bool is_scene_file(const std::string& filename)
+{
+    FileReader reader(filename);
+    char magic[sizeof(scene_file_magic)] = { 0 };
+    if (reader.get_size() < sizeof(magic))
+        return false;
+
+    reader.read(0, magic, sizeof(magic));
+    return std::memcmp(magic, scene_file_magic, sizeof(magic)) == 0;
+}
+
+void write_scene(const Scene& scene, Writer& writer, bool compress, const CompileRecord* record)
+{
+    // Zero the padding so identical scenes give identical files
+    SceneGlobals globals;
+    std::memset(static_cast<void*>(&globals), 0, sizeof(globals));
+    globals.scene_diffuse_mat_index = scene.scene_diffuse_mat_index;
+    globals.scene_emissive_mat_index = scene.scene_emissive_mat_index;
+    globals.camera = scene.camera;
+
+    SectionWriter sections(writer, num_section_types, compress);
+    sections.write(SECTION_GLOBALS, &globals, sizeof(globals), sizeof(globals));
+    sections.write(SECTION_BVH_NODES, scene.bvh_nodes);
+    sections.write(SECTION_BVH4_NODES, scene.bvh4_nodes);
+    sections.write(SECTION_BVH8_NODES, scene.bvh8_nodes);
+    sections.write(SECTION_MESH_INSTANCES, scene.mesh_instances);
+    sections.write(SECTION_MATERIAL_NODES, scene.material_nodes);
+    sections.write(SECTION_EMISSIVE_PRIMITIVES, scene.emissive_primitives);
+    sections.write(SECTION_TEXTURE_DATA, scene.texture_data);
+    sections.write(SECTION_TEXTURE_METADATA, scene.texture_metadata);
+    sections.write(SECTION_TEXTURE_LEVELS, scene.texture_levels);
+    sections.write(SECTION_TEXTURE_TILES, scene.texture_tiles);
+    sections.write(SECTION_TEXTURE_TILE_DATA, scene.texture_tile_data, false);
+    sections.write(SECTION_VERTICES, scene.vertices);
+    sections.write(SECTION_NORMALS, scene.normals);
+    sections.write(SECTION_UVS, scene.uvs);
+    sections.write(SECTION_INDICES, scene.indices);
+    sections.write(SECTION_MATERIAL_INDICES, scene.material_indices);
+    sections.write(SECTION_OCT_NORMALS, scene.oct_normals);
+    sections.write(SECTION_HALF_UVS, scene.half_uvs);
+
+    if (record)
+    {
+        sections.write(SECTION_RECORD_MESHES, record->meshes);
+        sections.write(SECTION_RECORD_BVH_NODES, record->bvh_nodes);
+        sections.write(SECTION_RECORD_PRIMITIVE_TRIANGLES, record->primitive_triangles);
+        sections.write(SECTION_RECORD_TEXTURES, record->textures);
+    }
+
+    const std::vector<SectionEntry>& entries = sections.get_sections();
+
+    FileHeader header;
+    std::memcpy(header.magic, scene_file_magic, sizeof(header.magic));
+    header.version = scene_file_version;
+    header.num_sections = uint32_t(entries.size());
+    header.file_size = sections.finish();
+
+    writer.write(0, &header, sizeof(header));
+    writer.write(sizeof(header), entries.data(), entries.size() * sizeof(SectionEntry));
+}
+
+std::unique_ptr<Scene> read_scene(const Reader& reader, bool verify_checksums, CompileRecord* record)
+{
+    const uint64_t file_size = reader.get_size();
+    if (file_size < sizeof(FileHeader))
+        throw IOError("scene file: truncated header");
+
+    FileHeader header;
+    reader.read(0, &header, sizeof(header));
+    if (std::memcmp(header.magic, scene_file_magic, sizeof(header.magic)) != 0)
+        throw IOError("scene file: not a compiled scene");
+    if (header.version != scene_file_version)
+        throw IOError("scene file: unsupported version " + std::to_string(header.version));
+    if (header.file_size != file_size ||
+        sizeof(FileHeader) + uint64_t(header.num_sections) * sizeof(SectionEntry) > file_size)
+        throw IOError("scene file: size " + std::to_string(file_size) + " does not match the header");
+
+    std::vector<SectionEntry> entries(header.num_sections);
+    reader.read(sizeof(FileHeader), entries.data(), entries.size() * sizeof(SectionEntry));
+
+    // Sections of types this version does not know are skipped
+    std::vector<const SectionEntry*> by_type(num_section_types, nullptr);
+    for (const auto& entry : entries)
+    {
+        if (entry.offset > file_size || entry.stored_size > file_size - entry.offset)
+            throw IOError("scene file: section " + std::to_string(entry.type) + " lies outside of the file");
+        if (entry.compression == COMPRESSION_NONE && (entry.stored_size != entry.size || entry.offset % scene_file_alignment != 0))
+            throw IOError("scene file: section " + std::to_string(entry.type) + " is malformed");
+        if (entry.compression != COMPRESSION_NONE && entry.compression != COMPRESSION_ZLIB)
+            throw IOError("scene file: section " + std::to_string(entry.type) + " has an unknown compression");
+
+        if (entry.type < num_section_types)
+            by_type[entry.type] = &entry;
+    }
+
+    const SectionEntry* globals_entry = by_type[SECTION_GLOBALS];
+    if (globals_entry == nullptr || globals_entry->compression != COMPRESSION_NONE ||
+        globals_entry->size != sizeof(SceneGlobals))
+        throw IOError("scene file: no valid globals section");
+
+    SceneGlobals globals;
+    reader.read(globals_entry->offset, static_cast<void*>(&globals), sizeof(globals));
+    verify_section(*globals_entry, reinterpret_cast<const uint8_t*>(&globals));
+
+    auto scene = std::make_unique<Scene>();
+    scene->scene_diffuse_mat_index = globals.scene_diffuse_mat_index;
+    scene->scene_emissive_mat_index = globals.scene_emissive_mat_index;
+    scene->camera = globals.camera;
+
+    read_section(reader, by_type[SECTION_BVH_NODES], verify_checksums, &scene->bvh_nodes);
+    read_section(reader, by_type[SECTION_BVH4_NODES], verify_checksums, &scene->bvh4_nodes);
+    read_section(reader, by_type[SECTION_BVH8_NODES], verify_checksums, &scene->bvh8_nodes);
+    read_section(reader, by_type[SECTION_MESH_INSTANCES], verify_checksums, &scene->mesh_instances);
+    read_section(reader, by_type[SECTION_MATERIAL_NODES], verify_checksums, &scene->material_nodes);
+    read_section(reader, by_type[SECTION_EMISSIVE_PRIMITIVES], verify_checksums, &scene->emissive_primitives);
+    read_section(reader, by_type[SECTION_TEXTURE_DATA], verify_checksums, &scene->texture_data);
+    read_section(reader, by_type[SECTION_TEXTURE_METADATA], verify_checksums, &scene->texture_metadata);
+    read_section(reader, by_type[SECTION_TEXTURE_LEVELS], verify_checksums, &scene->texture_levels);
+
+    read_section(reader, by_type[SECTION_TEXTURE_TILES], verify_checksums, &scene->texture_tiles);
+    read_section(reader, by_type[SECTION_TEXTURE_TILE_DATA], verify_checksums, &scene->texture_tile_data);
+    read_section(reader, by_type[SECTION_MATERIAL_INDICES], verify_checksums, &scene->material_indices);
+    read_section(reader, by_type[SECTION_VERTICES], verify_checksums, &scene->vertices);
+    read_section(reader, by_type[SECTION_NORMALS], verify_checksums, &scene->normals);
+    read_section(reader, by_type[SECTION_UVS], verify_checksums, &scene->uvs);
+    read_section(reader, by_type[SECTION_INDICES], verify_checksums, &scene->indices);
+    read_section(reader, by_type[SECTION_OCT_NORMALS], verify_checksums, &scene->oct_normals);
+    read_section(reader, by_type[SECTION_HALF_UVS], verify_checksums, &scene->half_uvs);
+
+    // Each attribute is in exactly one of its encodings
+    const size_t num_vertices = scene->vertices.size();
+    const bool normals_valid = scene->oct_normals.empty() ? scene->normals.size() == num_vertices
+                                                          : scene->oct_normals.size() == num_vertices && scene->normals.empty();
+    const bool uvs_valid = scene->half_uvs.empty() ? scene->uvs.size() == num_vertices
+                                                   : scene->half_uvs.size() == num_vertices && scene->uvs.empty();
+    if (scene->indices.size() != 3 * scene->material_indices.size() || !normals_valid || !uvs_valid)
+        throw IOError("scene file: vertex sections do not match the " +
+                      std::to_string(scene->material_indices.size()) + " primitives");
+
+    // Sections mapped from the file are only checksummed with -verify, so
+    // check everything the tracer indexes without bounds checks
+    validate_textures(*scene);
+    validate_geometry(*scene);
+
+    if (record)
+    {
+        *record = CompileRecord();
+        read_section(reader, by_type[SECTION_RECORD_MESHES], verify_checksums, &record->meshes);
+        read_section(reader, by_type[SECTION_RECORD_BVH_NODES], verify_checksums, &record->bvh_nodes);
+        read_section(reader, by_type[SECTION_RECORD_PRIMITIVE_TRIANGLES], verify_checksums, &record->primitive_triangles);
+        read_section(reader, by_type[SECTION_RECORD_TEXTURES], verify_checksums, &record->textures);
+    }
+
+    return scene;
+}
+
+void write_scene_file(const Scene& scene, const std::string& filename, bool compress, const CompileRecord* record)
+{
+    write_atomically(filename, [&](const std::string& path) {
+        FileWriter writer(path);
+        write_scene(scene, writer, compress, record);
+        writer.close();
+    });
+}
+
+std::unique_ptr<Scene> read_scene_file(const std::string& filename, bool verify_checksums, CompileRecord* record)
+{
+    StopWatch stop_watch;
+    stop_watch.start();
+
+    MappedReader reader(filename);
+    std::unique_ptr<Scene> scene;
+    try
+    {
+        scene = read_scene(reader, verify_checksums, record);
+    }
+    catch (const IOError& error)
+    {
+        throw IOError(std::string(error.what()) + " (" + filename + ")");
+    }
+
+    stop_watch.stop();
+    logger.log<INFO>("mapped scene ", filename, " (", reader.get_size(), " bytes) in ",
+                     stop_watch.get_elapsed_time_ms(), " ms");
+
+    return scene;
+}
+
+} } // namespace eclipse::scene
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <memory>
+
+namespace eclipse {
+
+class Reader;
+class Writer;
+
+namespace scene {
+
+struct Scene;
+struct CompileRecord;
+
+// Compiled scene container (.bin).
+//
+// The file starts with a FileHeader followed by a table of SectionEntry
+// records, one per scene array plus one for the scene globals. Each section
+// starts at a page boundary and is stored either as is, in which case the
+// scene array is a view straight into the read only mapping of the file, or
+// as zlib compressed chunks, which are compressed in parallel on write and
+// inflated in parallel straight into the scene array on load. Reading an
+// uncompressed file therefore costs a single copy of the data, in the page
+// cache, shared by all processes rendering the same file.
+//
+// Every section carries a CRC-32 of its stored bytes. Sections that are
+// copied or inflated on load are always checked; mapped sections only when
+// asked to, since checking them reads the whole file.
+//
+// Normals and uvs are stored either in SECTION_NORMALS and SECTION_UVS or in
+// their compact encodings, SECTION_OCT_NORMALS and SECTION_HALF_UVS.
+//
+// Mip chains and layouts of the textures, SECTION_TEXTURE_LEVELS, are optional.
+//
+// Textures compiled for paging are stored in SECTION_TEXTURE_TILES and
+// SECTION_TEXTURE_TILE_DATA instead of SECTION_TEXTURE_DATA. The tile data is
+// never compressed, so that it stays a view of the mapping and only the
+// pages of the tiles rendered are read from disk.
+//
+// Scenes in the compile cache also carry the CompileRecord of their compile
+// in the SECTION_RECORD_* sections, which are only read when asked for.
+//
+// Files from before the container, a zlib stream of the old scene layout, do
+// not start with the magic and are still read through Scene::deserialize.
+
+constexpr char scene_file_magic[8] = { 'E', 'C', 'L', 'I', 'P', 'S', 'E', 'S' };
+constexpr uint32_t scene_file_version = 2;
+constexpr uint64_t scene_file_alignment = 4096;
+constexpr uint64_t scene_file_chunk_size = 1 << 20;
+
+enum SectionType
+{
+    SECTION_GLOBALS = 0,
+    SECTION_BVH_NODES,
+    SECTION_BVH4_NODES,
+    SECTION_BVH8_NODES,
+    SECTION_MESH_INSTANCES,
+    SECTION_MATERIAL_NODES,
+    SECTION_EMISSIVE_PRIMITIVES,
+    SECTION_TEXTURE_DATA,
+    SECTION_TEXTURE_METADATA,
+    SECTION_VERTICES,
+    SECTION_NORMALS,
+    SECTION_UVS,
+    SECTION_MATERIAL_INDICES,
+    SECTION_INDICES,
+    SECTION_OCT_NORMALS,
+    SECTION_HALF_UVS,
+    SECTION_RECORD_MESHES,
+    SECTION_RECORD_BVH_NODES,
+    SECTION_RECORD_PRIMITIVE_TRIANGLES,
+    SECTION_RECORD_TEXTURES,
+    SECTION_TEXTURE_LEVELS,
+    SECTION_TEXTURE_TILES,
+    SECTION_TEXTURE_TILE_DATA
+};
+
+enum SectionCompression
+{
+    COMPRESSION_NONE = 0,
+    COMPRESSION_ZLIB
+};
+
+struct FileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t num_sections;
+    uint64_t file_size;
+};
+
+struct SectionEntry
+{
+    uint32_t type;
+    uint32_t compression;
+    uint32_t checksum;
+    uint32_t reserved;
+    uint64_t element_size;
+
+    // Position and size of the stored data, and its size once inflated
+    uint64_t offset;
+    uint64_t stored_size;
+    uint64_t size;
+};
+
+// Compressed sections start with a ChunkIndex and the end offset of each
+// stored chunk, relative to the start of the section, followed by the chunks.
+// Every chunk but the last inflates to chunk_size bytes; chunks that do not
+// compress are stored as is.
+struct ChunkIndex
+{
+    uint64_t chunk_size;
+    uint64_t num_chunks;
+};
+
+bool is_scene_file(const std::string& filename);
+
+// The compile record is written along with the scene and read back, when
+// given; scenes without one give an empty record
+void write_scene(const Scene& scene, Writer& writer, bool compress, const CompileRecord* record = nullptr);
+std::unique_ptr<Scene> read_scene(const Reader& reader, bool verify_checksums, CompileRecord* record = nullptr);
+
+// Writes to a file next to `filename` and renames it into place, so that
+// processes rendering from a mapping of the previous file keep reading it
+void write_scene_file(const Scene& scene, const std::string& filename, bool compress,
+                      const CompileRecord* record = nullptr);
+std::unique_ptr<Scene> read_scene_file(const std::string& filename, bool verify_checksums = false,
+                                       CompileRecord* record = nullptr);
+
+} } // namespace eclipse::scene
@@ -2,40 +2,78 @@
 #include "eclipse/scene/raw_scene.h"
 #include "eclipse/scene/obj_loader.h"
 #include "eclipse/scene/compiler.h"
+#include "eclipse/scene/scene_file.h"
+#include "eclipse/scene/compile_cache.h"
+#include "eclipse/scene/compile_record.h"
 #include "eclipse/util/resource.h"
+#include "eclipse/util/serializer.h"
+#include "eclipse/util/array.h"
 #include "eclipse/util/file_util.h"
 #include "eclipse/util/logger.h"
 #include "eclipse/util/stop_watch.h"
 
 #include <string>
 #include <cstring>
-#include <fstream>
-#include <sstream>
 #include <cstdint>
 #include <memory>
-#include <utility>
+#include <vector>
 #include <zlib.h>
 
 namespace eclipse { namespace scene {
 
 namespace {
     auto logger = Logger::create("scene_io");
+
+    std::string g_compile_cache_dir = get_default_compile_cache_dir();
 }
 
 std::unique_ptr<Scene> read_zip(std::shared_ptr<Resource> res);
 
 std::unique_ptr<Scene> read(std::shared_ptr<Resource> res)
+{
+    return read(res, CompileOptions());
+}
+
+std::unique_ptr<Scene> read(std::shared_ptr<Resource> res, const CompileOptions& options)
 {
     if (has_extension(res->get_path(), ".obj"))
     {
+        const bool use_cache = !g_compile_cache_dir.empty();
+        if (use_cache)
+        {
+            std::unique_ptr<Scene> scene = find_cached_scene(g_compile_cache_dir, res->get_path(), options);
+            if (scene)
+                return scene;
+        }
+
+        // A stale entry still holds the mesh BVHs and textures that the
+        // edit did not touch
+        CompileRecord previous_record;
+        std::unique_ptr<Scene> previous;
+        if (use_cache)
+            previous = find_previous_compile(g_compile_cache_dir, res->get_path(), options, &previous_record);
+
         std::shared_ptr<raw::Scene> raw_scene = load_obj(res);
-        std::unique_ptr<Scene> scene = compile(raw_scene);
-        return std::move(scene);
+        CompileRecord record;
+        std::unique_ptr<Scene> scene = compile(raw_scene, options, &record, previous.get(),
+                                               previous ? &previous_record : nullptr);
+        previous.reset();
+
+        if (use_cache)
+        {
+            std::vector<raw::SourceFile> source_files = raw_scene->source_files;
+            source_files.insert(source_files.end(), record.texture_files.begin(), record.texture_files.end());
+            add_cached_scene(g_compile_cache_dir, res->get_path(), options, *scene, record, source_files);
+        }
+
+        return scene;
     }
     else if (has_extension(res->get_path(), ".bin"))
     {
-        std::unique_ptr<Scene> scene = read_zip(res);
-        return std::move(scene);
+        if (is_scene_file(res->get_path()))
+            return read_scene_file(res->get_path());
+
+        return read_zip(res);
     }
     else
     {
@@ -43,68 +81,75 @@ std::unique_ptr<Scene> read(std::shared_ptr<Resource> res)
     }
 }
 
-void write(std::shared_ptr<Scene> scene, std::shared_ptr<Resource> res)
+void set_compile_cache_dir(const std::string& dir)
+{
+    g_compile_cache_dir = dir;
+}
+
+void write(std::shared_ptr<Scene> scene, std::shared_ptr<Resource> res, bool compress)
 {
     std::string filename = remove_extension(res->get_path()) + ".bin";
     StopWatch stop_watch;
     stop_watch.start();
-    logger.log<INFO>("compressing scene to " + filename);
+    logger.log<INFO>(compress ? "compressing" : "writing", " scene to " + filename);
 
     if (!scene)
-        logger.log<WARNING>("write: empty scene");
+        throw IOError("write: empty scene");
 
     create_dir(remove_filename(filename));
+    write_scene_file(*scene, filename, compress);
 
-    std::ostringstream oss;
-    scene->serialize(oss);
-
-    size_t ucomp_size = oss.str().size();
-    size_t comp_size = compressBound(ucomp_size);
-
-    std::vector<char> buffer(comp_size);
-    compress((Bytef*)&buffer[0], &comp_size, (Bytef*)oss.str().c_str(), ucomp_size);
-    buffer.resize(comp_size);
+    stop_watch.stop();
+    logger.log<INFO>("wrote scene in ", stop_watch.get_elapsed_time_ms(), " ms");
+}
 
-    std::ofstream out_file(filename);
-    out_file.write((char*)&ucomp_size, sizeof(ucomp_size));
-    out_file.write((char*)&buffer[0], buffer.size());
-    out_file.close();
+void verify(std::shared_ptr<Resource> res)
+{
+    if (!is_scene_file(res->get_path()))
+        throw IOError("verify: " + res->get_path() + " is not a compiled scene");
 
+    StopWatch stop_watch;
+    stop_watch.start();
+    read_scene_file(res->get_path(), true);
     stop_watch.stop();
-    logger.log<INFO>("compressed scene in ", stop_watch.get_elapsed_time_ms(), " ms");
+    logger.log<INFO>("verified ", res->get_path(), " in ", stop_watch.get_elapsed_time_ms(), " ms");
 }
 
+// Reads scenes written before the section based container
 std::unique_ptr<Scene> read_zip(std::shared_ptr<Resource> res)
 {
     StopWatch stop_watch;
     stop_watch.start();
     logger.log<INFO>("parsing compiled scene from ", res->get_path());
 
-    std::ifstream in_file(res->get_path());
-    in_file.seekg(0, std::ios::end);
-    uLong size = in_file.tellg();
-    in_file.seekg(0, std::ios::beg);
+    // The file is the uncompressed size followed by a zlib stream of the
+    // layout Scene::deserialize reads; inflate it straight into one buffer and read the
+    // scene from there
+    MappedReader file(res->get_path());
+    uint64_t ucomp_size;
+    if (file.get_size() < sizeof(ucomp_size))
+        throw IOError("read: " + res->get_path() + " is truncated");
+    file.read(0, &ucomp_size, sizeof(ucomp_size));
 
-    size_t ucomp_size;
-    in_file.read((char*)&ucomp_size, sizeof(ucomp_size));
+    // zlib inflates at most about 1032:1, larger sizes are corrupt
+    if (ucomp_size > 1032 * file.get_size())
+        throw IOError("read: " + res->get_path() + " is corrupt");
 
-    size_t data_size = size - sizeof(ucomp_size);
-    std::vector<char> data(data_size);
-    in_file.read(&data[0], data_size);
+    Array<uint8_t> buffer;
+    buffer.resize_uninitialized(size_t(ucomp_size));
 
-    std::string buffer;
-    buffer.resize(ucomp_size);
-    uncompress((Bytef*)buffer.data(), &ucomp_size, (Bytef*)&data[0], data.size());
+    uLongf inflated_size = uLongf(ucomp_size);
+    if (uncompress(buffer.data(), &inflated_size, file.get_data() + sizeof(ucomp_size),
+                   uLong(file.get_size() - sizeof(ucomp_size))) != Z_OK || inflated_size != ucomp_size)
+        throw IOError("read: " + res->get_path() + " is corrupt");
 
-    // deserialize scene from decompressed data
     auto scene = std::make_unique<Scene>();
-    std::istringstream iss(buffer);
-    scene->deserialize(iss);
+    scene->deserialize(BufferReader(buffer.data(), buffer.size()));
 
     stop_watch.stop();
     logger.log<INFO>("loaded scene in ", stop_watch.get_elapsed_time_ms(), " ms");
 
-    return std::move(scene);
+    return scene;
 }
 
 } } // namespace eclipse::scene
@@ -10,8 +10,22 @@ class Resource;
 namespace scene {
 
 struct Scene;
+struct CompileOptions;
 
+// OBJ scenes are compiled on read, unless the compile cache holds a compile
+// of the same sources with the same options; see compile_cache.h
 std::unique_ptr<Scene> read(std::shared_ptr<Resource> res);
-void write(std::shared_ptr<Scene> scene, std::shared_ptr<Resource> res);
+std::unique_ptr<Scene> read(std::shared_ptr<Resource> res, const CompileOptions& options);
+
+// Directory of the compile cache, get_default_compile_cache_dir() by
+// default; an empty one disables the cache
+void set_compile_cache_dir(const std::string& dir);
+
+// Writes the scene as a .bin next to `res`; uncompressed scenes are memory
+// mapped when read, compressed ones are smaller but inflated into memory
+void write(std::shared_ptr<Scene> scene, std::shared_ptr<Resource> res, bool compress = false);
+
+// Checks the section checksums of a compiled scene; throws IOError on mismatch
+void verify(std::shared_ptr<Resource> res);
 
 } } // namespace eclipse::scene
@@ -0,0 +1,113 @@
+#include "eclipse/tools/texture_bench.h"
+#include "eclipse/scene/scene.h"
+#include "eclipse/tracer/cpu_kernels.h"
+#include "eclipse/util/logger.h"
+#include "eclipse/util/stop_watch.h"
+#include "eclipse/util/mip_map.h"
+#include "eclipse/util/texture.h"
+#include "eclipse/util/texture_layout.h"
+#include "eclipse/math/vec2.h"
+
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace eclipse { namespace tools {
+
+namespace {
+
+auto logger = Logger::create("texture_bench");
+
+} // namespace
+
+void bench_textures(const scene::Scene& scene, uint32_t num_lookups)
+{
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::vector<Vec2> random_uvs(num_lookups);
+    std::vector<Vec2> walk_steps(num_lookups);
+    for (uint32_t i = 0; i < num_lookups; ++i)
+    {
+        random_uvs[i] = Vec2(unit(rng), unit(rng));
+        walk_steps[i] = Vec2(2.0f * unit(rng) - 1.0f, 2.0f * unit(rng) - 1.0f);
+    }
+    std::vector<Vec2> walk_uvs(num_lookups);
+
+    const TextureLayout layouts[] = { LinearTextureLayout, TiledTextureLayout, MortonTextureLayout };
+    const char* layout_names[] = { "linear", "tiled", "morton" };
+
+    if (!scene.texture_tiles.empty())
+    {
+        logger.log<WARNING>("the scene has paged textures, which are not measured");
+        return;
+    }
+
+    volatile float sink = 0.0f;
+    for (uint32_t i = 0; i < 3; ++i)
+    {
+        double random_ms = 0.0;
+        double walk_ms = 0.0;
+        uint64_t num_textures = 0;
+
+        for (size_t texture = 0; texture < scene.texture_metadata.size(); ++texture)
+        {
+            const scene::TextureMetadata& metadata = scene.texture_metadata[texture];
+            const uint32_t texel_size = get_texel_size(Texture::Format(metadata.format));
+            if (texel_size == 0)
+                continue;
+
+            // Back to linear, then into the layout measured
+            const TextureLayout stored = scene.texture_levels.empty() ? LinearTextureLayout :
+                get_level_layout(TextureLayout(scene.texture_levels[texture].layout), metadata.width, metadata.height);
+            const uint8_t* data = scene.texture_data.data() + metadata.offset;
+            std::vector<uint8_t> linear(size_t(metadata.width) * metadata.height * texel_size);
+            for (uint32_t y = 0; y < metadata.height; ++y)
+            {
+                for (uint32_t x = 0; x < metadata.width; ++x)
+                    std::memcpy(linear.data() + (size_t(y) * metadata.width + x) * texel_size,
+                                data + get_texel_index(stored, metadata.width, x, y) * texel_size, texel_size);
+            }
+
+            const TextureLayout layout = get_level_layout(layouts[i], metadata.width, metadata.height);
+            std::vector<uint8_t> texels(get_layout_texels(layout, metadata.width, metadata.height) * texel_size);
+            swizzle_texels(layout, texel_size, linear.data(), metadata.width, metadata.height, texels.data());
+
+            Vec2 uv(0.5f, 0.5f);
+            for (uint32_t lookup = 0; lookup < num_lookups; ++lookup)
+            {
+                uv = uv + Vec2(walk_steps[lookup].x / float(metadata.width), walk_steps[lookup].y / float(metadata.height));
+                walk_uvs[lookup] = uv;
+            }
+
+            auto measure = [&](const std::vector<Vec2>& uvs)
+            {
+                float sum = 0.0f;
+                StopWatch stop_watch;
+                stop_watch.start();
+                for (const Vec2& lookup_uv : uvs)
+                    sum += cpu::sample_bilinear(metadata.format, layout, texels.data(), metadata.width,
+                                                metadata.height, lookup_uv).x;
+                stop_watch.stop();
+                sink = sink + sum;
+                return stop_watch.get_elapsed_time_ms();
+            };
+
+            random_ms += measure(random_uvs);
+            walk_ms += measure(walk_uvs);
+            ++num_textures;
+        }
+
+        if (num_textures == 0)
+        {
+            logger.log<WARNING>("the scene has no textures to measure");
+            return;
+        }
+
+        const double lookups = double(num_lookups) * double(num_textures);
+        logger.log<INFO>(layout_names[i], ": ", lookups / (random_ms * 1000.0), " Mlookups/s at random uvs, ",
+                         lookups / (walk_ms * 1000.0), " Mlookups/s along random walks");
+    }
+}
+
+} } // namespace eclipse::tools
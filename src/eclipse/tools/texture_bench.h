@@ -0,0 +1,16 @@
+#pragma once
+
+#include "eclipse/scene/scene.h"
+
+#include <cstdint>
+
+namespace eclipse { namespace tools {
+
+// Bilinear lookups per second on the base level of each texture of a scene,
+// re-laid out in every texture layout, at uniformly random uvs and along
+// random walks of steps of up to a texel, which are closer to the lookups of
+// neighbouring rays. Each texture is looked up num_lookups times per
+// layout; scenes with paged textures are not measured.
+void bench_textures(const scene::Scene& scene, uint32_t num_lookups);
+
+} } // namespace eclipse::tools
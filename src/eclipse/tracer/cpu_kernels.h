@@ -0,0 +1,557 @@
+#pragma once
+
+#include "eclipse/scene/bvh_wide_node.h"
+#include "eclipse/math/math.h"
+#include "eclipse/math/vec3.h"
+#include "eclipse/math/vec2.h"
+#include "eclipse/math/vec4.h"
+#include "eclipse/util/texture.h"
+#include "eclipse/util/texture_layout.h"
+#include "eclipse/util/block_compression.h"
+
+#include <cstdint>
+#include <cstring>
+#include <immintrin.h>
+
+namespace eclipse { namespace cpu {
+
+// Inverse of a direction component; tiny components are clamped to avoid
+// infinities which would turn into NaNs when multiplied by zero
+inline float safe_inverse(float d)
+{
+    return 1.0f / (abs(d) < 1e-20f ? (d < 0.0f ? -1e-20f : 1e-20f) : d);
+}
+
+// A ray prepared for slab tests against wide BVH nodes. For each axis the
+// near and far planes are selected once from the direction signs, so boxes
+// are tested without min/max swaps and empty child slots (with inverted
+// bounds) never intersect.
+struct RayBoxData
+{
+    Vec3 org;
+    Vec3 inv_dir;
+    uint32_t near_offset[3];
+    uint32_t far_offset[3];
+
+    RayBoxData(const Vec3& org, const Vec3& dir) : org(org)
+    {
+        for (uint8_t axis = 0; axis < 3; ++axis)
+        {
+            inv_dir[axis] = safe_inverse(dir[axis]);
+
+            // Offsets between the min_* and max_* arrays of a node, in widths
+            near_offset[axis] = inv_dir[axis] >= 0.0f ? axis : axis + 3;
+            far_offset[axis] = inv_dir[axis] >= 0.0f ? axis + 3 : axis;
+        }
+    }
+};
+
+// Returns the planes array of a wide node; min_x, min_y, min_z, max_x, max_y
+// and max_z are laid out consecutively so they can be indexed by offset.
+template <uint32_t Width>
+inline const float* get_planes(const bvh::WideNode<Width>& node, uint32_t offset)
+{
+    return node.min_x + offset * Width;
+}
+
+// Slab test of 4 consecutive child boxes starting at lane `first`. Returns a
+// mask of the boxes hit in [0, t_max] and stores their entry distances.
+template <uint32_t Width>
+inline uint32_t intersect_children_sse(const bvh::WideNode<Width>& node, uint32_t first,
+        const RayBoxData& ray, float t_max, float* t_near)
+{
+    const __m128 near_x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(get_planes(node, ray.near_offset[0]) + first), _mm_set1_ps(ray.org.x)), _mm_set1_ps(ray.inv_dir.x));
+    const __m128 near_y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(get_planes(node, ray.near_offset[1]) + first), _mm_set1_ps(ray.org.y)), _mm_set1_ps(ray.inv_dir.y));
+    const __m128 near_z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(get_planes(node, ray.near_offset[2]) + first), _mm_set1_ps(ray.org.z)), _mm_set1_ps(ray.inv_dir.z));
+    const __m128 far_x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(get_planes(node, ray.far_offset[0]) + first), _mm_set1_ps(ray.org.x)), _mm_set1_ps(ray.inv_dir.x));
+    const __m128 far_y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(get_planes(node, ray.far_offset[1]) + first), _mm_set1_ps(ray.org.y)), _mm_set1_ps(ray.inv_dir.y));
+    const __m128 far_z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(get_planes(node, ray.far_offset[2]) + first), _mm_set1_ps(ray.org.z)), _mm_set1_ps(ray.inv_dir.z));
+
+    const __m128 t_enter = _mm_max_ps(_mm_max_ps(near_x, near_y), _mm_max_ps(near_z, _mm_setzero_ps()));
+    const __m128 t_exit = _mm_min_ps(_mm_min_ps(far_x, far_y), _mm_min_ps(far_z, _mm_set1_ps(t_max)));
+
+    _mm_storeu_ps(t_near, t_enter);
+    return uint32_t(_mm_movemask_ps(_mm_cmple_ps(t_enter, t_exit)));
+}
+
+inline uint32_t intersect_children(const bvh::Node4& node, const RayBoxData& ray, float t_max, float* t_near)
+{
+    return intersect_children_sse(node, 0, ray, t_max, t_near);
+}
+
+inline uint32_t intersect_children(const bvh::Node8& node, const RayBoxData& ray, float t_max, float* t_near)
+{
+#if defined(__AVX__)
+    const __m256 near_x = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(get_planes(node, ray.near_offset[0])), _mm256_set1_ps(ray.org.x)), _mm256_set1_ps(ray.inv_dir.x));
+    const __m256 near_y = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(get_planes(node, ray.near_offset[1])), _mm256_set1_ps(ray.org.y)), _mm256_set1_ps(ray.inv_dir.y));
+    const __m256 near_z = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(get_planes(node, ray.near_offset[2])), _mm256_set1_ps(ray.org.z)), _mm256_set1_ps(ray.inv_dir.z));
+    const __m256 far_x = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(get_planes(node, ray.far_offset[0])), _mm256_set1_ps(ray.org.x)), _mm256_set1_ps(ray.inv_dir.x));
+    const __m256 far_y = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(get_planes(node, ray.far_offset[1])), _mm256_set1_ps(ray.org.y)), _mm256_set1_ps(ray.inv_dir.y));
+    const __m256 far_z = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(get_planes(node, ray.far_offset[2])), _mm256_set1_ps(ray.org.z)), _mm256_set1_ps(ray.inv_dir.z));
+
+    const __m256 t_enter = _mm256_max_ps(_mm256_max_ps(near_x, near_y), _mm256_max_ps(near_z, _mm256_setzero_ps()));
+    const __m256 t_exit = _mm256_min_ps(_mm256_min_ps(far_x, far_y), _mm256_min_ps(far_z, _mm256_set1_ps(t_max)));
+
+    _mm256_storeu_ps(t_near, t_enter);
+    return uint32_t(_mm256_movemask_ps(_mm256_cmp_ps(t_enter, t_exit, _CMP_LE_OQ)));
+#else
+    return intersect_children_sse(node, 0, ray, t_max, t_near) |
+           (intersect_children_sse(node, 4, ray, t_max, t_near + 4) << 4);
+#endif
+}
+
+// Loads a vertex into the first three lanes of a register
+inline __m128 load_vertex(const Vec3& p)
+{
+    return _mm_setr_ps(p.x, p.y, p.z, 0.0f);
+}
+
+// Moller-Trumbore test of a ray against up to 4 triangles. Triangles are
+// given as consecutive index triples into `vertices`, starting at `indices`.
+// Returns a mask of the triangles hit in (t_min, t_max) and stores the hit
+// distances and barycentric coordinates.
+inline uint32_t intersect_triangles(const Vec3* vertices, const uint32_t* indices, uint32_t count,
+        const Vec3& org, const Vec3& dir, float t_min, float t_max, float* t, float* u, float* v)
+{
+    // Load vertices and transpose them so each register holds one
+    // coordinate of 4 triangles. Missing triangles repeat the last one
+    // and are masked out.
+    __m128 v0[4], v1[4], v2[4];
+    for (uint32_t i = 0; i < 4; ++i)
+    {
+        const uint32_t* tri = indices + 3 * (i < count ? i : count - 1);
+        v0[i] = load_vertex(vertices[tri[0]]);
+        v1[i] = load_vertex(vertices[tri[1]]);
+        v2[i] = load_vertex(vertices[tri[2]]);
+    }
+    _MM_TRANSPOSE4_PS(v0[0], v0[1], v0[2], v0[3]);
+    _MM_TRANSPOSE4_PS(v1[0], v1[1], v1[2], v1[3]);
+    _MM_TRANSPOSE4_PS(v2[0], v2[1], v2[2], v2[3]);
+
+    const __m128 dx = _mm_set1_ps(dir.x);
+    const __m128 dy = _mm_set1_ps(dir.y);
+    const __m128 dz = _mm_set1_ps(dir.z);
+
+    const __m128 e1x = _mm_sub_ps(v1[0], v0[0]);
+    const __m128 e1y = _mm_sub_ps(v1[1], v0[1]);
+    const __m128 e1z = _mm_sub_ps(v1[2], v0[2]);
+    const __m128 e2x = _mm_sub_ps(v2[0], v0[0]);
+    const __m128 e2y = _mm_sub_ps(v2[1], v0[1]);
+    const __m128 e2z = _mm_sub_ps(v2[2], v0[2]);
+
+    // p = dir x e2
+    const __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+    const __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+    const __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+
+    const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+    const __m128 inv_det = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+    // s = org - v0
+    const __m128 sx = _mm_sub_ps(_mm_set1_ps(org.x), v0[0]);
+    const __m128 sy = _mm_sub_ps(_mm_set1_ps(org.y), v0[1]);
+    const __m128 sz = _mm_sub_ps(_mm_set1_ps(org.z), v0[2]);
+
+    const __m128 bu = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inv_det);
+
+    // q = s x e1
+    const __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+    const __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+    const __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+
+    const __m128 bv = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inv_det);
+    const __m128 bt = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv_det);
+
+    __m128 mask = _mm_cmpneq_ps(det, _mm_setzero_ps());
+    mask = _mm_and_ps(mask, _mm_cmpge_ps(bu, _mm_setzero_ps()));
+    mask = _mm_and_ps(mask, _mm_cmpge_ps(bv, _mm_setzero_ps()));
+    mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(bu, bv), _mm_set1_ps(1.0f)));
+    mask = _mm_and_ps(mask, _mm_cmpgt_ps(bt, _mm_set1_ps(t_min)));
+    mask = _mm_and_ps(mask, _mm_cmplt_ps(bt, _mm_set1_ps(t_max)));
+
+    _mm_storeu_ps(t, bt);
+    _mm_storeu_ps(u, bu);
+    _mm_storeu_ps(v, bv);
+
+    return uint32_t(_mm_movemask_ps(mask)) & ((1u << count) - 1);
+}
+
+// Number of rays traced together by the packet kernels; one ray per lane
+constexpr uint32_t packet_size = 8;
+
+// A packet of rays stored as a structure of arrays. Besides the rays, it
+// keeps the bounds of their origins and inverse directions, so boxes that
+// the whole packet misses can be rejected with one interval arithmetic test
+// per box instead of one test per ray.
+struct RayPacket
+{
+    alignas(32) float org_x[packet_size];
+    alignas(32) float org_y[packet_size];
+    alignas(32) float org_z[packet_size];
+    alignas(32) float dir_x[packet_size];
+    alignas(32) float dir_y[packet_size];
+    alignas(32) float dir_z[packet_size];
+    alignas(32) float inv_x[packet_size];
+    alignas(32) float inv_y[packet_size];
+    alignas(32) float inv_z[packet_size];
+    alignas(32) float t_max[packet_size];
+
+    // Mask of the lanes holding a ray
+    uint32_t active;
+
+    // Set by finalize when all active rays have the same direction signs,
+    // which is required for the interval test
+    bool coherent;
+    uint32_t near_offset[3];
+    uint32_t far_offset[3];
+    float near_org[3];
+    float far_org[3];
+    float inv_min[3];
+    float inv_max[3];
+
+    RayPacket() : active(0), coherent(false)
+    {
+        for (uint32_t lane = 0; lane < packet_size; ++lane)
+        {
+            set_ray(lane, Vec3(0.0f, 0.0f, 0.0f), Vec3(1.0f, 1.0f, 1.0f));
+            t_max[lane] = 0.0f;
+        }
+    }
+
+    void set_ray(uint32_t lane, const Vec3& org, const Vec3& dir)
+    {
+        org_x[lane] = org.x;
+        org_y[lane] = org.y;
+        org_z[lane] = org.z;
+        dir_x[lane] = dir.x;
+        dir_y[lane] = dir.y;
+        dir_z[lane] = dir.z;
+        inv_x[lane] = safe_inverse(dir.x);
+        inv_y[lane] = safe_inverse(dir.y);
+        inv_z[lane] = safe_inverse(dir.z);
+    }
+
+    // Computes the packet bounds after all rays were set
+    void finalize()
+    {
+        const float* org[3] = { org_x, org_y, org_z };
+        const float* inv[3] = { inv_x, inv_y, inv_z };
+
+        coherent = active != 0;
+        for (uint8_t axis = 0; axis < 3 && coherent; ++axis)
+        {
+            float org_min = pos_inf, org_max = neg_inf;
+            inv_min[axis] = pos_inf;
+            inv_max[axis] = neg_inf;
+
+            for (uint32_t mask = active; mask; mask &= mask - 1)
+            {
+                const uint32_t lane = uint32_t(__builtin_ctz(mask));
+                org_min = min(org_min, org[axis][lane]);
+                org_max = max(org_max, org[axis][lane]);
+                inv_min[axis] = min(inv_min[axis], inv[axis][lane]);
+                inv_max[axis] = max(inv_max[axis], inv[axis][lane]);
+            }
+
+            // Rays going both ways along an axis see the box planes in a
+            // different order
+            const bool positive = inv_min[axis] >= 0.0f;
+            coherent = positive || inv_max[axis] < 0.0f;
+
+            // Origins giving the smallest entry and largest exit distances
+            near_offset[axis] = positive ? axis : axis + 3;
+            far_offset[axis] = positive ? axis + 3 : axis;
+            near_org[axis] = positive ? org_max : org_min;
+            far_org[axis] = positive ? org_min : org_max;
+        }
+    }
+
+    float get_max_distance(uint32_t mask) const
+    {
+        float out = neg_inf;
+        for (; mask; mask &= mask - 1)
+            out = max(out, t_max[__builtin_ctz(mask)]);
+        return out;
+    }
+};
+
+// Thin wrappers over SSE and AVX so the packet kernels are written once
+struct SSE
+{
+    typedef __m128 Float;
+    static constexpr uint32_t width = 4;
+
+    static Float load(const float* p) { return _mm_loadu_ps(p); }
+    static void store(float* p, Float a) { _mm_storeu_ps(p, a); }
+    static Float set1(float a) { return _mm_set1_ps(a); }
+    static Float zero() { return _mm_setzero_ps(); }
+    static Float add(Float a, Float b) { return _mm_add_ps(a, b); }
+    static Float sub(Float a, Float b) { return _mm_sub_ps(a, b); }
+    static Float mul(Float a, Float b) { return _mm_mul_ps(a, b); }
+    static Float div(Float a, Float b) { return _mm_div_ps(a, b); }
+    static Float min(Float a, Float b) { return _mm_min_ps(a, b); }
+    static Float max(Float a, Float b) { return _mm_max_ps(a, b); }
+    static Float bit_and(Float a, Float b) { return _mm_and_ps(a, b); }
+    static Float cmple(Float a, Float b) { return _mm_cmple_ps(a, b); }
+    static Float cmplt(Float a, Float b) { return _mm_cmplt_ps(a, b); }
+    static Float cmpge(Float a, Float b) { return _mm_cmpge_ps(a, b); }
+    static Float cmpgt(Float a, Float b) { return _mm_cmpgt_ps(a, b); }
+    static Float cmpneq(Float a, Float b) { return _mm_cmpneq_ps(a, b); }
+    static uint32_t movemask(Float a) { return uint32_t(_mm_movemask_ps(a)); }
+};
+
+#if defined(__AVX__)
+struct AVX
+{
+    typedef __m256 Float;
+    static constexpr uint32_t width = 8;
+
+    static Float load(const float* p) { return _mm256_loadu_ps(p); }
+    static void store(float* p, Float a) { _mm256_storeu_ps(p, a); }
+    static Float set1(float a) { return _mm256_set1_ps(a); }
+    static Float zero() { return _mm256_setzero_ps(); }
+    static Float add(Float a, Float b) { return _mm256_add_ps(a, b); }
+    static Float sub(Float a, Float b) { return _mm256_sub_ps(a, b); }
+    static Float mul(Float a, Float b) { return _mm256_mul_ps(a, b); }
+    static Float div(Float a, Float b) { return _mm256_div_ps(a, b); }
+    static Float min(Float a, Float b) { return _mm256_min_ps(a, b); }
+    static Float max(Float a, Float b) { return _mm256_max_ps(a, b); }
+    static Float bit_and(Float a, Float b) { return _mm256_and_ps(a, b); }
+    static Float cmple(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+    static Float cmplt(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    static Float cmpge(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+    static Float cmpgt(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+    static Float cmpneq(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_NEQ_UQ); }
+    static uint32_t movemask(Float a) { return uint32_t(_mm256_movemask_ps(a)); }
+};
+
+typedef AVX PacketSIMD;
+#else
+typedef SSE PacketSIMD;
+#endif
+
+// Conservative test of a packet against the children of a wide node: a child
+// is culled when the largest entry distance of any ray into its box cannot be
+// smaller than the smallest exit distance. Only valid for coherent packets.
+// Returns a mask of the children that may be hit by some ray.
+template <uint32_t Width>
+inline uint32_t intersect_children_interval(const bvh::WideNode<Width>& node, const RayPacket& packet, float t_max)
+{
+    typedef SSE S;
+
+    uint32_t mask = 0;
+    for (uint32_t first = 0; first < Width; first += S::width)
+    {
+        S::Float t_enter = S::zero();
+        S::Float t_exit = S::set1(t_max);
+
+        for (uint8_t axis = 0; axis < 3; ++axis)
+        {
+            const S::Float inv_min = S::set1(packet.inv_min[axis]);
+            const S::Float inv_max = S::set1(packet.inv_max[axis]);
+
+            const S::Float near = S::sub(S::load(get_planes(node, packet.near_offset[axis]) + first), S::set1(packet.near_org[axis]));
+            const S::Float far = S::sub(S::load(get_planes(node, packet.far_offset[axis]) + first), S::set1(packet.far_org[axis]));
+
+            t_enter = S::max(t_enter, S::min(S::mul(near, inv_min), S::mul(near, inv_max)));
+            t_exit = S::min(t_exit, S::max(S::mul(far, inv_min), S::mul(far, inv_max)));
+        }
+
+        mask |= S::movemask(S::cmple(t_enter, t_exit)) << first;
+    }
+    return mask;
+}
+
+// Slab test of the rays at lanes [first, first + S::width) against one box
+template <typename S>
+inline uint32_t intersect_box_packet(const RayPacket& packet, uint32_t first, const float* bmin, const float* bmax,
+        float* t_near)
+{
+    const typename S::Float ox = S::load(packet.org_x + first);
+    const typename S::Float oy = S::load(packet.org_y + first);
+    const typename S::Float oz = S::load(packet.org_z + first);
+    const typename S::Float ix = S::load(packet.inv_x + first);
+    const typename S::Float iy = S::load(packet.inv_y + first);
+    const typename S::Float iz = S::load(packet.inv_z + first);
+
+    const typename S::Float t0x = S::mul(S::sub(S::set1(bmin[0]), ox), ix);
+    const typename S::Float t1x = S::mul(S::sub(S::set1(bmax[0]), ox), ix);
+    const typename S::Float t0y = S::mul(S::sub(S::set1(bmin[1]), oy), iy);
+    const typename S::Float t1y = S::mul(S::sub(S::set1(bmax[1]), oy), iy);
+    const typename S::Float t0z = S::mul(S::sub(S::set1(bmin[2]), oz), iz);
+    const typename S::Float t1z = S::mul(S::sub(S::set1(bmax[2]), oz), iz);
+
+    const typename S::Float t_enter = S::max(S::max(S::min(t0x, t1x), S::min(t0y, t1y)), S::max(S::min(t0z, t1z), S::zero()));
+    const typename S::Float t_exit = S::min(S::min(S::max(t0x, t1x), S::max(t0y, t1y)),
+                                            S::min(S::max(t0z, t1z), S::load(packet.t_max + first)));
+
+    S::store(t_near + first, t_enter);
+    return S::movemask(S::cmple(t_enter, t_exit)) << first;
+}
+
+// Tests the active rays of a packet against a box given by its min and max
+// corners. Returns the mask of the rays hitting it within their t_max and
+// stores the entry distances.
+inline uint32_t intersect_box_packet(const RayPacket& packet, uint32_t active, const float* bmin, const float* bmax,
+        float* t_near)
+{
+    uint32_t mask = 0;
+    for (uint32_t first = 0; first < packet_size; first += PacketSIMD::width)
+        mask |= intersect_box_packet<PacketSIMD>(packet, first, bmin, bmax, t_near);
+    return mask & active;
+}
+
+// Moller-Trumbore test of the rays at lanes [first, first + S::width)
+// against one triangle; the operations match intersect_triangles so a ray
+// gets the same result from both kernels.
+template <typename S>
+inline uint32_t intersect_triangle_packet(const RayPacket& packet, uint32_t first,
+        const Vec3& p0, const Vec3& p1, const Vec3& p2, float* t, float* u, float* v)
+{
+    const typename S::Float e1x = S::set1(p1.x - p0.x);
+    const typename S::Float e1y = S::set1(p1.y - p0.y);
+    const typename S::Float e1z = S::set1(p1.z - p0.z);
+    const typename S::Float e2x = S::set1(p2.x - p0.x);
+    const typename S::Float e2y = S::set1(p2.y - p0.y);
+    const typename S::Float e2z = S::set1(p2.z - p0.z);
+
+    const typename S::Float dx = S::load(packet.dir_x + first);
+    const typename S::Float dy = S::load(packet.dir_y + first);
+    const typename S::Float dz = S::load(packet.dir_z + first);
+
+    // p = dir x e2
+    const typename S::Float px = S::sub(S::mul(dy, e2z), S::mul(dz, e2y));
+    const typename S::Float py = S::sub(S::mul(dz, e2x), S::mul(dx, e2z));
+    const typename S::Float pz = S::sub(S::mul(dx, e2y), S::mul(dy, e2x));
+
+    const typename S::Float det = S::add(S::add(S::mul(e1x, px), S::mul(e1y, py)), S::mul(e1z, pz));
+    const typename S::Float inv_det = S::div(S::set1(1.0f), det);
+
+    // s = org - v0
+    const typename S::Float sx = S::sub(S::load(packet.org_x + first), S::set1(p0.x));
+    const typename S::Float sy = S::sub(S::load(packet.org_y + first), S::set1(p0.y));
+    const typename S::Float sz = S::sub(S::load(packet.org_z + first), S::set1(p0.z));
+
+    const typename S::Float bu = S::mul(S::add(S::add(S::mul(sx, px), S::mul(sy, py)), S::mul(sz, pz)), inv_det);
+
+    // q = s x e1
+    const typename S::Float qx = S::sub(S::mul(sy, e1z), S::mul(sz, e1y));
+    const typename S::Float qy = S::sub(S::mul(sz, e1x), S::mul(sx, e1z));
+    const typename S::Float qz = S::sub(S::mul(sx, e1y), S::mul(sy, e1x));
+
+    const typename S::Float bv = S::mul(S::add(S::add(S::mul(dx, qx), S::mul(dy, qy)), S::mul(dz, qz)), inv_det);
+    const typename S::Float bt = S::mul(S::add(S::add(S::mul(e2x, qx), S::mul(e2y, qy)), S::mul(e2z, qz)), inv_det);
+
+    typename S::Float mask = S::cmpneq(det, S::zero());
+    mask = S::bit_and(mask, S::cmpge(bu, S::zero()));
+    mask = S::bit_and(mask, S::cmpge(bv, S::zero()));
+    mask = S::bit_and(mask, S::cmple(S::add(bu, bv), S::set1(1.0f)));
+    mask = S::bit_and(mask, S::cmpgt(bt, S::zero()));
+    mask = S::bit_and(mask, S::cmplt(bt, S::load(packet.t_max + first)));
+
+    S::store(t + first, bt);
+    S::store(u + first, bu);
+    S::store(v + first, bv);
+
+    return S::movemask(mask) << first;
+}
+
+// Tests the active rays of a packet against the triangle (p0, p1, p2).
+// Returns the mask of the rays hitting it in (0, t_max) and stores the hit
+// distances and barycentric coordinates.
+inline uint32_t intersect_triangle_packet(const RayPacket& packet, uint32_t active,
+        const Vec3& p0, const Vec3& p1, const Vec3& p2, float* t, float* u, float* v)
+{
+    uint32_t mask = 0;
+    for (uint32_t first = 0; first < packet_size; first += PacketSIMD::width)
+        mask |= intersect_triangle_packet<PacketSIMD>(packet, first, p0, p1, p2, t, u, v);
+    return mask & active;
+}
+
+// Texel (x, y) of a texture level, with repeat addressing. Block compressed
+// levels are rows of blocks whatever the layout.
+inline Vec4 fetch_texel(uint32_t format, TextureLayout layout, const uint8_t* data, int32_t width, int32_t height,
+        int32_t x, int32_t y)
+{
+    x %= width;
+    y %= height;
+    if (x < 0) x += width;
+    if (y < 0) y += height;
+
+    if (is_block_compressed(format))
+    {
+        const size_t blocks_x = size_t(width + 3) / 4;
+        const uint8_t* block = data + (size_t(y >> 2) * blocks_x + size_t(x >> 2)) * get_block_bytes(Texture::Format(format));
+        Vec4 out;
+        decode_block_texel(format, block, uint32_t((y & 3) * 4 + (x & 3)), &out.x);
+        return out;
+    }
+
+    const size_t texel = get_texel_index(layout, uint32_t(width), uint32_t(x), uint32_t(y));
+
+    switch (format)
+    {
+        case Texture::LUMINANCE8:
+        {
+            const float l = float(data[texel]) * (1.0f / 255.0f);
+            return Vec4(l, l, l, 1.0f);
+        }
+        case Texture::LUMINANCE32F:
+        {
+            float l;
+            memcpy(&l, data + 4 * texel, sizeof(l));
+            return Vec4(l, l, l, 1.0f);
+        }
+        case Texture::RGBA8:
+        {
+            const uint8_t* p = data + 4 * texel;
+            return Vec4(p[0] * (1.0f / 255.0f), p[1] * (1.0f / 255.0f), p[2] * (1.0f / 255.0f), p[3] * (1.0f / 255.0f));
+        }
+        case Texture::RGBA32F:
+        {
+            Vec4 out;
+            memcpy(&out.x, data + 16 * texel, 4 * sizeof(float));
+            return out;
+        }
+        default:
+            return Vec4(0.0f, 0.0f, 0.0f, 0.0f);
+    }
+}
+
+// Bilinear filtering of a texture level of `width` x `height` texels; the
+// first texture row is the top of the image. fetch(x, y) returns the texel
+// at the given coordinates after wrapping them into the level.
+template <typename Fetch>
+inline Vec4 filter_bilinear(uint32_t width, uint32_t height, const Vec2& uv, Fetch fetch)
+{
+    const float fx = uv.x * float(width) - 0.5f;
+    const float fy = (1.0f - uv.y) * float(height) - 0.5f;
+    const float x0 = floor(fx);
+    const float y0 = floor(fy);
+    const float tx = fx - x0;
+    const float ty = fy - y0;
+    const int32_t x = int32_t(x0);
+    const int32_t y = int32_t(y0);
+
+    const Vec4 t00 = fetch(x, y);
+    const Vec4 t10 = fetch(x + 1, y);
+    const Vec4 t01 = fetch(x, y + 1);
+    const Vec4 t11 = fetch(x + 1, y + 1);
+
+    Vec4 out;
+    for (uint8_t i = 0; i < 4; ++i)
+        out[i] = (t00[i] * (1.0f - tx) + t10[i] * tx) * (1.0f - ty) + (t01[i] * (1.0f - tx) + t11[i] * tx) * ty;
+    return out;
+}
+
+// Bilinear lookup of a texture level stored in memory
+inline Vec4 sample_bilinear(uint32_t format, TextureLayout layout, const uint8_t* data, uint32_t width, uint32_t height,
+        const Vec2& uv)
+{
+    return filter_bilinear(width, height, uv, [&](int32_t x, int32_t y)
+    {
+        return fetch_texel(format, layout, data, int32_t(width), int32_t(height), x, y);
+    });
+}
+
+} } // namespace eclipse::cpu
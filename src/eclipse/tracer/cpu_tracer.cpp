@@ -0,0 +1,1707 @@
+#include "eclipse/tracer/cpu_tracer.h"
+#include "eclipse/tracer/cpu_kernels.h"
+#include "eclipse/scene/bvh_wide_builder.h"
+#include "eclipse/util/texture.h"
+#include "eclipse/util/mip_map.h"
+#include "eclipse/util/texture_tiles.h"
+#include "eclipse/util/stop_watch.h"
+#include "eclipse/util/logger.h"
+#include "eclipse/util/except.h"
+#include "eclipse/math/math.h"
+
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <utility>
+#include <omp.h>
+
+namespace eclipse {
+
+namespace {
+
+auto logger = Logger::create("cpu_tracer");
+
+// Entries of the traversal stack; update_scene rejects BVHs deep enough to
+// overflow it
+constexpr uint32_t max_stack_size = 1024;
+
+// Bytes of texture tiles kept in memory for paged textures unless set
+constexpr uint64_t default_tile_cache_size = uint64_t(512) << 20;
+
+// Maximum number of operation nodes evaluated before reaching a BxDF
+constexpr uint32_t max_material_depth = 64;
+
+// Pixels covered by a packet of camera rays
+constexpr uint32_t packet_width = 4;
+constexpr uint32_t packet_height = 2;
+static_assert(packet_width * packet_height == cpu::packet_size, "camera ray blocks must fill a packet");
+
+// Shadow rays span the segment to the light sample and stop just short of
+// it, so they do not hit the light itself
+constexpr float shadow_ray_extent = 1.0f - 1e-3f;
+
+// Number of paths shaded or extended per scheduling step of the wavefront
+// stages
+constexpr int64_t wavefront_chunk_size = 64;
+
+// Footprints are stretched by 1 / cos of the incident angle up to this much,
+// so grazing hits do not blur textures away entirely
+constexpr float max_footprint_stretch = 16.0f;
+
+inline Vec3 transform_point(const Mat4& m, const Vec3& p)
+{
+    Vec3 out;
+    for (uint8_t i = 0; i < 3; ++i)
+        out[i] = m.m[i][0] * p.x + m.m[i][1] * p.y + m.m[i][2] * p.z + m.m[i][3];
+    return out;
+}
+
+inline Vec3 transform_vector(const Mat4& m, const Vec3& v)
+{
+    Vec3 out;
+    for (uint8_t i = 0; i < 3; ++i)
+        out[i] = m.m[i][0] * v.x + m.m[i][1] * v.y + m.m[i][2] * v.z;
+    return out;
+}
+
+// Transforms an object space normal by the world to object transform m;
+// normals transform with the inverse transpose of the object to world matrix
+inline Vec3 transform_normal(const Mat4& m, const Vec3& n)
+{
+    Vec3 out;
+    for (uint8_t i = 0; i < 3; ++i)
+        out[i] = m.m[0][i] * n.x + m.m[1][i] * n.y + m.m[2][i] * n.z;
+    return out;
+}
+
+inline float luminance(const Vec4& c)
+{
+    return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+}
+
+inline bool is_finite(const Vec3& v)
+{
+    return std::isfinite(v.x) && std::isfinite(v.y) && std::isfinite(v.z);
+}
+
+// Builds an orthonormal basis around n (Duff et al., "Building an
+// Orthonormal Basis, Revisited")
+inline void make_basis(const Vec3& n, Vec3* t, Vec3* b)
+{
+    const float s = n.z >= 0.0f ? 1.0f : -1.0f;
+    const float a = -1.0f / (s + n.z);
+    const float c = n.x * n.y * a;
+    *t = Vec3(1.0f + s * n.x * n.x * a, s * c, -s * n.x);
+    *b = Vec3(c, s + n.y * n.y * a, -n.y);
+}
+
+// Orthonormal tangent frame around n, aligned with dpdu when possible
+inline void make_tangent_frame(const Vec3& n, const Vec3& dpdu, Vec3* t, Vec3* b)
+{
+    const Vec3 tangent = dpdu - n * dot(n, dpdu);
+    if (dot(tangent, tangent) < 1e-12f)
+    {
+        make_basis(n, t, b);
+        return;
+    }
+
+    *t = normalize(tangent);
+    *b = cross(n, *t);
+}
+
+inline Vec3 to_world(const Vec3& v, const Vec3& t, const Vec3& b, const Vec3& n)
+{
+    return t * v.x + b * v.y + n * v.z;
+}
+
+inline Vec3 reflect(const Vec3& wo, const Vec3& n)
+{
+    return n * (2.0f * dot(wo, n)) - wo;
+}
+
+// Refracts wo through a surface with normal n on the side of wo; eta is the
+// ratio of the indices of refraction on the incident and transmitted sides.
+// Returns false on total internal reflection.
+inline bool refract(const Vec3& wo, const Vec3& n, float eta, Vec3* wt)
+{
+    const float cos_i = dot(wo, n);
+    const float sin2_t = eta * eta * max(0.0f, 1.0f - cos_i * cos_i);
+    if (sin2_t >= 1.0f)
+        return false;
+
+    const float cos_t = std::sqrt(1.0f - sin2_t);
+    *wt = -wo * eta + n * (eta * cos_i - cos_t);
+    return true;
+}
+
+// Unpolarized Fresnel reflectance of a dielectric interface; eta as above
+inline float fresnel_dielectric(float cos_i, float eta)
+{
+    cos_i = clamp(cos_i, 0.0f, 1.0f);
+    const float sin2_t = eta * eta * (1.0f - cos_i * cos_i);
+    if (sin2_t >= 1.0f)
+        return 1.0f;
+
+    const float cos_t = std::sqrt(1.0f - sin2_t);
+    const float rs = (eta * cos_i - cos_t) / (eta * cos_i + cos_t);
+    const float rp = (cos_i - eta * cos_t) / (cos_i + eta * cos_t);
+    return 0.5f * (rs * rs + rp * rp);
+}
+
+inline Vec3 fresnel_schlick(const Vec3& f0, float cos_i)
+{
+    const float m = clamp(1.0f - cos_i, 0.0f, 1.0f);
+    const float m5 = (m * m) * (m * m) * m;
+    return f0 + (Vec3(1.0f, 1.0f, 1.0f) - f0) * m5;
+}
+
+// GGX normal distribution; cos_h is measured from the shading normal
+inline float ggx_d(float cos_h, float alpha)
+{
+    const float a2 = alpha * alpha;
+    const float d = cos_h * cos_h * (a2 - 1.0f) + 1.0f;
+    return a2 / (float(pi) * d * d);
+}
+
+// Smith shadowing term of GGX for one direction
+inline float ggx_g1(float cos_w, float alpha)
+{
+    const float a2 = alpha * alpha;
+    cos_w = abs(cos_w);
+    return 2.0f * cos_w / (cos_w + std::sqrt(a2 + (1.0f - a2) * cos_w * cos_w));
+}
+
+// Samples a GGX half vector in the local frame of the shading normal
+inline Vec3 sample_ggx(float alpha, float u1, float u2)
+{
+    const float cos_theta = std::sqrt((1.0f - u1) / (1.0f + (alpha * alpha - 1.0f) * u1));
+    const float sin_theta = std::sqrt(max(0.0f, 1.0f - cos_theta * cos_theta));
+    const float phi = 2.0f * float(pi) * u2;
+    return Vec3(sin_theta * std::cos(phi), sin_theta * std::sin(phi), cos_theta);
+}
+
+inline Vec3 sample_cosine_hemisphere(float u1, float u2)
+{
+    const float r = std::sqrt(u1);
+    const float phi = 2.0f * float(pi) * u2;
+    return Vec3(r * std::cos(phi), r * std::sin(phi), std::sqrt(max(0.0f, 1.0f - u1)));
+}
+
+inline float power_heuristic(float pdf_a, float pdf_b)
+{
+    const float a = pdf_a * pdf_a;
+    const float b = pdf_b * pdf_b;
+    return a + b > 0.0f ? a / (a + b) : 0.0f;
+}
+
+inline bool is_light_sampled(material::NodeType type)
+{
+    return type == material::BXDF_DIFFUSE || type == material::BXDF_ROUGH_CONDUCTOR;
+}
+
+// Number of levels of inner nodes of one tree of a wide BVH
+template <typename Node>
+uint32_t get_tree_depth(const Array<Node>& nodes, uint32_t root)
+{
+    std::vector<std::pair<uint32_t, uint32_t>> pending(1, std::make_pair(root, 1u));
+    uint32_t depth = 0;
+    while (!pending.empty())
+    {
+        const std::pair<uint32_t, uint32_t> entry = pending.back();
+        pending.pop_back();
+        depth = max(depth, entry.second);
+
+        const Node& node = nodes[entry.first];
+        for (uint32_t i = 0; i < Node::width; ++i)
+        {
+            if (!node.is_empty(i) && !node.is_leaf(i))
+                pending.push_back(std::make_pair(node.get_child_node(i), entry.second + 1));
+        }
+    }
+    return depth;
+}
+
+// Stack based traversal of one tree of a wide BVH. Leaves are passed to
+// visit_leaf, which returns true when it found a hit and may shorten t_max;
+// inner children are pushed far to near so the nearest one is visited first.
+template <typename Node, typename LeafVisitor>
+bool traverse(const Array<Node>& nodes, uint32_t root, const cpu::RayBoxData& ray, float& t_max,
+              bool any_hit, LeafVisitor visit_leaf)
+{
+    constexpr uint32_t width = Node::width;
+
+    uint32_t stack[max_stack_size];
+    uint32_t stack_size = 0;
+    stack[stack_size++] = root;
+
+    bool found = false;
+    while (stack_size > 0)
+    {
+        const Node& node = nodes[stack[--stack_size]];
+
+        float t_near[width];
+        uint32_t mask = cpu::intersect_children(node, ray, t_max, t_near);
+
+        // Children to descend into, sorted by entry distance
+        uint32_t inner[width];
+        float inner_t[width];
+        uint32_t num_inner = 0;
+
+        while (mask)
+        {
+            const uint32_t i = uint32_t(__builtin_ctz(mask));
+            mask &= mask - 1;
+
+            if (node.is_empty(i) || t_near[i] > t_max)
+                continue;
+
+            if (node.is_leaf(i))
+            {
+                if (visit_leaf(node, i, t_max))
+                {
+                    found = true;
+                    if (any_hit)
+                        return true;
+                }
+                continue;
+            }
+
+            uint32_t j = num_inner++;
+            for (; j > 0 && inner_t[j - 1] < t_near[i]; --j)
+            {
+                inner[j] = inner[j - 1];
+                inner_t[j] = inner_t[j - 1];
+            }
+            inner[j] = node.get_child_node(i);
+            inner_t[j] = t_near[i];
+        }
+
+        for (uint32_t j = 0; j < num_inner; ++j)
+            stack[stack_size++] = inner[j];
+    }
+
+    return found;
+}
+
+// Traversal of one tree of a wide BVH with a packet of rays. Each stack
+// entry keeps the rays that hit its node; children are first tested with
+// the interval test of the whole packet, then with each of those rays.
+// Leaves are passed to visit_leaf with the mask of the rays hitting them.
+template <typename Node, typename LeafVisitor>
+void traverse(const Array<Node>& nodes, uint32_t root, const cpu::RayPacket& packet, LeafVisitor visit_leaf)
+{
+    constexpr uint32_t width = Node::width;
+
+    struct Entry
+    {
+        uint32_t node;
+        uint32_t rays;
+    };
+
+    Entry stack[max_stack_size];
+    uint32_t stack_size = 0;
+    stack[stack_size++] = { root, packet.active };
+
+    while (stack_size > 0)
+    {
+        const Entry entry = stack[--stack_size];
+        const Node& node = nodes[entry.node];
+
+        uint32_t mask = (1u << width) - 1;
+        if (packet.coherent)
+            mask = cpu::intersect_children_interval(node, packet, packet.get_max_distance(entry.rays));
+
+        Entry inner[width];
+        float inner_t[width];
+        uint32_t num_inner = 0;
+
+        while (mask)
+        {
+            const uint32_t i = uint32_t(__builtin_ctz(mask));
+            mask &= mask - 1;
+
+            if (node.is_empty(i))
+                continue;
+
+            const float bmin[3] = { node.min_x[i], node.min_y[i], node.min_z[i] };
+            const float bmax[3] = { node.max_x[i], node.max_y[i], node.max_z[i] };
+            float t_near[cpu::packet_size];
+            const uint32_t rays = cpu::intersect_box_packet(packet, entry.rays, bmin, bmax, t_near);
+            if (rays == 0)
+                continue;
+
+            if (node.is_leaf(i))
+            {
+                visit_leaf(node, i, rays);
+                continue;
+            }
+
+            // Order children by the closest entry of any of their rays
+            float t_min = pos_inf;
+            for (uint32_t r = rays; r; r &= r - 1)
+                t_min = min(t_min, t_near[__builtin_ctz(r)]);
+
+            uint32_t j = num_inner++;
+            for (; j > 0 && inner_t[j - 1] < t_min; --j)
+            {
+                inner[j] = inner[j - 1];
+                inner_t[j] = inner_t[j - 1];
+            }
+            inner[j] = { node.get_child_node(i), rays };
+            inner_t[j] = t_min;
+        }
+
+        for (uint32_t j = 0; j < num_inner; ++j)
+            stack[stack_size++] = inner[j];
+    }
+}
+
+} // namespace
+
+// PCG32 generator (O'Neill, "PCG: A Family of Simple Fast Space-Efficient
+// Statistically Good Algorithms for Random Number Generation"). Each sample
+// of each pixel uses its own stream, so results do not depend on the order
+// in which pixels are traced.
+class CPUTracer::Random
+{
+public:
+    Random() : m_state(0), m_inc(1)
+    {
+    }
+
+    Random(uint64_t seed, uint64_t stream)
+        : m_state(0), m_inc((stream << 1) | 1)
+    {
+        next_uint();
+        m_state += seed;
+        next_uint();
+    }
+
+    uint32_t next_uint()
+    {
+        const uint64_t old_state = m_state;
+        m_state = old_state * 6364136223846793005ull + m_inc;
+        const uint32_t xorshifted = uint32_t(((old_state >> 18) ^ old_state) >> 27);
+        const uint32_t rot = uint32_t(old_state >> 59);
+        return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+    }
+
+    // Uniform float in [0, 1)
+    float next()
+    {
+        return float(next_uint() >> 8) * (1.0f / 16777216.0f);
+    }
+
+private:
+    uint64_t m_state;
+    uint64_t m_inc;
+};
+
+// State of a path between the stages of tracing; see trace_path for the
+// single path loop and trace_wavefront for the batched one.
+struct CPUTracer::PathState
+{
+    Ray ray;
+    Hit hit;
+    bool found;
+    Random rng;
+
+    Vec3 throughput;
+    Vec3 radiance;
+
+    // State of the previous scattering event, for weighting emission hit
+    // by chance against light sampling
+    bool is_specular;
+    float bsdf_pdf;
+
+    // Wavelength channel picked by a dispersive material, -1 if none
+    int32_t channel;
+    uint32_t bounce;
+
+    // Ray cone for texture filtering: its width at the ray origin and how
+    // much it widens per unit of distance. The cone ignores the curvature
+    // and roughness of the surfaces it bounces off, so it only ever picks
+    // sharper levels than the true footprint.
+    float cone_width;
+    float cone_spread;
+
+    // Light sample waiting for its shadow ray
+    bool shadow_pending;
+    Ray shadow_ray;
+    Vec3 shadow_radiance;
+};
+
+CPUTracer::CPUTracer(uint32_t num_threads)
+    : m_num_threads(0), m_packet_tracing(true), m_wavefront(false), m_texture_lod(true)
+    , m_scene(nullptr), m_tile_cache(default_tile_cache_size, 1)
+    , m_bvh_width(0), m_bvh4_nodes(nullptr), m_bvh8_nodes(nullptr)
+    , m_environment_material(-1), m_tan_half_fov(1.0f), m_invert_y(false)
+    , m_frame_width(0), m_frame_height(0)
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+    set_num_threads(num_threads);
+}
+
+CPUTracer::~CPUTracer()
+{
+}
+
+void CPUTracer::set_num_threads(uint32_t num_threads)
+{
+    m_num_threads = num_threads > 0 ? num_threads : uint32_t(omp_get_max_threads());
+    m_tile_cache.set_max_threads(m_num_threads);
+
+#if defined(__AVX__)
+    const char* isa = "AVX";
+#else
+    const char* isa = "SSE";
+#endif
+    m_name = "CPU (" + std::to_string(m_num_threads) + " threads, " + isa + ")";
+}
+
+const char* CPUTracer::get_name() const
+{
+    return m_name.c_str();
+}
+
+float CPUTracer::get_gflops_estimate() const
+{
+    // Rough peak: one vector multiply-add per cycle per thread at ~3 GHz
+#if defined(__AVX__)
+    const float lanes = 8.0f;
+#else
+    const float lanes = 4.0f;
+#endif
+    return float(m_num_threads) * lanes * 2.0f * 3.0f;
+}
+
+uint32_t CPUTracer::get_flags() const
+{
+    return LOCAL | CPU;
+}
+
+const TracerStats* CPUTracer::get_stats() const
+{
+    return &m_stats;
+}
+
+void CPUTracer::init()
+{
+}
+
+void CPUTracer::terminate()
+{
+    m_scene = nullptr;
+    m_tile_cache.set_scene(nullptr);
+    m_bvh_width = 0;
+    m_own_bvh4_nodes.clear();
+    m_own_bvh8_nodes.clear();
+    m_accumulator.clear();
+    m_framebuffer.clear();
+}
+
+void CPUTracer::update(UpdateType type, void* data, bool synchronous)
+{
+    // Updates are always applied immediately
+    (void)synchronous;
+
+    if (data == nullptr)
+        throw Error("cpu tracer: no data for update");
+
+    StopWatch stop_watch;
+    stop_watch.start();
+
+    switch (type)
+    {
+        case FrameDimensions:
+        {
+            const uint32_t* dims = static_cast<const uint32_t*>(data);
+            update_frame_dimensions(dims[0], dims[1]);
+            break;
+        }
+        case SceneData:
+            update_scene(static_cast<const scene::Scene*>(data));
+            break;
+        case CameraData:
+            update_camera(static_cast<const scene::Camera*>(data));
+            break;
+    }
+
+    stop_watch.stop();
+    m_stats.update_time_ms = float(stop_watch.get_elapsed_time_ms());
+}
+
+void CPUTracer::update_frame_dimensions(uint32_t width, uint32_t height)
+{
+    m_frame_width = width;
+    m_frame_height = height;
+    m_accumulator.assign(size_t(width) * height, Vec4());
+    m_framebuffer.assign(size_t(width) * height, Vec4());
+}
+
+void CPUTracer::update_scene(const scene::Scene* scene)
+{
+    m_scene = scene;
+    m_tile_cache.set_scene(scene);
+
+    const size_t num_instances = scene->mesh_instances.size();
+    m_object_to_world.resize(num_instances);
+    for (size_t i = 0; i < num_instances; ++i)
+        m_object_to_world[i] = inverse(scene->mesh_instances[i].transform);
+
+    // Use the wide BVH of the scene if it has one, otherwise collapse the
+    // binary BVH ourselves
+    m_own_bvh4_nodes.clear();
+    m_own_bvh8_nodes.clear();
+    m_instance_roots.resize(num_instances);
+
+    if (!scene->bvh8_nodes.empty() || !scene->bvh4_nodes.empty())
+    {
+        m_bvh_width = scene->bvh8_nodes.empty() ? 4 : 8;
+        m_bvh4_nodes = &scene->bvh4_nodes;
+        m_bvh8_nodes = &scene->bvh8_nodes;
+
+        for (size_t i = 0; i < num_instances; ++i)
+            m_instance_roots[i] = scene->mesh_instances[i].wide_bvh_root;
+    }
+    else if (!scene->bvh_nodes.empty())
+    {
+        // Instances of the same mesh share their BVH
+        std::vector<uint32_t> roots(1, 0);
+        std::unordered_map<uint32_t, uint32_t> root_slots;
+        for (const auto& instance : scene->mesh_instances)
+        {
+            if (root_slots.emplace(instance.bvh_root, uint32_t(roots.size())).second)
+                roots.push_back(instance.bvh_root);
+        }
+
+        std::vector<uint32_t> wide_roots;
+#if defined(__AVX__)
+        m_bvh_width = 8;
+        m_own_bvh8_nodes = bvh::WideBuilder<8>::build(scene->bvh_nodes, roots, &wide_roots);
+#else
+        m_bvh_width = 4;
+        m_own_bvh4_nodes = bvh::WideBuilder<4>::build(scene->bvh_nodes, roots, &wide_roots);
+#endif
+        m_bvh4_nodes = &m_own_bvh4_nodes;
+        m_bvh8_nodes = &m_own_bvh8_nodes;
+
+        for (size_t i = 0; i < num_instances; ++i)
+            m_instance_roots[i] = wide_roots[root_slots[scene->mesh_instances[i].bvh_root]];
+    }
+    else
+    {
+        m_bvh_width = 0;
+    }
+
+    // Each level of the traversal pops one node and pushes at most a full
+    // node of children, so the stack holds at most width - 1 entries per
+    // level plus the root
+    if (m_bvh_width > 0)
+    {
+        std::vector<uint32_t> roots(m_instance_roots.begin(), m_instance_roots.end());
+        roots.push_back(0);
+        std::sort(roots.begin(), roots.end());
+        roots.erase(std::unique(roots.begin(), roots.end()), roots.end());
+
+        uint32_t depth = 0;
+        for (uint32_t root : roots)
+            depth = max(depth, m_bvh_width == 8 ? get_tree_depth(*m_bvh8_nodes, root) : get_tree_depth(*m_bvh4_nodes, root));
+
+        if (depth * (m_bvh_width - 1) + 1 > max_stack_size)
+            throw Error("cpu tracer: BVH of depth " + std::to_string(depth) + " is too deep to traverse");
+    }
+
+    // Collect the emitters in world space
+    m_area_lights.clear();
+    m_environment_material = -1;
+
+    for (const auto& eprim : scene->emissive_primitives)
+    {
+        if (eprim.type == scene::EnvironmentLight)
+        {
+            m_environment_material = int32_t(eprim.material_index);
+            continue;
+        }
+
+        const Mat4 object_to_world = inverse(eprim.transform);
+        const uint32_t* indices = &scene->indices[3 * eprim.primitive_index];
+
+        AreaLight light;
+        light.p0 = transform_point(object_to_world, scene->vertices[indices[0]]);
+        light.e1 = transform_point(object_to_world, scene->vertices[indices[1]]) - light.p0;
+        light.e2 = transform_point(object_to_world, scene->vertices[indices[2]]) - light.p0;
+
+        const Vec3 n = cross(light.e1, light.e2);
+        light.area = 0.5f * length(n);
+        if (light.area <= 0.0f)
+            continue;
+
+        light.normal = n * (0.5f / light.area);
+        light.primitive = eprim.primitive_index;
+        light.material = eprim.material_index;
+        m_area_lights.push_back(light);
+    }
+
+    logger.log<INFO>("using a ", m_bvh_width, "-wide BVH and ", m_area_lights.size(), " area lights",
+                     m_environment_material >= 0 ? " with an environment light" : "");
+}
+
+void CPUTracer::update_camera(const scene::Camera* camera)
+{
+    m_eye = camera->eye;
+    m_forward = normalize(camera->look_at - camera->eye);
+    m_right = normalize(cross(m_forward, camera->up));
+    m_up = cross(m_right, m_forward);
+    m_tan_half_fov = std::tan(0.5f * radians(camera->fov));
+    m_invert_y = camera->invert_y;
+}
+
+void CPUTracer::trace(const TraceTile* tile)
+{
+    if (m_scene == nullptr)
+        throw Error("cpu tracer: trace called before the scene was set");
+
+    if (tile->frame_width != m_frame_width || tile->frame_height != m_frame_height ||
+        tile->tile_x + tile->tile_w > m_frame_width || tile->tile_y + tile->tile_h > m_frame_height)
+        throw Error("cpu tracer: tile does not fit the frame dimensions");
+
+    StopWatch stop_watch;
+    stop_watch.start();
+
+    if (m_wavefront)
+    {
+        trace_wavefront(tile);
+    }
+    else
+    {
+        // Pixels are traced in blocks the size of a ray packet
+        const uint32_t block_w = m_packet_tracing ? packet_width : 1;
+        const uint32_t block_h = m_packet_tracing ? packet_height : 1;
+        const int64_t num_block_rows = int64_t((tile->tile_h + block_h - 1) / block_h);
+
+#pragma omp parallel for schedule(dynamic, 1) num_threads(m_num_threads)
+        for (int64_t block_row = 0; block_row < num_block_rows; ++block_row)
+        {
+            const uint32_t y = tile->tile_y + uint32_t(block_row) * block_h;
+            const uint32_t h = min(block_h, tile->tile_y + tile->tile_h - y);
+
+            for (uint32_t x = tile->tile_x; x < tile->tile_x + tile->tile_w; x += block_w)
+                trace_block(tile, x, y, min(block_w, tile->tile_x + tile->tile_w - x), h);
+        }
+    }
+
+    stop_watch.stop();
+    m_stats.tile_w = tile->tile_w;
+    m_stats.tile_h = tile->tile_h;
+    m_stats.render_time_ms = float(stop_watch.get_elapsed_time_ms());
+}
+
+void CPUTracer::trace_block(const TraceTile* tile, uint32_t x0, uint32_t y0, uint32_t w, uint32_t h)
+{
+    const uint32_t num_rays = w * h;
+
+    if (tile->accumulated_samples == 0)
+    {
+        for (uint32_t i = 0; i < num_rays; ++i)
+            m_accumulator[(y0 + i / w) * m_frame_width + x0 + i % w] = Vec4();
+    }
+
+    Random rngs[cpu::packet_size];
+    Ray rays[cpu::packet_size];
+    Hit hits[cpu::packet_size];
+
+    for (uint32_t s = 0; s < tile->samples_per_pixel; ++s)
+    {
+        // Find the first hit of each camera ray, as a packet if enabled
+        uint32_t hit_mask = 0;
+        cpu::RayPacket packet;
+
+        for (uint32_t i = 0; i < num_rays; ++i)
+        {
+            const uint32_t x = x0 + i % w;
+            const uint32_t y = y0 + i / w;
+
+            rngs[i] = Random(y * m_frame_width + x, uint64_t(tile->accumulated_samples) + s);
+            rays[i] = get_camera_ray(x, y, rngs[i]);
+
+            if (m_packet_tracing)
+            {
+                packet.set_ray(i, rays[i].org, rays[i].dir);
+                packet.t_max[i] = pos_inf;
+                packet.active |= 1u << i;
+            }
+            else if (intersect(rays[i], pos_inf, &hits[i]))
+            {
+                hit_mask |= 1u << i;
+            }
+        }
+
+        if (m_packet_tracing)
+        {
+            packet.finalize();
+            hit_mask = intersect(&packet, hits);
+        }
+
+        for (uint32_t i = 0; i < num_rays; ++i)
+        {
+            const Vec3 radiance = trace_path(rays[i], (hit_mask >> i) & 1, hits[i], tile->num_bounces,
+                                             tile->bounces_before_russian_roulette, rngs[i]);
+
+            // Drop samples that went wrong numerically instead of spoiling
+            // the pixel
+            Vec4& accumulator = m_accumulator[(y0 + i / w) * m_frame_width + x0 + i % w];
+            if (is_finite(radiance))
+            {
+                accumulator.x += radiance.x;
+                accumulator.y += radiance.y;
+                accumulator.z += radiance.z;
+            }
+            accumulator.w += 1.0f;
+        }
+    }
+}
+
+void CPUTracer::trace_wavefront(const TraceTile* tile)
+{
+    // Paths are stored block by block so each block of camera rays can be
+    // traced as a packet
+    const uint32_t blocks_x = (tile->tile_w + packet_width - 1) / packet_width;
+    const uint32_t blocks_y = (tile->tile_h + packet_height - 1) / packet_height;
+    const int64_t num_blocks = int64_t(blocks_x) * blocks_y;
+
+    std::vector<uint32_t> pixels;
+    std::vector<uint32_t> block_offsets(1, 0);
+    pixels.reserve(size_t(tile->tile_w) * tile->tile_h);
+
+    for (uint32_t by = 0; by < blocks_y; ++by)
+    {
+        for (uint32_t bx = 0; bx < blocks_x; ++bx)
+        {
+            const uint32_t x0 = tile->tile_x + bx * packet_width;
+            const uint32_t y0 = tile->tile_y + by * packet_height;
+            const uint32_t w = min(packet_width, tile->tile_x + tile->tile_w - x0);
+            const uint32_t h = min(packet_height, tile->tile_y + tile->tile_h - y0);
+
+            for (uint32_t i = 0; i < w * h; ++i)
+                pixels.push_back((y0 + i / w) * m_frame_width + x0 + i % w);
+            block_offsets.push_back(uint32_t(pixels.size()));
+        }
+    }
+
+    const int64_t num_paths = int64_t(pixels.size());
+    std::vector<PathState> paths(num_paths);
+    std::vector<uint8_t> alive(num_paths);
+    std::vector<uint32_t> active, next_active;
+    std::vector<uint64_t> sort_keys;
+
+    if (tile->accumulated_samples == 0)
+    {
+        for (uint32_t pixel : pixels)
+            m_accumulator[pixel] = Vec4();
+    }
+
+    for (uint32_t s = 0; s < tile->samples_per_pixel; ++s)
+    {
+        // Generate the camera rays and find their first hits
+#pragma omp parallel for schedule(dynamic, 16) num_threads(m_num_threads)
+        for (int64_t block = 0; block < num_blocks; ++block)
+        {
+            const uint32_t first = block_offsets[block];
+            const uint32_t num_rays = block_offsets[block + 1] - first;
+
+            cpu::RayPacket packet;
+            for (uint32_t i = 0; i < num_rays; ++i)
+            {
+                PathState& path = paths[first + i];
+                const uint32_t pixel = pixels[first + i];
+
+                Random rng(pixel, uint64_t(tile->accumulated_samples) + s);
+                const Ray ray = get_camera_ray(pixel % m_frame_width, pixel / m_frame_width, rng);
+                start_path(&path, ray, rng);
+
+                if (m_packet_tracing)
+                {
+                    packet.set_ray(i, ray.org, ray.dir);
+                    packet.t_max[i] = pos_inf;
+                    packet.active |= 1u << i;
+                }
+                else
+                {
+                    path.found = intersect(ray, pos_inf, &path.hit);
+                }
+            }
+
+            if (m_packet_tracing)
+            {
+                packet.finalize();
+
+                Hit hits[cpu::packet_size];
+                const uint32_t hit_mask = intersect(&packet, hits);
+                for (uint32_t i = 0; i < num_rays; ++i)
+                {
+                    paths[first + i].found = (hit_mask >> i) & 1;
+                    paths[first + i].hit = hits[i];
+                }
+            }
+        }
+
+        active.resize(num_paths);
+        for (int64_t i = 0; i < num_paths; ++i)
+            active[i] = uint32_t(i);
+
+        while (!active.empty())
+        {
+            // Group the paths by the root node of the material they hit, so
+            // each material tree is evaluated for many paths in a row;
+            // paths that missed the scene go last
+            sort_keys.resize(active.size());
+            for (size_t i = 0; i < active.size(); ++i)
+            {
+                const PathState& path = paths[active[i]];
+                const uint64_t material = path.found ? m_scene->material_indices[path.hit.primitive] : UINT32_MAX;
+                sort_keys[i] = (material << 32) | active[i];
+            }
+            std::sort(sort_keys.begin(), sort_keys.end());
+
+            const int64_t num_active = int64_t(active.size());
+
+#pragma omp parallel for schedule(dynamic, wavefront_chunk_size) num_threads(m_num_threads)
+            for (int64_t i = 0; i < num_active; ++i)
+            {
+                const uint32_t index = uint32_t(sort_keys[i]);
+                alive[index] = shade(&paths[index], tile->num_bounces, tile->bounces_before_russian_roulette);
+            }
+
+            // Test the shadow rays of the light samples taken while shading
+#pragma omp parallel for schedule(dynamic, wavefront_chunk_size) num_threads(m_num_threads)
+            for (int64_t i = 0; i < num_active; ++i)
+                trace_shadow(&paths[active[i]]);
+
+            // Keep the surviving paths, in path order so that rays of
+            // neighbouring pixels stay together
+            next_active.clear();
+            for (uint32_t index : active)
+            {
+                if (alive[index])
+                    next_active.push_back(index);
+            }
+            active.swap(next_active);
+
+            // Extend the surviving paths
+            const int64_t num_extended = int64_t(active.size());
+
+#pragma omp parallel for schedule(dynamic, wavefront_chunk_size) num_threads(m_num_threads)
+            for (int64_t i = 0; i < num_extended; ++i)
+            {
+                PathState& path = paths[active[i]];
+                path.found = intersect(path.ray, pos_inf, &path.hit);
+            }
+        }
+
+        // Drop samples that went wrong numerically instead of spoiling the
+        // pixel
+        for (int64_t i = 0; i < num_paths; ++i)
+        {
+            const Vec3& radiance = paths[i].radiance;
+            Vec4& accumulator = m_accumulator[pixels[i]];
+            if (is_finite(radiance))
+            {
+                accumulator.x += radiance.x;
+                accumulator.y += radiance.y;
+                accumulator.z += radiance.z;
+            }
+            accumulator.w += 1.0f;
+        }
+    }
+}
+
+CPUTracer::Ray CPUTracer::get_camera_ray(uint32_t x, uint32_t y, Random& rng) const
+{
+    // Jittered position on the image plane in [-1, 1]
+    const float aspect = float(m_frame_width) / float(m_frame_height);
+    const float sx = 2.0f * (float(x) + rng.next()) / float(m_frame_width) - 1.0f;
+    float sy = 1.0f - 2.0f * (float(y) + rng.next()) / float(m_frame_height);
+    if (m_invert_y)
+        sy = -sy;
+
+    Ray ray;
+    ray.org = m_eye;
+    ray.dir = normalize(m_forward + m_right * (sx * aspect * m_tan_half_fov) + m_up * (sy * m_tan_half_fov));
+    return ray;
+}
+
+void CPUTracer::merge_output(const Tracer* tracer, const TraceTile* tile)
+{
+    const CPUTracer* other = dynamic_cast<const CPUTracer*>(tracer);
+    if (other == nullptr)
+        throw Error("cpu tracer: can only merge the output of another cpu tracer");
+
+    if (other->m_frame_width != m_frame_width || other->m_frame_height != m_frame_height)
+        throw Error("cpu tracer: cannot merge output of different frame dimensions");
+
+    for (uint32_t y = tile->tile_y; y < tile->tile_y + tile->tile_h; ++y)
+    {
+        const size_t offset = size_t(y) * m_frame_width + tile->tile_x;
+        std::copy(other->m_accumulator.begin() + offset, other->m_accumulator.begin() + offset + tile->tile_w,
+                  m_accumulator.begin() + offset);
+    }
+}
+
+void CPUTracer::sync_framebuffer(const TraceTile* tile)
+{
+    for (uint32_t y = tile->tile_y; y < tile->tile_y + tile->tile_h; ++y)
+    {
+        for (uint32_t x = tile->tile_x; x < tile->tile_x + tile->tile_w; ++x)
+        {
+            const uint32_t pixel = y * m_frame_width + x;
+            const Vec4& accumulator = m_accumulator[pixel];
+            const float scale = tile->exposure / max(accumulator.w, 1.0f);
+
+            Vec4& out = m_framebuffer[pixel];
+            for (uint8_t i = 0; i < 3; ++i)
+                out[i] = std::pow(clamp(accumulator[i] * scale, 0.0f, 1.0f), 1.0f / 2.2f);
+            out.w = 1.0f;
+        }
+    }
+}
+
+Vec3 CPUTracer::trace_path(const Ray& camera_ray, bool found, const Hit& camera_hit,
+                           uint32_t num_bounces, uint32_t rr_bounces, Random& rng) const
+{
+    PathState path;
+    start_path(&path, camera_ray, rng);
+    path.found = found;
+    path.hit = camera_hit;
+
+    for (;;)
+    {
+        const bool alive = shade(&path, num_bounces, rr_bounces);
+        trace_shadow(&path);
+        if (!alive)
+            break;
+
+        path.found = intersect(path.ray, pos_inf, &path.hit);
+    }
+
+    return path.radiance;
+}
+
+void CPUTracer::start_path(PathState* path, const Ray& camera_ray, const Random& rng) const
+{
+    path->ray = camera_ray;
+    path->found = false;
+    path->rng = rng;
+    path->throughput = Vec3(1.0f, 1.0f, 1.0f);
+    path->radiance = Vec3(0.0f, 0.0f, 0.0f);
+    path->is_specular = true;
+    path->bsdf_pdf = 0.0f;
+    path->channel = -1;
+    path->bounce = 0;
+    path->cone_width = 0.0f;
+    path->cone_spread = 2.0f * m_tan_half_fov / float(m_frame_height);
+    path->shadow_pending = false;
+}
+
+bool CPUTracer::shade(PathState* path, uint32_t num_bounces, uint32_t rr_bounces) const
+{
+    path->shadow_pending = false;
+
+    if (!path->found)
+    {
+        path->radiance = path->radiance + path->throughput * get_environment(path->ray.dir);
+        return false;
+    }
+
+    SurfacePoint sp;
+    get_surface_point(path->ray, path->hit, &sp);
+    sp.channel = path->channel;
+
+    // Project the ray cone at the hit onto the texture space of the surface
+    const float cone_width = path->cone_width + path->cone_spread * path->hit.t;
+    if (m_texture_lod)
+        sp.uv_footprint = cone_width * sp.uv_density * min(1.0f / abs(dot(sp.wo, sp.geometric_normal)), max_footprint_stretch);
+
+    const material::Node* node = resolve_material(m_scene->material_indices[path->hit.primitive], &sp, path->rng);
+    if (node == nullptr)
+        return false;
+
+    // From now on only the selected channel is carried
+    if (sp.channel != path->channel)
+    {
+        path->channel = sp.channel;
+        Vec3 mask(0.0f, 0.0f, 0.0f);
+        mask[path->channel] = 3.0f;
+        path->throughput = path->throughput * mask;
+    }
+
+    const material::NodeType type = node->get_type();
+    if (type == material::BXDF_EMISSIVE)
+    {
+        float weight = 1.0f;
+        if (!path->is_specular && !m_area_lights.empty())
+            weight = power_heuristic(path->bsdf_pdf, get_light_pdf(path->hit, path->ray));
+
+        path->radiance = path->radiance + path->throughput * get_emission(*node, sp.uv, sp.uv_footprint) * weight;
+        return false;
+    }
+
+    if (path->bounce >= num_bounces)
+        return false;
+
+    Vec3 light_radiance;
+    if (is_light_sampled(type) && sample_lights(sp, *node, path->rng, &path->shadow_ray, &light_radiance))
+    {
+        path->shadow_radiance = path->throughput * light_radiance;
+        path->shadow_pending = true;
+    }
+
+    Vec3 wi, weight;
+    if (!sample_bsdf(*node, sp, path->rng, &wi, &weight, &path->bsdf_pdf, &path->is_specular))
+        return false;
+
+    path->throughput = path->throughput * weight;
+
+    if (path->bounce >= rr_bounces)
+    {
+        const float q = min(max_component(path->throughput), 0.95f);
+        if (path->rng.next() >= q)
+            return false;
+        path->throughput = path->throughput * (1.0f / q);
+    }
+
+    // Offset the origin to the side of the new direction
+    const Vec3 ng = dot(wi, sp.geometric_normal) > 0.0f ? sp.geometric_normal : -sp.geometric_normal;
+    const float eps = 1e-4f * max(1.0f, max(abs(sp.position.x), max(abs(sp.position.y), abs(sp.position.z))));
+
+    path->ray.org = sp.position + ng * eps;
+    path->ray.dir = wi;
+    path->cone_width = cone_width;
+    ++path->bounce;
+    return true;
+}
+
+void CPUTracer::trace_shadow(PathState* path) const
+{
+    if (path->shadow_pending && !occluded(path->shadow_ray, shadow_ray_extent))
+        path->radiance = path->radiance + path->shadow_radiance;
+    path->shadow_pending = false;
+}
+
+template <typename Node>
+bool CPUTracer::intersect(const Array<Node>& nodes, const Ray& ray, float t_max, Hit* hit, bool any_hit) const
+{
+    const cpu::RayBoxData world_ray(ray.org, ray.dir);
+
+    // The scene BVH leaves are mesh instances; continue in the mesh BVH with
+    // the ray in object space. Both rays share the same parametrization so
+    // distances carry over.
+    return traverse(nodes, 0, world_ray, t_max, any_hit, [&](const Node& node, uint32_t child, float& t_limit)
+    {
+        const uint32_t instance = node.get_mesh_index(child);
+        const Mat4& world_to_object = m_scene->mesh_instances[instance].transform;
+        const Vec3 org = transform_point(world_to_object, ray.org);
+        const Vec3 dir = transform_vector(world_to_object, ray.dir);
+        const cpu::RayBoxData object_ray(org, dir);
+
+        return traverse(nodes, m_instance_roots[instance], object_ray, t_limit, any_hit,
+                        [&](const Node& leaf, uint32_t leaf_child, float& t_leaf)
+        {
+            const uint32_t first = leaf.get_primitives_offset(leaf_child);
+            const uint32_t count = leaf.get_num_primitives(leaf_child);
+
+            bool found = false;
+            for (uint32_t i = 0; i < count; i += 4)
+            {
+                float t[4], u[4], v[4];
+                uint32_t mask = cpu::intersect_triangles(m_scene->vertices.data(), &m_scene->indices[3 * (first + i)],
+                                                         min(count - i, 4u), org, dir, 0.0f, t_leaf, t, u, v);
+                while (mask)
+                {
+                    const uint32_t lane = uint32_t(__builtin_ctz(mask));
+                    mask &= mask - 1;
+
+                    if (t[lane] >= t_leaf)
+                        continue;
+
+                    t_leaf = t[lane];
+                    found = true;
+                    if (hit != nullptr)
+                    {
+                        hit->t = t[lane];
+                        hit->u = u[lane];
+                        hit->v = v[lane];
+                        hit->primitive = first + i + lane;
+                        hit->instance = instance;
+                    }
+
+                    if (any_hit)
+                        return true;
+                }
+            }
+            return found;
+        });
+    });
+}
+
+template <typename Node>
+uint32_t CPUTracer::intersect(const Array<Node>& nodes, cpu::RayPacket* packet, Hit* hits) const
+{
+    uint32_t hit_mask = 0;
+
+    traverse(nodes, 0, *packet, [&](const Node& node, uint32_t child, uint32_t rays)
+    {
+        // Continue with the rays moved into object space; an affine
+        // transform keeps the packet coherent
+        const uint32_t instance = node.get_mesh_index(child);
+        const Mat4& world_to_object = m_scene->mesh_instances[instance].transform;
+
+        cpu::RayPacket object_packet;
+        for (uint32_t r = rays; r; r &= r - 1)
+        {
+            const uint32_t lane = uint32_t(__builtin_ctz(r));
+            const Vec3 org(packet->org_x[lane], packet->org_y[lane], packet->org_z[lane]);
+            const Vec3 dir(packet->dir_x[lane], packet->dir_y[lane], packet->dir_z[lane]);
+            object_packet.set_ray(lane, transform_point(world_to_object, org), transform_vector(world_to_object, dir));
+            object_packet.t_max[lane] = packet->t_max[lane];
+        }
+        object_packet.active = rays;
+        object_packet.finalize();
+
+        traverse(nodes, m_instance_roots[instance], object_packet, [&](const Node& leaf, uint32_t leaf_child, uint32_t leaf_rays)
+        {
+            const uint32_t first = leaf.get_primitives_offset(leaf_child);
+            const uint32_t count = leaf.get_num_primitives(leaf_child);
+
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                const uint32_t* indices = &m_scene->indices[3 * (first + i)];
+                float t[cpu::packet_size], u[cpu::packet_size], v[cpu::packet_size];
+                uint32_t mask = cpu::intersect_triangle_packet(object_packet, leaf_rays, m_scene->vertices[indices[0]],
+                        m_scene->vertices[indices[1]], m_scene->vertices[indices[2]], t, u, v);
+                for (; mask; mask &= mask - 1)
+                {
+                    const uint32_t lane = uint32_t(__builtin_ctz(mask));
+                    object_packet.t_max[lane] = t[lane];
+                    hits[lane].t = t[lane];
+                    hits[lane].u = u[lane];
+                    hits[lane].v = v[lane];
+                    hits[lane].primitive = first + i;
+                    hits[lane].instance = instance;
+                    hit_mask |= 1u << lane;
+                }
+            }
+        });
+
+        for (uint32_t r = rays; r; r &= r - 1)
+        {
+            const uint32_t lane = uint32_t(__builtin_ctz(r));
+            packet->t_max[lane] = object_packet.t_max[lane];
+        }
+    });
+
+    return hit_mask;
+}
+
+uint32_t CPUTracer::intersect(cpu::RayPacket* packet, Hit* hits) const
+{
+    if (m_bvh_width == 8)
+        return intersect(*m_bvh8_nodes, packet, hits);
+    if (m_bvh_width == 4)
+        return intersect(*m_bvh4_nodes, packet, hits);
+    return 0;
+}
+
+bool CPUTracer::intersect(const Ray& ray, float t_max, Hit* hit) const
+{
+    if (m_bvh_width == 8)
+        return intersect(*m_bvh8_nodes, ray, t_max, hit, false);
+    if (m_bvh_width == 4)
+        return intersect(*m_bvh4_nodes, ray, t_max, hit, false);
+    return false;
+}
+
+bool CPUTracer::occluded(const Ray& ray, float t_max) const
+{
+    if (m_bvh_width == 8)
+        return intersect(*m_bvh8_nodes, ray, t_max, nullptr, true);
+    if (m_bvh_width == 4)
+        return intersect(*m_bvh4_nodes, ray, t_max, nullptr, true);
+    return false;
+}
+
+void CPUTracer::get_surface_point(const Ray& ray, const Hit& hit, SurfacePoint* sp) const
+{
+    const Mat4& world_to_object = m_scene->mesh_instances[hit.instance].transform;
+    const Mat4& object_to_world = m_object_to_world[hit.instance];
+
+    const uint32_t* indices = &m_scene->indices[3 * hit.primitive];
+    const Vec3& p0 = m_scene->vertices[indices[0]];
+    const Vec3& p1 = m_scene->vertices[indices[1]];
+    const Vec3& p2 = m_scene->vertices[indices[2]];
+    const Vec3 n0 = m_scene->get_normal(indices[0]);
+    const Vec3 n1 = m_scene->get_normal(indices[1]);
+    const Vec3 n2 = m_scene->get_normal(indices[2]);
+    const Vec2 uv0 = m_scene->get_uv(indices[0]);
+    const Vec2 uv1 = m_scene->get_uv(indices[1]);
+    const Vec2 uv2 = m_scene->get_uv(indices[2]);
+
+    const float w = 1.0f - hit.u - hit.v;
+    const Vec3 e1 = p1 - p0;
+    const Vec3 e2 = p2 - p0;
+
+    sp->position = ray.org + ray.dir * hit.t;
+    sp->uv = uv0 * w + uv1 * hit.u + uv2 * hit.v;
+    sp->wo = -normalize(ray.dir);
+
+    Vec3 ng = normalize(transform_normal(world_to_object, cross(e1, e2)));
+    const Vec3 ns = n0 * w + n1 * hit.u + n2 * hit.v;
+    Vec3 n = dot(ns, ns) > 1e-12f ? normalize(transform_normal(world_to_object, ns)) : ng;
+
+    // Vertex normals define the outside of the surface regardless of the
+    // triangle winding
+    if (dot(ng, n) < 0.0f)
+        ng = -ng;
+
+    sp->entering = dot(sp->wo, ng) > 0.0f;
+
+    // Shade on the side the ray arrived from
+    if (!sp->entering)
+    {
+        ng = -ng;
+        n = -n;
+    }
+    sp->geometric_normal = ng;
+    sp->normal = n;
+
+    // Texture space tangents
+    const Vec2 duv1 = uv1 - uv0;
+    const Vec2 duv2 = uv2 - uv0;
+    const float det = duv1.x * duv2.y - duv1.y * duv2.x;
+    if (abs(det) > 1e-12f)
+    {
+        const float inv_det = 1.0f / det;
+        sp->dpdu = transform_vector(object_to_world, (e1 * duv2.y - e2 * duv1.y) * inv_det);
+        sp->dpdv = transform_vector(object_to_world, (e2 * duv1.x - e1 * duv2.x) * inv_det);
+    }
+    else
+    {
+        make_basis(n, &sp->dpdu, &sp->dpdv);
+    }
+
+    // Ratio of the texture space and world space areas of the triangle
+    const float world_area = length(cross(transform_vector(object_to_world, e1), transform_vector(object_to_world, e2)));
+    sp->uv_density = world_area > 0.0f ? std::sqrt(abs(det) / world_area) : 0.0f;
+    sp->uv_footprint = 0.0f;
+
+    sp->channel = -1;
+    sp->int_ior = -1.0f;
+    sp->ext_ior = -1.0f;
+}
+
+const material::Node* CPUTracer::resolve_material(uint32_t node_index, SurfacePoint* sp, Random& rng) const
+{
+    // Walk down the operation nodes until a BxDF is reached
+    int32_t index = int32_t(node_index);
+    for (uint32_t depth = 0; depth < max_material_depth; ++depth)
+    {
+        if (index < 0 || size_t(index) >= m_scene->material_nodes.size())
+            return nullptr;
+
+        const material::Node& node = m_scene->material_nodes[index];
+        switch (node.get_type())
+        {
+            case material::OP_MIX:
+                index = rng.next() < node.get_float(material::WEIGHT) ? node.get_right_child() : node.get_left_child();
+                break;
+            case material::OP_MIXMAP:
+            {
+                const float weight = luminance(sample_texture(node.get_texture(material::PARAM_NONE), sp->uv, sp->uv_footprint));
+                index = rng.next() < weight ? node.get_right_child() : node.get_left_child();
+                break;
+            }
+            case material::OP_BUMPMAP:
+                apply_bump_map(node.get_texture(material::PARAM_NONE), sp);
+                index = node.get_left_child();
+                break;
+            case material::OP_NORMALMAP:
+                apply_normal_map(node.get_texture(material::PARAM_NONE), sp);
+                index = node.get_left_child();
+                break;
+            case material::OP_DISPERSE:
+            {
+                if (sp->channel < 0)
+                    sp->channel = min(int32_t(rng.next() * 3.0f), 2);
+
+                sp->int_ior = node.get_vec3(material::INT_IOR)[sp->channel];
+                sp->ext_ior = node.get_vec3(material::EXT_IOR)[sp->channel];
+                index = node.get_left_child();
+                break;
+            }
+            case material::NODE_NONE:
+                return nullptr;
+            default:
+                return &node;
+        }
+    }
+
+    return nullptr;
+}
+
+void CPUTracer::apply_bump_map(int32_t texture, SurfacePoint* sp) const
+{
+    if (texture < 0)
+        return;
+
+    // Height differences to the neighbouring texels, in texel units
+    const scene::TextureMetadata& metadata = m_scene->texture_metadata[texture];
+    const float du = 1.0f / float(metadata.width);
+    const float dv = 1.0f / float(metadata.height);
+
+    const float h = luminance(sample_texture(texture, sp->uv, 0.0f));
+    const float dh_du = luminance(sample_texture(texture, sp->uv + Vec2(du, 0.0f), 0.0f)) - h;
+    const float dh_dv = luminance(sample_texture(texture, sp->uv + Vec2(0.0f, dv), 0.0f)) - h;
+
+    Vec3 t, b;
+    make_tangent_frame(sp->normal, sp->dpdu, &t, &b);
+
+    const Vec3 n = normalize(sp->normal - t * dh_du - b * dh_dv);
+    if (dot(n, sp->geometric_normal) > 0.0f)
+        sp->normal = n;
+}
+
+void CPUTracer::apply_normal_map(int32_t texture, SurfacePoint* sp) const
+{
+    if (texture < 0)
+        return;
+
+    const Vec4 texel = sample_texture(texture, sp->uv, sp->uv_footprint);
+    const Vec3 local(2.0f * texel.x - 1.0f, 2.0f * texel.y - 1.0f, 2.0f * texel.z - 1.0f);
+    if (dot(local, local) < 1e-12f)
+        return;
+
+    Vec3 t, b;
+    make_tangent_frame(sp->normal, sp->dpdu, &t, &b);
+
+    const Vec3 n = normalize(to_world(local, t, b, sp->normal));
+    if (dot(n, sp->geometric_normal) > 0.0f)
+        sp->normal = n;
+}
+
+Vec3 CPUTracer::eval_bsdf(const material::Node& node, const SurfacePoint& sp, const Vec3& wi, float* pdf) const
+{
+    // Only the BxDFs sampled by sample_lights are evaluated; the result
+    // includes the cosine term
+    *pdf = 0.0f;
+
+    const float cos_i = dot(wi, sp.normal);
+    const float cos_o = dot(sp.wo, sp.normal);
+    if (cos_i <= 0.0f || cos_o <= 0.0f || dot(wi, sp.geometric_normal) <= 0.0f)
+        return Vec3(0.0f, 0.0f, 0.0f);
+
+    switch (node.get_type())
+    {
+        case material::BXDF_DIFFUSE:
+            *pdf = cos_i * float(one_over_pi);
+            return get_color(node, material::REFLECTANCE, sp.uv, sp.uv_footprint) * (cos_i * float(one_over_pi));
+        case material::BXDF_ROUGH_CONDUCTOR:
+        {
+            const float alpha = max(get_roughness(node, sp.uv, sp.uv_footprint), 1e-3f);
+            const Vec3 h = normalize(sp.wo + wi);
+            const float cos_h = dot(h, sp.normal);
+            const float d = ggx_d(cos_h, alpha);
+
+            *pdf = d * cos_h / (4.0f * dot(sp.wo, h));
+
+            const Vec3 f = fresnel_schlick(get_color(node, material::SPECULARITY, sp.uv, sp.uv_footprint), dot(wi, h));
+            const float g = ggx_g1(cos_o, alpha) * ggx_g1(cos_i, alpha);
+            return f * (d * g / (4.0f * cos_o));
+        }
+        default:
+            return Vec3(0.0f, 0.0f, 0.0f);
+    }
+}
+
+bool CPUTracer::sample_bsdf(const material::Node& node, const SurfacePoint& sp, Random& rng,
+                            Vec3* wi, Vec3* weight, float* pdf, bool* is_specular) const
+{
+    // is_specular is set for directions that light sampling cannot produce
+    const Vec3& n = sp.normal;
+    const float cos_o = dot(sp.wo, n);
+    if (cos_o <= 0.0f)
+        return false;
+
+    Vec3 t, b;
+    make_tangent_frame(n, sp.dpdu, &t, &b);
+
+    *pdf = 0.0f;
+    *is_specular = true;
+
+    switch (node.get_type())
+    {
+        case material::BXDF_DIFFUSE:
+        {
+            const Vec3 local = sample_cosine_hemisphere(rng.next(), rng.next());
+            *wi = to_world(local, t, b, n);
+            *weight = get_color(node, material::REFLECTANCE, sp.uv, sp.uv_footprint);
+            *pdf = local.z * float(one_over_pi);
+            *is_specular = false;
+            break;
+        }
+        case material::BXDF_CONDUCTOR:
+        {
+            *wi = reflect(sp.wo, n);
+            *weight = get_color(node, material::SPECULARITY, sp.uv, sp.uv_footprint);
+            break;
+        }
+        case material::BXDF_ROUGH_CONDUCTOR:
+        {
+            const float alpha = max(get_roughness(node, sp.uv, sp.uv_footprint), 1e-3f);
+            const Vec3 h = to_world(sample_ggx(alpha, rng.next(), rng.next()), t, b, n);
+            const float cos_oh = dot(sp.wo, h);
+            if (cos_oh <= 0.0f)
+                return false;
+
+            *wi = reflect(sp.wo, h);
+            const float cos_i = dot(*wi, n);
+            if (cos_i <= 0.0f)
+                return false;
+
+            const float cos_h = dot(h, n);
+            const Vec3 f = fresnel_schlick(get_color(node, material::SPECULARITY, sp.uv, sp.uv_footprint), cos_oh);
+            const float g = ggx_g1(cos_o, alpha) * ggx_g1(cos_i, alpha);
+
+            *weight = f * (g * cos_oh / (cos_o * cos_h));
+            *pdf = ggx_d(cos_h, alpha) * cos_h / (4.0f * cos_oh);
+            *is_specular = false;
+            break;
+        }
+        case material::BXDF_DIELECTRIC:
+        case material::BXDF_ROUGH_DIELECTRIC:
+        {
+            const float int_ior = sp.int_ior > 0.0f ? sp.int_ior : node.get_float(material::INT_IOR);
+            const float ext_ior = sp.ext_ior > 0.0f ? sp.ext_ior : node.get_float(material::EXT_IOR);
+            const float eta = sp.entering ? ext_ior / int_ior : int_ior / ext_ior;
+
+            // Smooth interfaces scatter around the shading normal, rough ones
+            // around a sampled microfacet normal
+            const bool rough = node.get_type() == material::BXDF_ROUGH_DIELECTRIC;
+            const float alpha = rough ? max(get_roughness(node, sp.uv, sp.uv_footprint), 1e-3f) : 0.0f;
+            const Vec3 h = rough ? to_world(sample_ggx(alpha, rng.next(), rng.next()), t, b, n) : n;
+            const float cos_oh = dot(sp.wo, h);
+            if (cos_oh <= 0.0f)
+                return false;
+
+            Vec3 transmitted;
+            const bool can_refract = refract(sp.wo, h, eta, &transmitted);
+            const float f = can_refract ? fresnel_dielectric(cos_oh, eta) : 1.0f;
+
+            if (rng.next() < f)
+            {
+                *wi = reflect(sp.wo, h);
+                *weight = get_color(node, material::SPECULARITY, sp.uv, sp.uv_footprint);
+            }
+            else
+            {
+                *wi = normalize(transmitted);
+                *weight = get_color(node, material::TRANSMITTANCE, sp.uv, sp.uv_footprint);
+            }
+
+            if (rough)
+            {
+                const float cos_h = dot(h, n);
+                const float g = ggx_g1(cos_o, alpha) * ggx_g1(dot(*wi, n), alpha);
+                *weight = *weight * (g * cos_oh / (cos_o * cos_h));
+            }
+            break;
+        }
+        default:
+            return false;
+    }
+
+    // Reject directions on the wrong side of the geometry; transmission is
+    // the only way below the surface
+    const bool transmitted = dot(*wi, n) < 0.0f;
+    const bool below = dot(*wi, sp.geometric_normal) < 0.0f;
+    return transmitted == below;
+}
+
+bool CPUTracer::sample_lights(const SurfacePoint& sp, const material::Node& node, Random& rng,
+                              Ray* shadow_ray, Vec3* radiance) const
+{
+    if (m_area_lights.empty())
+        return false;
+
+    const uint32_t num_lights = uint32_t(m_area_lights.size());
+    const AreaLight& light = m_area_lights[min(uint32_t(rng.next() * float(num_lights)), num_lights - 1)];
+
+    // Uniform point on the triangle
+    const float r1 = std::sqrt(rng.next());
+    const float r2 = rng.next();
+    const float b1 = r1 * (1.0f - r2);
+    const float b2 = r1 * r2;
+    const Vec3 p = light.p0 + light.e1 * b1 + light.e2 * b2;
+
+    const Vec3 ng = sp.geometric_normal;
+    const float eps = 1e-4f * max(1.0f, max(abs(sp.position.x), max(abs(sp.position.y), abs(sp.position.z))));
+    const Vec3 org = sp.position + ng * eps;
+
+    const Vec3 d = p - org;
+    const float dist2 = dot(d, d);
+    if (dist2 <= 0.0f)
+        return false;
+
+    const Vec3 wi = d * (1.0f / std::sqrt(dist2));
+    const float cos_l = abs(dot(light.normal, wi));
+    if (cos_l < 1e-6f)
+        return false;
+
+    float bsdf_pdf;
+    const Vec3 f = eval_bsdf(node, sp, wi, &bsdf_pdf);
+    if (bsdf_pdf <= 0.0f)
+        return false;
+
+    // Emission is looked up with the texture coordinates of the light
+    const uint32_t* indices = &m_scene->indices[3 * light.primitive];
+    const Vec2 uv = m_scene->get_uv(indices[0]) * (1.0f - b1 - b2) + m_scene->get_uv(indices[1]) * b1 +
+                    m_scene->get_uv(indices[2]) * b2;
+    const Vec3 emission = get_emission(m_scene->material_nodes[light.material], uv, 0.0f);
+
+    const float light_pdf = dist2 / (cos_l * light.area * float(num_lights));
+    *radiance = f * emission * (power_heuristic(light_pdf, bsdf_pdf) / light_pdf);
+
+    // The shadow ray ends just short of the light
+    shadow_ray->org = org;
+    shadow_ray->dir = d;
+    return true;
+}
+
+Vec3 CPUTracer::get_emission(const material::Node& node, const Vec2& uv, float footprint) const
+{
+    return get_color(node, material::RADIANCE, uv, footprint) * node.get_float(material::SCALER);
+}
+
+Vec3 CPUTracer::get_environment(const Vec3& dir) const
+{
+    if (m_environment_material < 0)
+        return Vec3(0.0f, 0.0f, 0.0f);
+
+    // Latitude-longitude mapping
+    const Vec3 d = normalize(dir);
+    const Vec2 uv(0.5f + std::atan2(d.x, -d.z) * (0.5f * float(one_over_pi)),
+                  0.5f + std::asin(clamp(d.y, -1.0f, 1.0f)) * float(one_over_pi));
+
+    return get_emission(m_scene->material_nodes[m_environment_material], uv, 0.0f);
+}
+
+float CPUTracer::get_light_pdf(const Hit& hit, const Ray& ray) const
+{
+    // Density of sample_lights picking the hit point, in solid angle
+    const Mat4& object_to_world = m_object_to_world[hit.instance];
+    const uint32_t* indices = &m_scene->indices[3 * hit.primitive];
+    const Vec3& p0 = m_scene->vertices[indices[0]];
+    const Vec3 e1 = transform_vector(object_to_world, m_scene->vertices[indices[1]] - p0);
+    const Vec3 e2 = transform_vector(object_to_world, m_scene->vertices[indices[2]] - p0);
+
+    const Vec3 n = cross(e1, e2);
+    const float area = 0.5f * length(n);
+    const Vec3 d = ray.dir * hit.t;
+    const float dist2 = dot(d, d);
+    const float cos_l = abs(dot(n, d)) / (2.0f * area * std::sqrt(dist2));
+    if (area <= 0.0f || cos_l < 1e-6f)
+        return 0.0f;
+
+    return dist2 / (cos_l * area * float(m_area_lights.size()));
+}
+
+Vec3 CPUTracer::get_color(const material::Node& node, material::ParamType param, const Vec2& uv, float footprint) const
+{
+    const int32_t texture = node.get_texture(param);
+    if (texture >= 0)
+    {
+        const Vec4 texel = sample_texture(texture, uv, footprint);
+        return Vec3(texel.x, texel.y, texel.z);
+    }
+    return node.get_vec3(param);
+}
+
+float CPUTracer::get_roughness(const material::Node& node, const Vec2& uv, float footprint) const
+{
+    const int32_t texture = node.get_texture(material::ROUGHNESS);
+    if (texture >= 0)
+        return sample_texture(texture, uv, footprint).x;
+    return node.get_float(material::ROUGHNESS);
+}
+
+Vec4 CPUTracer::sample_texture(int32_t texture, const Vec2& uv, float footprint) const
+{
+    if (texture < 0 || size_t(texture) >= m_scene->texture_metadata.size())
+        return Vec4(0.0f, 0.0f, 0.0f, 0.0f);
+
+    const scene::TextureMetadata& metadata = m_scene->texture_metadata[texture];
+    const uint32_t num_levels = m_scene->texture_levels.empty() ? 1 : m_scene->texture_levels[texture].num_levels;
+    if (footprint <= 0.0f || num_levels == 1)
+        return sample_level(texture, 0, uv);
+
+    // Trilinear filtering between the two levels whose texels are closest
+    // to the footprint in size
+    const float texels = footprint * std::sqrt(float(metadata.width) * float(metadata.height));
+    const float lod = clamp(std::log2(max(texels, 1.0f)), 0.0f, float(num_levels - 1));
+    const uint32_t level = uint32_t(lod);
+    const float t = lod - float(level);
+
+    const Vec4 fine = sample_level(texture, level, uv);
+    if (t <= 0.0f || level + 1 >= num_levels)
+        return fine;
+
+    const Vec4 coarse = sample_level(texture, level + 1, uv);
+    Vec4 out;
+    for (uint8_t i = 0; i < 4; ++i)
+        out[i] = fine[i] * (1.0f - t) + coarse[i] * t;
+    return out;
+}
+
+Vec4 CPUTracer::sample_level(int32_t texture, uint32_t level, const Vec2& uv) const
+{
+    const scene::TextureMetadata& metadata = m_scene->texture_metadata[texture];
+    const uint32_t width = get_mip_size(metadata.width, level);
+    const uint32_t height = get_mip_size(metadata.height, level);
+
+    // Paged textures are filtered tile by tile; the texels of a lookup are
+    // fetched one at a time, as a tile only stays valid until the next one
+    // is looked up
+    if (!m_scene->texture_tiles.empty())
+    {
+        const uint32_t tiles_x = get_num_texture_tiles(width);
+        return cpu::filter_bilinear(width, height, uv, [&](int32_t x, int32_t y)
+        {
+            x %= int32_t(width);
+            y %= int32_t(height);
+            if (x < 0) x += int32_t(width);
+            if (y < 0) y += int32_t(height);
+
+            const uint32_t tile = (uint32_t(y) / texture_tile_texels) * tiles_x + uint32_t(x) / texture_tile_texels;
+            const uint8_t* data = m_tile_cache.get_tile(uint32_t(texture), level, tile);
+            return cpu::fetch_texel(metadata.format, LinearTextureLayout, data, int32_t(texture_tile_texels),
+                                    int32_t(texture_tile_texels), x % int32_t(texture_tile_texels),
+                                    y % int32_t(texture_tile_texels));
+        });
+    }
+
+    uint32_t offset = metadata.offset;
+    TextureLayout layout = LinearTextureLayout;
+    if (!m_scene->texture_levels.empty())
+    {
+        const scene::TextureLevels& levels = m_scene->texture_levels[texture];
+        offset = levels.offsets[level];
+        layout = get_level_layout(TextureLayout(levels.layout), width, height);
+    }
+
+    // Bilinear filtering with repeat addressing
+    return cpu::sample_bilinear(metadata.format, layout, m_scene->texture_data.data() + offset, width, height, uv);
+}
+
+} // namespace eclipse
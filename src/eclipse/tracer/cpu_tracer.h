@@ -0,0 +1,243 @@
+#pragma once
+
+#include "eclipse/tracer/tracer.h"
+#include "eclipse/tracer/cpu_kernels.h"
+#include "eclipse/tracer/tile_cache.h"
+#include "eclipse/scene/scene.h"
+#include "eclipse/scene/camera.h"
+#include "eclipse/scene/bvh_wide_node.h"
+#include "eclipse/scene/material_node.h"
+#include "eclipse/math/vec2.h"
+#include "eclipse/math/vec3.h"
+#include "eclipse/math/vec4.h"
+#include "eclipse/math/mat4.h"
+#include "eclipse/util/array.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace eclipse {
+
+// A multi-threaded path tracer running on the host. It renders compiled
+// scenes directly: the two-level BVH is traversed as a 4 or 8 wide BVH (taken
+// from the scene when it was compiled with one, collapsed on update
+// otherwise), child boxes and leaf triangles are tested with SSE/AVX kernels,
+// and tile rows are distributed over OpenMP threads.
+//
+// Camera rays are coherent, so by default they are traced in packets of
+// 4x2 pixels which share the traversal of the BVH; paths continue with
+// single rays after the first hit.
+//
+// In wavefront mode all paths of a tile advance one bounce at a time: the
+// hits are sorted by material and shaded material by material, shadow rays
+// are traced in a separate pass, and the surviving paths are compacted
+// before they are extended. This keeps the evaluation of each material tree
+// cache hot on scenes with many layered materials. Both modes produce the
+// same image.
+//
+// Textures with mip chains are filtered trilinearly. The level follows the
+// footprint of a ray cone traced along each path, which starts at the angle
+// a pixel subtends and widens with the distance travelled.
+//
+// Textures of scenes compiled for paging are read tile by tile through a
+// TileCache, which holds a bounded amount of them in memory.
+//
+// Radiance is accumulated in an HDR buffer; sync_framebuffer converts the
+// accumulated radiance of a tile into the tone mapped framebuffer. The
+// output only depends on the tile parameters, so it does not change with
+// the number of threads.
+class CPUTracer : public Tracer
+{
+public:
+    // Uses all available OpenMP threads when num_threads is 0
+    CPUTracer(uint32_t num_threads = 0);
+    ~CPUTracer();
+
+    const char* get_name() const override;
+    float get_gflops_estimate() const override;
+    uint32_t get_flags() const override;
+    const TracerStats* get_stats() const override;
+
+    void init() override;
+    void terminate() override;
+
+    void update(UpdateType type, void* data, bool synchronous = true) override;
+    void trace(const TraceTile* tile) override;
+    void merge_output(const Tracer* tracer, const TraceTile* tile) override;
+    void sync_framebuffer(const TraceTile* tile) override;
+
+    // OpenMP threads tracing each tile; 0 uses all available threads.
+    // Drops the texture tiles kept so far.
+    void set_num_threads(uint32_t num_threads);
+    uint32_t get_num_threads() const { return m_num_threads; }
+
+    // Trace camera rays in packets (the default) or one by one
+    void set_packet_tracing(bool enabled) { m_packet_tracing = enabled; }
+    bool get_packet_tracing() const { return m_packet_tracing; }
+
+    // Trace tiles with the wavefront pipeline instead of path by path
+    void set_wavefront(bool enabled) { m_wavefront = enabled; }
+    bool get_wavefront() const { return m_wavefront; }
+
+    // Pick texture mip levels from the ray footprint (the default) or
+    // always sample full resolution textures
+    void set_texture_lod(bool enabled) { m_texture_lod = enabled; }
+    bool get_texture_lod() const { return m_texture_lod; }
+
+    // Bytes of texture tiles kept in memory for scenes with paged textures
+    // (512 MB by default); changing it drops the tiles kept so far
+    void set_tile_cache_size(uint64_t bytes) { m_tile_cache.set_capacity(bytes); }
+    TileCache::Stats get_tile_cache_stats() const { return m_tile_cache.get_stats(); }
+
+    uint32_t get_frame_width() const { return m_frame_width; }
+    uint32_t get_frame_height() const { return m_frame_height; }
+
+    // Accumulated radiance per pixel; w holds the number of samples
+    const std::vector<Vec4>& get_accumulator() const { return m_accumulator; }
+
+    // Tone mapped RGBA output in the [0, 1] range; the first row is the top
+    // of the frame unless the camera inverts the y axis
+    const std::vector<Vec4>& get_framebuffer() const { return m_framebuffer; }
+
+private:
+    struct Ray
+    {
+        Vec3 org;
+        Vec3 dir;
+    };
+
+    struct Hit
+    {
+        float t;
+        float u, v;
+        uint32_t primitive;
+        uint32_t instance;
+    };
+
+    struct SurfacePoint
+    {
+        Vec3 position;
+        Vec3 geometric_normal;
+        Vec3 normal;
+        Vec3 dpdu, dpdv;
+        Vec3 wo;
+        Vec2 uv;
+
+        // Texture space per world space length on the triangle, and the
+        // width of the ray footprint in texture space; 0 samples level 0
+        float uv_density;
+        float uv_footprint;
+
+        bool entering;
+        int32_t channel;
+        float int_ior, ext_ior;
+    };
+
+    struct AreaLight
+    {
+        Vec3 p0, e1, e2;
+        Vec3 normal;
+        float area;
+        uint32_t primitive;
+        uint32_t material;
+    };
+
+    class Random;
+    struct PathState;
+
+    void update_scene(const scene::Scene* scene);
+    void update_camera(const scene::Camera* camera);
+    void update_frame_dimensions(uint32_t width, uint32_t height);
+
+    void trace_block(const TraceTile* tile, uint32_t x0, uint32_t y0, uint32_t w, uint32_t h);
+    void trace_wavefront(const TraceTile* tile);
+    Ray get_camera_ray(uint32_t x, uint32_t y, Random& rng) const;
+
+    // Continues a path from the first intersection of its camera ray
+    Vec3 trace_path(const Ray& camera_ray, bool found, const Hit& camera_hit,
+                    uint32_t num_bounces, uint32_t rr_bounces, Random& rng) const;
+
+    // Steps of a path: shade scatters the path at its current hit and
+    // returns false when it ends; trace_shadow resolves the light sample
+    // taken while shading
+    void start_path(PathState* path, const Ray& camera_ray, const Random& rng) const;
+    bool shade(PathState* path, uint32_t num_bounces, uint32_t rr_bounces) const;
+    void trace_shadow(PathState* path) const;
+
+    template <typename Node>
+    bool intersect(const Array<Node>& nodes, const Ray& ray, float t_max, Hit* hit, bool any_hit) const;
+    bool intersect(const Ray& ray, float t_max, Hit* hit) const;
+    bool occluded(const Ray& ray, float t_max) const;
+
+    // Finds the closest hits of the active rays of a packet and returns the
+    // mask of the rays that hit something
+    template <typename Node>
+    uint32_t intersect(const Array<Node>& nodes, cpu::RayPacket* packet, Hit* hits) const;
+    uint32_t intersect(cpu::RayPacket* packet, Hit* hits) const;
+
+    void get_surface_point(const Ray& ray, const Hit& hit, SurfacePoint* sp) const;
+    const material::Node* resolve_material(uint32_t node_index, SurfacePoint* sp, Random& rng) const;
+    void apply_bump_map(int32_t texture, SurfacePoint* sp) const;
+    void apply_normal_map(int32_t texture, SurfacePoint* sp) const;
+
+    Vec3 eval_bsdf(const material::Node& node, const SurfacePoint& sp, const Vec3& wi, float* pdf) const;
+    bool sample_bsdf(const material::Node& node, const SurfacePoint& sp, Random& rng,
+                     Vec3* wi, Vec3* weight, float* pdf, bool* is_specular) const;
+    bool sample_lights(const SurfacePoint& sp, const material::Node& node, Random& rng,
+                       Ray* shadow_ray, Vec3* radiance) const;
+    Vec3 get_emission(const material::Node& node, const Vec2& uv, float footprint) const;
+    Vec3 get_environment(const Vec3& dir) const;
+    float get_light_pdf(const Hit& hit, const Ray& ray) const;
+
+    Vec3 get_color(const material::Node& node, material::ParamType param, const Vec2& uv, float footprint) const;
+    float get_roughness(const material::Node& node, const Vec2& uv, float footprint) const;
+
+    // Samples the mip level matching a footprint given in texture space
+    Vec4 sample_texture(int32_t texture, const Vec2& uv, float footprint) const;
+    Vec4 sample_level(int32_t texture, uint32_t level, const Vec2& uv) const;
+
+private:
+    std::string m_name;
+    uint32_t m_num_threads;
+    bool m_packet_tracing;
+    bool m_wavefront;
+    bool m_texture_lod;
+    TracerStats m_stats;
+
+    const scene::Scene* m_scene;
+
+    // Tiles of paged textures, filled as they are sampled
+    mutable TileCache m_tile_cache;
+
+    // Wide BVH used for traversal and the wide root of each mesh instance.
+    // Points to the scene's wide nodes or to the ones collapsed on update.
+    uint32_t m_bvh_width;
+    const Array<bvh::Node4>* m_bvh4_nodes;
+    const Array<bvh::Node8>* m_bvh8_nodes;
+    Array<bvh::Node4> m_own_bvh4_nodes;
+    Array<bvh::Node8> m_own_bvh8_nodes;
+    std::vector<uint32_t> m_instance_roots;
+
+    // Mesh instance transforms from object to world space; the scene only
+    // stores the world to object transforms
+    std::vector<Mat4> m_object_to_world;
+
+    std::vector<AreaLight> m_area_lights;
+    int32_t m_environment_material;
+
+    // Camera basis
+    Vec3 m_eye;
+    Vec3 m_right;
+    Vec3 m_up;
+    Vec3 m_forward;
+    float m_tan_half_fov;
+    bool m_invert_y;
+
+    uint32_t m_frame_width;
+    uint32_t m_frame_height;
+    std::vector<Vec4> m_accumulator;
+    std::vector<Vec4> m_framebuffer;
+};
+
+} // namespace eclipse
@@ -0,0 +1,173 @@
+#include "eclipse/tracer/tile_cache.h"
+#include "eclipse/util/texture_tiles.h"
+
+#include <algorithm>
+#include <cstring>
+#include <omp.h>
+
+namespace eclipse {
+
+namespace {
+
+// Spreads the keys of neighbouring tiles over the shards and thread entries
+uint64_t mix_key(uint64_t key)
+{
+    return key * 0x9e3779b97f4a7c15ull;
+}
+
+} // namespace
+
+TileCache::TileCache(uint64_t capacity_bytes, uint32_t max_threads)
+    : m_scene(nullptr), m_capacity(capacity_bytes), m_slots(new ThreadSlot[std::max(max_threads, 1u)])
+    , m_num_slots(std::max(max_threads, 1u))
+{
+    clear();
+    reset_stats();
+}
+
+TileCache::~TileCache()
+{
+}
+
+void TileCache::set_scene(const scene::Scene* scene)
+{
+    clear();
+    reset_stats();
+    m_scene = scene;
+}
+
+void TileCache::set_capacity(uint64_t capacity_bytes)
+{
+    clear();
+    m_capacity = capacity_bytes;
+}
+
+void TileCache::set_max_threads(uint32_t max_threads)
+{
+    m_num_slots = std::max(max_threads, 1u);
+    m_slots.reset(new ThreadSlot[m_num_slots]);
+    clear();
+    reset_stats();
+}
+
+void TileCache::clear()
+{
+    for (Shard& shard : m_shards)
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.lru.clear();
+        shard.index.clear();
+        shard.resident_bytes = 0;
+    }
+
+    for (uint32_t i = 0; i < m_num_slots; ++i)
+    {
+        for (uint32_t entry = 0; entry < num_thread_entries; ++entry)
+        {
+            m_slots[i].keys[entry] = 0;
+            m_slots[i].tiles[entry] = nullptr;
+        }
+    }
+}
+
+const uint8_t* TileCache::get_tile(uint32_t texture, uint32_t level, uint32_t tile)
+{
+    const uint64_t key = make_key(texture, level, tile);
+    const uint64_t hash = mix_key(key);
+    ThreadSlot& slot = m_slots[uint32_t(omp_get_thread_num()) % m_num_slots];
+
+    // Only this thread touches its slot, so the counters need no atomic
+    // read-modify-write
+    const uint32_t entry = uint32_t(hash >> 61);
+    if (slot.keys[entry] == key && slot.tiles[entry])
+    {
+        slot.hits.store(slot.hits.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return slot.tiles[entry]->data();
+    }
+
+    slot.keys[entry] = key;
+    slot.tiles[entry] = load_tile(key, m_shards[(hash >> 57) & (num_shards - 1)], slot);
+    return slot.tiles[entry]->data();
+}
+
+TileCache::TilePtr TileCache::load_tile(uint64_t key, Shard& shard, ThreadSlot& slot)
+{
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.index.find(key);
+        if (it != shard.index.end())
+        {
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+            slot.hits.store(slot.hits.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return it->second->tile;
+        }
+    }
+
+    // Reading the tile may wait for the disk, so other threads can use the
+    // shard meanwhile
+    slot.misses.store(slot.misses.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    TilePtr tile = read_tile(uint32_t(key >> 36), uint32_t(key >> 32) & 0xf, uint32_t(key));
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    // Another thread may have read the same tile in the meantime
+    auto it = shard.index.find(key);
+    if (it != shard.index.end())
+    {
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+        return it->second->tile;
+    }
+
+    shard.lru.push_front(Entry{ key, tile });
+    shard.index.emplace(key, shard.lru.begin());
+    shard.resident_bytes += tile->size();
+
+    // Keep the tile just read even if it alone exceeds the shard's share
+    const uint64_t shard_capacity = m_capacity / num_shards;
+    while (shard.resident_bytes > shard_capacity && shard.lru.size() > 1)
+    {
+        const Entry& last = shard.lru.back();
+        shard.resident_bytes -= last.tile->size();
+        shard.index.erase(last.key);
+        shard.lru.pop_back();
+    }
+    return tile;
+}
+
+TileCache::TilePtr TileCache::read_tile(uint32_t texture, uint32_t level, uint32_t tile) const
+{
+    const scene::TextureTiles& tiles = m_scene->texture_tiles[texture];
+    const uint8_t* data = m_scene->texture_tile_data.data() + tiles.offsets[level] + uint64_t(tile) * tiles.tile_size;
+    return std::make_shared<const std::vector<uint8_t>>(data, data + tiles.tile_size);
+}
+
+TileCache::Stats TileCache::get_stats() const
+{
+    Stats stats = {};
+    stats.capacity_bytes = m_capacity;
+
+    for (uint32_t i = 0; i < m_num_slots; ++i)
+    {
+        stats.hits += m_slots[i].hits.load(std::memory_order_relaxed);
+        stats.misses += m_slots[i].misses.load(std::memory_order_relaxed);
+    }
+
+    for (const Shard& shard : m_shards)
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        stats.resident_bytes += shard.resident_bytes;
+        stats.resident_tiles += shard.lru.size();
+    }
+    return stats;
+}
+
+void TileCache::reset_stats()
+{
+    for (uint32_t i = 0; i < m_num_slots; ++i)
+    {
+        m_slots[i].hits.store(0, std::memory_order_relaxed);
+        m_slots[i].misses.store(0, std::memory_order_relaxed);
+    }
+}
+
+} // namespace eclipse
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "eclipse/scene/scene.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace eclipse {
+
+// Fixed size cache of the tiles of paged textures; see util/texture_tiles.h.
+//
+// Tiles are requested by texture, mip level and tile index, and read from
+// the scene's tile data on a miss. Since that data is a view of the mapping
+// of the scene file, a miss is what pages the tile in from disk; the cache
+// keeps the tiles being rendered in memory of its own, so the rest of the
+// file never has to stay resident.
+//
+// Tiles are spread over shards, each with its own lock and least recently
+// used list, and evicted from a shard once it holds more than its share of
+// the capacity, though each keeps at least the tile it read last. Tiles are
+// read outside of the lock, so threads only wait on each other for the list
+// updates. In front of the shards each thread keeps a few tiles it looked up
+// last, which it reads without locking; a bilinear lookup usually finds all
+// its texels in one of them. Hits there do not refresh the tile in its shard,
+// so eviction is only approximately least recently used, and a tile evicted
+// from its shard lives on until the threads holding it move on.
+class TileCache
+{
+public:
+    struct Stats
+    {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t resident_bytes;
+        uint64_t resident_tiles;
+        uint64_t capacity_bytes;
+    };
+
+    // Up to max_threads threads, numbered by omp_get_thread_num, may look up
+    // tiles at the same time
+    TileCache(uint64_t capacity_bytes, uint32_t max_threads);
+    ~TileCache();
+
+    // Drops all tiles and statistics and starts serving the tiles of
+    // `scene`, which may be null. Must not be called while tiles are looked
+    // up.
+    void set_scene(const scene::Scene* scene);
+
+    // Drops all tiles and keeps at most `capacity_bytes` of them from now on
+    void set_capacity(uint64_t capacity_bytes);
+    uint64_t get_capacity() const { return m_capacity; }
+
+    // Drops all tiles and statistics and lets up to `max_threads` threads
+    // look up tiles from now on. Must not be called while tiles are looked
+    // up.
+    void set_max_threads(uint32_t max_threads);
+
+    // Tile `tile` of mip level `level` of `texture`, which must exist in
+    // the scene, laid out as a linear level of texture_tile_texels squared
+    // texels. The tile stays valid until the calling thread looks up
+    // another one.
+    const uint8_t* get_tile(uint32_t texture, uint32_t level, uint32_t tile);
+
+    Stats get_stats() const;
+    void reset_stats();
+
+private:
+    typedef std::shared_ptr<const std::vector<uint8_t>> TilePtr;
+
+    struct Entry
+    {
+        uint64_t key;
+        TilePtr tile;
+    };
+
+    struct Shard
+    {
+        mutable std::mutex mutex;
+        std::list<Entry> lru;
+        std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+        uint64_t resident_bytes = 0;
+    };
+
+    static constexpr uint32_t num_shards = 16;
+    static constexpr uint32_t num_thread_entries = 8;
+
+    // Tiles last looked up by a thread and its counters, padded so that the
+    // slots of different threads never share a cache line
+    struct ThreadSlot
+    {
+        uint64_t keys[num_thread_entries];
+        TilePtr tiles[num_thread_entries];
+        std::atomic<uint64_t> hits;
+        std::atomic<uint64_t> misses;
+        uint8_t padding[64];
+    };
+
+    static uint64_t make_key(uint32_t texture, uint32_t level, uint32_t tile)
+    {
+        return (uint64_t(texture) << 36) | (uint64_t(level) << 32) | tile;
+    }
+
+    TilePtr load_tile(uint64_t key, Shard& shard, ThreadSlot& slot);
+    TilePtr read_tile(uint32_t texture, uint32_t level, uint32_t tile) const;
+    void clear();
+
+private:
+    const scene::Scene* m_scene;
+    uint64_t m_capacity;
+    Shard m_shards[num_shards];
+    std::unique_ptr<ThreadSlot[]> m_slots;
+    uint32_t m_num_slots;
+};
+
+} // namespace eclipse
@@ -15,6 +15,7 @@ struct TraceTile
     uint32_t tile_h;
 
     uint32_t samples_per_pixel;
+    uint32_t num_bounces;
     uint32_t bounces_before_russian_roulette;
     uint32_t accumulated_samples;
     float exposure;
@@ -37,6 +38,10 @@ enum TracerFlags
     GPU    = 1 << 3
 };
 
+// The data passed to Tracer::update for each update type:
+//     FrameDimensions: const uint32_t[2] holding the frame width and height
+//     SceneData:       const scene::Scene*; must outlive the tracer or the next update
+//     CameraData:      const scene::Camera*
 enum UpdateType
 {
     FrameDimensions,
@@ -47,6 +52,8 @@ enum UpdateType
 class Tracer
 {
 public:
+    virtual ~Tracer() {}
+
     virtual const char* get_name() const = 0;
     virtual float get_gflops_estimate() const = 0;
     virtual uint32_t get_flags() const = 0;
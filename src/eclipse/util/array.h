@@ -0,0 +1,186 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace eclipse {
+
+// Allocator leaving elements constructed without arguments uninitialized,
+// which lets Array::resize_uninitialized skip clearing memory that is about
+// to be overwritten
+template <typename T>
+struct UninitializedAllocator : public std::allocator<T>
+{
+    template <typename U>
+    struct rebind { typedef UninitializedAllocator<U> other; };
+
+    UninitializedAllocator() { }
+    template <typename U>
+    UninitializedAllocator(const UninitializedAllocator<U>&) { }
+
+    template <typename U>
+    void construct(U*) { }
+
+    template <typename U, typename... Args>
+    void construct(U* ptr, Args&&... args) { ::new (static_cast<void*>(ptr)) U(std::forward<Args>(args)...); }
+};
+
+// A vector that either owns its elements or views elements stored elsewhere,
+// e.g. in a memory mapped file. Views are read only; the first non-const
+// access copies the elements into owned storage, so code building or editing
+// arrays does not need to care which kind it got. Copies of a view share the
+// viewed memory, which stays alive as long as any of them does.
+template <typename T>
+class Array
+{
+public:
+    typedef T value_type;
+    typedef T* iterator;
+    typedef const T* const_iterator;
+
+    Array() : m_data(nullptr), m_size(0), m_view(false) { }
+    explicit Array(size_t size) : m_owned(size, T()), m_view(false) { sync(); }
+    Array(const std::vector<T>& elements) : m_owned(elements.begin(), elements.end()), m_view(false) { sync(); }
+
+    Array(const Array& other) : m_data(nullptr), m_size(0), m_view(false) { *this = other; }
+    Array(Array&& other) : m_data(nullptr), m_size(0), m_view(false) { *this = std::move(other); }
+
+    Array& operator=(const Array& other)
+    {
+        if (this != &other)
+        {
+            m_owned = other.m_owned;
+            m_owner = other.m_owner;
+            m_view = other.m_view;
+            if (m_view)
+            {
+                m_data = other.m_data;
+                m_size = other.m_size;
+            }
+            else
+            {
+                sync();
+            }
+        }
+        return *this;
+    }
+
+    Array& operator=(Array&& other)
+    {
+        if (this != &other)
+        {
+            m_owned = std::move(other.m_owned);
+            m_owner = std::move(other.m_owner);
+            m_view = other.m_view;
+            if (m_view)
+            {
+                m_data = other.m_data;
+                m_size = other.m_size;
+            }
+            else
+            {
+                sync();
+            }
+            other.m_owned.clear();
+            other.m_owner.reset();
+            other.m_view = false;
+            other.sync();
+        }
+        return *this;
+    }
+
+    // Views `size` elements at `data`; `owner` keeps the memory alive
+    static Array view(const T* data, size_t size, std::shared_ptr<const void> owner)
+    {
+        static_assert(std::is_standard_layout<T>::value, "only plain data can be viewed");
+
+        Array array;
+        array.m_data = const_cast<T*>(data);
+        array.m_size = size;
+        array.m_view = true;
+        array.m_owner = std::move(owner);
+        return array;
+    }
+
+    bool is_view() const { return m_view; }
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    const T* data() const { return m_data; }
+    T* data() { make_owned(); return m_data; }
+
+    const T& operator[](size_t index) const { return m_data[index]; }
+    T& operator[](size_t index) { make_owned(); return m_data[index]; }
+
+    const T* begin() const { return m_data; }
+    const T* end() const { return m_data + m_size; }
+    T* begin() { make_owned(); return m_data; }
+    T* end() { make_owned(); return m_data + m_size; }
+
+    const T& front() const { return m_data[0]; }
+    const T& back() const { return m_data[m_size - 1]; }
+    T& front() { make_owned(); return m_data[0]; }
+    T& back() { make_owned(); return m_data[m_size - 1]; }
+
+    void resize(size_t size) { make_owned(); m_owned.resize(size, T()); sync(); }
+
+    // Leaves new elements uninitialized; for plain data that is overwritten
+    // right away, e.g. by a file read
+    void resize_uninitialized(size_t size)
+    {
+        static_assert(std::is_standard_layout<T>::value, "only plain data can be left uninitialized");
+        make_owned();
+        m_owned.resize(size);
+        sync();
+    }
+
+    void reserve(size_t size) { make_owned(); m_owned.reserve(size); sync(); }
+    void push_back(const T& value) { make_owned(); m_owned.push_back(value); sync(); }
+
+    // Unlike std::vector::clear this also releases the storage
+    void clear()
+    {
+        decltype(m_owned)().swap(m_owned);
+        m_owner.reset();
+        m_view = false;
+        sync();
+    }
+
+    void swap(Array& other)
+    {
+        Array tmp(std::move(other));
+        other = std::move(*this);
+        *this = std::move(tmp);
+    }
+
+private:
+    void make_owned()
+    {
+        if (!m_view)
+            return;
+
+        m_owned.assign(m_data, m_data + m_size);
+        m_owner.reset();
+        m_view = false;
+        sync();
+    }
+
+    void sync()
+    {
+        m_data = m_owned.data();
+        m_size = m_owned.size();
+    }
+
+private:
+    std::vector<T, UninitializedAllocator<T>> m_owned;
+    std::shared_ptr<const void> m_owner;
+    T* m_data;
+    size_t m_size;
+    bool m_view;
+};
+
+} // namespace eclipse
@@ -0,0 +1,639 @@
+#include "eclipse/util/block_compression.h"
+#include "eclipse/math/packing.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace eclipse {
+
+namespace {
+
+// Texels of a block as floats in the range of their source format: 0-255
+// for 8 bit texels and half float bits for BC6H
+struct Block
+{
+    float texels[16][4];
+};
+
+void load_block(Texture::Format src_format, const uint8_t* src, uint32_t width, uint32_t height, uint32_t block_x,
+                uint32_t block_y, bool to_half, Block* block)
+{
+    const bool is_float = src_format == Texture::LUMINANCE32F || src_format == Texture::RGBA32F;
+    const uint32_t channels = (src_format == Texture::RGBA8 || src_format == Texture::RGBA32F) ? 4 : 1;
+
+    for (uint32_t i = 0; i < 16; ++i)
+    {
+        const uint32_t x = std::min(block_x * 4 + i % 4, width - 1);
+        const uint32_t y = std::min(block_y * 4 + i / 4, height - 1);
+        const size_t texel = (size_t(y) * width + x) * channels;
+
+        for (uint32_t c = 0; c < 4; ++c)
+        {
+            float value;
+            if (channels == 1 && c == 3)
+            {
+                value = is_float ? 1.0f : 255.0f;
+            }
+            else
+            {
+                const size_t index = texel + (channels == 1 ? 0 : c);
+                if (is_float)
+                    std::memcpy(&value, src + 4 * index, sizeof(value));
+                else
+                    value = float(src[index]);
+            }
+
+            // Negative, infinite and NaN radiance has no unsigned half
+            if (to_half)
+                value = float(float_to_half(value > 0.0f ? std::min(value, 65504.0f) : 0.0f));
+
+            block->texels[i][c] = value;
+        }
+    }
+}
+
+// Endpoints of the segment of the texels' principal axis spanned by their
+// projections onto it
+void fit_principal_axis(const Block& block, float* lo, float* hi)
+{
+    float mean[3] = { 0.0f, 0.0f, 0.0f };
+    for (uint32_t i = 0; i < 16; ++i)
+    {
+        for (uint32_t c = 0; c < 3; ++c)
+            mean[c] += block.texels[i][c] * (1.0f / 16.0f);
+    }
+
+    float cov[3][3] = {};
+    for (uint32_t i = 0; i < 16; ++i)
+    {
+        const float d[3] = { block.texels[i][0] - mean[0], block.texels[i][1] - mean[1], block.texels[i][2] - mean[2] };
+        for (uint32_t a = 0; a < 3; ++a)
+        {
+            for (uint32_t b = 0; b < 3; ++b)
+                cov[a][b] += d[a] * d[b];
+        }
+    }
+
+    // Power iteration; a block of a single color keeps the diagonal
+    float axis[3] = { 1.0f, 1.0f, 1.0f };
+    for (uint32_t iteration = 0; iteration < 8; ++iteration)
+    {
+        float next[3];
+        for (uint32_t a = 0; a < 3; ++a)
+            next[a] = cov[a][0] * axis[0] + cov[a][1] * axis[1] + cov[a][2] * axis[2];
+
+        const float scale = std::max(std::max(std::fabs(next[0]), std::fabs(next[1])), std::fabs(next[2]));
+        if (scale == 0.0f)
+            break;
+        for (uint32_t a = 0; a < 3; ++a)
+            axis[a] = next[a] / scale;
+    }
+
+    const float length = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+    for (uint32_t a = 0; a < 3; ++a)
+        axis[a] /= length;
+
+    float t_min = 0.0f;
+    float t_max = 0.0f;
+    for (uint32_t i = 0; i < 16; ++i)
+    {
+        float t = 0.0f;
+        for (uint32_t c = 0; c < 3; ++c)
+            t += (block.texels[i][c] - mean[c]) * axis[c];
+        t_min = std::min(t_min, t);
+        t_max = std::max(t_max, t);
+    }
+
+    for (uint32_t c = 0; c < 3; ++c)
+    {
+        lo[c] = mean[c] + axis[c] * t_min;
+        hi[c] = mean[c] + axis[c] * t_max;
+    }
+}
+
+// Least squares endpoints for texels which are interpolated between them
+// with the given weights of the second endpoint
+bool fit_endpoints(const Block& block, const float* weights, float* end0, float* end1)
+{
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+    float ax[3] = {}, bx[3] = {};
+    for (uint32_t i = 0; i < 16; ++i)
+    {
+        const float b = weights[i];
+        const float a = 1.0f - b;
+        aa += a * a;
+        ab += a * b;
+        bb += b * b;
+        for (uint32_t c = 0; c < 3; ++c)
+        {
+            ax[c] += a * block.texels[i][c];
+            bx[c] += b * block.texels[i][c];
+        }
+    }
+
+    const float det = aa * bb - ab * ab;
+    if (std::fabs(det) < 1e-6f)
+        return false;
+
+    for (uint32_t c = 0; c < 3; ++c)
+    {
+        end0[c] = (ax[c] * bb - bx[c] * ab) / det;
+        end1[c] = (bx[c] * aa - ax[c] * ab) / det;
+    }
+    return true;
+}
+
+float get_distance2(const float* texel, const int32_t* color)
+{
+    float d = 0.0f;
+    for (uint32_t c = 0; c < 3; ++c)
+        d += (texel[c] - float(color[c])) * (texel[c] - float(color[c]));
+    return d;
+}
+
+// BC1
+
+uint16_t to_rgb565(const float* color)
+{
+    const uint32_t r = uint32_t(std::lround(std::min(std::max(color[0], 0.0f), 255.0f) * 31.0f / 255.0f));
+    const uint32_t g = uint32_t(std::lround(std::min(std::max(color[1], 0.0f), 255.0f) * 63.0f / 255.0f));
+    const uint32_t b = uint32_t(std::lround(std::min(std::max(color[2], 0.0f), 255.0f) * 31.0f / 255.0f));
+    return uint16_t((r << 11) | (g << 5) | b);
+}
+
+void from_rgb565(uint16_t value, int32_t* color)
+{
+    const int32_t r = value >> 11;
+    const int32_t g = (value >> 5) & 63;
+    const int32_t b = value & 31;
+    color[0] = (r << 3) | (r >> 2);
+    color[1] = (g << 2) | (g >> 4);
+    color[2] = (b << 3) | (b >> 2);
+}
+
+void get_bc1_palette(uint16_t color0, uint16_t color1, int32_t palette[4][3])
+{
+    from_rgb565(color0, palette[0]);
+    from_rgb565(color1, palette[1]);
+    for (uint32_t c = 0; c < 3; ++c)
+    {
+        if (color0 > color1)
+        {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c] + 1) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c] + 1) / 3;
+        }
+        else
+        {
+            palette[2][c] = (palette[0][c] + palette[1][c] + 1) / 2;
+            palette[3][c] = 0;
+        }
+    }
+}
+
+// Picks the nearest palette entry for each texel; returns the total error
+float get_bc1_indices(const Block& block, uint16_t color0, uint16_t color1, uint32_t* indices)
+{
+    int32_t palette[4][3];
+    get_bc1_palette(color0, color1, palette);
+
+    float error = 0.0f;
+    *indices = 0;
+    for (uint32_t i = 0; i < 16; ++i)
+    {
+        uint32_t best = 0;
+        float best_distance = get_distance2(block.texels[i], palette[0]);
+        for (uint32_t p = 1; p < 4; ++p)
+        {
+            const float distance = get_distance2(block.texels[i], palette[p]);
+            if (distance < best_distance)
+            {
+                best = p;
+                best_distance = distance;
+            }
+        }
+        *indices |= best << (2 * i);
+        error += best_distance;
+    }
+    return error;
+}
+
+// Orders the endpoints for the four color mode
+void order_bc1_endpoints(uint16_t* color0, uint16_t* color1)
+{
+    if (*color0 < *color1)
+        std::swap(*color0, *color1);
+}
+
+// Endpoints that best fit the texels with the given indices of the four
+// color mode
+bool refine_bc1_endpoints(const Block& block, uint32_t indices, uint16_t* color0, uint16_t* color1)
+{
+    const float palette_weights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+
+    float weights[16];
+    for (uint32_t i = 0; i < 16; ++i)
+        weights[i] = palette_weights[(indices >> (2 * i)) & 3];
+
+    float end0[3], end1[3];
+    if (!fit_endpoints(block, weights, end0, end1))
+        return false;
+
+    *color0 = to_rgb565(end0);
+    *color1 = to_rgb565(end1);
+    order_bc1_endpoints(color0, color1);
+    return true;
+}
+
+void encode_bc1(const Block& block, uint8_t* out)
+{
+    float lo[3], hi[3];
+    fit_principal_axis(block, lo, hi);
+
+    uint16_t color0 = to_rgb565(hi);
+    uint16_t color1 = to_rgb565(lo);
+    order_bc1_endpoints(&color0, &color1);
+
+    uint32_t indices;
+    float error = get_bc1_indices(block, color0, color1, &indices);
+
+    uint16_t refined0, refined1;
+    if (color0 != color1 && refine_bc1_endpoints(block, indices, &refined0, &refined1))
+    {
+        uint32_t refined_indices;
+        const float refined_error = get_bc1_indices(block, refined0, refined1, &refined_indices);
+        if (refined_error < error)
+        {
+            color0 = refined0;
+            color1 = refined1;
+            indices = refined_indices;
+        }
+    }
+
+    out[0] = uint8_t(color0);
+    out[1] = uint8_t(color0 >> 8);
+    out[2] = uint8_t(color1);
+    out[3] = uint8_t(color1 >> 8);
+    for (uint32_t b = 0; b < 4; ++b)
+        out[4 + b] = uint8_t(indices >> (8 * b));
+}
+
+// BC4
+
+void get_bc4_palette(uint32_t value0, uint32_t value1, int32_t palette[8])
+{
+    palette[0] = int32_t(value0);
+    palette[1] = int32_t(value1);
+    if (value0 > value1)
+    {
+        for (int32_t i = 1; i < 7; ++i)
+            palette[i + 1] = ((7 - i) * palette[0] + i * palette[1] + 3) / 7;
+    }
+    else
+    {
+        for (int32_t i = 1; i < 5; ++i)
+            palette[i + 1] = ((5 - i) * palette[0] + i * palette[1] + 2) / 5;
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+}
+
+void encode_bc4(const Block& block, uint32_t channel, uint8_t* out)
+{
+    float lo = 255.0f;
+    float hi = 0.0f;
+    for (uint32_t i = 0; i < 16; ++i)
+    {
+        lo = std::min(lo, block.texels[i][channel]);
+        hi = std::max(hi, block.texels[i][channel]);
+    }
+
+    const uint32_t value0 = uint32_t(std::lround(std::min(std::max(hi, 0.0f), 255.0f)));
+    const uint32_t value1 = uint32_t(std::lround(std::min(std::max(lo, 0.0f), 255.0f)));
+    int32_t palette[8];
+    get_bc4_palette(value0, value1, palette);
+
+    uint64_t indices = 0;
+    for (uint32_t i = 0; i < 16; ++i)
+    {
+        uint32_t best = 0;
+        float best_distance = std::fabs(block.texels[i][channel] - float(palette[0]));
+        for (uint32_t p = 1; p < 8; ++p)
+        {
+            const float distance = std::fabs(block.texels[i][channel] - float(palette[p]));
+            if (distance < best_distance)
+            {
+                best = p;
+                best_distance = distance;
+            }
+        }
+        indices |= uint64_t(best) << (3 * i);
+    }
+
+    out[0] = uint8_t(value0);
+    out[1] = uint8_t(value1);
+    for (uint32_t b = 0; b < 6; ++b)
+        out[2 + b] = uint8_t(indices >> (8 * b));
+}
+
+float decode_bc4(const uint8_t* block, uint32_t index)
+{
+    int32_t palette[8];
+    get_bc4_palette(block[0], block[1], palette);
+
+    uint64_t indices = 0;
+    for (uint32_t b = 0; b < 6; ++b)
+        indices |= uint64_t(block[2 + b]) << (8 * b);
+    return float(palette[(indices >> (3 * index)) & 7]) * (1.0f / 255.0f);
+}
+
+// BC6H
+
+constexpr uint32_t bc6h_mode_11 = 0x03;
+constexpr uint32_t bc6h_endpoint_bits = 10;
+constexpr uint32_t bc6h_weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+void put_bits(uint8_t* block, uint32_t* pos, uint32_t value, uint32_t bits)
+{
+    for (uint32_t i = 0; i < bits; ++i, ++*pos)
+    {
+        if ((value >> i) & 1)
+            block[*pos >> 3] |= uint8_t(1u << (*pos & 7));
+    }
+}
+
+uint32_t get_bits(const uint8_t* block, uint32_t* pos, uint32_t bits)
+{
+    uint32_t value = 0;
+    for (uint32_t i = 0; i < bits; ++i, ++*pos)
+        value |= uint32_t((block[*pos >> 3] >> (*pos & 7)) & 1) << i;
+    return value;
+}
+
+uint32_t unquantize_bc6h(uint32_t endpoint)
+{
+    const uint32_t max_endpoint = (1u << bc6h_endpoint_bits) - 1;
+    if (endpoint == 0)
+        return 0;
+    if (endpoint == max_endpoint)
+        return 0xffff;
+    return ((endpoint << 16) + 0x8000) >> bc6h_endpoint_bits;
+}
+
+// Half float bits of palette entry `index` between two unquantized endpoints
+uint32_t interpolate_bc6h(uint32_t a, uint32_t b, uint32_t index)
+{
+    const uint32_t w = bc6h_weights[index];
+    return ((((64 - w) * a + w * b + 32) >> 6) * 31) >> 6;
+}
+
+// The 10 bit endpoint decoding closest to the half float bits `half`
+uint32_t quantize_bc6h(float half)
+{
+    const int32_t guess = int32_t(std::lround((half - 15.5f) / 31.0f));
+
+    uint32_t best = 0;
+    float best_distance = -1.0f;
+    for (int32_t endpoint = guess - 1; endpoint <= guess + 1; ++endpoint)
+    {
+        const uint32_t e = uint32_t(std::min(std::max(endpoint, 0), int32_t(1u << bc6h_endpoint_bits) - 1));
+        const float distance = std::fabs(float((unquantize_bc6h(e) * 31) >> 6) - half);
+        if (best_distance < 0.0f || distance < best_distance)
+        {
+            best = e;
+            best_distance = distance;
+        }
+    }
+    return best;
+}
+
+// Quantizes endpoints given as half float bits and picks the nearest
+// palette entry for each texel; returns the total error
+float get_bc6h_indices(const Block& block, const float* end0, const float* end1, uint32_t endpoints[2][3],
+                       uint32_t* indices)
+{
+    uint32_t unquantized[2][3];
+    for (uint32_t c = 0; c < 3; ++c)
+    {
+        endpoints[0][c] = quantize_bc6h(end0[c]);
+        endpoints[1][c] = quantize_bc6h(end1[c]);
+        unquantized[0][c] = unquantize_bc6h(endpoints[0][c]);
+        unquantized[1][c] = unquantize_bc6h(endpoints[1][c]);
+    }
+
+    int32_t palette[16][3];
+    for (uint32_t p = 0; p < 16; ++p)
+    {
+        for (uint32_t c = 0; c < 3; ++c)
+            palette[p][c] = int32_t(interpolate_bc6h(unquantized[0][c], unquantized[1][c], p));
+    }
+
+    float error = 0.0f;
+    for (uint32_t i = 0; i < 16; ++i)
+    {
+        indices[i] = 0;
+        float best_distance = get_distance2(block.texels[i], palette[0]);
+        for (uint32_t p = 1; p < 16; ++p)
+        {
+            const float distance = get_distance2(block.texels[i], palette[p]);
+            if (distance < best_distance)
+            {
+                indices[i] = p;
+                best_distance = distance;
+            }
+        }
+        error += best_distance;
+    }
+    return error;
+}
+
+void encode_bc6h(const Block& block, uint8_t* out)
+{
+    float lo[3], hi[3];
+    fit_principal_axis(block, lo, hi);
+
+    uint32_t endpoints[2][3];
+    uint32_t indices[16];
+    const float error = get_bc6h_indices(block, lo, hi, endpoints, indices);
+
+    float weights[16];
+    for (uint32_t i = 0; i < 16; ++i)
+        weights[i] = float(bc6h_weights[indices[i]]) / 64.0f;
+
+    float end0[3], end1[3];
+    uint32_t refined_endpoints[2][3];
+    uint32_t refined_indices[16];
+    if (fit_endpoints(block, weights, end0, end1) &&
+        get_bc6h_indices(block, end0, end1, refined_endpoints, refined_indices) < error)
+    {
+        std::memcpy(endpoints, refined_endpoints, sizeof(endpoints));
+        std::memcpy(indices, refined_indices, sizeof(indices));
+    }
+
+    // The most significant index bit of the first texel is implied zero
+    if (indices[0] >= 8)
+    {
+        std::swap(endpoints[0], endpoints[1]);
+        for (uint32_t i = 0; i < 16; ++i)
+            indices[i] = 15 - indices[i];
+    }
+
+    std::memset(out, 0, 16);
+    uint32_t pos = 0;
+    put_bits(out, &pos, bc6h_mode_11, 5);
+    for (uint32_t e = 0; e < 2; ++e)
+    {
+        for (uint32_t c = 0; c < 3; ++c)
+            put_bits(out, &pos, endpoints[e][c], bc6h_endpoint_bits);
+    }
+    for (uint32_t i = 0; i < 16; ++i)
+        put_bits(out, &pos, indices[i], i == 0 ? 3 : 4);
+}
+
+void decode_bc6h(const uint8_t* block, uint32_t index, float* rgba)
+{
+    uint32_t pos = 0;
+    if (get_bits(block, &pos, 5) != bc6h_mode_11)
+    {
+        rgba[0] = rgba[1] = rgba[2] = 0.0f;
+        rgba[3] = 1.0f;
+        return;
+    }
+
+    uint32_t unquantized[2][3];
+    for (uint32_t e = 0; e < 2; ++e)
+    {
+        for (uint32_t c = 0; c < 3; ++c)
+            unquantized[e][c] = unquantize_bc6h(get_bits(block, &pos, bc6h_endpoint_bits));
+    }
+
+    pos = index == 0 ? pos : pos + 3 + 4 * (index - 1);
+    const uint32_t texel_index = get_bits(block, &pos, index == 0 ? 3 : 4);
+    for (uint32_t c = 0; c < 3; ++c)
+        rgba[c] = half_to_float(uint16_t(interpolate_bc6h(unquantized[0][c], unquantized[1][c], texel_index)));
+    rgba[3] = 1.0f;
+}
+
+} // namespace
+
+uint32_t get_block_bytes(Texture::Format format)
+{
+    switch (format)
+    {
+        case Texture::BC1:
+        case Texture::BC4:
+            return 8;
+        case Texture::BC5:
+        case Texture::BC6H:
+            return 16;
+        default:
+            return 0;
+    }
+}
+
+size_t get_compressed_size(Texture::Format format, uint32_t width, uint32_t height)
+{
+    return size_t((width + 3) / 4) * ((height + 3) / 4) * get_block_bytes(format);
+}
+
+bool can_compress(Texture::Format format, Texture::Format src_format)
+{
+    const bool is_8bit = src_format == Texture::LUMINANCE8 || src_format == Texture::RGBA8;
+    switch (format)
+    {
+        case Texture::BC1:
+        case Texture::BC4:
+        case Texture::BC5:
+            return is_8bit;
+        case Texture::BC6H:
+            return !is_8bit;
+        default:
+            return false;
+    }
+}
+
+void compress_texels(Texture::Format format, Texture::Format src_format, const uint8_t* src, uint32_t width,
+                     uint32_t height, uint8_t* dst)
+{
+    const uint32_t blocks_x = (width + 3) / 4;
+    const int64_t blocks_y = int64_t((height + 3) / 4);
+    const uint32_t block_bytes = get_block_bytes(format);
+
+#pragma omp parallel for schedule(dynamic)
+    for (int64_t block_y = 0; block_y < blocks_y; ++block_y)
+    {
+        Block block;
+        for (uint32_t block_x = 0; block_x < blocks_x; ++block_x)
+        {
+            load_block(src_format, src, width, height, block_x, uint32_t(block_y), format == Texture::BC6H, &block);
+
+            uint8_t* out = dst + (size_t(block_y) * blocks_x + block_x) * block_bytes;
+            switch (format)
+            {
+                case Texture::BC1:
+                    encode_bc1(block, out);
+                    break;
+                case Texture::BC4:
+                    encode_bc4(block, 0, out);
+                    break;
+                case Texture::BC5:
+                    encode_bc4(block, 0, out);
+                    encode_bc4(block, 1, out + 8);
+                    break;
+                case Texture::BC6H:
+                    encode_bc6h(block, out);
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+}
+
+void decode_block_texel(uint32_t format, const uint8_t* block, uint32_t index, float* rgba)
+{
+    switch (format)
+    {
+        case Texture::BC1:
+        {
+            const uint16_t color0 = uint16_t(block[0] | (block[1] << 8));
+            const uint16_t color1 = uint16_t(block[2] | (block[3] << 8));
+            const uint32_t indices = uint32_t(block[4]) | (uint32_t(block[5]) << 8) | (uint32_t(block[6]) << 16) |
+                                     (uint32_t(block[7]) << 24);
+
+            int32_t palette[4][3];
+            get_bc1_palette(color0, color1, palette);
+            const int32_t* color = palette[(indices >> (2 * index)) & 3];
+            for (uint32_t c = 0; c < 3; ++c)
+                rgba[c] = float(color[c]) * (1.0f / 255.0f);
+            rgba[3] = 1.0f;
+            break;
+        }
+        case Texture::BC4:
+        {
+            rgba[0] = rgba[1] = rgba[2] = decode_bc4(block, index);
+            rgba[3] = 1.0f;
+            break;
+        }
+        case Texture::BC5:
+        {
+            rgba[0] = decode_bc4(block, index);
+            rgba[1] = decode_bc4(block + 8, index);
+
+            const float x = 2.0f * rgba[0] - 1.0f;
+            const float y = 2.0f * rgba[1] - 1.0f;
+            rgba[2] = 0.5f * std::sqrt(std::max(1.0f - x * x - y * y, 0.0f)) + 0.5f;
+            rgba[3] = 1.0f;
+            break;
+        }
+        case Texture::BC6H:
+            decode_bc6h(block, index, rgba);
+            break;
+        default:
+            rgba[0] = rgba[1] = rgba[2] = rgba[3] = 0.0f;
+            break;
+    }
+}
+
+} // namespace eclipse
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "eclipse/util/texture.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace eclipse {
+
+// Block compression of baked textures.
+//
+// Textures are split into 4x4 texel blocks, stored row by row; the last row
+// and column of blocks are padded by repeating the edge texels. The formats
+// follow the BCn formats of the graphics APIs:
+//
+//   BC1   8 bytes, RGB: two RGB565 endpoints and a 2 bit index per texel
+//         into them and two colors between them. Alpha is not kept.
+//   BC4   8 bytes, one channel: two 8 bit endpoints and a 3 bit index per
+//         texel into them and six values between them.
+//   BC5   16 bytes, two channels stored as two BC4 blocks. Used for normal
+//         maps, whose third channel is reconstructed on decode.
+//   BC6H  16 bytes, unsigned half float RGB. Only mode 11 is used, a single
+//         pair of 10 bit endpoints with a 4 bit index per texel; the decoder
+//         reads that mode only and gives black for other blocks. Without the
+//         two region modes blocks of two colors lose too much, so the
+//         compiler does not use it yet.
+//
+// BC1, BC4 and BC5 encode RGBA8 or LUMINANCE8 texels (BC4 keeps the first
+// channel), BC6H encodes RGBA32F or LUMINANCE32F ones. Endpoints are fitted
+// along the principal axis of the block's texels and BC1 endpoints refined
+// by least squares once indices are known. Blocks are encoded in parallel.
+
+uint32_t get_block_bytes(Texture::Format format);
+
+inline bool is_block_compressed(uint32_t format)
+{
+    return format == Texture::BC1 || format == Texture::BC4 || format == Texture::BC5 || format == Texture::BC6H;
+}
+
+// Bytes of a level of `width` x `height` texels
+size_t get_compressed_size(Texture::Format format, uint32_t width, uint32_t height);
+
+// Whether texels of `src_format` can be compressed into `format`
+bool can_compress(Texture::Format format, Texture::Format src_format);
+
+// Compresses a level stored row by row in `src_format` into `format`; dst
+// must have room for get_compressed_size bytes
+void compress_texels(Texture::Format format, Texture::Format src_format, const uint8_t* src, uint32_t width,
+                     uint32_t height, uint8_t* dst);
+
+// Decodes texel `index` (y * 4 + x) of a block into RGBA: BC4 gives the
+// value in the first three channels, BC5 the normal map texel with the third
+// channel reconstructed, and alpha is 1
+void decode_block_texel(uint32_t format, const uint8_t* block, uint32_t index, float* rgba);
+
+} // namespace eclipse
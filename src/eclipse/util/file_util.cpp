@@ -4,10 +4,13 @@
 #include <vector>
 #include <fstream>
 #include <cstring>
+#include <cerrno>
+#include <cstdio>
 #include <iterator>
 #include <utility>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 namespace eclipse {
 
@@ -88,6 +91,25 @@ std::string concat_paths(const std::string& base_uri, const std::string& rel_uri
     return parent_uri + "/" + child_uri;
 }
 
+std::string get_absolute_path(const std::string& path)
+{
+    if (!path.empty() && path[0] == '/')
+        return path;
+
+    std::vector<char> cwd(256);
+    while (getcwd(cwd.data(), cwd.size()) == nullptr)
+    {
+        if (errno != ERANGE)
+            throw IOError(std::string("can't get the working directory: ") + std::strerror(errno));
+        cwd.resize(cwd.size() * 2);
+    }
+
+    const std::string prefix(cwd.data());
+    if (path.substr(0, 2) == "./")
+        return prefix + path.substr(1);
+    return prefix + "/" + path;
+}
+
 bool file_exists(const std::string& name)
 {
     std::ifstream file(name.c_str());
@@ -109,6 +131,14 @@ bool create_dir(const std::string& dir)
     return false;
 }
 
+void create_dirs(const std::string& dir)
+{
+    for (size_t pos = dir.find('/', 1); pos != std::string::npos; pos = dir.find('/', pos + 1))
+        create_dir(dir.substr(0, pos));
+    if (!dir.empty() && dir.back() != '/')
+        create_dir(dir);
+}
+
 std::vector<char> read_file(const std::string& file)
 {
     std::ifstream file_stream(file, std::ios::binary);
@@ -118,4 +148,20 @@ std::vector<char> read_file(const std::string& file)
     return std::move(data);
 }
 
+void write_atomically(const std::string& path, const std::function<void(const std::string&)>& write)
+{
+    const std::string temp_path = path + ".tmp" + std::to_string(getpid());
+    try
+    {
+        write(temp_path);
+        if (std::rename(temp_path.c_str(), path.c_str()) != 0)
+            throw IOError("could not rename " + temp_path + " to " + path);
+    }
+    catch (...)
+    {
+        std::remove(temp_path.c_str());
+        throw;
+    }
+}
+
 } // namespace eclipse
@@ -2,6 +2,7 @@
 
 #include "eclipse/util/except.h"
 
+#include <functional>
 #include <string>
 #include <vector>
 
@@ -19,8 +20,19 @@ std::string remove_extension(const std::string& uri);
 std::string get_filename(const std::string& uri);
 std::string concat_paths(const std::string& base_uri, const std::string& rel_uri);
 
+// Prefixes relative paths with the working directory
+std::string get_absolute_path(const std::string& path);
+
 bool file_exists(const std::string& name);
 bool create_dir(const std::string& dir);
+
+// Creates `dir` along with any missing parents
+void create_dirs(const std::string& dir);
 std::vector<char> read_file(const std::string& file);
 
+// Calls `write` with a temporary path next to `path` and renames what it
+// wrote into place, so readers of `path`, including processes that have it
+// mapped, never see a half written file
+void write_atomically(const std::string& path, const std::function<void(const std::string&)>& write);
+
 } // namespace eclipse
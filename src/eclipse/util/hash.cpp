@@ -0,0 +1,123 @@
+#include "eclipse/util/hash.h"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace eclipse {
+
+namespace {
+
+constexpr uint64_t prime1 = 11400714785074694791ull;
+constexpr uint64_t prime2 = 14029467366897019727ull;
+constexpr uint64_t prime3 = 1609587929392839161ull;
+constexpr uint64_t prime4 = 9650029242287828579ull;
+constexpr uint64_t prime5 = 2870177450012600261ull;
+
+inline uint64_t rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t read64(const uint8_t* p)
+{
+    uint64_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+inline uint32_t read32(const uint8_t* p)
+{
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+inline uint64_t round(uint64_t acc, uint64_t input)
+{
+    acc += input * prime2;
+    return rotl(acc, 31) * prime1;
+}
+
+inline uint64_t merge_round(uint64_t acc, uint64_t value)
+{
+    acc ^= round(0, value);
+    return acc * prime1 + prime4;
+}
+
+} // namespace
+
+uint64_t hash64(const void* data, size_t size, uint64_t seed)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    const uint8_t* end = p + size;
+    uint64_t h;
+
+    // Four independent lanes over 32 byte stripes
+    if (size >= 32)
+    {
+        uint64_t v1 = seed + prime1 + prime2;
+        uint64_t v2 = seed + prime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - prime1;
+
+        const uint8_t* limit = end - 32;
+        do
+        {
+            v1 = round(v1, read64(p));
+            v2 = round(v2, read64(p + 8));
+            v3 = round(v3, read64(p + 16));
+            v4 = round(v4, read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = merge_round(h, v1);
+        h = merge_round(h, v2);
+        h = merge_round(h, v3);
+        h = merge_round(h, v4);
+    }
+    else
+    {
+        h = seed + prime5;
+    }
+
+    h += uint64_t(size);
+
+    for (; p + 8 <= end; p += 8)
+    {
+        h ^= round(0, read64(p));
+        h = rotl(h, 27) * prime1 + prime4;
+    }
+
+    if (p + 4 <= end)
+    {
+        h ^= uint64_t(read32(p)) * prime1;
+        h = rotl(h, 23) * prime2 + prime3;
+        p += 4;
+    }
+
+    for (; p < end; ++p)
+    {
+        h ^= uint64_t(*p) * prime5;
+        h = rotl(h, 11) * prime1;
+    }
+
+    h ^= h >> 33;
+    h *= prime2;
+    h ^= h >> 29;
+    h *= prime3;
+    h ^= h >> 32;
+    return h;
+}
+
+std::string hash_to_string(uint64_t hash)
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string str(16, '0');
+    for (int i = 15; i >= 0; --i, hash >>= 4)
+        str[size_t(i)] = digits[hash & 0xf];
+    return str;
+}
+
+} // namespace eclipse
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace eclipse {
+
+// 64 bit non-cryptographic hash of a byte range (XXH64); fast enough to
+// fingerprint whole scene files, and stable across runs and machines, so
+// hashes can be stored on disk
+uint64_t hash64(const void* data, size_t size, uint64_t seed = 0);
+
+inline uint64_t hash64(const std::string& str, uint64_t seed = 0)
+{
+    return hash64(str.data(), str.size(), seed);
+}
+
+// Lower case hexadecimal of all 16 digits
+std::string hash_to_string(uint64_t hash);
+
+} // namespace eclipse
@@ -0,0 +1,65 @@
+#include "eclipse/util/mapped_file.h"
+#include "eclipse/util/file_util.h"
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace eclipse {
+
+MappedFile::MappedFile(const std::string& path)
+    : m_path(path), m_data(nullptr), m_size(0)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw IOError("mapped file: could not open " + path + ": " + std::strerror(errno));
+
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+        const int error = errno;
+        close(fd);
+        throw IOError("mapped file: could not stat " + path + ": " + std::strerror(error));
+    }
+
+    m_size = size_t(info.st_size);
+    if (m_size > 0)
+    {
+        void* data = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            const int error = errno;
+            close(fd);
+            throw IOError("mapped file: could not map " + path + ": " + std::strerror(error));
+        }
+        m_data = static_cast<const uint8_t*>(data);
+    }
+
+    // The mapping stays valid after the descriptor is closed
+    close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if (m_data)
+        munmap(const_cast<uint8_t*>(m_data), m_size);
+    m_data = nullptr;
+}
+
+void MappedFile::prefetch(size_t offset, size_t size) const
+{
+    if (offset >= m_size || size == 0)
+        return;
+
+    // madvise needs a page aligned address
+    const size_t page_size = size_t(sysconf(_SC_PAGESIZE));
+    const size_t begin = offset - offset % page_size;
+    const size_t end = offset + size < m_size ? offset + size : m_size;
+    madvise(const_cast<uint8_t*>(m_data) + begin, end - begin, MADV_WILLNEED);
+}
+
+} // namespace eclipse
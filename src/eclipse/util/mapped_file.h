@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace eclipse {
+
+// A read only, shared memory mapping of a whole file. Processes mapping the
+// same file share its pages in the page cache.
+class MappedFile
+{
+public:
+    MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const uint8_t* get_data() const { return m_data; }
+    size_t get_size() const { return m_size; }
+    const std::string& get_path() const { return m_path; }
+
+    // Asks the kernel to start reading a range ahead of its use
+    void prefetch(size_t offset, size_t size) const;
+
+private:
+    std::string m_path;
+    const uint8_t* m_data;
+    size_t m_size;
+};
+
+} // namespace eclipse
@@ -0,0 +1,279 @@
+#include "eclipse/util/mip_map.h"
+#include "eclipse/math/math.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <immintrin.h>
+
+namespace eclipse {
+
+namespace {
+
+constexpr float kaiser_width = 3.0f;
+constexpr float kaiser_alpha = 4.0f;
+
+struct Tap
+{
+    uint32_t index;
+    float weight;
+};
+
+// Modified Bessel function of the first kind of order zero
+float bessel_i0(float x)
+{
+    float sum = 1.0f;
+    float term = 1.0f;
+    for (int k = 1; k < 32 && term > sum * 1e-8f; ++k)
+    {
+        term *= (0.5f * x / float(k)) * (0.5f * x / float(k));
+        sum += term;
+    }
+    return sum;
+}
+
+float kaiser_sinc(float x)
+{
+    const float t = x / kaiser_width;
+    if (std::fabs(t) >= 1.0f)
+        return 0.0f;
+
+    const float window = bessel_i0(kaiser_alpha * std::sqrt(1.0f - t * t)) / bessel_i0(kaiser_alpha);
+    if (std::fabs(x) < 1e-6f)
+        return window;
+
+    const float px = float(pi) * x;
+    return window * std::sin(px) / px;
+}
+
+// Source texels and their weights for each destination texel along an axis
+// of `size` texels
+std::vector<std::vector<Tap>> get_taps(MipFilter filter, uint32_t size)
+{
+    const uint32_t dst_size = get_mip_size(size, 1);
+    std::vector<std::vector<Tap>> taps(dst_size);
+
+    if (size == 1)
+    {
+        taps[0].push_back(Tap{ 0, 1.0f });
+        return taps;
+    }
+
+    if (filter == BoxMipFilter)
+    {
+        for (uint32_t x = 0; x < dst_size; ++x)
+        {
+            if (size % 2 == 0)
+            {
+                taps[x].push_back(Tap{ 2 * x, 0.5f });
+                taps[x].push_back(Tap{ 2 * x + 1, 0.5f });
+            }
+            else
+            {
+                // Each destination texel covers 2 + 1 / dst_size source texels
+                const float n = float(size);
+                taps[x].push_back(Tap{ 2 * x, float(dst_size - x) / n });
+                taps[x].push_back(Tap{ 2 * x + 1, float(dst_size) / n });
+                taps[x].push_back(Tap{ 2 * x + 2, float(x + 1) / n });
+            }
+        }
+        return taps;
+    }
+
+    // The kernel is stretched over the source texels a destination texel
+    // covers and normalized, which also absorbs the truncation of the window
+    const float scale = float(size) / float(dst_size);
+    const float radius = kaiser_width * scale;
+    for (uint32_t x = 0; x < dst_size; ++x)
+    {
+        const float center = (float(x) + 0.5f) * scale - 0.5f;
+        const int64_t first = int64_t(std::ceil(center - radius));
+        const int64_t last = int64_t(std::floor(center + radius));
+
+        float total = 0.0f;
+        for (int64_t i = first; i <= last; ++i)
+        {
+            const float weight = kaiser_sinc((float(i) - center) / scale);
+            if (weight == 0.0f)
+                continue;
+
+            const int64_t index = ((i % int64_t(size)) + int64_t(size)) % int64_t(size);
+            taps[x].push_back(Tap{ uint32_t(index), weight });
+            total += weight;
+        }
+
+        for (Tap& tap : taps[x])
+            tap.weight /= total;
+    }
+    return taps;
+}
+
+// Separable filter through float rows, for any format and size
+void downsample_separable(MipFilter filter, Texture::Format format, const uint8_t* src, uint32_t width,
+                          uint32_t height, uint8_t* dst)
+{
+    const bool is_float = format == Texture::LUMINANCE32F || format == Texture::RGBA32F;
+    const uint32_t channels = (format == Texture::RGBA8 || format == Texture::RGBA32F) ? 4 : 1;
+    const uint32_t dst_width = get_mip_size(width, 1);
+    const uint32_t dst_height = get_mip_size(height, 1);
+
+    auto load = [&](size_t i) -> float
+    {
+        if (!is_float)
+            return float(src[i]);
+
+        float value;
+        std::memcpy(&value, src + 4 * i, sizeof(value));
+        return value;
+    };
+
+    const auto x_taps = get_taps(filter, width);
+    const auto y_taps = get_taps(filter, height);
+
+    // Filter the rows, then the columns of the filtered rows
+    std::vector<float> rows(size_t(height) * dst_width * channels, 0.0f);
+    for (uint32_t y = 0; y < height; ++y)
+    {
+        float* row = rows.data() + size_t(y) * dst_width * channels;
+        for (uint32_t x = 0; x < dst_width; ++x)
+        {
+            for (const Tap& tap : x_taps[x])
+            {
+                const size_t texel = (size_t(y) * width + tap.index) * channels;
+                for (uint32_t c = 0; c < channels; ++c)
+                    row[x * channels + c] += load(texel + c) * tap.weight;
+            }
+        }
+    }
+
+    std::vector<float> texel(channels);
+    for (uint32_t y = 0; y < dst_height; ++y)
+    {
+        for (uint32_t x = 0; x < dst_width; ++x)
+        {
+            std::fill(texel.begin(), texel.end(), 0.0f);
+            for (const Tap& tap : y_taps[y])
+            {
+                const float* row = rows.data() + size_t(tap.index) * dst_width * channels;
+                for (uint32_t c = 0; c < channels; ++c)
+                    texel[c] += row[x * channels + c] * tap.weight;
+            }
+
+            const size_t out = (size_t(y) * dst_width + x) * channels;
+            for (uint32_t c = 0; c < channels; ++c)
+            {
+                if (is_float)
+                {
+                    const float value = filter == KaiserMipFilter ? std::max(texel[c], 0.0f) : texel[c];
+                    std::memcpy(dst + 4 * (out + c), &value, sizeof(value));
+                }
+                else
+                {
+                    dst[out + c] = uint8_t(std::min(std::max(std::floor(texel[c] + 0.5f), 0.0f), 255.0f));
+                }
+            }
+        }
+    }
+}
+
+// 2x2 box filters of even sized levels; rounding matches the separable
+// filter, so levels do not depend on which path made them
+void downsample_box_rgba8(const uint8_t* src, uint32_t width, uint32_t height, uint8_t* dst)
+{
+    const uint32_t dst_width = width / 2;
+    const uint32_t dst_height = height / 2;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i two = _mm_set1_epi16(2);
+
+    for (uint32_t y = 0; y < dst_height; ++y)
+    {
+        const uint8_t* row0 = src + size_t(2 * y) * width * 4;
+        const uint8_t* row1 = row0 + size_t(width) * 4;
+        uint8_t* out = dst + size_t(y) * dst_width * 4;
+
+        // Two destination texels from four source texels of each row
+        uint32_t x = 0;
+        for (; x + 1 < dst_width; x += 2)
+        {
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + 8 * x));
+            const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + 8 * x));
+            const __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+            const __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+            __m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+            sum = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(out + 4 * x), _mm_packus_epi16(sum, sum));
+        }
+
+        for (; x < dst_width; ++x)
+        {
+            for (uint32_t c = 0; c < 4; ++c)
+            {
+                const uint32_t sum = row0[8 * x + c] + row0[8 * x + 4 + c] + row1[8 * x + c] + row1[8 * x + 4 + c];
+                out[4 * x + c] = uint8_t((sum + 2) >> 2);
+            }
+        }
+    }
+}
+
+void downsample_box_rgba32f(const uint8_t* src, uint32_t width, uint32_t height, uint8_t* dst)
+{
+    const uint32_t dst_width = width / 2;
+    const uint32_t dst_height = height / 2;
+    const __m128 quarter = _mm_set1_ps(0.25f);
+
+    for (uint32_t y = 0; y < dst_height; ++y)
+    {
+        const float* row0 = reinterpret_cast<const float*>(src) + size_t(2 * y) * width * 4;
+        const float* row1 = row0 + size_t(width) * 4;
+        float* out = reinterpret_cast<float*>(dst) + size_t(y) * dst_width * 4;
+
+        for (uint32_t x = 0; x < dst_width; ++x)
+        {
+            const __m128 top = _mm_add_ps(_mm_loadu_ps(row0 + 8 * x), _mm_loadu_ps(row0 + 8 * x + 4));
+            const __m128 bottom = _mm_add_ps(_mm_loadu_ps(row1 + 8 * x), _mm_loadu_ps(row1 + 8 * x + 4));
+            _mm_storeu_ps(out + 4 * x, _mm_mul_ps(_mm_add_ps(top, bottom), quarter));
+        }
+    }
+}
+
+} // namespace
+
+uint32_t get_texel_size(Texture::Format format)
+{
+    switch (format)
+    {
+        case Texture::LUMINANCE8:
+            return 1;
+        case Texture::LUMINANCE32F:
+        case Texture::RGBA8:
+            return 4;
+        case Texture::RGBA32F:
+            return 16;
+        default:
+            return 0;
+    }
+}
+
+uint32_t get_num_mip_levels(uint32_t width, uint32_t height)
+{
+    uint32_t num_levels = 1;
+    for (uint32_t size = std::max(width, height); size > 1; size >>= 1)
+        ++num_levels;
+    return num_levels;
+}
+
+void downsample(MipFilter filter, Texture::Format format, const uint8_t* src, uint32_t width, uint32_t height,
+                uint8_t* dst)
+{
+    const bool even = width % 2 == 0 && height % 2 == 0;
+    if (filter == BoxMipFilter && even && format == Texture::RGBA8)
+        downsample_box_rgba8(src, width, height, dst);
+    else if (filter == BoxMipFilter && even && format == Texture::RGBA32F)
+        downsample_box_rgba32f(src, width, height, dst);
+    else
+        downsample_separable(filter, format, src, width, height, dst);
+}
+
+} // namespace eclipse
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "eclipse/util/texture.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace eclipse {
+
+// Mip map generation for baked textures.
+//
+// Each level halves the width and height of the previous one, rounding down
+// and stopping at 1. Textures repeat, so filters wrap around the edges.
+//
+// The box filter averages the texels each destination texel covers: 2x2 of
+// them for even sizes, three weighted ones along odd axes. The Kaiser filter
+// is a Kaiser windowed sinc (half width of 3 destination texels, alpha 4)
+// which keeps more detail at the cost of some ringing; ringing below zero is
+// clamped. Even sized RGBA8 and RGBA32F levels are box filtered with SSE.
+
+enum MipFilter
+{
+    BoxMipFilter,
+    KaiserMipFilter
+};
+
+// Bytes per texel, or 0 for block compressed formats
+uint32_t get_texel_size(Texture::Format format);
+
+// Number of levels of the full chain, the texture itself included
+uint32_t get_num_mip_levels(uint32_t width, uint32_t height);
+
+inline uint32_t get_mip_size(uint32_t size, uint32_t level)
+{
+    return (size >> level) > 0 ? size >> level : 1;
+}
+
+// Filters a level of `width` x `height` texels into the next one, which must
+// have room for get_mip_size(width, 1) x get_mip_size(height, 1) texels
+void downsample(MipFilter filter, Texture::Format format, const uint8_t* src, uint32_t width, uint32_t height,
+                uint8_t* dst);
+
+} // namespace eclipse
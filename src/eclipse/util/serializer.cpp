@@ -0,0 +1,168 @@
+#include "eclipse/util/serializer.h"
+#include "eclipse/util/mapped_file.h"
+#include "eclipse/util/file_util.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace eclipse {
+
+void Reader::check_range(uint64_t offset, uint64_t size) const
+{
+    if (offset > get_size() || size > get_size() - offset)
+        throw IOError("reader: read of " + std::to_string(size) + " bytes at " + std::to_string(offset) +
+                      " past the end of the data (" + std::to_string(get_size()) + " bytes)");
+}
+
+FileWriter::FileWriter(const std::string& path)
+    : m_path(path), m_size(0)
+{
+    m_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (m_fd < 0)
+        throw IOError("file writer: could not create " + path + ": " + std::strerror(errno));
+}
+
+FileWriter::~FileWriter()
+{
+    if (m_fd >= 0)
+        ::close(m_fd);
+}
+
+void FileWriter::write(uint64_t offset, const void* data, uint64_t size)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    uint64_t written = 0;
+    while (written < size)
+    {
+        const ssize_t result = pwrite(m_fd, bytes + written, size_t(size - written), off_t(offset + written));
+        if (result < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            throw IOError("file writer: could not write " + m_path + ": " + std::strerror(errno));
+        }
+        written += uint64_t(result);
+    }
+
+    m_size = std::max(m_size, offset + size);
+}
+
+void FileWriter::close()
+{
+    if (m_fd < 0)
+        return;
+
+    const int result = ::close(m_fd);
+    m_fd = -1;
+    if (result != 0)
+        throw IOError("file writer: could not close " + m_path + ": " + std::strerror(errno));
+}
+
+BufferWriter::BufferWriter()
+    : m_size(0)
+{
+}
+
+void BufferWriter::write(uint64_t offset, const void* data, uint64_t size)
+{
+    const uint64_t end = offset + size;
+    if (end > m_buffer.size())
+        m_buffer.resize_uninitialized(size_t(std::max(end, 2 * uint64_t(m_buffer.size()))));
+
+    // Zero the gap between the previous end and this write
+    if (offset > m_size)
+        std::memset(m_buffer.data() + m_size, 0, size_t(offset - m_size));
+
+    std::memcpy(m_buffer.data() + offset, data, size_t(size));
+    m_size = std::max(m_size, end);
+}
+
+FileReader::FileReader(const std::string& path)
+    : m_path(path)
+{
+    m_fd = open(path.c_str(), O_RDONLY);
+    if (m_fd < 0)
+        throw IOError("file reader: could not open " + path + ": " + std::strerror(errno));
+
+    struct stat info;
+    if (fstat(m_fd, &info) != 0)
+    {
+        const int error = errno;
+        ::close(m_fd);
+        throw IOError("file reader: could not stat " + path + ": " + std::strerror(error));
+    }
+    m_size = uint64_t(info.st_size);
+}
+
+FileReader::~FileReader()
+{
+    ::close(m_fd);
+}
+
+void FileReader::read(uint64_t offset, void* data, uint64_t size) const
+{
+    check_range(offset, size);
+
+    uint8_t* bytes = static_cast<uint8_t*>(data);
+    uint64_t done = 0;
+    while (done < size)
+    {
+        const ssize_t result = pread(m_fd, bytes + done, size_t(size - done), off_t(offset + done));
+        if (result < 0 && errno == EINTR)
+            continue;
+        if (result <= 0)
+            throw IOError("file reader: could not read " + m_path + ": " +
+                          (result < 0 ? std::strerror(errno) : "unexpected end of file"));
+        done += uint64_t(result);
+    }
+}
+
+MappedReader::MappedReader(const std::string& path)
+    : m_file(std::make_shared<MappedFile>(path))
+{
+}
+
+uint64_t MappedReader::get_size() const
+{
+    return m_file->get_size();
+}
+
+void MappedReader::read(uint64_t offset, void* data, uint64_t size) const
+{
+    check_range(offset, size);
+    std::memcpy(data, m_file->get_data() + offset, size_t(size));
+}
+
+const uint8_t* MappedReader::get_data() const
+{
+    return m_file->get_data();
+}
+
+std::shared_ptr<const void> MappedReader::get_owner() const
+{
+    return m_file;
+}
+
+void MappedReader::prefetch(uint64_t offset, uint64_t size) const
+{
+    m_file->prefetch(size_t(offset), size_t(size));
+}
+
+BufferReader::BufferReader(const uint8_t* data, uint64_t size, std::shared_ptr<const void> owner)
+    : m_data(data), m_size(size), m_owner(owner)
+{
+}
+
+void BufferReader::read(uint64_t offset, void* data, uint64_t size) const
+{
+    check_range(offset, size);
+    std::memcpy(data, m_data + offset, size_t(size));
+}
+
+} // namespace eclipse
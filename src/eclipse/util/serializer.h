@@ -0,0 +1,136 @@
+#pragma once
+
+#include "eclipse/util/array.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace eclipse {
+
+class MappedFile;
+
+// Destination of serialized data. Writes are positional, so a table can be
+// filled in after the data it describes; gaps left between writes read as
+// zeros.
+class Writer
+{
+public:
+    virtual ~Writer() { }
+
+    virtual void write(uint64_t offset, const void* data, uint64_t size) = 0;
+
+    // End of the furthest write so far
+    virtual uint64_t get_size() const = 0;
+};
+
+// Source of serialized data. Reads outside of the data throw IOError.
+class Reader
+{
+public:
+    virtual ~Reader() { }
+
+    virtual uint64_t get_size() const = 0;
+    virtual void read(uint64_t offset, void* data, uint64_t size) const = 0;
+
+    // Readers holding the data in memory return it here, so it can be used in
+    // place as long as the owner is alive; others return nullptr
+    virtual const uint8_t* get_data() const { return nullptr; }
+    virtual std::shared_ptr<const void> get_owner() const { return nullptr; }
+
+    // Hints that the range will be read soon
+    virtual void prefetch(uint64_t, uint64_t) const { }
+
+protected:
+    void check_range(uint64_t offset, uint64_t size) const;
+};
+
+// Writes straight to a file descriptor with pwrite
+class FileWriter : public Writer
+{
+public:
+    FileWriter(const std::string& path);
+    ~FileWriter();
+
+    void write(uint64_t offset, const void* data, uint64_t size) override;
+    uint64_t get_size() const override { return m_size; }
+
+    // Flushes the file and reports errors the destructor would swallow
+    void close();
+
+private:
+    std::string m_path;
+    int m_fd;
+    uint64_t m_size;
+};
+
+// Writes to a growing memory buffer
+class BufferWriter : public Writer
+{
+public:
+    BufferWriter();
+
+    void write(uint64_t offset, const void* data, uint64_t size) override;
+    uint64_t get_size() const override { return m_size; }
+
+    const uint8_t* get_data() const { return m_buffer.data(); }
+
+private:
+    Array<uint8_t> m_buffer;
+    uint64_t m_size;
+};
+
+// Reads from a file descriptor with pread into the caller's memory
+class FileReader : public Reader
+{
+public:
+    FileReader(const std::string& path);
+    ~FileReader();
+
+    uint64_t get_size() const override { return m_size; }
+    void read(uint64_t offset, void* data, uint64_t size) const override;
+
+private:
+    std::string m_path;
+    int m_fd;
+    uint64_t m_size;
+};
+
+// Reads from a memory mapped file; the data can be used in place
+class MappedReader : public Reader
+{
+public:
+    MappedReader(const std::string& path);
+
+    uint64_t get_size() const override;
+    void read(uint64_t offset, void* data, uint64_t size) const override;
+
+    const uint8_t* get_data() const override;
+    std::shared_ptr<const void> get_owner() const override;
+    void prefetch(uint64_t offset, uint64_t size) const override;
+
+    const MappedFile& get_file() const { return *m_file; }
+
+private:
+    std::shared_ptr<MappedFile> m_file;
+};
+
+// Reads from memory owned by someone else
+class BufferReader : public Reader
+{
+public:
+    BufferReader(const uint8_t* data, uint64_t size, std::shared_ptr<const void> owner = nullptr);
+
+    uint64_t get_size() const override { return m_size; }
+    void read(uint64_t offset, void* data, uint64_t size) const override;
+
+    const uint8_t* get_data() const override { return m_data; }
+    std::shared_ptr<const void> get_owner() const override { return m_owner; }
+
+private:
+    const uint8_t* m_data;
+    uint64_t m_size;
+    std::shared_ptr<const void> m_owner;
+};
+
+} // namespace eclipse
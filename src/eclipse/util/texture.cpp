@@ -68,6 +68,9 @@ Texture::Texture(std::shared_ptr<Resource> res)
     m_size = data.size();
 
     // convert to RGBA as this makes addressing in opencl much easier
+    if (spec.nchannels == 3)
+        m_size = m_size / 3 * 4;
+
     if (convert_to == TypeDesc::UINT8 && spec.nchannels == 3)
     {
         uint8_t* pixels = new uint8_t[m_width * m_height * 4];
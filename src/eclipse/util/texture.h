@@ -26,7 +26,14 @@ public:
         LUMINANCE8 = 0,
         LUMINANCE32F,
         RGBA8,
-        RGBA32F
+        RGBA32F,
+
+        // Block compressed formats textures are baked into; loaded
+        // textures are never in them. See util/block_compression.h.
+        BC1,
+        BC4,
+        BC5,
+        BC6H
     };
 
     uint32_t get_width() const { return m_width; }
@@ -0,0 +1,35 @@
+#include "eclipse/util/texture_layout.h"
+
+#include <cstring>
+
+namespace eclipse {
+
+size_t get_layout_texels(TextureLayout layout, uint32_t width, uint32_t height)
+{
+    if (layout == LinearTextureLayout)
+        return size_t(width) * height;
+
+    const uint32_t shift = get_tile_shift(layout);
+    const uint32_t mask = (1u << shift) - 1;
+    return (size_t((width + mask) >> shift) * ((height + mask) >> shift)) << (2 * shift);
+}
+
+void swizzle_texels(TextureLayout layout, uint32_t texel_size, const uint8_t* src, uint32_t width, uint32_t height,
+                    uint8_t* dst)
+{
+    if (layout == LinearTextureLayout)
+    {
+        std::memcpy(dst, src, size_t(width) * height * texel_size);
+        return;
+    }
+
+    std::memset(dst, 0, get_layout_texels(layout, width, height) * texel_size);
+    for (uint32_t y = 0; y < height; ++y)
+    {
+        const uint8_t* row = src + size_t(y) * width * texel_size;
+        for (uint32_t x = 0; x < width; ++x)
+            std::memcpy(dst + get_texel_index(layout, width, x, y) * texel_size, row + size_t(x) * texel_size, texel_size);
+    }
+}
+
+} // namespace eclipse
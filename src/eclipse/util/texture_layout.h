@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace eclipse {
+
+// Storage order of the texels of a baked texture.
+//
+// Linear textures are stored row by row, so the four texels of a bilinear
+// lookup span two rows which are usually in different cache lines, and
+// lookups at nearby uvs in the vertical direction land far apart. The other
+// layouts store square tiles of texels contiguously: tiled textures in 8x8
+// tiles, each row major, and Morton textures in 32x32 tiles, each in Z order,
+// which keeps neighbours close at every scale within the tile. Tiles are row
+// major and the last row and column of tiles are padded.
+//
+// Levels smaller than a tile in either dimension, such as the tail of a mip
+// chain, are stored linearly; see get_level_layout.
+
+enum TextureLayout
+{
+    LinearTextureLayout,
+    TiledTextureLayout,
+    MortonTextureLayout
+};
+
+// Log2 of the tile width and height
+inline uint32_t get_tile_shift(TextureLayout layout)
+{
+    return layout == TiledTextureLayout ? 3 : layout == MortonTextureLayout ? 5 : 0;
+}
+
+inline TextureLayout get_level_layout(TextureLayout layout, uint32_t width, uint32_t height)
+{
+    const uint32_t tile_size = 1u << get_tile_shift(layout);
+    return width < tile_size || height < tile_size ? LinearTextureLayout : layout;
+}
+
+// Interleaves the lower 16 bits of v with zeros
+inline uint32_t spread_bits(uint32_t v)
+{
+    v &= 0x0000ffff;
+    v = (v | (v << 8)) & 0x00ff00ff;
+    v = (v | (v << 4)) & 0x0f0f0f0f;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+// Index of texel (x, y) of a level stored in `layout`, as given by
+// get_level_layout
+inline size_t get_texel_index(TextureLayout layout, uint32_t width, uint32_t x, uint32_t y)
+{
+    if (layout == LinearTextureLayout)
+        return size_t(y) * width + x;
+
+    const uint32_t shift = get_tile_shift(layout);
+    const uint32_t mask = (1u << shift) - 1;
+    const size_t tiles_x = (width + mask) >> shift;
+    const size_t tile = (size_t(y >> shift) * tiles_x + (x >> shift)) << (2 * shift);
+
+    if (layout == TiledTextureLayout)
+        return tile + (((y & mask) << shift) | (x & mask));
+    return tile + (spread_bits(x & mask) | (spread_bits(y & mask) << 1));
+}
+
+// Number of texels stored for a level, padding included
+size_t get_layout_texels(TextureLayout layout, uint32_t width, uint32_t height);
+
+// Reorders a linear level of `texel_size` byte texels into `layout`; dst must
+// have room for get_layout_texels texels. Padding texels are zeroed.
+void swizzle_texels(TextureLayout layout, uint32_t texel_size, const uint8_t* src, uint32_t width, uint32_t height,
+                    uint8_t* dst);
+
+} // namespace eclipse
@@ -0,0 +1,60 @@
+#include "eclipse/util/texture_tiles.h"
+#include "eclipse/util/block_compression.h"
+#include "eclipse/util/mip_map.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace eclipse {
+
+namespace {
+
+// Texels or blocks are copied as units of `unit_size` bytes covering
+// `unit_texels` texels along each axis
+void get_unit(Texture::Format format, uint32_t* unit_size, uint32_t* unit_texels)
+{
+    if (is_block_compressed(format))
+    {
+        *unit_size = get_block_bytes(format);
+        *unit_texels = 4;
+    }
+    else
+    {
+        *unit_size = get_texel_size(format);
+        *unit_texels = 1;
+    }
+}
+
+} // namespace
+
+uint32_t get_texture_tile_size(Texture::Format format)
+{
+    uint32_t unit_size, unit_texels;
+    get_unit(format, &unit_size, &unit_texels);
+    const uint32_t units = texture_tile_texels / unit_texels;
+    return units * units * unit_size;
+}
+
+void copy_texture_tile(Texture::Format format, const uint8_t* src, uint32_t width, uint32_t height, uint32_t tile_x,
+                       uint32_t tile_y, uint8_t* dst)
+{
+    uint32_t unit_size, unit_texels;
+    get_unit(format, &unit_size, &unit_texels);
+
+    const uint32_t tile_units = texture_tile_texels / unit_texels;
+    const uint32_t level_units_x = (width + unit_texels - 1) / unit_texels;
+    const uint32_t level_units_y = (height + unit_texels - 1) / unit_texels;
+    const uint32_t x0 = tile_x * tile_units;
+    const uint32_t y0 = tile_y * tile_units;
+    const uint32_t units_x = x0 < level_units_x ? std::min(tile_units, level_units_x - x0) : 0;
+    const uint32_t units_y = y0 < level_units_y ? std::min(tile_units, level_units_y - y0) : 0;
+
+    std::memset(dst, 0, size_t(tile_units) * tile_units * unit_size);
+    for (uint32_t y = 0; y < units_y; ++y)
+    {
+        std::memcpy(dst + size_t(y) * tile_units * unit_size,
+                    src + (size_t(y0 + y) * level_units_x + x0) * unit_size, size_t(units_x) * unit_size);
+    }
+}
+
+} // namespace eclipse
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "eclipse/util/texture.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace eclipse {
+
+// Tiles of textures that are paged in on demand.
+//
+// Each level of a paged texture is cut into square tiles of
+// texture_tile_texels texels, stored row by row. A tile holds its texels row
+// by row, or its 4x4 blocks row by row for block compressed formats, so a
+// tile is itself a linear texture_tile_texels squared level. Tiles of the
+// last row and column are padded with zeros.
+
+constexpr uint32_t texture_tile_texels = 64;
+
+// Tiles along a level dimension of `size` texels
+inline uint32_t get_num_texture_tiles(uint32_t size)
+{
+    return (size + texture_tile_texels - 1) / texture_tile_texels;
+}
+
+// Bytes of a tile of `format` texels, or 0 for unknown formats
+uint32_t get_texture_tile_size(Texture::Format format);
+
+// Copies tile (tile_x, tile_y) of a level of `width` x `height` texels,
+// stored row by row or as rows of blocks, into dst, which must have room for
+// get_texture_tile_size bytes
+void copy_texture_tile(Texture::Format format, const uint8_t* src, uint32_t width, uint32_t height, uint32_t tile_x,
+                       uint32_t tile_y, uint8_t* dst);
+
+} // namespace eclipse